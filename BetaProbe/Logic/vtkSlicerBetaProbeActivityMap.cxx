@@ -0,0 +1,1238 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeActivityMap.h"
+
+// MRML includes
+#include "vtkMRMLBetaProbeSessionChunk.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkMultiThreader.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace
+{
+// Chunks acquired and splatted at once
+const int BatchSize = 16;
+
+// Batches smaller than this are splatted by a single thread
+const vtkIdType MinimumParallelSamples = 4096;
+
+// Coverage of extents smaller than this is computed by a single thread
+const vtkIdType MinimumParallelVoxels = 65536;
+
+// Coverage statistics and images of a voxel, in bytes
+const size_t CoverageVoxelSize = sizeof(vtkSlicerBetaProbeActivityMap::voxelCoverage) +
+  vtkSlicerBetaProbeActivityMap::NumberOfCoverageComponents * sizeof(float);
+
+// What the kernels need to know about the map
+typedef struct
+{
+  double RASToIJK[3][4];
+  // Voxels that may be written (slab of the map), inclusive
+  int Bounds[6];
+  vtkIdType Increments[3];
+  int PointSize;
+}splatGeometry;
+
+typedef vtkSlicerBetaProbeActivityMap::voxelAccumulator voxelAccumulator;
+typedef vtkSlicerBetaProbeActivityMap::voxelCoverage voxelCoverage;
+
+// Samples [Begin, End) of a chunk
+typedef struct
+{
+  const double* X;
+  const double* Y;
+  const double* Z;
+  const float* Values;
+  const float* BetaGamma;
+  int Begin;
+  int End;
+}splatSamples;
+
+//----------------------------------------------------------------------------
+// Value of a voxel after accumulator was updated by at least one sample
+template <int Aggregation>
+inline double GetStatistic(const voxelAccumulator& accumulator)
+{
+  switch (Aggregation)
+    {
+    case vtkSlicerBetaProbeActivityMap::AggregateMean:
+      return accumulator.Sum / accumulator.Count;
+    case vtkSlicerBetaProbeActivityMap::AggregateMaximum:
+      return accumulator.Maximum;
+    case vtkSlicerBetaProbeActivityMap::AggregateSum:
+      return accumulator.Sum;
+    case vtkSlicerBetaProbeActivityMap::AggregateCount:
+      return accumulator.Count;
+    default:
+      return 0.0;
+    }
+}
+
+//----------------------------------------------------------------------------
+inline double GetStatistic(const voxelAccumulator& accumulator, int aggregation)
+{
+  if (accumulator.Count == 0)
+    {
+    return 0.0;
+    }
+  switch (aggregation)
+    {
+    case vtkSlicerBetaProbeActivityMap::AggregateMean:
+      return GetStatistic<vtkSlicerBetaProbeActivityMap::AggregateMean>(accumulator);
+    case vtkSlicerBetaProbeActivityMap::AggregateMaximum:
+      return GetStatistic<vtkSlicerBetaProbeActivityMap::AggregateMaximum>(accumulator);
+    case vtkSlicerBetaProbeActivityMap::AggregateSum:
+      return GetStatistic<vtkSlicerBetaProbeActivityMap::AggregateSum>(accumulator);
+    case vtkSlicerBetaProbeActivityMap::AggregateCount:
+      return GetStatistic<vtkSlicerBetaProbeActivityMap::AggregateCount>(accumulator);
+    default:
+      return 0.0;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Add a sample to the coverage of the voxels of box. slice points to the
+// coverage of the first voxel of the first slice of box.
+inline void AccumulateCoverage(voxelCoverage* slice, const splatGeometry& geometry,
+                               const int box[6], double gamma, double betaGamma)
+{
+  const int rowLength = box[1] - box[0] + 1;
+  for (int k = box[4]; k <= box[5]; ++k, slice += geometry.Increments[2])
+    {
+    voxelCoverage* row = slice + box[2] * geometry.Increments[1];
+    for (int j = box[2]; j <= box[3]; ++j, row += geometry.Increments[1])
+      {
+      for (int i = 0; i < rowLength; ++i)
+        {
+        // Welford
+        voxelCoverage& coverage = row[i];
+        coverage.Count++;
+        const double delta = gamma - coverage.GammaMean;
+        coverage.GammaMean += delta / coverage.Count;
+        coverage.GammaM2 += delta * (gamma - coverage.GammaMean);
+        coverage.BetaGammaSum += betaGamma;
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Confidence interval of the mean of a Poisson variable of which counts
+// were observed (Garwood), approximated after Wilson and Hilferty. z is the
+// standard normal quantile of the confidence level.
+inline void GetPoissonInterval(double counts, double z, double& lower, double& upper)
+{
+  lower = 0.0;
+  if (counts > 0.0)
+    {
+    const double a = 1.0 - 1.0 / (9.0 * counts) - z / (3.0 * std::sqrt(counts));
+    lower = a > 0.0 ? counts * a * a * a : 0.0;
+    }
+  const double n = std::max(counts, 0.0) + 1.0;
+  const double b = 1.0 - 1.0 / (9.0 * n) + z / (3.0 * std::sqrt(n));
+  upper = n * b * b * b;
+}
+
+//----------------------------------------------------------------------------
+// Set the coverage images over the voxels of extent
+void RenderCoverageExtent(const voxelCoverage* coverage,
+                          float* const images[vtkSlicerBetaProbeActivityMap::NumberOfCoverageComponents],
+                          const int dimensions[3], const int extent[6], double z)
+{
+  const vtkIdType sliceSize = static_cast<vtkIdType>(dimensions[0]) * dimensions[1];
+  for (int k = extent[4]; k <= extent[5]; ++k)
+    {
+    for (int j = extent[2]; j <= extent[3]; ++j)
+      {
+      const vtkIdType rowStart = k * sliceSize + static_cast<vtkIdType>(j) * dimensions[0];
+      for (vtkIdType v = rowStart + extent[0]; v <= rowStart + extent[1]; ++v)
+        {
+        const voxelCoverage& voxel = coverage[v];
+        float values[vtkSlicerBetaProbeActivityMap::NumberOfCoverageComponents] = { 0.0f };
+        if (voxel.Count > 0)
+          {
+          const double count = voxel.Count;
+          double lower = 0.0;
+          double upper = 0.0;
+          values[vtkSlicerBetaProbeActivityMap::CoverageCount] = static_cast<float>(count);
+          values[vtkSlicerBetaProbeActivityMap::CoverageStandardDeviation] =
+            voxel.Count > 1 ? static_cast<float>(std::sqrt(voxel.GammaM2 / (count - 1.0))) : 0.0f;
+          GetPoissonInterval(voxel.GammaMean * count, z, lower, upper);
+          values[vtkSlicerBetaProbeActivityMap::CoverageGammaLower] = static_cast<float>(lower / count);
+          values[vtkSlicerBetaProbeActivityMap::CoverageGammaUpper] = static_cast<float>(upper / count);
+          GetPoissonInterval(voxel.BetaGammaSum, z, lower, upper);
+          values[vtkSlicerBetaProbeActivityMap::CoverageBetaGammaLower] = static_cast<float>(lower / count);
+          values[vtkSlicerBetaProbeActivityMap::CoverageBetaGammaUpper] = static_cast<float>(upper / count);
+          }
+        for (int c = 0; c < vtkSlicerBetaProbeActivityMap::NumberOfCoverageComponents; ++c)
+          {
+          images[c][v] = values[c];
+          }
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Splat samples into map, and into accumulators unless Aggregation is
+// AggregateLatest, and into coverage unless it is NULL. Radius is the point
+// size, or -1 if it is only known at run time (geometry.PointSize).
+// A sample at i sets the voxels from int(i - pointSize) to the last one
+// before i + pointSize, on every axis.
+template <typename T, int Radius, int Aggregation>
+void Splat(T* map, voxelAccumulator* accumulators, voxelCoverage* coverage,
+           const splatGeometry& geometry, const splatSamples& samples,
+           double range[2], int updatedExtent[6])
+{
+  const double pointSize = Radius >= 0 ? Radius : geometry.PointSize;
+  for (int s = samples.Begin; s < samples.End; ++s)
+    {
+    // Box of voxels around the sample, clipped to the slab. K first, as
+    // most samples miss a slab along K.
+    int box[6];
+    bool inside = true;
+    for (int c = 2; c >= 0 && inside; --c)
+      {
+      const double* m = geometry.RASToIJK[c];
+      const double ijk = m[0] * samples.X[s] + m[1] * samples.Y[s] + m[2] * samples.Z[s] + m[3];
+      if (!(ijk + pointSize > geometry.Bounds[2 * c] &&
+            ijk - pointSize < geometry.Bounds[2 * c + 1] + 1))
+        {
+        inside = false;
+        break;
+        }
+      int last = static_cast<int>(ijk + pointSize);
+      if (last >= ijk + pointSize)
+        {
+        last--;
+        }
+      box[2 * c] = std::max(static_cast<int>(ijk - pointSize), geometry.Bounds[2 * c]);
+      box[2 * c + 1] = std::min(last, geometry.Bounds[2 * c + 1]);
+      inside = box[2 * c] <= box[2 * c + 1];
+      }
+    if (!inside)
+      {
+      continue;
+      }
+
+    const int rowLength = box[1] - box[0] + 1;
+    const vtkIdType sliceStart = box[4] * geometry.Increments[2] + box[0];
+    if (Aggregation == vtkSlicerBetaProbeActivityMap::AggregateLatest)
+      {
+      const T value = static_cast<T>(samples.Values[s]);
+      T* slice = map + sliceStart;
+      for (int k = box[4]; k <= box[5]; ++k, slice += geometry.Increments[2])
+        {
+        T* row = slice + box[2] * geometry.Increments[1];
+        for (int j = box[2]; j <= box[3]; ++j, row += geometry.Increments[1])
+          {
+          for (int i = 0; i < rowLength; ++i)
+            {
+            row[i] = value;
+            }
+          }
+        }
+      range[0] = std::min(range[0], static_cast<double>(value));
+      range[1] = std::max(range[1], static_cast<double>(value));
+      }
+    else
+      {
+      // Accumulators and map are walked together, row by row
+      const double value = samples.Values[s];
+      double rowRange[2] = { range[0], range[1] };
+      T* slice = map + sliceStart;
+      voxelAccumulator* accumulatorSlice = accumulators + sliceStart;
+      for (int k = box[4]; k <= box[5]; ++k,
+             slice += geometry.Increments[2], accumulatorSlice += geometry.Increments[2])
+        {
+        const vtkIdType rowStart = box[2] * geometry.Increments[1];
+        T* row = slice + rowStart;
+        voxelAccumulator* accumulatorRow = accumulatorSlice + rowStart;
+        for (int j = box[2]; j <= box[3]; ++j,
+               row += geometry.Increments[1], accumulatorRow += geometry.Increments[1])
+          {
+          for (int i = 0; i < rowLength; ++i)
+            {
+            voxelAccumulator& accumulator = accumulatorRow[i];
+            accumulator.Maximum = accumulator.Count == 0 ?
+              static_cast<float>(value) : std::max(accumulator.Maximum, static_cast<float>(value));
+            accumulator.Sum += value;
+            accumulator.Count++;
+            const T statistic = static_cast<T>(GetStatistic<Aggregation>(accumulator));
+            row[i] = statistic;
+            rowRange[0] = std::min(rowRange[0], static_cast<double>(statistic));
+            rowRange[1] = std::max(rowRange[1], static_cast<double>(statistic));
+            }
+          }
+        }
+      range[0] = rowRange[0];
+      range[1] = rowRange[1];
+      }
+
+    if (coverage)
+      {
+      AccumulateCoverage(coverage + sliceStart, geometry, box,
+                         samples.Values[s], samples.BetaGamma[s]);
+      }
+
+    for (int c = 0; c < 3; ++c)
+      {
+      updatedExtent[2 * c] = std::min(updatedExtent[2 * c], box[2 * c]);
+      updatedExtent[2 * c + 1] = std::max(updatedExtent[2 * c + 1], box[2 * c + 1]);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename T, int Radius>
+void SplatAggregated(T* map, voxelAccumulator* accumulators, voxelCoverage* coverage,
+                     const splatGeometry& geometry, int aggregation,
+                     const splatSamples& samples, double range[2], int updatedExtent[6])
+{
+  switch (aggregation)
+    {
+    case vtkSlicerBetaProbeActivityMap::AggregateMean:
+      Splat<T, Radius, vtkSlicerBetaProbeActivityMap::AggregateMean>(
+        map, accumulators, coverage, geometry, samples, range, updatedExtent);
+      break;
+    case vtkSlicerBetaProbeActivityMap::AggregateMaximum:
+      Splat<T, Radius, vtkSlicerBetaProbeActivityMap::AggregateMaximum>(
+        map, accumulators, coverage, geometry, samples, range, updatedExtent);
+      break;
+    case vtkSlicerBetaProbeActivityMap::AggregateSum:
+      Splat<T, Radius, vtkSlicerBetaProbeActivityMap::AggregateSum>(
+        map, accumulators, coverage, geometry, samples, range, updatedExtent);
+      break;
+    case vtkSlicerBetaProbeActivityMap::AggregateCount:
+      Splat<T, Radius, vtkSlicerBetaProbeActivityMap::AggregateCount>(
+        map, accumulators, coverage, geometry, samples, range, updatedExtent);
+      break;
+    default:
+      Splat<T, Radius, vtkSlicerBetaProbeActivityMap::AggregateLatest>(
+        map, accumulators, coverage, geometry, samples, range, updatedExtent);
+      break;
+    }
+}
+
+//----------------------------------------------------------------------------
+template <typename T>
+void Splat(T* map, voxelAccumulator* accumulators, voxelCoverage* coverage,
+           const splatGeometry& geometry, int aggregation,
+           const splatSamples& samples, double range[2], int updatedExtent[6])
+{
+  switch (geometry.PointSize)
+    {
+    case 0:
+      SplatAggregated<T, 0>(map, accumulators, coverage, geometry, aggregation,
+                             samples, range, updatedExtent);
+      break;
+    case 1:
+      SplatAggregated<T, 1>(map, accumulators, coverage, geometry, aggregation,
+                             samples, range, updatedExtent);
+      break;
+    case 2:
+      SplatAggregated<T, 2>(map, accumulators, coverage, geometry, aggregation,
+                             samples, range, updatedExtent);
+      break;
+    case 3:
+      SplatAggregated<T, 3>(map, accumulators, coverage, geometry, aggregation,
+                             samples, range, updatedExtent);
+      break;
+    case 4:
+      SplatAggregated<T, 4>(map, accumulators, coverage, geometry, aggregation,
+                             samples, range, updatedExtent);
+      break;
+    default:
+      SplatAggregated<T, -1>(map, accumulators, coverage, geometry, aggregation,
+                             samples, range, updatedExtent);
+      break;
+    }
+}
+
+//----------------------------------------------------------------------------
+// Set every voxel of map to its statistic. Return the range of the map.
+template <typename T>
+void RenderStatistic(T* map, const voxelAccumulator* accumulators, size_t numberOfVoxels,
+                     int aggregation, double range[2])
+{
+  range[0] = 0.0;
+  range[1] = 0.0;
+  for (size_t v = 0; v < numberOfVoxels; ++v)
+    {
+    const T statistic = static_cast<T>(GetStatistic(accumulators[v], aggregation));
+    map[v] = statistic;
+    range[0] = std::min(range[0], static_cast<double>(statistic));
+    range[1] = std::max(range[1], static_cast<double>(statistic));
+    }
+}
+
+//----------------------------------------------------------------------------
+// z such that a standard normal variable falls in [-z, z] with the given
+// probability, by bisection
+double GetNormalQuantile(double probability)
+{
+  double low = 0.0;
+  double high = 40.0;
+  for (int i = 0; i < 100; ++i)
+    {
+    const double z = 0.5 * (low + high);
+    if (std::erf(z / std::sqrt(2.0)) < probability)
+      {
+      low = z;
+      }
+    else
+      {
+      high = z;
+      }
+    }
+  return 0.5 * (low + high);
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerBetaProbeActivityMap);
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeActivityMap::vtkSlicerBetaProbeActivityMap()
+{
+  this->Output = vtkImageData::New();
+  this->RASToIJK = vtkMatrix4x4::New();
+  this->PointSize = 1;
+  this->ScalarType = VTK_DOUBLE;
+  this->Aggregation = AggregateLatest;
+  this->ComputeCoverage = false;
+  this->ConfidenceLevel = 0.95;
+  this->ConfidenceZ = GetNormalQuantile(this->ConfidenceLevel);
+  this->StatisticsMemoryLimit = static_cast<size_t>(2048) * 1024 * 1024;
+  for (int c = 0; c < NumberOfCoverageComponents; ++c)
+    {
+    this->CoverageOutputs[c] = vtkImageData::New();
+    }
+  for (int i = 0; i < 6; ++i)
+    {
+    this->CoverageExtent[i] = 0;
+    }
+  this->Dimensions[0] = 0;
+  this->Dimensions[1] = 0;
+  this->Dimensions[2] = 0;
+  this->Threader = vtkMultiThreader::New();
+  this->Threader->SetNumberOfThreads(vtkMultiThreader::GetGlobalDefaultNumberOfThreads());
+  this->Thread = vtkMultiThreader::New();
+  this->ThreadID = -1;
+  this->UpdateResult = 0;
+  this->Updating = false;
+  this->AbortRequested = false;
+  this->NumberOfSamplesToSplat = 0;
+  this->NumberOfSamplesSplatted = 0;
+  this->Reset();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeActivityMap::~vtkSlicerBetaProbeActivityMap()
+{
+  this->AbortUpdate();
+  this->WaitForUpdate();
+  this->Thread->Delete();
+  this->Threader->Delete();
+  this->Output->Delete();
+  for (int c = 0; c < NumberOfCoverageComponents; ++c)
+    {
+    this->CoverageOutputs[c]->Delete();
+    }
+  this->RASToIJK->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "PointSize: " << this->PointSize << "\n";
+  os << indent << "ScalarType: " << this->ScalarType << "\n";
+  os << indent << "Aggregation: " << this->Aggregation << "\n";
+  os << indent << "ComputeCoverage: " << this->ComputeCoverage << "\n";
+  os << indent << "ConfidenceLevel: " << this->ConfidenceLevel << "\n";
+  os << indent << "StatisticsMemoryLimit: " << this->StatisticsMemoryLimit << "\n";
+  os << indent << "Dimensions: " << this->Dimensions[0] << " "
+     << this->Dimensions[1] << " " << this->Dimensions[2] << "\n";
+  os << indent << "NumberOfThreads: " << this->Threader->GetNumberOfThreads() << "\n";
+  os << indent << "NumberOfMappedSamples: " << this->NumberOfMappedSamples << "\n";
+  os << indent << "Updating: " << this->IsUpdating() << "\n";
+  os << indent << "ScalarRange: " << this->ScalarRange[0] << " "
+     << this->ScalarRange[1] << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SetGeometry(const int dimensions[3],
+                                                vtkMatrix4x4* rasToIJK)
+{
+  for (int i = 0; i < 3; ++i)
+    {
+    this->Dimensions[i] = std::max(dimensions[i], 0);
+    }
+  if (rasToIJK)
+    {
+    this->RASToIJK->DeepCopy(rasToIJK);
+    }
+  else
+    {
+    this->RASToIJK->Identity();
+    }
+
+  this->Output->SetDimensions(this->Dimensions);
+  this->Output->AllocateScalars(this->ScalarType, 1);
+  // Coverage of the previous geometry does not count against the limit
+  std::vector<voxelCoverage>().swap(this->Coverage);
+  this->AllocateAccumulators();
+  this->AllocateCoverage();
+  this->Reset();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SetAggregation(int aggregation)
+{
+  if (aggregation < AggregateLatest || aggregation > AggregateCount)
+    {
+    vtkErrorMacro("SetAggregation: Unknown aggregation " << aggregation);
+    return;
+    }
+  if (aggregation == this->Aggregation)
+    {
+    return;
+    }
+
+  const bool accumulated = (this->Aggregation != AggregateLatest);
+  this->Aggregation = aggregation;
+  if (!accumulated || aggregation == AggregateLatest)
+    {
+    // Samples must be splatted again
+    this->AllocateAccumulators();
+    this->Reset();
+    return;
+    }
+
+  // Redraw from the accumulators
+  void* map = this->Output->GetScalarPointer();
+  if (!map || this->Accumulators.empty())
+    {
+    return;
+    }
+  if (this->ScalarType == VTK_FLOAT)
+    {
+    RenderStatistic(static_cast<float*>(map), &this->Accumulators[0],
+                    this->Accumulators.size(), aggregation, this->ScalarRange);
+    }
+  else
+    {
+    RenderStatistic(static_cast<double*>(map), &this->Accumulators[0],
+                    this->Accumulators.size(), aggregation, this->ScalarRange);
+    }
+  for (int i = 0; i < 3; ++i)
+    {
+    this->UpdatedExtent[2 * i] = 0;
+    this->UpdatedExtent[2 * i + 1] = this->Dimensions[i] - 1;
+    }
+  this->Output->GetPointData()->GetScalars()->Modified();
+  this->Output->Modified();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeActivityMap::AllocateAccumulators()
+{
+  std::vector<voxelAccumulator>().swap(this->Accumulators);
+  if (this->Aggregation == AggregateLatest)
+    {
+    return true;
+    }
+
+  const double numberOfVoxels = static_cast<double>(this->Dimensions[0]) *
+    this->Dimensions[1] * this->Dimensions[2];
+  const double size = numberOfVoxels * sizeof(voxelAccumulator);
+  const double available = static_cast<double>(this->StatisticsMemoryLimit) -
+    static_cast<double>(this->Coverage.size() * CoverageVoxelSize);
+  if (size > available)
+    {
+    vtkErrorMacro("AllocateAccumulators: " << size / (1024 * 1024)
+                  << " MiB of accumulators exceed the statistics memory limit of "
+                  << this->StatisticsMemoryLimit / (1024.0 * 1024.0) << " MiB");
+    return false;
+    }
+  try
+    {
+    this->Accumulators.resize(static_cast<size_t>(numberOfVoxels));
+    }
+  catch (const std::bad_alloc&)
+    {
+    std::vector<voxelAccumulator>().swap(this->Accumulators);
+    vtkErrorMacro("AllocateAccumulators: Unable to allocate "
+                  << size / (1024 * 1024) << " MiB of accumulators");
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeActivityMap::HasStatistics() const
+{
+  if (this->Dimensions[0] <= 0 || this->Dimensions[1] <= 0 || this->Dimensions[2] <= 0)
+    {
+    return true;
+    }
+  return (this->Aggregation == AggregateLatest || !this->Accumulators.empty()) &&
+    (!this->ComputeCoverage || !this->Coverage.empty());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SetComputeCoverage(bool computeCoverage)
+{
+  if (computeCoverage == this->ComputeCoverage)
+    {
+    return;
+    }
+  this->ComputeCoverage = computeCoverage;
+
+  // Samples must be splatted again
+  this->AllocateCoverage();
+  this->Reset();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeActivityMap::AllocateCoverage()
+{
+  std::vector<voxelCoverage>().swap(this->Coverage);
+  if (!this->ComputeCoverage)
+    {
+    return true;
+    }
+
+  const double numberOfVoxels = static_cast<double>(this->Dimensions[0]) *
+    this->Dimensions[1] * this->Dimensions[2];
+  const double size = numberOfVoxels * CoverageVoxelSize;
+  const double available = static_cast<double>(this->StatisticsMemoryLimit) -
+    static_cast<double>(this->Accumulators.size() * sizeof(voxelAccumulator));
+  if (size > available)
+    {
+    vtkErrorMacro("AllocateCoverage: " << size / (1024 * 1024)
+                  << " MiB of coverage exceed the statistics memory limit of "
+                  << this->StatisticsMemoryLimit / (1024.0 * 1024.0) << " MiB");
+    return false;
+    }
+  try
+    {
+    this->Coverage.resize(static_cast<size_t>(numberOfVoxels));
+    for (int c = 0; c < NumberOfCoverageComponents; ++c)
+      {
+      this->CoverageOutputs[c]->SetDimensions(this->Dimensions);
+      this->CoverageOutputs[c]->AllocateScalars(VTK_FLOAT, 1);
+      }
+    }
+  catch (const std::bad_alloc&)
+    {
+    std::vector<voxelCoverage>().swap(this->Coverage);
+    vtkErrorMacro("AllocateCoverage: Unable to allocate "
+                  << size / (1024 * 1024) << " MiB of coverage");
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SetConfidenceLevel(double confidenceLevel)
+{
+  if (!(confidenceLevel > 0.0 && confidenceLevel < 1.0))
+    {
+    vtkErrorMacro("SetConfidenceLevel: Confidence level must be in ]0, 1[");
+    return;
+    }
+  if (confidenceLevel == this->ConfidenceLevel)
+    {
+    return;
+    }
+  this->ConfidenceLevel = confidenceLevel;
+  this->ConfidenceZ = GetNormalQuantile(confidenceLevel);
+
+  int extent[6];
+  for (int i = 0; i < 3; ++i)
+    {
+    extent[2 * i] = 0;
+    extent[2 * i + 1] = this->Dimensions[i] - 1;
+    }
+  this->RenderCoverage(extent);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkImageData* vtkSlicerBetaProbeActivityMap::GetCoverageOutput(int component)
+{
+  if (component < 0 || component >= NumberOfCoverageComponents)
+    {
+    return NULL;
+    }
+  return this->CoverageOutputs[component];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SetScalarType(int scalarType)
+{
+  if (scalarType != VTK_DOUBLE && scalarType != VTK_FLOAT)
+    {
+    vtkErrorMacro("SetScalarType: only VTK_DOUBLE and VTK_FLOAT are supported");
+    return;
+    }
+  if (scalarType != this->ScalarType)
+    {
+    this->ScalarType = scalarType;
+    this->Output->AllocateScalars(this->ScalarType, 1);
+    this->Reset();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SetPointSize(int pointSize)
+{
+  pointSize = std::max(pointSize, 0);
+  if (pointSize != this->PointSize)
+    {
+    this->PointSize = pointSize;
+    this->Reset();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SetNumberOfThreads(int numberOfThreads)
+{
+  if (numberOfThreads < 1 || numberOfThreads == this->Threader->GetNumberOfThreads())
+    {
+    return;
+    }
+  this->Threader->SetNumberOfThreads(numberOfThreads);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeActivityMap::GetNumberOfThreads()
+{
+  return this->Threader->GetNumberOfThreads();
+}
+
+//----------------------------------------------------------------------------
+vtkImageData* vtkSlicerBetaProbeActivityMap::GetOutput()
+{
+  return this->Output;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::Reset()
+{
+  this->Store = NULL;
+  this->MappedGeneration = 0;
+  this->NumberOfMappedSamples = 0;
+  this->ScalarRange[0] = 0.0;
+  this->ScalarRange[1] = 0.0;
+
+  // Everything changed
+  for (int i = 0; i < 3; ++i)
+    {
+    this->UpdatedExtent[2 * i] = 0;
+    this->UpdatedExtent[2 * i + 1] = this->Dimensions[i] - 1;
+    }
+
+  const size_t numberOfVoxels = static_cast<size_t>(this->Dimensions[0]) *
+    this->Dimensions[1] * this->Dimensions[2];
+  if (numberOfVoxels > 0 && this->Output->GetScalarPointer())
+    {
+    const size_t scalarSize = (this->ScalarType == VTK_FLOAT) ? sizeof(float) : sizeof(double);
+    memset(this->Output->GetScalarPointer(), 0, numberOfVoxels * scalarSize);
+    if (!this->Accumulators.empty())
+      {
+      memset(&this->Accumulators[0], 0, this->Accumulators.size() * sizeof(voxelAccumulator));
+      }
+    this->Output->Modified();
+    }
+  if (numberOfVoxels > 0 && !this->Coverage.empty())
+    {
+    memset(&this->Coverage[0], 0, this->Coverage.size() * sizeof(voxelCoverage));
+    for (int c = 0; c < NumberOfCoverageComponents; ++c)
+      {
+      memset(this->CoverageOutputs[c]->GetScalarPointer(), 0, numberOfVoxels * sizeof(float));
+      this->CoverageOutputs[c]->Modified();
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::GetScalarRange(double range[2]) const
+{
+  range[0] = this->ScalarRange[0];
+  range[1] = this->ScalarRange[1];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::GetUpdatedExtent(int extent[6]) const
+{
+  for (int i = 0; i < 6; ++i)
+    {
+    extent[i] = this->UpdatedExtent[i];
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerBetaProbeActivityMap::Update(vtkMRMLBetaProbeSessionStore* store)
+{
+  if (!store)
+    {
+    return 0;
+    }
+  if (!this->HasStatistics())
+    {
+    // Reported when they were allocated
+    return -1;
+    }
+
+  // Appends since the last update only, unless the store was reset
+  if (store != this->Store ||
+      store->GetResetGeneration() > this->MappedGeneration ||
+      store->GetNumberOfSamples() < this->NumberOfMappedSamples)
+    {
+    this->Reset();
+    this->Store = store;
+    }
+  else
+    {
+    for (int i = 0; i < 3; ++i)
+      {
+      this->UpdatedExtent[2 * i] = VTK_INT_MAX;
+      this->UpdatedExtent[2 * i + 1] = VTK_INT_MIN;
+      }
+    }
+
+  const vtkIdType numberOfSamples = store->GetNumberOfSamples();
+  const vtkIdType firstSample = this->NumberOfMappedSamples;
+  const vtkIdType capacity = vtkMRMLBetaProbeSessionChunk::Capacity;
+  this->NumberOfSamplesSplatted = 0;
+  this->NumberOfSamplesToSplat = numberOfSamples - firstSample;
+
+  // Chunks are acquired here, by one thread, and splatted a batch at a time
+  vtkIdType sample = firstSample;
+  while (sample < numberOfSamples)
+    {
+    if (this->AbortRequested)
+      {
+      this->AbortRequested = false;
+      this->Batch.clear();
+      this->Reset();
+      return -1;
+      }
+
+    this->Batch.clear();
+    vtkIdType numberOfBatchSamples = 0;
+    const vtkIdType batchStart = sample;
+    while (sample < numberOfSamples && static_cast<int>(this->Batch.size()) < BatchSize)
+      {
+      const int chunkIndex = static_cast<int>(sample / capacity);
+      const vtkIdType chunkStart = chunkIndex * capacity;
+      chunkSamples samples;
+      samples.Chunk = store->AcquireChunk(chunkIndex);
+      // Chunks that could not be paged back are skipped
+      if (samples.Chunk)
+        {
+        samples.Begin = static_cast<int>(sample - chunkStart);
+        samples.End = static_cast<int>(std::min<vtkIdType>(
+          samples.Chunk->GetNumberOfSamples(), numberOfSamples - chunkStart));
+        if (samples.Begin < samples.End)
+          {
+          numberOfBatchSamples += samples.End - samples.Begin;
+          this->Batch.push_back(samples);
+          }
+        }
+      sample = chunkStart + capacity;
+      }
+
+    this->SplatBatch(numberOfBatchSamples);
+    this->NumberOfSamplesSplatted += std::min(sample, numberOfSamples) - batchStart;
+    }
+  this->Batch.clear();
+
+  this->MappedGeneration = store->GetGeneration();
+  this->NumberOfMappedSamples = numberOfSamples;
+
+  if (numberOfSamples > firstSample)
+    {
+    this->Output->GetPointData()->GetScalars()->Modified();
+    this->Output->Modified();
+    // Voxels set by the new samples only
+    this->RenderCoverage(this->UpdatedExtent);
+    }
+  return numberOfSamples - firstSample;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeActivityMap::StartUpdate(vtkMRMLBetaProbeSessionStore* store)
+{
+  if (this->IsUpdating())
+    {
+    vtkErrorMacro("StartUpdate: An update is already running");
+    return false;
+    }
+  this->WaitForUpdate();
+
+  this->UpdateStore = store;
+  this->UpdateResult = 0;
+  this->AbortRequested = false;
+  this->NumberOfSamplesSplatted = 0;
+  this->NumberOfSamplesToSplat = 0;
+  this->Updating = true;
+  this->ThreadID = this->Thread->SpawnThread(
+    (vtkThreadFunctionType)&vtkSlicerBetaProbeActivityMap::UpdateFunction, this);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeActivityMap::IsUpdating() const
+{
+  return this->Updating;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerBetaProbeActivityMap::WaitForUpdate()
+{
+  if (this->ThreadID < 0)
+    {
+    return 0;
+    }
+  this->Thread->TerminateThread(this->ThreadID);
+  this->ThreadID = -1;
+  this->UpdateStore = NULL;
+  this->AbortRequested = false;
+  return this->UpdateResult;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::AbortUpdate()
+{
+  if (this->Updating)
+    {
+    this->AbortRequested = true;
+    }
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerBetaProbeActivityMap::GetProgress() const
+{
+  const vtkIdType numberOfSamples = this->NumberOfSamplesToSplat;
+  if (numberOfSamples <= 0)
+    {
+    return this->Updating ? 0.0 : 1.0;
+    }
+  return static_cast<double>(this->NumberOfSamplesSplatted) / numberOfSamples;
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeActivityMap::UpdateFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeActivityMap* self =
+    static_cast<vtkSlicerBetaProbeActivityMap*>(info->UserData);
+  self->UpdateResult = self->Update(self->UpdateStore);
+  self->Updating = false;
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SplatBatch(vtkIdType numberOfSamples)
+{
+  if (!this->Output->GetScalarPointer() || this->Batch.empty() ||
+      (this->Aggregation != AggregateLatest && this->Accumulators.empty()) ||
+      (this->ComputeCoverage && this->Coverage.empty()))
+    {
+    return;
+    }
+
+  int numberOfSlabs = std::min(this->Threader->GetNumberOfThreads(), this->Dimensions[2]);
+  if (numberOfSamples < MinimumParallelSamples)
+    {
+    numberOfSlabs = 1;
+    }
+
+  this->BalanceSlabs(std::max(numberOfSlabs, 1));
+
+  slabResult result;
+  result.ScalarRange[0] = this->ScalarRange[0];
+  result.ScalarRange[1] = this->ScalarRange[1];
+  for (int i = 0; i < 6; ++i)
+    {
+    result.UpdatedExtent[i] = this->UpdatedExtent[i];
+    }
+  this->SlabResults.assign(std::max(numberOfSlabs, 1), result);
+
+  if (numberOfSlabs > 1)
+    {
+    this->Threader->SetSingleMethod(&vtkSlicerBetaProbeActivityMap::SplatFunction, this);
+    this->Threader->SingleMethodExecute();
+    }
+  else
+    {
+    this->SplatSlab(0);
+    }
+
+  // Union of the slabs
+  for (size_t slab = 0; slab < this->SlabResults.size(); ++slab)
+    {
+    const slabResult& slabUpdate = this->SlabResults[slab];
+    this->ScalarRange[0] = std::min(this->ScalarRange[0], slabUpdate.ScalarRange[0]);
+    this->ScalarRange[1] = std::max(this->ScalarRange[1], slabUpdate.ScalarRange[1]);
+    for (int c = 0; c < 3; ++c)
+      {
+      this->UpdatedExtent[2 * c] =
+        std::min(this->UpdatedExtent[2 * c], slabUpdate.UpdatedExtent[2 * c]);
+      this->UpdatedExtent[2 * c + 1] =
+        std::max(this->UpdatedExtent[2 * c + 1], slabUpdate.UpdatedExtent[2 * c + 1]);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::BalanceSlabs(int numberOfSlabs)
+{
+  const int depth = this->Dimensions[2];
+  this->SlabBounds.resize(numberOfSlabs + 1);
+  this->SlabBounds[0] = 0;
+  this->SlabBounds[numberOfSlabs] = depth;
+  if (numberOfSlabs == 1)
+    {
+    return;
+    }
+
+  // Number of samples setting every plane of the map, through the
+  // differences between consecutive planes. A sample costs about as much
+  // in every plane it sets.
+  this->PlaneWork.assign(depth + 1, 0);
+  const double pointSize = this->PointSize;
+  double m[4];
+  for (int j = 0; j < 4; ++j)
+    {
+    m[j] = this->RASToIJK->GetElement(2, j);
+    }
+  vtkIdType totalWork = 0;
+  for (size_t b = 0; b < this->Batch.size(); ++b)
+    {
+    const chunkSamples& chunkRange = this->Batch[b];
+    const double* x = chunkRange.Chunk->GetX();
+    const double* y = chunkRange.Chunk->GetY();
+    const double* z = chunkRange.Chunk->GetZ();
+    for (int s = chunkRange.Begin; s < chunkRange.End; ++s)
+      {
+      // Planes of the box of the sample, as in Splat()
+      const double k = m[0] * x[s] + m[1] * y[s] + m[2] * z[s] + m[3];
+      if (!(k + pointSize > 0 && k - pointSize < depth))
+        {
+        continue;
+        }
+      int last = static_cast<int>(k + pointSize);
+      if (last >= k + pointSize)
+        {
+        last--;
+        }
+      const int first = std::max(static_cast<int>(k - pointSize), 0);
+      last = std::min(last, depth - 1);
+      if (first <= last)
+        {
+        this->PlaneWork[first]++;
+        this->PlaneWork[last + 1]--;
+        totalWork += last - first + 1;
+        }
+      }
+    }
+
+  // Cut the planes in slabs of about totalWork / numberOfSlabs each. Slabs
+  // of equal depth split the map even if the samples are not spread out.
+  if (totalWork == 0)
+    {
+    for (int slab = 1; slab < numberOfSlabs; ++slab)
+      {
+      this->SlabBounds[slab] = static_cast<int>(
+        static_cast<vtkIdType>(depth) * slab / numberOfSlabs);
+      }
+    return;
+    }
+  vtkIdType planeWork = 0;
+  vtkIdType work = 0;
+  int slab = 1;
+  for (int plane = 0; plane < depth && slab < numberOfSlabs; ++plane)
+    {
+    planeWork += this->PlaneWork[plane];
+    work += planeWork;
+    while (slab < numberOfSlabs && work * numberOfSlabs >= totalWork * slab)
+      {
+      this->SlabBounds[slab++] = plane + 1;
+      }
+    }
+  for (; slab < numberOfSlabs; ++slab)
+    {
+    this->SlabBounds[slab] = depth;
+    }
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeActivityMap::SplatFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeActivityMap* self =
+    static_cast<vtkSlicerBetaProbeActivityMap*>(info->UserData);
+  if (info->ThreadID >= 0 && info->ThreadID < static_cast<int>(self->SlabResults.size()))
+    {
+    self->SplatSlab(info->ThreadID);
+    }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::SplatSlab(int slab)
+{
+  slabResult& result = this->SlabResults[slab];
+
+  splatGeometry geometry;
+  for (int i = 0; i < 3; ++i)
+    {
+    for (int j = 0; j < 4; ++j)
+      {
+      geometry.RASToIJK[i][j] = this->RASToIJK->GetElement(i, j);
+      }
+    geometry.Bounds[2 * i] = 0;
+    geometry.Bounds[2 * i + 1] = this->Dimensions[i] - 1;
+    }
+  geometry.Bounds[4] = this->SlabBounds[slab];
+  geometry.Bounds[5] = this->SlabBounds[slab + 1] - 1;
+  geometry.Increments[0] = 1;
+  geometry.Increments[1] = this->Dimensions[0];
+  geometry.Increments[2] = static_cast<vtkIdType>(this->Dimensions[0]) * this->Dimensions[1];
+  geometry.PointSize = this->PointSize;
+
+  void* map = this->Output->GetScalarPointer();
+  voxelAccumulator* accumulators =
+    this->Accumulators.empty() ? NULL : &this->Accumulators[0];
+  voxelCoverage* coverage = this->Coverage.empty() ? NULL : &this->Coverage[0];
+  for (size_t b = 0; b < this->Batch.size(); ++b)
+    {
+    const chunkSamples& chunkRange = this->Batch[b];
+    vtkMRMLBetaProbeSessionChunk* chunk = chunkRange.Chunk;
+    splatSamples samples;
+    samples.X = chunk->GetX();
+    samples.Y = chunk->GetY();
+    samples.Z = chunk->GetZ();
+    samples.Values = chunk->GetGamma();
+    samples.BetaGamma = chunk->GetBetaGamma();
+    samples.Begin = chunkRange.Begin;
+    samples.End = chunkRange.End;
+    if (this->ScalarType == VTK_FLOAT)
+      {
+      Splat(static_cast<float*>(map), accumulators, coverage, geometry, this->Aggregation,
+            samples, result.ScalarRange, result.UpdatedExtent);
+      }
+    else
+      {
+      Splat(static_cast<double*>(map), accumulators, coverage, geometry, this->Aggregation,
+            samples, result.ScalarRange, result.UpdatedExtent);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeActivityMap::RenderCoverage(const int extent[6])
+{
+  if (this->Coverage.empty())
+    {
+    return;
+    }
+
+  vtkIdType numberOfVoxels = 1;
+  for (int i = 0; i < 3; ++i)
+    {
+    this->CoverageExtent[2 * i] = std::max(extent[2 * i], 0);
+    this->CoverageExtent[2 * i + 1] = std::min(extent[2 * i + 1], this->Dimensions[i] - 1);
+    numberOfVoxels *= std::max(this->CoverageExtent[2 * i + 1] - this->CoverageExtent[2 * i] + 1, 0);
+    }
+  if (numberOfVoxels == 0)
+    {
+    return;
+    }
+
+  // Slabs of equal depth along K: every voxel of the extent costs the same
+  if (numberOfVoxels >= MinimumParallelVoxels && this->Threader->GetNumberOfThreads() > 1)
+    {
+    this->Threader->SetSingleMethod(&vtkSlicerBetaProbeActivityMap::RenderCoverageFunction, this);
+    this->Threader->SingleMethodExecute();
+    }
+  else
+    {
+    float* images[NumberOfCoverageComponents];
+    for (int c = 0; c < NumberOfCoverageComponents; ++c)
+      {
+      images[c] = static_cast<float*>(this->CoverageOutputs[c]->GetScalarPointer());
+      }
+    RenderCoverageExtent(&this->Coverage[0], images, this->Dimensions, this->CoverageExtent,
+                         this->ConfidenceZ);
+    }
+
+  for (int c = 0; c < NumberOfCoverageComponents; ++c)
+    {
+    this->CoverageOutputs[c]->GetPointData()->GetScalars()->Modified();
+    this->CoverageOutputs[c]->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeActivityMap::RenderCoverageFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeActivityMap* self =
+    static_cast<vtkSlicerBetaProbeActivityMap*>(info->UserData);
+
+  int extent[6];
+  for (int i = 0; i < 6; ++i)
+    {
+    extent[i] = self->CoverageExtent[i];
+    }
+  const vtkIdType depth = extent[5] - extent[4] + 1;
+  extent[4] = self->CoverageExtent[4] +
+    static_cast<int>(depth * info->ThreadID / info->NumberOfThreads);
+  extent[5] = self->CoverageExtent[4] +
+    static_cast<int>(depth * (info->ThreadID + 1) / info->NumberOfThreads) - 1;
+
+  float* images[NumberOfCoverageComponents];
+  for (int c = 0; c < NumberOfCoverageComponents; ++c)
+    {
+    images[c] = static_cast<float*>(self->CoverageOutputs[c]->GetScalarPointer());
+    }
+  RenderCoverageExtent(&self->Coverage[0], images, self->Dimensions, extent, self->ConfidenceZ);
+  return NULL;
+}
@@ -0,0 +1,325 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeActivityMap - activity map of recorded samples
+// .SECTION Description
+// Splats the gamma counts of the samples of a session store into a volume:
+// every sample sets the voxels within PointSize of its position. The map
+// is persistent: Update() only splats the samples appended to the store
+// since the previous call, and rebuilds the map when the store was reset
+// or replaced (see vtkMRMLBetaProbeSessionStore::GetResetGeneration()).
+//
+// The scalar range and the extent touched by the last Update() are kept
+// up to date as samples are splatted, so that the map never has to be
+// scanned.
+//
+// Samples are splatted a chunk at a time by a kernel specialized on the
+// scalar type of the map and on the point size (up to MaximumFixedPointSize,
+// larger sizes use a generic kernel). The box of every sample is clipped to
+// the map once, then written row by row.
+//
+// Large updates are split in slabs of the map along K, one per thread:
+// every thread splats all the samples, in order, into its own slab only.
+// Slabs are cut for every batch of samples so that they hold about the
+// same number of planes set by the samples, from one counting pass over
+// the batch: sweeps over a small part of the map are split as well as
+// sweeps over all of it.
+// Every voxel is thus written by a single thread in the order of the
+// samples, and the map does not depend on the number of threads.
+//
+// Voxels set by several samples hold the value of the latest one, or a
+// statistic of all of them (see SetAggregation()). Statistics are computed
+// from running accumulators kept next to the map, one voxelAccumulator per
+// voxel, updated by every sample and walked together with the map rows.
+//
+// With ComputeCoverage on, the samples also update coverage statistics of
+// the voxels they set, in the same pass: number of samples, Welford
+// running variance of gamma, and mean gamma and beta+gamma counts. The
+// coverage images are computed from them once per Update(), over the
+// extent updated only. Their confidence intervals assume Poisson counts:
+// the exact (Garwood) interval of the counts summed over the samples of a
+// voxel, approximated after Wilson and Hilferty, divided by the number of
+// samples.
+//
+// StartUpdate() runs Update() on a background thread, which reports its
+// progress and can be aborted.
+
+#ifndef __vtkSlicerBetaProbeActivityMap_h
+#define __vtkSlicerBetaProbeActivityMap_h
+
+// VTK includes
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+
+// MRML includes
+#include "vtkMRMLBetaProbeSessionChunk.h"
+
+// STD includes
+#include <atomic>
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+class vtkImageData;
+class vtkMatrix4x4;
+class vtkMRMLBetaProbeSessionStore;
+class vtkMultiThreader;
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeActivityMap :
+  public vtkObject
+{
+public:
+  static vtkSlicerBetaProbeActivityMap *New();
+  vtkTypeMacro(vtkSlicerBetaProbeActivityMap, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Allocate a map of the given dimensions, positions being converted
+  /// to voxels by rasToIJK. Clears the map.
+  void SetGeometry(const int dimensions[3], vtkMatrix4x4* rasToIJK);
+
+  /// Half-size of the box of voxels set by every sample, in voxels.
+  /// Changing it clears the map.
+  void SetPointSize(int pointSize);
+  vtkGetMacro(PointSize, int);
+
+  /// Largest point size with a kernel of its own
+  enum { MaximumFixedPointSize = 4 };
+
+  /// Value of a voxel set by several samples:
+  /// AggregateLatest: gamma of the latest sample (default)
+  /// AggregateMean, AggregateMaximum, AggregateSum: of the gamma of all
+  /// samples
+  /// AggregateCount: number of samples
+  enum
+  {
+    AggregateLatest = 0,
+    AggregateMean,
+    AggregateMaximum,
+    AggregateSum,
+    AggregateCount
+  };
+
+  /// Running statistics of a voxel, 16 bytes so that four of them share a
+  /// cache line
+  typedef struct
+  {
+    double Sum;
+    float Maximum;
+    vtkTypeUInt32 Count;
+  }voxelAccumulator;
+
+  /// Coverage images, computed when ComputeCoverage is on:
+  /// CoverageCount: number of samples
+  /// CoverageStandardDeviation: sample standard deviation of gamma
+  /// CoverageGammaLower, CoverageGammaUpper: confidence interval of the
+  /// mean gamma counts per sample
+  /// CoverageBetaGammaLower, CoverageBetaGammaUpper: same for beta+gamma
+  enum
+  {
+    CoverageCount = 0,
+    CoverageStandardDeviation,
+    CoverageGammaLower,
+    CoverageGammaUpper,
+    CoverageBetaGammaLower,
+    CoverageBetaGammaUpper,
+    NumberOfCoverageComponents
+  };
+
+  /// Running coverage statistics of a voxel, 32 bytes so that two of them
+  /// share a cache line. GammaM2 is the sum of the squared differences to
+  /// GammaMean.
+  typedef struct
+  {
+    double GammaMean;
+    double GammaM2;
+    double BetaGammaSum;
+    vtkTypeUInt32 Count;
+  }voxelCoverage;
+
+  /// Changing from a statistic to another one redraws the map from the
+  /// accumulators. Changing from or to AggregateLatest clears the map, and
+  /// allocates or frees the accumulators. Not to be called during an update.
+  void SetAggregation(int aggregation);
+  vtkGetMacro(Aggregation, int);
+
+  /// Scalar type of the map, VTK_DOUBLE (default) or VTK_FLOAT. Changing it
+  /// reallocates and clears the map.
+  void SetScalarType(int scalarType);
+  vtkGetMacro(ScalarType, int);
+
+  /// Map, one value of ScalarType per voxel, 0 where nothing was splatted
+  vtkImageData* GetOutput();
+
+  /// Compute the coverage images along with the map. Changing it clears
+  /// the map, and allocates or frees the coverage statistics. The coverage
+  /// images are not updated while it is off.
+  /// Not to be called during an update.
+  void SetComputeCoverage(bool computeCoverage);
+  vtkGetMacro(ComputeCoverage, bool);
+  vtkBooleanMacro(ComputeCoverage, bool);
+
+  /// Confidence level of the intervals of the coverage images, 0.95 by
+  /// default. Changing it recomputes the coverage images.
+  /// Not to be called during an update.
+  void SetConfidenceLevel(double confidenceLevel);
+  vtkGetMacro(ConfidenceLevel, double);
+
+  /// Coverage image component (see Coverage*), one float per voxel, 0
+  /// where nothing was splatted. NULL if component is out of range.
+  vtkImageData* GetCoverageOutput(int component);
+
+  /// Memory allowed for the per-voxel statistics, in bytes, 2 GiB by
+  /// default: accumulators (16 bytes per voxel, unless AggregateLatest),
+  /// and coverage statistics and images (56 bytes per voxel, with
+  /// ComputeCoverage on). Statistics that do not fit are not allocated,
+  /// and Update() fails until the geometry, the aggregation or the coverage
+  /// is changed. Checked when the statistics are allocated.
+  vtkSetMacro(StatisticsMemoryLimit, size_t);
+  vtkGetMacro(StatisticsMemoryLimit, size_t);
+
+  /// Number of threads splatting large updates, by default the number of
+  /// cores
+  void SetNumberOfThreads(int numberOfThreads);
+  int GetNumberOfThreads();
+
+  /// Splat the samples of store not splatted yet, or all of them if store
+  /// changed otherwise than by appending samples.
+  /// Return the number of samples splatted, -1 if the update was aborted
+  /// (the map is then cleared) or if the statistics it needs could not be
+  /// allocated.
+  vtkIdType Update(vtkMRMLBetaProbeSessionStore* store);
+
+  /// Run Update(store) on a background thread. store must not change until
+  /// the update is over: give it a copy of a store being recorded (see
+  /// vtkMRMLBetaProbeSessionStore::ShallowCopy()). The map must not be used
+  /// until IsUpdating() is false and WaitForUpdate() was called.
+  /// Return false if an update is already running.
+  bool StartUpdate(vtkMRMLBetaProbeSessionStore* store);
+  bool IsUpdating() const;
+
+  /// Wait for the end of the background update and return its result, as
+  /// returned by Update(). Return 0 if none was started.
+  vtkIdType WaitForUpdate();
+
+  /// Ask the running update to stop. Safe to call from any thread.
+  void AbortUpdate();
+
+  /// Fraction of the samples of the running or last update splatted so
+  /// far. Safe to call from any thread.
+  double GetProgress() const;
+
+  /// Clear the map
+  void Reset();
+
+  /// Range of the values splatted since the map was cleared, 0 included.
+  /// Values overwritten by later samples still count.
+  void GetScalarRange(double range[2]) const;
+
+  /// Extent of the voxels set by the last Update(), empty (min > max) if
+  /// none was.
+  void GetUpdatedExtent(int extent[6]) const;
+
+  vtkGetMacro(NumberOfMappedSamples, vtkIdType);
+
+protected:
+  vtkSlicerBetaProbeActivityMap();
+  virtual ~vtkSlicerBetaProbeActivityMap();
+
+  // Samples of a chunk to splat
+  typedef struct
+  {
+    vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> Chunk;
+    int Begin;
+    int End;
+  }chunkSamples;
+
+  // Scalar range and extent of the voxels set in one slab
+  typedef struct
+  {
+    double ScalarRange[2];
+    int UpdatedExtent[6];
+  }slabResult;
+
+  // Splat Batch, in parallel if large enough
+  void SplatBatch(vtkIdType numberOfSamples);
+  // Set SlabBounds to split the splatting of Batch evenly
+  void BalanceSlabs(int numberOfSlabs);
+  void SplatSlab(int slab);
+  // Allocate the statistics needed by Aggregation and ComputeCoverage, free
+  // the others. Return false if they exceed StatisticsMemoryLimit or
+  // cannot be allocated: they are then left empty.
+  bool AllocateAccumulators();
+  bool AllocateCoverage();
+  bool HasStatistics() const;
+  // Compute the coverage images over extent, in parallel if large enough
+  void RenderCoverage(const int extent[6]);
+  static void* SplatFunction(void* ptr);
+  static void* RenderCoverageFunction(void* ptr);
+  static void* UpdateFunction(void* ptr);
+
+  vtkImageData* Output;
+  vtkMatrix4x4* RASToIJK;
+  int PointSize;
+  int ScalarType;
+  int Aggregation;
+  bool ComputeCoverage;
+  double ConfidenceLevel;
+  // Standard normal quantile of ConfidenceLevel
+  double ConfidenceZ;
+  size_t StatisticsMemoryLimit;
+  int Dimensions[3];
+
+  vtkSmartPointer<vtkMRMLBetaProbeSessionStore> Store;
+  vtkTypeUInt64 MappedGeneration;
+  vtkIdType NumberOfMappedSamples;
+
+  double ScalarRange[2];
+  int UpdatedExtent[6];
+
+  // Empty for AggregateLatest
+  std::vector<voxelAccumulator> Accumulators;
+
+  // Empty unless ComputeCoverage is on
+  std::vector<voxelCoverage> Coverage;
+  vtkImageData* CoverageOutputs[NumberOfCoverageComponents];
+  int CoverageExtent[6];
+
+  vtkMultiThreader* Threader;
+  std::vector<chunkSamples> Batch;
+  std::vector<slabResult> SlabResults;
+  // First plane of every slab, followed by Dimensions[2]
+  std::vector<int> SlabBounds;
+  // Scratch counts of BalanceSlabs()
+  std::vector<vtkIdType> PlaneWork;
+
+  // Background update
+  vtkMultiThreader* Thread;
+  int ThreadID;
+  vtkSmartPointer<vtkMRMLBetaProbeSessionStore> UpdateStore;
+  vtkIdType UpdateResult;
+  std::atomic<bool> Updating;
+  std::atomic<bool> AbortRequested;
+  std::atomic<vtkIdType> NumberOfSamplesToSplat;
+  std::atomic<vtkIdType> NumberOfSamplesSplatted;
+
+private:
+  vtkSlicerBetaProbeActivityMap(const vtkSlicerBetaProbeActivityMap&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeActivityMap&);                 // Not implemented
+};
+
+#endif
@@ -0,0 +1,273 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeClockEstimator.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+// A bucket is an outlier if it is further than this many robust standard
+// deviations from the fit, and never if it is closer than MinimumTolerance.
+const double RejectionThreshold = 3.0;
+const double MinimumTolerance = 200000.0; // 0.2 ms
+
+// The device clock is considered to have been reset after this many
+// consecutive samples further than JumpThreshold from the prediction.
+const double JumpThreshold = 1e9; // 1 s
+const int NumberOfJumpsBeforeReset = 5;
+
+//----------------------------------------------------------------------------
+double Median(std::vector<double>& values)
+{
+  size_t middle = values.size() / 2;
+  std::nth_element(values.begin(), values.begin() + middle, values.end());
+  return values[middle];
+}
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeClockEstimator::vtkSlicerBetaProbeClockEstimator()
+{
+  this->BucketDuration = 2000000000LL; // 2 s
+  this->NumberOfBuckets = 300;         // 10 min
+  this->Reset();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeClockEstimator::Reset()
+{
+  this->Buckets.clear();
+  this->CurrentBucket.DeviceTime = 0;
+  this->CurrentBucket.Offset = 0;
+  this->CurrentBucketStart = 0;
+  this->HasCurrentBucket = false;
+  this->ReferenceDeviceTime = 0;
+  this->ReferenceOffset = 0;
+  this->Intercept = 0.0;
+  this->Slope = 0.0;
+  this->LatestDeviceTime = 0;
+  this->NumberOfRejectedBuckets = 0;
+  this->NumberOfConsecutiveJumps = 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeClockEstimator::SetBucketDuration(vtkTypeInt64 duration)
+{
+  this->BucketDuration = duration > 0 ? duration : 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeClockEstimator::SetNumberOfBuckets(int numberOfBuckets)
+{
+  this->NumberOfBuckets = numberOfBuckets > 2 ? numberOfBuckets : 2;
+  while (this->Buckets.size() > static_cast<size_t>(this->NumberOfBuckets))
+    {
+    this->Buckets.pop_front();
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeClockEstimator::IsValid() const
+{
+  return this->HasCurrentBucket;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeClockEstimator::GetNumberOfRejectedBuckets() const
+{
+  return this->NumberOfRejectedBuckets;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerBetaProbeClockEstimator::Predict(vtkTypeInt64 deviceTime) const
+{
+  // Relative to ReferenceOffset
+  double elapsed = static_cast<double>(deviceTime - this->ReferenceDeviceTime);
+  return this->Intercept + this->Slope * elapsed;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeClockEstimator::DeviceToHost(vtkTypeInt64 deviceTime) const
+{
+  return deviceTime + this->ReferenceOffset +
+    static_cast<vtkTypeInt64>(floor(this->Predict(deviceTime) + 0.5));
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeClockEstimator::GetOffset() const
+{
+  return this->DeviceToHost(this->LatestDeviceTime) - this->LatestDeviceTime;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerBetaProbeClockEstimator::GetDrift() const
+{
+  return this->Slope * 1e6;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeClockEstimator::AddSample(vtkTypeInt64 deviceTime, vtkTypeInt64 receiveTime)
+{
+  const vtkTypeInt64 offset = receiveTime - deviceTime;
+
+  if (!this->HasCurrentBucket)
+    {
+    this->ReferenceDeviceTime = deviceTime;
+    this->ReferenceOffset = offset;
+    this->CurrentBucketStart = deviceTime;
+    this->CurrentBucket.DeviceTime = deviceTime;
+    this->CurrentBucket.Offset = offset;
+    this->LatestDeviceTime = deviceTime;
+    this->HasCurrentBucket = true;
+    return;
+    }
+
+  // Device clock stepped (or was reset): start over once it is confirmed
+  double residual = static_cast<double>(offset - this->ReferenceOffset) - this->Predict(deviceTime);
+  if (fabs(residual) > JumpThreshold ||
+      deviceTime < this->CurrentBucketStart - this->BucketDuration)
+    {
+    if (++this->NumberOfConsecutiveJumps >= NumberOfJumpsBeforeReset)
+      {
+      this->Reset();
+      this->AddSample(deviceTime, receiveTime);
+      }
+    return;
+    }
+  this->NumberOfConsecutiveJumps = 0;
+
+  if (deviceTime > this->LatestDeviceTime)
+    {
+    this->LatestDeviceTime = deviceTime;
+    }
+
+  if (deviceTime - this->CurrentBucketStart >= this->BucketDuration)
+    {
+    this->CloseBucket();
+    this->CurrentBucketStart = deviceTime;
+    this->CurrentBucket.DeviceTime = deviceTime;
+    this->CurrentBucket.Offset = offset;
+    }
+  else if (offset < this->CurrentBucket.Offset)
+    {
+    this->CurrentBucket.DeviceTime = deviceTime;
+    this->CurrentBucket.Offset = offset;
+    }
+
+  // Until a first bucket is closed, follow the fastest datagram seen so far
+  if (this->Buckets.empty())
+    {
+    this->Intercept = static_cast<double>(this->CurrentBucket.Offset - this->ReferenceOffset);
+    this->Slope = 0.0;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeClockEstimator::CloseBucket()
+{
+  this->Buckets.push_back(this->CurrentBucket);
+  if (this->Buckets.size() > static_cast<size_t>(this->NumberOfBuckets))
+    {
+    this->Buckets.pop_front();
+    }
+  this->Fit();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeClockEstimator::Fit()
+{
+  const size_t numberOfBuckets = this->Buckets.size();
+
+  // Keep the numbers small: rebase on the oldest bucket
+  const bucketMinimum& oldest = this->Buckets.front();
+  this->ReferenceDeviceTime = oldest.DeviceTime;
+  this->ReferenceOffset = oldest.Offset;
+
+  std::vector<double> x(numberOfBuckets);
+  std::vector<double> y(numberOfBuckets);
+  std::vector<bool> inlier(numberOfBuckets, true);
+  for (size_t i = 0; i < numberOfBuckets; ++i)
+    {
+    x[i] = static_cast<double>(this->Buckets[i].DeviceTime - this->ReferenceDeviceTime);
+    y[i] = static_cast<double>(this->Buckets[i].Offset - this->ReferenceOffset);
+    }
+
+  // Two passes: fit all minima, then refit without the outliers
+  for (int pass = 0; pass < 2; ++pass)
+    {
+    double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumXY = 0.0;
+    double n = 0.0;
+    for (size_t i = 0; i < numberOfBuckets; ++i)
+      {
+      if (!inlier[i])
+        {
+        continue;
+        }
+      sumX += x[i];
+      sumY += y[i];
+      sumXX += x[i] * x[i];
+      sumXY += x[i] * y[i];
+      n += 1.0;
+      }
+
+    if (n < 1.0)
+      {
+      break;
+      }
+    double denominator = n * sumXX - sumX * sumX;
+    // Fewer than two distinct times: offset only
+    if (n < 2.0 || fabs(denominator) < 1e-9 * n * sumXX + 1e-300)
+      {
+      this->Slope = 0.0;
+      this->Intercept = sumY / n;
+      }
+    else
+      {
+      this->Slope = (n * sumXY - sumX * sumY) / denominator;
+      this->Intercept = (sumY - this->Slope * sumX) / n;
+      }
+
+    if (pass == 1 || numberOfBuckets < 3)
+      {
+      break;
+      }
+
+    // Reject minima further than a few robust sigmas (MAD) from the line
+    std::vector<double> residuals(numberOfBuckets);
+    for (size_t i = 0; i < numberOfBuckets; ++i)
+      {
+      residuals[i] = fabs(y[i] - (this->Intercept + this->Slope * x[i]));
+      }
+    std::vector<double> sorted(residuals);
+    double tolerance = std::max(RejectionThreshold * 1.4826 * Median(sorted),
+                                MinimumTolerance);
+    this->NumberOfRejectedBuckets = 0;
+    for (size_t i = 0; i < numberOfBuckets; ++i)
+      {
+      inlier[i] = residuals[i] <= tolerance;
+      if (!inlier[i])
+        {
+        this->NumberOfRejectedBuckets++;
+        }
+      }
+    }
+}
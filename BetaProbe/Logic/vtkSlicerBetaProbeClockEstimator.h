@@ -0,0 +1,102 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeClockEstimator - map the device clock to host time
+// .SECTION Description
+// Streaming estimate of the offset and drift between the BetaProbe device
+// clock and the host clock, from (device time, receive time) pairs.
+//
+// Network jitter only ever delays a datagram, so the estimator works on the
+// lower envelope of (receive - device): the pairs are grouped in buckets of
+// BucketDuration and only the fastest datagram of each bucket is kept. A line
+// is fitted through the last NumberOfBuckets minima by least squares, buckets
+// far from the fit (congestion, scheduling hiccups) are rejected and the line
+// is refitted. A sustained jump of the device clock restarts the estimate.
+
+#ifndef __vtkSlicerBetaProbeClockEstimator_h
+#define __vtkSlicerBetaProbeClockEstimator_h
+
+// VTK includes
+#include <vtkType.h>
+
+// STD includes
+#include <deque>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeClockEstimator
+{
+public:
+  vtkSlicerBetaProbeClockEstimator();
+
+  /// Add a datagram sent at deviceTime (device clock) and received at
+  /// receiveTime (host clock), both in nanoseconds.
+  void AddSample(vtkTypeInt64 deviceTime, vtkTypeInt64 receiveTime);
+
+  /// True once at least one sample was added
+  bool IsValid() const;
+
+  /// Host time corresponding to deviceTime
+  vtkTypeInt64 DeviceToHost(vtkTypeInt64 deviceTime) const;
+
+  /// Current offset (host - device) in nanoseconds, at the latest sample
+  vtkTypeInt64 GetOffset() const;
+
+  /// Current drift of the host clock relative to the device clock,
+  /// in parts per million
+  double GetDrift() const;
+
+  /// Number of buckets rejected as outliers by the last fit
+  int GetNumberOfRejectedBuckets() const;
+
+  void Reset();
+
+  /// Tuning
+  void SetBucketDuration(vtkTypeInt64 duration);
+  void SetNumberOfBuckets(int numberOfBuckets);
+
+protected:
+  typedef struct
+  {
+    vtkTypeInt64 DeviceTime;
+    vtkTypeInt64 Offset;
+  }bucketMinimum;
+
+  void CloseBucket();
+  void Fit();
+  double Predict(vtkTypeInt64 deviceTime) const;
+
+  vtkTypeInt64 BucketDuration;
+  int NumberOfBuckets;
+
+  std::deque<bucketMinimum> Buckets;
+  bucketMinimum CurrentBucket;
+  vtkTypeInt64 CurrentBucketStart;
+  bool HasCurrentBucket;
+
+  // Fit: offset = ReferenceOffset + Intercept + Slope * (device - ReferenceDeviceTime)
+  vtkTypeInt64 ReferenceDeviceTime;
+  vtkTypeInt64 ReferenceOffset;
+  double Intercept;
+  double Slope;
+  vtkTypeInt64 LatestDeviceTime;
+  int NumberOfRejectedBuckets;
+  int NumberOfConsecutiveJumps;
+};
+
+#endif
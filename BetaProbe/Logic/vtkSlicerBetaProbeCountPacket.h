@@ -0,0 +1,179 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeCountPacket - fixed layout binary count datagram
+// .SECTION Description
+// Binary alternative to the CSV count datagrams. All fields are little-endian:
+//
+//   offset  size  field
+//        0     4  magic "BPRB"
+//        4     1  version (1)
+//        5     1  flags
+//        6     2  reserved (0)
+//        8     4  sequence number
+//       12     4  smoothed (float)
+//       16     8  device timestamp, nanoseconds since 1970-01-01 UTC
+//       24     4  beta+gamma (float)
+//       28     4  gamma (float)
+//
+// A receiver tells both formats apart from the first four bytes, which can
+// never start a CSV datagram.
+
+#ifndef __vtkSlicerBetaProbeCountPacket_h
+#define __vtkSlicerBetaProbeCountPacket_h
+
+// VTK includes
+#include <vtkType.h>
+
+// STD includes
+#include <cstddef>
+#include <cstring>
+
+struct vtkSlicerBetaProbeCountPacket
+{
+  enum
+  {
+    Size = 32,
+    CurrentVersion = 1
+  };
+
+  vtkTypeUInt8  Version;
+  vtkTypeUInt8  Flags;
+  vtkTypeUInt32 Sequence;
+  vtkTypeInt64  DeviceTime;
+  float         Smoothed;
+  float         BetaGamma;
+  float         Gamma;
+
+  /// True if the datagram starts with the binary packet magic
+  static bool HasMagic(const char* data, size_t length)
+  {
+    return length >= 4 &&
+      data[0] == 'B' && data[1] == 'P' && data[2] == 'R' && data[3] == 'B';
+  }
+
+  /// Serialize into buffer, which must hold at least Size bytes
+  void Encode(unsigned char* buffer) const
+  {
+    buffer[0] = 'B';
+    buffer[1] = 'P';
+    buffer[2] = 'R';
+    buffer[3] = 'B';
+    buffer[4] = this->Version;
+    buffer[5] = this->Flags;
+    buffer[6] = 0;
+    buffer[7] = 0;
+    WriteUInt32(buffer + 8, this->Sequence);
+    WriteUInt32(buffer + 12, FloatBits(this->Smoothed));
+    WriteUInt32(buffer + 16, static_cast<vtkTypeUInt32>(
+                  static_cast<vtkTypeUInt64>(this->DeviceTime)));
+    WriteUInt32(buffer + 20, static_cast<vtkTypeUInt32>(
+                  static_cast<vtkTypeUInt64>(this->DeviceTime) >> 32));
+    WriteUInt32(buffer + 24, FloatBits(this->BetaGamma));
+    WriteUInt32(buffer + 28, FloatBits(this->Gamma));
+  }
+
+  /// Deserialize. Return false if the magic, version or size do not match.
+  bool Decode(const unsigned char* buffer, size_t length)
+  {
+    if (length != Size ||
+        !HasMagic(reinterpret_cast<const char*>(buffer), length) ||
+        buffer[4] != CurrentVersion)
+      {
+      return false;
+      }
+    this->Version = buffer[4];
+    this->Flags = buffer[5];
+    this->Sequence = ReadUInt32(buffer + 8);
+    this->Smoothed = BitsFloat(ReadUInt32(buffer + 12));
+    this->DeviceTime = static_cast<vtkTypeInt64>(
+      static_cast<vtkTypeUInt64>(ReadUInt32(buffer + 16)) |
+      (static_cast<vtkTypeUInt64>(ReadUInt32(buffer + 20)) << 32));
+    this->BetaGamma = BitsFloat(ReadUInt32(buffer + 24));
+    this->Gamma = BitsFloat(ReadUInt32(buffer + 28));
+    return true;
+  }
+
+  static void WriteUInt32(unsigned char* p, vtkTypeUInt32 v)
+  {
+    p[0] = static_cast<unsigned char>(v);
+    p[1] = static_cast<unsigned char>(v >> 8);
+    p[2] = static_cast<unsigned char>(v >> 16);
+    p[3] = static_cast<unsigned char>(v >> 24);
+  }
+
+  static vtkTypeUInt32 ReadUInt32(const unsigned char* p)
+  {
+    return static_cast<vtkTypeUInt32>(p[0]) |
+      (static_cast<vtkTypeUInt32>(p[1]) << 8) |
+      (static_cast<vtkTypeUInt32>(p[2]) << 16) |
+      (static_cast<vtkTypeUInt32>(p[3]) << 24);
+  }
+
+  static void WriteUInt64(unsigned char* p, vtkTypeUInt64 v)
+  {
+    WriteUInt32(p, static_cast<vtkTypeUInt32>(v));
+    WriteUInt32(p + 4, static_cast<vtkTypeUInt32>(v >> 32));
+  }
+
+  static vtkTypeUInt64 ReadUInt64(const unsigned char* p)
+  {
+    return static_cast<vtkTypeUInt64>(ReadUInt32(p)) |
+      (static_cast<vtkTypeUInt64>(ReadUInt32(p + 4)) << 32);
+  }
+
+  static vtkTypeUInt32 FloatBits(float f)
+  {
+    vtkTypeUInt32 bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+  }
+
+  static float BitsFloat(vtkTypeUInt32 bits)
+  {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+
+  static void WriteFloat(unsigned char* p, double v)
+  {
+    WriteUInt32(p, FloatBits(static_cast<float>(v)));
+  }
+
+  static float ReadFloat(const unsigned char* p)
+  {
+    return BitsFloat(ReadUInt32(p));
+  }
+
+  static void WriteDouble(unsigned char* p, double v)
+  {
+    vtkTypeUInt64 bits;
+    memcpy(&bits, &v, sizeof(bits));
+    WriteUInt64(p, bits);
+  }
+
+  static double ReadDouble(const unsigned char* p)
+  {
+    const vtkTypeUInt64 bits = ReadUInt64(p);
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+};
+
+#endif
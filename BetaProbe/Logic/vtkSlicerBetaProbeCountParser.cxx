@@ -0,0 +1,430 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeCountParser.h"
+#include "vtkSlicerBetaProbeCountPacket.h"
+
+// STD includes
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace
+{
+const int NumberOfFields = 5;
+
+//----------------------------------------------------------------------------
+const double PowersOfTen[] =
+{
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+  1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+  1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//----------------------------------------------------------------------------
+inline bool IsDigit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+//----------------------------------------------------------------------------
+inline bool IsBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0';
+}
+
+//----------------------------------------------------------------------------
+inline bool CopyField(const char* begin, const char* end,
+                      char* destination, size_t destinationSize)
+{
+  size_t length = static_cast<size_t>(end - begin);
+  if (length >= destinationSize)
+    {
+    return false;
+    }
+  memcpy(destination, begin, length);
+  destination[length] = '\0';
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Read 1 to maximumDigits digits from p, then skip one separator. More
+// digits fail.
+inline bool ReadNumber(const char*& p, const char* end, int maximumDigits,
+                       int& value, int& numberOfDigits)
+{
+  value = 0;
+  numberOfDigits = 0;
+  while (p != end && IsDigit(*p))
+    {
+    if (numberOfDigits == maximumDigits)
+      {
+      return false;
+      }
+    value = value * 10 + (*p - '0');
+    ++numberOfDigits;
+    ++p;
+    }
+  if (numberOfDigits == 0)
+    {
+    return false;
+    }
+  if (p != end)
+    {
+    ++p;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Read exactly numberOfDigits digits from p, then skip one separator
+inline bool ReadField(const char*& p, const char* end, int numberOfDigits, int& value)
+{
+  int digits;
+  return ReadNumber(p, end, numberOfDigits, value, digits) && digits == numberOfDigits;
+}
+
+//----------------------------------------------------------------------------
+inline int GetDaysInMonth(int year, int month)
+{
+  static const int daysInMonth[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  const bool leapYear = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  return (month == 2 && leapYear) ? 29 : daysInMonth[month - 1];
+}
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeCountParser::ParseStatus
+vtkSlicerBetaProbeCountParser::Parse(const char* data, size_t length,
+                                     vtkMRMLBetaProbeNode::countingData& sample)
+{
+  if (vtkSlicerBetaProbeCountPacket::HasMagic(data, length))
+    {
+    return ParseBinary(data, length, sample);
+    }
+  return ParseCSV(data, length, sample);
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeCountParser::ParseStatus
+vtkSlicerBetaProbeCountParser::ParseBinary(const char* data, size_t length,
+                                           vtkMRMLBetaProbeNode::countingData& sample)
+{
+  vtkSlicerBetaProbeCountPacket packet;
+  if (!packet.Decode(reinterpret_cast<const unsigned char*>(data), length))
+    {
+    return InvalidPacket;
+    }
+
+  sample.Date[0]    = '\0';
+  sample.Time[0]    = '\0';
+  sample.Smoothed   = packet.Smoothed;
+  sample.BetaGamma  = packet.BetaGamma;
+  sample.Gamma      = packet.Gamma;
+  sample.Sequence   = packet.Sequence;
+  sample.DeviceTime = packet.DeviceTime;
+  return Success;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountParser::FormatDeviceTime(vtkMRMLBetaProbeNode::countingData& sample)
+{
+  const vtkTypeInt64 nanosecondsPerSecond = 1000000000;
+  time_t seconds = static_cast<time_t>(sample.DeviceTime / nanosecondsPerSecond);
+  int milliseconds = static_cast<int>((sample.DeviceTime % nanosecondsPerSecond) / 1000000);
+
+  tm local;
+#if defined(_WIN32)
+  localtime_s(&local, &seconds);
+#else
+  localtime_r(&seconds, &local);
+#endif
+
+  strftime(sample.Date, sizeof(sample.Date), "%Y-%m-%d", &local);
+  size_t length = strftime(sample.Time, sizeof(sample.Time), "%H:%M:%S", &local);
+  snprintf(sample.Time + length, sizeof(sample.Time) - length, ".%03d", milliseconds);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeCountParser::ParseDeviceTime(vtkMRMLBetaProbeNode::countingData& sample)
+{
+  return ParseDeviceTime(sample.Date, sample.Date + strlen(sample.Date),
+                         sample.Time, sample.Time + strlen(sample.Time),
+                         sample.DeviceTime);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeCountParser::ParseDeviceTime(const char* dateBegin, const char* dateEnd,
+                                                    const char* timeBegin, const char* timeEnd,
+                                                    vtkTypeInt64& deviceTime, hourCache* cache)
+{
+  int year, month, day, hours, minutes, seconds;
+  const char* p = dateBegin;
+  if (!ReadField(p, dateEnd, 4, year) ||
+      !ReadField(p, dateEnd, 2, month) ||
+      !ReadField(p, dateEnd, 2, day) || p != dateEnd)
+    {
+    return false;
+    }
+  p = timeBegin;
+  if (!ReadField(p, timeEnd, 2, hours) ||
+      !ReadField(p, timeEnd, 2, minutes) ||
+      !ReadField(p, timeEnd, 2, seconds))
+    {
+    return false;
+    }
+
+  // Fraction of second, if any
+  vtkTypeInt64 nanoseconds = 0;
+  if (p != timeEnd)
+    {
+    const char* fractionBegin = p;
+    int fraction = 0;
+    int digits = 0;
+    if (!ReadNumber(p, timeEnd, 9, fraction, digits) || fractionBegin + digits != timeEnd)
+      {
+      return false;
+      }
+    nanoseconds = fraction;
+    for (; digits < 9; ++digits)
+      {
+      nanoseconds *= 10;
+      }
+    }
+
+  // mktime() would silently normalize out of range fields
+  if (month < 1 || month > 12 || day < 1 || day > GetDaysInMonth(year, month) ||
+      hours > 23 || minutes > 59 || seconds > 59)
+    {
+    return false;
+    }
+
+  hourCache localCache;
+  if (!cache)
+    {
+    localCache.Year = -1;
+    cache = &localCache;
+    }
+  if (year != cache->Year || month != cache->Month ||
+      day != cache->Day || hours != cache->Hour)
+    {
+    tm local;
+    memset(&local, 0, sizeof(local));
+    local.tm_year = year - 1900;
+    local.tm_mon = month - 1;
+    local.tm_mday = day;
+    local.tm_hour = hours;
+    local.tm_isdst = -1;
+    time_t epochSeconds = mktime(&local);
+    if (epochSeconds == static_cast<time_t>(-1))
+      {
+      return false;
+      }
+    cache->Year = year;
+    cache->Month = month;
+    cache->Day = day;
+    cache->Hour = hours;
+    cache->Epoch = static_cast<vtkTypeInt64>(epochSeconds);
+    }
+
+  deviceTime = (cache->Epoch + minutes * 60 + seconds) * 1000000000LL + nanoseconds;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeCountParser::ParseDouble(const char* begin, const char* end,
+                                                double& value)
+{
+  // Blanks around the number are skipped, as QString::toDouble() does
+  while (begin != end && IsBlank(*begin))
+    {
+    ++begin;
+    }
+  while (end != begin && IsBlank(*(end - 1)))
+    {
+    --end;
+    }
+
+  const char* p = begin;
+  if (p == end)
+    {
+    return false;
+    }
+
+  bool negative = false;
+  if (*p == '-' || *p == '+')
+    {
+    negative = (*p == '-');
+    ++p;
+    }
+
+  // Accumulate up to 19 significant digits in an integer mantissa
+  vtkTypeUInt64 mantissa = 0;
+  int significantDigits = 0;
+  int exponent = 0;
+  bool anyDigit = false;
+
+  for (; p != end && IsDigit(*p); ++p)
+    {
+    anyDigit = true;
+    if (significantDigits < 19)
+      {
+      mantissa = mantissa * 10 + static_cast<vtkTypeUInt64>(*p - '0');
+      if (mantissa)
+        {
+        significantDigits++;
+        }
+      }
+    else
+      {
+      exponent++;
+      }
+    }
+
+  if (p != end && *p == '.')
+    {
+    ++p;
+    for (; p != end && IsDigit(*p); ++p)
+      {
+      anyDigit = true;
+      if (significantDigits < 19)
+        {
+        mantissa = mantissa * 10 + static_cast<vtkTypeUInt64>(*p - '0');
+        if (mantissa)
+          {
+          significantDigits++;
+          }
+        exponent--;
+        }
+      }
+    }
+
+  if (!anyDigit)
+    {
+    return false;
+    }
+
+  if (p != end && (*p == 'e' || *p == 'E'))
+    {
+    ++p;
+    bool negativeExponent = false;
+    if (p != end && (*p == '-' || *p == '+'))
+      {
+      negativeExponent = (*p == '-');
+      ++p;
+      }
+    if (p == end || !IsDigit(*p))
+      {
+      return false;
+      }
+    int explicitExponent = 0;
+    for (; p != end && IsDigit(*p); ++p)
+      {
+      if (explicitExponent < 10000)
+        {
+        explicitExponent = explicitExponent * 10 + (*p - '0');
+        }
+      }
+    exponent += negativeExponent ? -explicitExponent : explicitExponent;
+    }
+
+  if (p != end)
+    {
+    return false;
+    }
+
+  double result = static_cast<double>(mantissa);
+  if (exponent != 0 && mantissa != 0)
+    {
+    int absExponent = exponent < 0 ? -exponent : exponent;
+    double scale = absExponent <= 22 ?
+      PowersOfTen[absExponent] : std::pow(10.0, absExponent);
+    result = exponent < 0 ? result / scale : result * scale;
+    }
+  // Out of the range of double, as "1e400": strtod() would return HUGE_VAL
+  if (!std::isfinite(result))
+    {
+    return false;
+    }
+
+  value = negative ? -result : result;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeCountParser::ParseStatus
+vtkSlicerBetaProbeCountParser::ParseCSV(const char* data, size_t length,
+                                        vtkMRMLBetaProbeNode::countingData& sample)
+{
+  // Ignore trailing line terminators and padding
+  const char* end = data + length;
+  while (end != data && IsBlank(*(end - 1)))
+    {
+    --end;
+    }
+
+  // Locate the field separators in a single scan
+  const char* fieldBegin[NumberOfFields];
+  const char* fieldEnd[NumberOfFields];
+  int field = 0;
+  fieldBegin[0] = data;
+  for (const char* p = data; p != end; ++p)
+    {
+    if (*p == ',')
+      {
+      if (field == NumberOfFields - 1)
+        {
+        return ExtraField;
+        }
+      fieldEnd[field] = p;
+      fieldBegin[++field] = p + 1;
+      }
+    }
+  if (field != NumberOfFields - 1)
+    {
+    return MissingField;
+    }
+  fieldEnd[field] = end;
+
+  for (field = 0; field < NumberOfFields; ++field)
+    {
+    if (fieldBegin[field] == fieldEnd[field])
+      {
+      return MissingField;
+      }
+    }
+
+  if (!CopyField(fieldBegin[0], fieldEnd[0], sample.Date, sizeof(sample.Date)) ||
+      !CopyField(fieldBegin[1], fieldEnd[1], sample.Time, sizeof(sample.Time)))
+    {
+    return FieldTooLong;
+    }
+
+  if (!ParseDouble(fieldBegin[2], fieldEnd[2], sample.Smoothed) ||
+      !ParseDouble(fieldBegin[3], fieldEnd[3], sample.BetaGamma) ||
+      !ParseDouble(fieldBegin[4], fieldEnd[4], sample.Gamma))
+    {
+    return InvalidNumber;
+    }
+
+  sample.Sequence = 0;
+  sample.DeviceTime = 0;
+
+  return Success;
+}
@@ -0,0 +1,103 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeCountParser - parse count datagrams in place
+// .SECTION Description
+// Single pass parser for the "Date,Time,Smoothed,Beta+Gamma,Gamma" datagrams
+// sent by the BetaProbe device, and for the binary packets described in
+// vtkSlicerBetaProbeCountPacket. Works directly on the receive buffer and
+// writes into a caller-provided sample, so parsing never allocates.
+
+#ifndef __vtkSlicerBetaProbeCountParser_h
+#define __vtkSlicerBetaProbeCountParser_h
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// STD includes
+#include <cstddef>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeCountParser
+{
+public:
+  enum ParseStatus
+    {
+    Success = 0,
+    MissingField,
+    ExtraField,
+    FieldTooLong,
+    InvalidNumber,
+    InvalidPacket
+    };
+
+  /// Parse a datagram, detecting its format (binary or CSV).
+  static ParseStatus Parse(const char* data, size_t length,
+                           vtkMRMLBetaProbeNode::countingData& sample);
+
+  /// Parse a CSV count datagram of the given length into sample.
+  /// data does not need to be null-terminated. sample is only partially
+  /// written if the datagram is malformed.
+  static ParseStatus ParseCSV(const char* data, size_t length,
+                              vtkMRMLBetaProbeNode::countingData& sample);
+
+  /// Decode a binary count packet into sample. Date and Time are left
+  /// empty, DeviceTime and Sequence are set.
+  static ParseStatus ParseBinary(const char* data, size_t length,
+                                 vtkMRMLBetaProbeNode::countingData& sample);
+
+  /// Fill the Date ("yyyy-MM-dd") and Time ("hh:mm:ss.zzz") strings of
+  /// sample from its DeviceTime, in local time.
+  static void FormatDeviceTime(vtkMRMLBetaProbeNode::countingData& sample);
+
+  /// Compute DeviceTime from the Date ("yyyy-MM-dd") and Time
+  /// ("hh:mm:ss[.zzz]") strings of sample, read in local time. Any single
+  /// non-digit separator is accepted, the fraction of second may have 1 to
+  /// 9 digits. Return false if they cannot be read, have other numbers of
+  /// digits or trailing characters, or a field is out of range (such as
+  /// month 13, February 30 or minute 60).
+  static bool ParseDeviceTime(vtkMRMLBetaProbeNode::countingData& sample);
+
+  /// Local time of the last hour converted by ParseDeviceTime(). mktime()
+  /// serializes on the time zone, so callers parsing many times keep one
+  /// between calls to convert each hour once. Year is -1 when empty.
+  typedef struct
+  {
+    int Year;
+    int Month;
+    int Day;
+    int Hour;
+    vtkTypeInt64 Epoch;
+  }hourCache;
+
+  /// Same as ParseDeviceTime(sample), from Date and Time fields spanning
+  /// [dateBegin, dateEnd) and [timeBegin, timeEnd), which do not need to be
+  /// null-terminated, into deviceTime. cache may be NULL.
+  static bool ParseDeviceTime(const char* dateBegin, const char* dateEnd,
+                              const char* timeBegin, const char* timeEnd,
+                              vtkTypeInt64& deviceTime, hourCache* cache = NULL);
+
+  /// Parse a decimal floating point number spanning [begin, end), blanks
+  /// around it skipped. Accept an optional sign, fraction and exponent.
+  /// Return false if any other character is left unparsed, or if the
+  /// number overflows a double.
+  static bool ParseDouble(const char* begin, const char* end, double& value);
+};
+
+#endif
@@ -0,0 +1,452 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeCountReceiver.h"
+#include "vtkSlicerBetaProbeCountParser.h"
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <cstring>
+#include <vector>
+
+// Socket includes
+#if defined(_WIN32)
+# include <winsock2.h>
+# include <ws2tcpip.h>
+#else
+# include <arpa/inet.h>
+# include <netinet/in.h>
+# include <sys/socket.h>
+# include <sys/time.h>
+# include <unistd.h>
+#endif
+
+#if defined(__linux__)
+# define BETAPROBE_HAVE_RECVMMSG
+# define BETAPROBE_HAVE_SO_TIMESTAMPNS
+#endif
+
+namespace
+{
+// Largest datagram the device is expected to send
+const int DatagramBufferSize = 2048;
+
+// Receive timeout, so the thread notices Stop() requests
+const int ReceiveTimeoutMs = 100;
+
+#if defined(BETAPROBE_HAVE_SO_TIMESTAMPNS)
+// Room for one SO_TIMESTAMPNS control message
+const int ControlBufferSize = CMSG_SPACE(sizeof(timespec));
+
+//----------------------------------------------------------------------------
+// Offset converting CLOCK_REALTIME (used by kernel timestamps) to host time
+vtkTypeInt64 RealtimeToHostOffset()
+{
+  timespec realtime;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  return vtkMRMLBetaProbeNode::GetHostTime() -
+    (static_cast<vtkTypeInt64>(realtime.tv_sec) * 1000000000LL + realtime.tv_nsec);
+}
+
+//----------------------------------------------------------------------------
+// Kernel receive time of a message in host time, or 0 if not available
+vtkTypeInt64 KernelReceiveTime(msghdr* message, vtkTypeInt64 realtimeToHost)
+{
+  for (cmsghdr* control = CMSG_FIRSTHDR(message); control != NULL;
+       control = CMSG_NXTHDR(message, control))
+    {
+    if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SCM_TIMESTAMPNS)
+      {
+      timespec stamp;
+      memcpy(&stamp, CMSG_DATA(control), sizeof(stamp));
+      return static_cast<vtkTypeInt64>(stamp.tv_sec) * 1000000000LL +
+        stamp.tv_nsec + realtimeToHost;
+      }
+    }
+  return 0;
+}
+#endif
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerBetaProbeCountReceiver);
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeCountReceiver::vtkSlicerBetaProbeCountReceiver()
+  : Samples(4096)
+{
+  this->Thread = vtkMultiThreader::New();
+  this->ThreadID = -1;
+  this->StopRequested = false;
+  this->Socket = -1;
+  this->IngestMode = vtkMRMLBetaProbeNode::CountIngestSingle;
+  this->BatchSize = 32;
+  this->ReceiveBufferSize = 0;
+  this->NumberOfDatagramsReceived = 0;
+  this->NumberOfSamplesDropped = 0;
+  this->NumberOfMalformedDatagrams = 0;
+  this->NumberOfTruncatedDatagrams = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeCountReceiver::~vtkSlicerBetaProbeCountReceiver()
+{
+  this->Stop();
+  this->Thread->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountReceiver::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "Running: " << this->IsRunning() << "\n";
+  os << indent << "IngestMode: " << this->IngestMode << "\n";
+  os << indent << "BatchSize: " << this->BatchSize << "\n";
+  os << indent << "ReceiveBufferSize: " << this->ReceiveBufferSize << "\n";
+  os << indent << "NumberOfDatagramsReceived: "
+     << this->GetNumberOfDatagramsReceived() << "\n";
+  os << indent << "NumberOfSamplesDropped: "
+     << this->GetNumberOfSamplesDropped() << "\n";
+  os << indent << "NumberOfMalformedDatagrams: "
+     << this->GetNumberOfMalformedDatagrams() << "\n";
+  os << indent << "NumberOfTruncatedDatagrams: "
+     << this->GetNumberOfTruncatedDatagrams() << "\n";
+  os << indent << "NumberOfPendingSamples: "
+     << this->GetNumberOfPendingSamples() << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeCountReceiver::Start(const char* address, int port)
+{
+  if (this->IsRunning())
+    {
+    return 1;
+    }
+
+  if (!this->OpenSocket(address, port))
+    {
+    vtkErrorMacro("Start: Unable to bind counting socket to "
+                  << (address ? address : "") << ":" << port);
+    return 0;
+    }
+
+  this->StopRequested = false;
+  this->ThreadID = this->Thread->SpawnThread(
+    (vtkThreadFunctionType)&vtkSlicerBetaProbeCountReceiver::ThreadFunction, this);
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountReceiver::Stop()
+{
+  if (this->ThreadID >= 0)
+    {
+    this->StopRequested = true;
+    this->Thread->TerminateThread(this->ThreadID);
+    this->ThreadID = -1;
+    }
+  this->CloseSocket();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeCountReceiver::IsRunning() const
+{
+  return this->ThreadID >= 0;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeCountReceiver::PopSample(vtkMRMLBetaProbeNode::countingData& sample)
+{
+  return this->Samples.Pop(sample);
+}
+
+//----------------------------------------------------------------------------
+size_t vtkSlicerBetaProbeCountReceiver::GetNumberOfPendingSamples() const
+{
+  return this->Samples.GetSize();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeCountReceiver::GetNumberOfDatagramsReceived() const
+{
+  return this->NumberOfDatagramsReceived.load();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeCountReceiver::GetNumberOfSamplesDropped() const
+{
+  return this->NumberOfSamplesDropped.load();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeCountReceiver::GetNumberOfMalformedDatagrams() const
+{
+  return this->NumberOfMalformedDatagrams.load();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeCountReceiver::GetNumberOfTruncatedDatagrams() const
+{
+  return this->NumberOfTruncatedDatagrams.load();
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeCountReceiver::ThreadFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* vinfo =
+    static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeCountReceiver* receiver =
+    static_cast<vtkSlicerBetaProbeCountReceiver*>(vinfo->UserData);
+
+#if defined(BETAPROBE_HAVE_RECVMMSG)
+  if (receiver->IngestMode == vtkMRMLBetaProbeNode::CountIngestBatched)
+    {
+    receiver->ReceiveLoopBatched();
+    return NULL;
+    }
+#endif
+  receiver->ReceiveLoop();
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountReceiver::ReceiveLoop()
+{
+  char datagram[DatagramBufferSize];
+  vtkMRMLBetaProbeNode::countingData sample;
+
+#if defined(BETAPROBE_HAVE_SO_TIMESTAMPNS)
+  char control[ControlBufferSize];
+  iovec vector;
+  vector.iov_base = datagram;
+  vector.iov_len = DatagramBufferSize;
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &vector;
+  message.msg_iovlen = 1;
+#endif
+
+  while (!this->StopRequested)
+    {
+#if defined(BETAPROBE_HAVE_SO_TIMESTAMPNS)
+    message.msg_control = control;
+    message.msg_controllen = ControlBufferSize;
+    int length = static_cast<int>(recvmsg(this->Socket, &message, 0));
+#else
+    int length = recv(this->Socket, datagram, DatagramBufferSize, 0);
+#endif
+    if (length <= 0)
+      {
+      // Timeout or transient error: check stop flag and retry
+      continue;
+      }
+#if defined(BETAPROBE_HAVE_SO_TIMESTAMPNS)
+    if (message.msg_flags & MSG_TRUNC)
+      {
+      this->DropTruncatedDatagram();
+      continue;
+      }
+#endif
+
+    vtkTypeInt64 receiveTime = 0;
+#if defined(BETAPROBE_HAVE_SO_TIMESTAMPNS)
+    receiveTime = KernelReceiveTime(&message, RealtimeToHostOffset());
+#endif
+    if (receiveTime == 0)
+      {
+      receiveTime = vtkMRMLBetaProbeNode::GetHostTime();
+      }
+
+    this->ProcessDatagram(datagram, length, receiveTime, sample);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountReceiver::ReceiveLoopBatched()
+{
+#if defined(BETAPROBE_HAVE_RECVMMSG)
+  // All buffers are allocated once, before the first receive
+  const int batchSize = this->BatchSize;
+  std::vector<char> buffers(batchSize * DatagramBufferSize);
+  std::vector<char> controls(batchSize * ControlBufferSize);
+  std::vector<iovec> vectors(batchSize);
+  std::vector<mmsghdr> messages(batchSize);
+  for (int i = 0; i < batchSize; ++i)
+    {
+    vectors[i].iov_base = &buffers[i * DatagramBufferSize];
+    vectors[i].iov_len = DatagramBufferSize;
+    memset(&messages[i], 0, sizeof(mmsghdr));
+    messages[i].msg_hdr.msg_iov = &vectors[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+  vtkMRMLBetaProbeNode::countingData sample;
+
+  while (!this->StopRequested)
+    {
+    for (int i = 0; i < batchSize; ++i)
+      {
+      messages[i].msg_hdr.msg_control = &controls[i * ControlBufferSize];
+      messages[i].msg_hdr.msg_controllen = ControlBufferSize;
+      }
+
+    // Block (up to the socket timeout) for the first datagram only,
+    // then take whatever else is already queued
+    int received = recvmmsg(this->Socket, &messages[0], batchSize,
+                            MSG_WAITFORONE, NULL);
+    if (received <= 0)
+      {
+      continue;
+      }
+
+    const vtkTypeInt64 realtimeToHost = RealtimeToHostOffset();
+    const vtkTypeInt64 now = vtkMRMLBetaProbeNode::GetHostTime();
+    for (int i = 0; i < received; ++i)
+      {
+      if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+        {
+        this->DropTruncatedDatagram();
+        continue;
+        }
+      vtkTypeInt64 receiveTime =
+        KernelReceiveTime(&messages[i].msg_hdr, realtimeToHost);
+      this->ProcessDatagram(&buffers[i * DatagramBufferSize],
+                            static_cast<int>(messages[i].msg_len),
+                            receiveTime != 0 ? receiveTime : now, sample);
+      }
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountReceiver::ProcessDatagram(const char* data, int length,
+                                                      vtkTypeInt64 receiveTime,
+                                                      vtkMRMLBetaProbeNode::countingData& sample)
+{
+  this->NumberOfDatagramsReceived++;
+
+  if (vtkSlicerBetaProbeCountParser::Parse(data, length, sample) !=
+      vtkSlicerBetaProbeCountParser::Success)
+    {
+    this->NumberOfMalformedDatagrams++;
+    return;
+    }
+  sample.ReceiveTime = receiveTime;
+  sample.HostTime = 0;
+
+  if (!this->Samples.Push(sample))
+    {
+    // Consumer is a full buffer behind
+    this->NumberOfSamplesDropped++;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountReceiver::DropTruncatedDatagram()
+{
+  // The end of the datagram was discarded by the kernel: its last field
+  // could parse as another number
+  this->NumberOfDatagramsReceived++;
+  this->NumberOfTruncatedDatagrams++;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeCountReceiver::OpenSocket(const char* address, int port)
+{
+  this->CloseSocket();
+
+#if defined(_WIN32)
+  WSADATA wsaData;
+  if (WSAStartup(MAKEWORD(2,2), &wsaData) != 0)
+    {
+    return false;
+    }
+#endif
+
+  int sock = static_cast<int>(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+  if (sock < 0)
+    {
+    return false;
+    }
+
+  sockaddr_in local;
+  memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_port = htons(static_cast<unsigned short>(port));
+  local.sin_addr.s_addr = (address && *address) ? inet_addr(address) : htonl(INADDR_ANY);
+
+  if (bind(sock, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0)
+    {
+#if defined(_WIN32)
+    closesocket(sock);
+#else
+    close(sock);
+#endif
+    return false;
+    }
+
+  if (this->ReceiveBufferSize > 0)
+    {
+    int bufferSize = this->ReceiveBufferSize;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF,
+               reinterpret_cast<const char*>(&bufferSize), sizeof(bufferSize));
+    }
+
+#if defined(BETAPROBE_HAVE_SO_TIMESTAMPNS)
+  // Ask the kernel to attach the receive time to each datagram
+  int enableTimestamps = 1;
+  setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS,
+             &enableTimestamps, sizeof(enableTimestamps));
+#endif
+
+  // Wake up periodically so Stop() never waits on a silent device
+#if defined(_WIN32)
+  DWORD timeout = ReceiveTimeoutMs;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,
+             reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+#else
+  timeval timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_usec = ReceiveTimeoutMs * 1000;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+
+  this->Socket = sock;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeCountReceiver::CloseSocket()
+{
+  if (this->Socket < 0)
+    {
+    return;
+    }
+
+#if defined(_WIN32)
+  closesocket(this->Socket);
+  WSACleanup();
+#else
+  close(this->Socket);
+#endif
+  this->Socket = -1;
+}
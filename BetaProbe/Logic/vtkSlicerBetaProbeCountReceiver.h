@@ -0,0 +1,131 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeCountReceiver - headless UDP receiver for probe counts
+// .SECTION Description
+// Owns the UDP socket the BetaProbe device sends its counts to and drains it
+// from a dedicated thread, so datagrams keep being read while the main thread
+// is busy rendering or building maps. Parsed samples are queued in a lock-free
+// ring buffer and consumed from the main thread with PopSample().
+// CSV and binary datagrams are told apart per datagram, so both can be
+// received on the same port. Each sample is stamped with its receive time on
+// the host clock, taken from the kernel (SO_TIMESTAMPNS) on Linux.
+
+#ifndef __vtkSlicerBetaProbeCountReceiver_h
+#define __vtkSlicerBetaProbeCountReceiver_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeRingBuffer.h"
+
+// STD includes
+#include <atomic>
+#include <string>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+class vtkMultiThreader;
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeCountReceiver :
+  public vtkObject
+{
+public:
+  static vtkSlicerBetaProbeCountReceiver *New();
+  vtkTypeMacro(vtkSlicerBetaProbeCountReceiver, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Ingest mode, one of vtkMRMLBetaProbeNode::CountIngest*. Batched mode
+  /// is only available on Linux and falls back to single reads elsewhere.
+  /// Settings are applied on the next Start().
+  vtkSetMacro(IngestMode, int);
+  vtkGetMacro(IngestMode, int);
+
+  /// Maximum number of datagrams read per call in batched mode
+  vtkSetClampMacro(BatchSize, int, 1, 1024);
+  vtkGetMacro(BatchSize, int);
+
+  /// Socket receive buffer size in bytes, 0 to keep the system default
+  vtkSetMacro(ReceiveBufferSize, int);
+  vtkGetMacro(ReceiveBufferSize, int);
+
+  /// Bind the socket to address:port and start the receiving thread.
+  /// Return 1 on success, 0 if the socket could not be bound.
+  int Start(const char* address, int port);
+
+  /// Stop the receiving thread and close the socket.
+  void Stop();
+
+  bool IsRunning() const;
+
+  /// Pop the oldest parsed sample. Must only be called from one thread
+  /// (usually the main thread). Return false if no sample is pending.
+  bool PopSample(vtkMRMLBetaProbeNode::countingData& sample);
+
+  /// Number of samples waiting to be consumed
+  size_t GetNumberOfPendingSamples() const;
+
+  /// Statistics, updated by the receiving thread
+  vtkTypeUInt64 GetNumberOfDatagramsReceived() const;
+  vtkTypeUInt64 GetNumberOfSamplesDropped() const;
+  vtkTypeUInt64 GetNumberOfMalformedDatagrams() const;
+
+  /// Datagrams longer than the receive buffer, dropped unparsed. Counted
+  /// on Linux only: elsewhere the socket reports them as receive errors.
+  vtkTypeUInt64 GetNumberOfTruncatedDatagrams() const;
+
+protected:
+  vtkSlicerBetaProbeCountReceiver();
+  virtual ~vtkSlicerBetaProbeCountReceiver();
+
+  static void* ThreadFunction(void* ptr);
+  void ReceiveLoop();
+  void ReceiveLoopBatched();
+  void ProcessDatagram(const char* data, int length, vtkTypeInt64 receiveTime,
+                       vtkMRMLBetaProbeNode::countingData& sample);
+  void DropTruncatedDatagram();
+
+  bool OpenSocket(const char* address, int port);
+  void CloseSocket();
+
+  vtkMultiThreader* Thread;
+  int ThreadID;
+  std::atomic<bool> StopRequested;
+
+  int Socket;
+  int IngestMode;
+  int BatchSize;
+  int ReceiveBufferSize;
+
+  vtkSlicerBetaProbeRingBuffer<vtkMRMLBetaProbeNode::countingData> Samples;
+
+  std::atomic<vtkTypeUInt64> NumberOfDatagramsReceived;
+  std::atomic<vtkTypeUInt64> NumberOfSamplesDropped;
+  std::atomic<vtkTypeUInt64> NumberOfMalformedDatagrams;
+  std::atomic<vtkTypeUInt64> NumberOfTruncatedDatagrams;
+
+private:
+  vtkSlicerBetaProbeCountReceiver(const vtkSlicerBetaProbeCountReceiver&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeCountReceiver&);                   // Not implemented
+};
+
+#endif
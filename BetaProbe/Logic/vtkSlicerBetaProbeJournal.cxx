@@ -0,0 +1,550 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeJournal.h"
+#include "vtkSlicerBetaProbeCountPacket.h"
+#include "vtkSlicerBetaProbeCountParser.h"
+#include "vtkSlicerBetaProbeLogFormat.h"
+
+// MRML includes
+#include "vtkMRMLBetaProbeSessionChunk.h"
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+# include <io.h>
+# include <windows.h>
+#else
+# include <sys/file.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace
+{
+// Wait between two looks at an empty queue, in milliseconds
+const int WaitInterval = 5;
+
+//----------------------------------------------------------------------------
+// CRC-32 (IEEE 802.3, as zlib)
+struct crcTable
+{
+  vtkTypeUInt32 Values[256];
+
+  crcTable()
+  {
+    for (vtkTypeUInt32 i = 0; i < 256; ++i)
+      {
+      vtkTypeUInt32 c = i;
+      for (int k = 0; k < 8; ++k)
+        {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+      this->Values[i] = c;
+      }
+  }
+};
+
+//----------------------------------------------------------------------------
+vtkTypeUInt32 Crc32(const unsigned char* data, size_t length)
+{
+  static const crcTable table;
+
+  vtkTypeUInt32 crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < length; ++i)
+    {
+    crc = table.Values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+//----------------------------------------------------------------------------
+// Lock the whole file without waiting. The lock is released when the file
+// is closed, by Close() or by the system if the process dies.
+bool TryLockJournal(FILE* file)
+{
+#if defined(_WIN32)
+  HANDLE handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+  OVERLAPPED overlapped;
+  memset(&overlapped, 0, sizeof(overlapped));
+  return LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY,
+                    0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+#else
+  return flock(fileno(file), LOCK_EX | LOCK_NB) == 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Whether the locked file was removed meanwhile, by the session that
+// recovered it or by the one that closed it
+bool IsJournalRemoved(FILE* file)
+{
+#if defined(_WIN32)
+  // Open files cannot be removed
+  (void)file;
+  return false;
+#else
+  struct stat status;
+  return fstat(fileno(file), &status) != 0 || status.st_nlink == 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Remove the journal fileName, open as file, and release its lock. It is
+// removed while still locked where open files can be.
+void RemoveJournal(FILE* file, const char* fileName)
+{
+#if defined(_WIN32)
+  fclose(file);
+  remove(fileName);
+#else
+  remove(fileName);
+  fclose(file);
+#endif
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerBetaProbeJournal);
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeJournal::vtkSlicerBetaProbeJournal()
+  : Samples(8192)
+{
+  this->Thread = vtkMultiThreader::New();
+  this->ThreadID = -1;
+  this->StopRequested = false;
+  this->File = NULL;
+  this->CommitInterval = 0.5;
+  this->CommitRecords = 256;
+  this->NumberOfSamplesCommitted = 0;
+  this->NumberOfSamplesDropped = 0;
+  this->WriteFailed = false;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeJournal::~vtkSlicerBetaProbeJournal()
+{
+  this->Close();
+  // Left for the next session, whose data they still are
+  for (size_t i = 0; i < this->RecoveredJournals.size(); ++i)
+    {
+    fclose(this->RecoveredJournals[i].second);
+    }
+  this->Thread->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeJournal::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "FileName: " << this->FileName << "\n";
+  os << indent << "CommitInterval: " << this->CommitInterval << "\n";
+  os << indent << "CommitRecords: " << this->CommitRecords << "\n";
+  os << indent << "NumberOfPendingSamples: "
+     << this->GetNumberOfPendingSamples() << "\n";
+  os << indent << "NumberOfSamplesCommitted: "
+     << this->GetNumberOfSamplesCommitted() << "\n";
+  os << indent << "NumberOfSamplesDropped: "
+     << this->GetNumberOfSamplesDropped() << "\n";
+  os << indent << "WriteFailed: " << this->GetWriteFailed() << "\n";
+  os << indent << "NumberOfRecoveredJournals: "
+     << this->GetNumberOfRecoveredJournals() << "\n";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeJournal::Open(const char* fileName)
+{
+  this->Close();
+
+  if (!fileName || !*fileName)
+    {
+    return false;
+    }
+
+  this->File = fopen(fileName, "wb");
+  if (!this->File)
+    {
+    vtkErrorMacro("Open: Unable to create " << fileName);
+    return false;
+    }
+  if (!TryLockJournal(this->File))
+    {
+    vtkErrorMacro("Open: Unable to lock " << fileName);
+    fclose(this->File);
+    this->File = NULL;
+    return false;
+    }
+  this->FileName = fileName;
+
+  unsigned char header[HeaderSize];
+  header[0] = 'B';
+  header[1] = 'P';
+  header[2] = 'J';
+  header[3] = 'N';
+  header[4] = static_cast<unsigned char>(CurrentVersion);
+  header[5] = static_cast<unsigned char>(CurrentVersion >> 8);
+  header[6] = static_cast<unsigned char>(RecordSize);
+  header[7] = static_cast<unsigned char>(RecordSize >> 8);
+  vtkSlicerBetaProbeCountPacket::WriteUInt64(
+    header + 8, static_cast<vtkTypeUInt64>(vtkSlicerBetaProbeLogFormat::GetWallTime()));
+  if (fwrite(header, 1, sizeof(header), this->File) != sizeof(header))
+    {
+    vtkErrorMacro("Open: Unable to write " << fileName);
+    fclose(this->File);
+    this->File = NULL;
+    remove(fileName);
+    return false;
+    }
+
+  this->NumberOfSamplesCommitted = 0;
+  this->NumberOfSamplesDropped = 0;
+  this->WriteFailed = false;
+
+  this->StopRequested = false;
+  this->ThreadID = this->Thread->SpawnThread(
+    (vtkThreadFunctionType)&vtkSlicerBetaProbeJournal::ThreadFunction, this);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeJournal::Close()
+{
+  if (this->ThreadID >= 0)
+    {
+    // The thread commits the pending samples before exiting
+    this->StopRequested = true;
+    this->Thread->TerminateThread(this->ThreadID);
+    this->ThreadID = -1;
+    }
+  if (this->File)
+    {
+    // Finished journals are not kept
+    RemoveJournal(this->File, this->FileName.c_str());
+    this->File = NULL;
+    }
+  this->FileName.clear();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeJournal::IsOpen() const
+{
+  return this->File != NULL;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeJournal::WriteSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                                            const vtkMRMLBetaProbeNode::countingData& counts)
+{
+  if (!this->IsOpen())
+    {
+    return false;
+    }
+
+  journalSample sample;
+  sample.Position = position;
+  sample.Counts = counts;
+  if (!this->Samples.Push(sample))
+    {
+    this->NumberOfSamplesDropped++;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+size_t vtkSlicerBetaProbeJournal::GetNumberOfPendingSamples() const
+{
+  return this->Samples.GetSize();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeJournal::GetNumberOfSamplesCommitted() const
+{
+  return this->NumberOfSamplesCommitted.load();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeJournal::GetNumberOfSamplesDropped() const
+{
+  return this->NumberOfSamplesDropped.load();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeJournal::GetWriteFailed() const
+{
+  return this->WriteFailed.load();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeJournal::EncodeSample(const journalSample& sample, unsigned char* buffer)
+{
+  const vtkMRMLBetaProbeNode::trackingData& position = sample.Position;
+  const vtkMRMLBetaProbeNode::countingData& counts = sample.Counts;
+
+  vtkTypeUInt32 flags = 0;
+  flags |= counts.DeviceTime != 0 ? vtkMRMLBetaProbeSessionChunk::HasDeviceTime : 0;
+  flags |= counts.HostTime != 0 ? vtkMRMLBetaProbeSessionChunk::HasHostTime : 0;
+
+  vtkSlicerBetaProbeCountPacket::WriteDouble(buffer, position.X);
+  vtkSlicerBetaProbeCountPacket::WriteDouble(buffer + 8, position.Y);
+  vtkSlicerBetaProbeCountPacket::WriteDouble(buffer + 16, position.Z);
+  for (int c = 0; c < 4; ++c)
+    {
+    vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 24 + 4 * c, position.Orientation[c]);
+    }
+  vtkSlicerBetaProbeCountPacket::WriteUInt64(
+    buffer + 40, static_cast<vtkTypeUInt64>(vtkSlicerBetaProbeLogFormat::GetSampleTime(counts)));
+  vtkSlicerBetaProbeCountPacket::WriteUInt64(
+    buffer + 48, static_cast<vtkTypeUInt64>(counts.DeviceTime));
+  vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 56, counts.Smoothed);
+  vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 60, counts.BetaGamma);
+  vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 64, counts.Gamma);
+  vtkSlicerBetaProbeCountPacket::WriteUInt32(buffer + 68, counts.Sequence);
+  vtkSlicerBetaProbeCountPacket::WriteUInt32(buffer + 72, flags);
+  vtkSlicerBetaProbeCountPacket::WriteUInt32(buffer + 76, 0);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeJournal::DecodeSample(const unsigned char* buffer, journalSample& sample)
+{
+  vtkMRMLBetaProbeNode::trackingData& position = sample.Position;
+  vtkMRMLBetaProbeNode::countingData& counts = sample.Counts;
+
+  const vtkTypeInt64 timestamp =
+    static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 40));
+  const vtkTypeUInt32 flags = vtkSlicerBetaProbeCountPacket::ReadUInt32(buffer + 72);
+
+  position.X = vtkSlicerBetaProbeCountPacket::ReadDouble(buffer);
+  position.Y = vtkSlicerBetaProbeCountPacket::ReadDouble(buffer + 8);
+  position.Z = vtkSlicerBetaProbeCountPacket::ReadDouble(buffer + 16);
+  for (int c = 0; c < 4; ++c)
+    {
+    position.Orientation[c] = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 24 + 4 * c);
+    }
+  position.ReceiveTime = timestamp;
+
+  counts.DeviceTime =
+    static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 48));
+  counts.ReceiveTime = timestamp;
+  counts.HostTime = (flags & vtkMRMLBetaProbeSessionChunk::HasHostTime) ? timestamp : 0;
+  counts.Smoothed = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 56);
+  counts.BetaGamma = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 60);
+  counts.Gamma = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 64);
+  counts.Sequence = vtkSlicerBetaProbeCountPacket::ReadUInt32(buffer + 68);
+  counts.Date[0] = '\0';
+  counts.Time[0] = '\0';
+  if (flags & vtkMRMLBetaProbeSessionChunk::HasDeviceTime)
+    {
+    vtkSlicerBetaProbeCountParser::FormatDeviceTime(counts);
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerBetaProbeJournal::Recover(const char* fileName, vtkMRMLBetaProbeNode* node)
+{
+  if (!fileName || !node)
+    {
+    return -1;
+    }
+
+  FILE* file = fopen(fileName, "rb");
+  if (!file)
+    {
+    return -1;
+    }
+
+  // Journals of running sessions stay locked by their writer, recovered
+  // ones by the session that recovered them
+  if (!TryLockJournal(file) || IsJournalRemoved(file))
+    {
+    fclose(file);
+    return -1;
+    }
+
+  unsigned char header[HeaderSize];
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+      header[0] != 'B' || header[1] != 'P' || header[2] != 'J' || header[3] != 'N' ||
+      (header[4] | (header[5] << 8)) != CurrentVersion ||
+      (header[6] | (header[7] << 8)) != RecordSize)
+    {
+    fclose(file);
+    return -1;
+    }
+
+  // Replay the batches up to the first one that was not fully written
+  vtkIdType numberOfSamples = 0;
+  unsigned char batchHeader[BatchHeaderSize];
+  std::vector<unsigned char> records;
+  journalSample sample;
+  while (fread(batchHeader, 1, sizeof(batchHeader), file) == sizeof(batchHeader))
+    {
+    const vtkTypeUInt32 count = vtkSlicerBetaProbeCountPacket::ReadUInt32(batchHeader + 4);
+    const vtkTypeUInt32 checksum = vtkSlicerBetaProbeCountPacket::ReadUInt32(batchHeader + 8);
+    if (batchHeader[0] != 'B' || batchHeader[1] != 'T' ||
+        batchHeader[2] != 'C' || batchHeader[3] != 'H' ||
+        count == 0 || count > MaximumBatchSize)
+      {
+      break;
+      }
+
+    const size_t size = static_cast<size_t>(count) * RecordSize;
+    records.resize(size);
+    if (fread(&records[0], 1, size, file) != size ||
+        Crc32(&records[0], size) != checksum)
+      {
+      break;
+      }
+
+    for (vtkTypeUInt32 i = 0; i < count; ++i)
+      {
+      DecodeSample(&records[i * RecordSize], sample);
+      node->RecordMappingData(sample.Position, sample.Counts);
+      }
+    numberOfSamples += count;
+    }
+
+  this->RecoveredJournals.push_back(std::make_pair(std::string(fileName), file));
+  return numberOfSamples;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeJournal::GetNumberOfRecoveredJournals() const
+{
+  return static_cast<int>(this->RecoveredJournals.size());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeJournal::RemoveRecoveredJournals()
+{
+  for (size_t i = 0; i < this->RecoveredJournals.size(); ++i)
+    {
+    RemoveJournal(this->RecoveredJournals[i].second,
+                  this->RecoveredJournals[i].first.c_str());
+    }
+  this->RecoveredJournals.clear();
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeJournal::ThreadFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* vinfo =
+    static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeJournal* journal =
+    static_cast<vtkSlicerBetaProbeJournal*>(vinfo->UserData);
+
+  journal->WriteLoop();
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeJournal::WriteLoop()
+{
+  typedef std::chrono::steady_clock clock;
+
+  const vtkTypeUInt32 commitRecords = static_cast<vtkTypeUInt32>(this->CommitRecords);
+  const clock::duration commitInterval =
+    std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(this->CommitInterval));
+
+  // Batch header, filled on commit, followed by the records
+  std::string batch(BatchHeaderSize, '\0');
+  batch.reserve(BatchHeaderSize + static_cast<size_t>(commitRecords) * RecordSize);
+  vtkTypeUInt32 numberOfSamples = 0;
+  clock::time_point batchStart = clock::now();
+
+  journalSample sample;
+  unsigned char record[RecordSize];
+
+  while (true)
+    {
+    // Read before draining, so the samples queued before Close() are committed
+    const bool stopping = this->StopRequested;
+
+    bool popped = false;
+    while (numberOfSamples < commitRecords && this->Samples.Pop(sample))
+      {
+      if (numberOfSamples == 0)
+        {
+        batchStart = clock::now();
+        }
+      EncodeSample(sample, record);
+      batch.append(reinterpret_cast<char*>(record), sizeof(record));
+      numberOfSamples++;
+      popped = true;
+      }
+
+    if (numberOfSamples > 0 &&
+        (numberOfSamples >= commitRecords || stopping ||
+         clock::now() - batchStart >= commitInterval))
+      {
+      this->CommitBatch(batch, numberOfSamples);
+      batch.resize(BatchHeaderSize);
+      numberOfSamples = 0;
+      }
+
+    if (!popped)
+      {
+      if (stopping && numberOfSamples == 0)
+        {
+        break;
+        }
+      std::this_thread::sleep_for(std::chrono::milliseconds(WaitInterval));
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeJournal::CommitBatch(std::string& batch, vtkTypeUInt32 numberOfSamples)
+{
+  unsigned char* header = reinterpret_cast<unsigned char*>(&batch[0]);
+  header[0] = 'B';
+  header[1] = 'T';
+  header[2] = 'C';
+  header[3] = 'H';
+  vtkSlicerBetaProbeCountPacket::WriteUInt32(header + 4, numberOfSamples);
+  vtkSlicerBetaProbeCountPacket::WriteUInt32(
+    header + 8, Crc32(header + BatchHeaderSize, batch.size() - BatchHeaderSize));
+  vtkSlicerBetaProbeCountPacket::WriteUInt32(header + 12, 0);
+
+  // One write and one sync per batch
+  if (fwrite(batch.data(), 1, batch.size(), this->File) != batch.size() ||
+      fflush(this->File) != 0)
+    {
+    this->WriteFailed = true;
+    return;
+    }
+#if defined(_WIN32)
+  _commit(_fileno(this->File));
+#elif defined(__APPLE__)
+  fsync(fileno(this->File));
+#else
+  fdatasync(fileno(this->File));
+#endif
+  this->NumberOfSamplesCommitted += numberOfSamples;
+}
@@ -0,0 +1,164 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkSlicerBetaProbeJournal - write-ahead journal of recorded samples
+// .SECTION Description
+// Keeps a copy of the recorded samples on disk, so a session survives a
+// crash. Samples are queued by the main thread in a lock-free ring buffer;
+// a dedicated thread groups them in batches, each written with a checksum
+// and synced to disk in one call once it holds CommitRecords samples or is
+// CommitInterval old. A crash loses at most the batch being filled.
+//
+// Journals are removed by Close(): a journal left on disk is unfinished,
+// and Recover() reads back its complete batches. An open journal is locked
+// until Close() or the end of its process, so Recover() skips the
+// journals of the sessions still running. A recovered journal stays
+// locked as well, until RemoveRecoveredJournals() or the end of the
+// process, so it is recovered by one session only.
+//
+// File layout, little-endian:
+//   header: magic "BPJN", version (2 bytes), record size (2 bytes),
+//           creation time (8 bytes, nanoseconds since 1970-01-01 UTC)
+//   batches: magic "BTCH", number of records (4 bytes), CRC-32 of the
+//            records (4 bytes), reserved (4 bytes), then the records
+//   record: X, Y, Z (double), orientation w, x, y, z (float), timestamp
+//           and device time (8 bytes each), smoothed, beta+gamma, gamma
+//           (float), sequence and flags (4 bytes each), reserved (4 bytes)
+
+#ifndef __vtkSlicerBetaProbeJournal_h
+#define __vtkSlicerBetaProbeJournal_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeRingBuffer.h"
+
+// STD includes
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+class vtkMultiThreader;
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeJournal :
+  public vtkObject
+{
+public:
+  static vtkSlicerBetaProbeJournal *New();
+  vtkTypeMacro(vtkSlicerBetaProbeJournal, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  enum
+  {
+    HeaderSize = 16,
+    BatchHeaderSize = 16,
+    RecordSize = 80,
+    CurrentVersion = 1,
+    MaximumBatchSize = 65536
+  };
+
+  /// Group commit policy, applied on the next Open(): a batch is written
+  /// and synced once it holds CommitRecords samples, or CommitInterval
+  /// seconds after its first sample.
+  vtkSetClampMacro(CommitInterval, double, 0.0, 60.0);
+  vtkGetMacro(CommitInterval, double);
+  vtkSetClampMacro(CommitRecords, int, 1, MaximumBatchSize);
+  vtkGetMacro(CommitRecords, int);
+
+  /// Create and lock the journal fileName and start the writing thread.
+  /// Return false if the file could not be created.
+  bool Open(const char* fileName);
+
+  /// Commit the pending samples, stop the thread and remove the journal.
+  void Close();
+
+  bool IsOpen() const;
+
+  /// Queue a sample. Must only be called from one thread.
+  /// Return false if the sample was dropped.
+  bool WriteSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                   const vtkMRMLBetaProbeNode::countingData& counts);
+
+  /// Statistics since Open()
+  size_t GetNumberOfPendingSamples() const;
+  vtkTypeUInt64 GetNumberOfSamplesCommitted() const;
+  vtkTypeUInt64 GetNumberOfSamplesDropped() const;
+  bool GetWriteFailed() const;
+
+  /// Record the samples of every complete batch of the journal fileName
+  /// in node, in order. Reading stops at the first incomplete or corrupted
+  /// batch. The journal is kept on disk and locked, until
+  /// RemoveRecoveredJournals(), or released as is on destruction.
+  /// Return the number of samples recovered, or -1 if fileName is not a
+  /// journal or is locked by a running session or by another recovery.
+  vtkIdType Recover(const char* fileName, vtkMRMLBetaProbeNode* node);
+
+  /// Remove the journals recovered so far, once their samples are safe
+  int GetNumberOfRecoveredJournals() const;
+  void RemoveRecoveredJournals();
+
+protected:
+  vtkSlicerBetaProbeJournal();
+  virtual ~vtkSlicerBetaProbeJournal();
+
+  typedef struct
+  {
+    vtkMRMLBetaProbeNode::trackingData Position;
+    vtkMRMLBetaProbeNode::countingData Counts;
+  }journalSample;
+
+  static void EncodeSample(const journalSample& sample, unsigned char* buffer);
+  static void DecodeSample(const unsigned char* buffer, journalSample& sample);
+
+  static void* ThreadFunction(void* ptr);
+  void WriteLoop();
+  void CommitBatch(std::string& batch, vtkTypeUInt32 numberOfSamples);
+
+  vtkMultiThreader* Thread;
+  int ThreadID;
+  std::atomic<bool> StopRequested;
+
+  FILE* File;
+  std::string FileName;
+  double CommitInterval;
+  int CommitRecords;
+
+  vtkSlicerBetaProbeRingBuffer<journalSample> Samples;
+
+  // Recovered journals, open to keep them locked
+  std::vector<std::pair<std::string, FILE*> > RecoveredJournals;
+
+  std::atomic<vtkTypeUInt64> NumberOfSamplesCommitted;
+  std::atomic<vtkTypeUInt64> NumberOfSamplesDropped;
+  std::atomic<bool> WriteFailed;
+
+private:
+  vtkSlicerBetaProbeJournal(const vtkSlicerBetaProbeJournal&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeJournal&);             // Not implemented
+};
+
+#endif
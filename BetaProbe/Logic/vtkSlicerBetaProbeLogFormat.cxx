@@ -0,0 +1,292 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeLogFormat.h"
+#include "vtkSlicerBetaProbeCountPacket.h"
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace
+{
+const char* SeparatorLine =
+  "-------------------------------------------------------------------------------------------------------------------------------------------------------------";
+
+//----------------------------------------------------------------------------
+void WriteUInt16(unsigned char* p, vtkTypeUInt16 v)
+{
+  p[0] = static_cast<unsigned char>(v);
+  p[1] = static_cast<unsigned char>(v >> 8);
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt16 ReadUInt16(const unsigned char* p)
+{
+  return static_cast<vtkTypeUInt16>(p[0] | (p[1] << 8));
+}
+
+//----------------------------------------------------------------------------
+tm LocalTime(vtkTypeInt64 wallTime)
+{
+  time_t seconds = static_cast<time_t>(wallTime / 1000000000LL);
+  tm local;
+#if defined(_WIN32)
+  localtime_s(&local, &seconds);
+#else
+  localtime_r(&seconds, &local);
+#endif
+  return local;
+}
+
+//----------------------------------------------------------------------------
+// "hh:mm:ss", as QTime::toString()
+void AppendClockTime(vtkTypeInt64 wallTime, std::string& text)
+{
+  tm local = LocalTime(wallTime);
+  char buffer[16];
+  strftime(buffer, sizeof(buffer), "%H:%M:%S", &local);
+  text += buffer;
+}
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeLogFormat::GetWallTime()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeLogFormat::GetSampleTime(const vtkMRMLBetaProbeNode::countingData& counts)
+{
+  return counts.HostTime != 0 ? counts.HostTime : counts.ReceiveTime;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogFormat::FormatHeaderText(vtkTypeInt64 creationTime, std::string& text)
+{
+  // Creation date as QDateTime::toString(): "ddd MMM d hh:mm:ss yyyy"
+  tm local = LocalTime(creationTime);
+  char date[64];
+  size_t length = strftime(date, sizeof(date), "%a %b ", &local);
+  length += snprintf(date + length, sizeof(date) - length, "%d ", local.tm_mday);
+  strftime(date + length, sizeof(date) - length, "%H:%M:%S %Y", &local);
+
+  text += "File recorded from BetaProbe Module \n";
+  text += "Creation date: ";
+  text += date;
+  text += '\n';
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogFormat::FormatRecordText(const logRecord& record, std::string& text)
+{
+  switch (record.Type)
+    {
+    case SampleRecord:
+      {
+      // Same notation as the default stream formatting
+      char line[2 * vtkMRMLBetaProbeNode::DateTimeStringSize + 256];
+      int length = snprintf(line, sizeof(line), "%s,%s,%g,%g,%g,%g,%g,%g%s\n",
+                            record.Counts.Date, record.Counts.Time,
+                            record.Counts.Smoothed, record.Counts.BetaGamma,
+                            record.Counts.Gamma,
+                            record.Position.X, record.Position.Y, record.Position.Z,
+                            record.Flagged ? ",Flagged" : "");
+      if (length > 0)
+        {
+        text.append(line, std::min<size_t>(length, sizeof(line) - 1));
+        }
+      }
+      break;
+
+    case BlockBeginRecord:
+      text += '\n';
+      if (record.BlockKind == SingleShotBlock)
+        {
+        text += "Single shots data\n";
+        text += SeparatorLine;
+        text += "\nDate,Time,Smoothed,Beta+Gamma,Gamma,X,Y,Z\n";
+        }
+      else
+        {
+        text += "Start recording at: ";
+        AppendClockTime(record.WallTime, text);
+        text += '\n';
+        text += SeparatorLine;
+        text += "\nDate,Time,Smoothed,Beta+Gamma,Gamma,X,Y,Z,Flag\n";
+        }
+      text += SeparatorLine;
+      text += '\n';
+      break;
+
+    case BlockEndRecord:
+      text += SeparatorLine;
+      if (record.BlockKind == SingleShotBlock)
+        {
+        text += "\nEnd of single shots\n";
+        }
+      else
+        {
+        text += "\nEnd recording at: ";
+        AppendClockTime(record.WallTime, text);
+        text += '\n';
+        }
+      text += '\n';
+      break;
+
+    default:
+      break;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogFormat::EncodeHeader(vtkTypeInt64 creationTime,
+                                               vtkTypeInt64 hostToWallOffset,
+                                               unsigned char* buffer)
+{
+  memset(buffer, 0, HeaderSize);
+  buffer[0] = 'B';
+  buffer[1] = 'P';
+  buffer[2] = 'L';
+  buffer[3] = 'G';
+  WriteUInt16(buffer + 4, CurrentVersion);
+  WriteUInt16(buffer + 6, RecordSize);
+  vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 8, static_cast<vtkTypeUInt64>(creationTime));
+  vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 16, static_cast<vtkTypeUInt64>(hostToWallOffset));
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogFormat::DecodeHeader(const unsigned char* buffer,
+                                               vtkTypeInt64& creationTime,
+                                               vtkTypeInt64& hostToWallOffset)
+{
+  if (buffer[0] != 'B' || buffer[1] != 'P' || buffer[2] != 'L' || buffer[3] != 'G' ||
+      ReadUInt16(buffer + 4) != CurrentVersion ||
+      ReadUInt16(buffer + 6) != RecordSize)
+    {
+    return false;
+    }
+  creationTime = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 8));
+  hostToWallOffset = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 16));
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogFormat::EncodeRecord(const logRecord& record, unsigned char* buffer)
+{
+  memset(buffer, 0, RecordSize);
+  buffer[0] = static_cast<unsigned char>(record.Type);
+
+  if (record.Type == SampleRecord)
+    {
+    const vtkMRMLBetaProbeNode::countingData& counts = record.Counts;
+    unsigned char flags = 0;
+    flags |= record.Flagged ? Flagged : 0;
+    flags |= counts.DeviceTime != 0 ? HasDeviceTime : 0;
+    flags |= counts.HostTime != 0 ? HasHostTime : 0;
+    buffer[1] = flags;
+    vtkSlicerBetaProbeCountPacket::WriteUInt32(buffer + 4, counts.Sequence);
+    vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 8, static_cast<vtkTypeUInt64>(GetSampleTime(counts)));
+    vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 16, static_cast<vtkTypeUInt64>(counts.DeviceTime));
+    vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 24, counts.Smoothed);
+    vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 28, counts.BetaGamma);
+    vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 32, counts.Gamma);
+    vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 36, record.Position.X);
+    vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 40, record.Position.Y);
+    vtkSlicerBetaProbeCountPacket::WriteFloat(buffer + 44, record.Position.Z);
+    return;
+    }
+
+  buffer[1] = static_cast<unsigned char>(record.BlockKind);
+  vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 8, static_cast<vtkTypeUInt64>(record.HostTime));
+  vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 16, static_cast<vtkTypeUInt64>(record.WallTime));
+  if (record.Type == BlockEndRecord)
+    {
+    vtkSlicerBetaProbeCountPacket::WriteUInt32(buffer + 4, record.NumberOfSamples);
+    vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 24, record.BeginIndex);
+    vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 32, static_cast<vtkTypeUInt64>(record.FirstTime));
+    vtkSlicerBetaProbeCountPacket::WriteUInt64(buffer + 40, static_cast<vtkTypeUInt64>(record.LastTime));
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogFormat::DecodeRecord(const unsigned char* buffer, logRecord& record)
+{
+  record.Type = buffer[0];
+  record.BlockKind = 0;
+  record.Flagged = false;
+  record.HostTime = 0;
+  record.WallTime = 0;
+  record.NumberOfSamples = 0;
+  record.BeginIndex = 0;
+  record.FirstTime = 0;
+  record.LastTime = 0;
+
+  if (record.Type == SampleRecord)
+    {
+    const unsigned char flags = buffer[1];
+    vtkMRMLBetaProbeNode::countingData& counts = record.Counts;
+    vtkMRMLBetaProbeNode::trackingData& position = record.Position;
+    const vtkTypeInt64 timestamp = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 8));
+
+    record.Flagged = (flags & Flagged) != 0;
+    counts.Sequence = vtkSlicerBetaProbeCountPacket::ReadUInt32(buffer + 4);
+    counts.ReceiveTime = timestamp;
+    counts.HostTime = (flags & HasHostTime) ? timestamp : 0;
+    counts.DeviceTime = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 16));
+    counts.Smoothed = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 24);
+    counts.BetaGamma = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 28);
+    counts.Gamma = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 32);
+    counts.Date[0] = '\0';
+    counts.Time[0] = '\0';
+
+    position.X = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 36);
+    position.Y = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 40);
+    position.Z = vtkSlicerBetaProbeCountPacket::ReadFloat(buffer + 44);
+    position.Orientation[0] = 1.0;
+    position.Orientation[1] = 0.0;
+    position.Orientation[2] = 0.0;
+    position.Orientation[3] = 0.0;
+    position.ReceiveTime = timestamp;
+    record.HostTime = timestamp;
+    return true;
+    }
+
+  if (record.Type != BlockBeginRecord && record.Type != BlockEndRecord)
+    {
+    return false;
+    }
+
+  record.BlockKind = buffer[1];
+  record.HostTime = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 8));
+  record.WallTime = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 16));
+  if (record.Type == BlockEndRecord)
+    {
+    record.NumberOfSamples = vtkSlicerBetaProbeCountPacket::ReadUInt32(buffer + 4);
+    record.BeginIndex = vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 24);
+    record.FirstTime = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 32));
+    record.LastTime = static_cast<vtkTypeInt64>(vtkSlicerBetaProbeCountPacket::ReadUInt64(buffer + 40));
+    }
+  return true;
+}
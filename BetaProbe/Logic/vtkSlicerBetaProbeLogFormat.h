@@ -0,0 +1,157 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkSlicerBetaProbeLogFormat - recording log layouts
+// .SECTION Description
+// The recording log is written either as the historical CSV text, or as a
+// compact binary file. Both hold the same records: samples, and markers
+// delimiting the single shot and continuous recording blocks.
+//
+// Binary files start with a header followed by fixed-size records, so
+// record i is at HeaderSize + i * RecordSize. All fields are little-endian.
+//
+// Header:
+//   offset  size  field
+//        0     4  magic "BPLG"
+//        4     2  version (1)
+//        6     2  record size (48)
+//        8     8  creation time, nanoseconds since 1970-01-01 UTC
+//       16     8  wall time minus host time, nanoseconds: adding it to the
+//                 host timestamps of the records gives wall clock times
+//       24    40  reserved (0)
+//
+// Sample record:
+//        0     1  type (0)
+//        1     1  flags (Flagged, HasDeviceTime, HasHostTime)
+//        2     2  reserved (0)
+//        4     4  sequence number
+//        8     8  timestamp on the host clock, nanoseconds
+//       16     8  device time, nanoseconds since 1970-01-01 UTC, or 0
+//       24     4  smoothed (float)
+//       28     4  beta+gamma (float)
+//       32     4  gamma (float)
+//       36    12  X, Y, Z (float)
+//
+// Block begin (1) and block end (2) records:
+//        0     1  type
+//        1     1  block kind (SingleShotBlock, ContinuousBlock)
+//        2     2  reserved (0)
+//        4     4  end: number of samples in the block
+//        8     8  host time of the marker
+//       16     8  wall time of the marker, nanoseconds since 1970-01-01 UTC
+//       24     8  end: index of the matching begin record
+//       32     8  end: timestamp of the first sample of the block
+//       40     8  end: timestamp of the last sample of the block
+//
+// End records index their block: starting from the last record, a reader
+// finds every block and its time range without scanning the samples.
+
+#ifndef __vtkSlicerBetaProbeLogFormat_h
+#define __vtkSlicerBetaProbeLogFormat_h
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// STD includes
+#include <cstddef>
+#include <string>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeLogFormat
+{
+public:
+  enum
+  {
+    TextFormat = 0,
+    BinaryFormat
+  };
+
+  enum
+  {
+    HeaderSize = 64,
+    RecordSize = 48,
+    CurrentVersion = 1
+  };
+
+  enum
+  {
+    SampleRecord = 0,
+    BlockBeginRecord,
+    BlockEndRecord
+  };
+
+  enum
+  {
+    SingleShotBlock = 1,
+    ContinuousBlock
+  };
+
+  /// Sample flags
+  enum
+  {
+    Flagged = 0x1,
+    HasDeviceTime = 0x2,
+    HasHostTime = 0x4
+  };
+
+  /// Record as queued by the writer and decoded by the reader.
+  /// HostTime and WallTime are the time of the marker for block records.
+  /// NumberOfSamples, BeginIndex, FirstTime and LastTime are only set on
+  /// block end records written in binary.
+  typedef struct
+  {
+    int Type;
+    int BlockKind;
+    bool Flagged;
+    vtkTypeInt64 HostTime;
+    vtkTypeInt64 WallTime;
+    vtkTypeUInt32 NumberOfSamples;
+    vtkTypeUInt64 BeginIndex;
+    vtkTypeInt64 FirstTime;
+    vtkTypeInt64 LastTime;
+    vtkMRMLBetaProbeNode::trackingData Position;
+    vtkMRMLBetaProbeNode::countingData Counts;
+  }logRecord;
+
+  /// Current wall clock time, nanoseconds since 1970-01-01 UTC
+  static vtkTypeInt64 GetWallTime();
+
+  /// Timestamp of a sample on the host clock: its host time if known,
+  /// its receive time otherwise
+  static vtkTypeInt64 GetSampleTime(const vtkMRMLBetaProbeNode::countingData& counts);
+
+  /// Append the CSV text of the file banner or of a record to text
+  static void FormatHeaderText(vtkTypeInt64 creationTime, std::string& text);
+  static void FormatRecordText(const logRecord& record, std::string& text);
+
+  /// Serialize into buffer, which must hold HeaderSize or RecordSize bytes
+  static void EncodeHeader(vtkTypeInt64 creationTime, vtkTypeInt64 hostToWallOffset,
+                           unsigned char* buffer);
+  static void EncodeRecord(const logRecord& record, unsigned char* buffer);
+
+  /// Deserialize. Return false if the magic, version or type do not match.
+  /// Date and Time of decoded samples are left empty, see
+  /// vtkSlicerBetaProbeCountParser::FormatDeviceTime().
+  static bool DecodeHeader(const unsigned char* buffer,
+                           vtkTypeInt64& creationTime, vtkTypeInt64& hostToWallOffset);
+  static bool DecodeRecord(const unsigned char* buffer, logRecord& record);
+};
+
+#endif
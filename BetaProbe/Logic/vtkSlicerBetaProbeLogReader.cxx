@@ -0,0 +1,430 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeLogReader.h"
+#include "vtkSlicerBetaProbeCountParser.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <string>
+
+namespace
+{
+// Records read per call when scanning or exporting a log
+const vtkIdType RecordsPerRead = 4096;
+
+// CSV text written per call when exporting a log
+const size_t TextBlockSize = 64 * 1024;
+
+//----------------------------------------------------------------------------
+int SeekFile(FILE* file, vtkTypeInt64 offset, int origin)
+{
+#if defined(_WIN32)
+  return _fseeki64(file, offset, origin);
+#else
+  return fseeko(file, static_cast<off_t>(offset), origin);
+#endif
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 TellFile(FILE* file)
+{
+#if defined(_WIN32)
+  return _ftelli64(file);
+#else
+  return static_cast<vtkTypeInt64>(ftello(file));
+#endif
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerBetaProbeLogReader);
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeLogReader::vtkSlicerBetaProbeLogReader()
+{
+  this->File = NULL;
+  this->CreationTime = 0;
+  this->HostToWallOffset = 0;
+  this->NumberOfRecords = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeLogReader::~vtkSlicerBetaProbeLogReader()
+{
+  this->Close();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogReader::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "Open: " << this->IsOpen() << "\n";
+  os << indent << "CreationTime: " << this->CreationTime << "\n";
+  os << indent << "NumberOfRecords: " << this->NumberOfRecords << "\n";
+  os << indent << "NumberOfBlocks: " << this->GetNumberOfBlocks() << "\n";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogReader::Open(const char* fileName)
+{
+  this->Close();
+
+  if (!fileName || !*fileName)
+    {
+    return false;
+    }
+
+  this->File = fopen(fileName, "rb");
+  if (!this->File)
+    {
+    vtkErrorMacro("Open: Unable to open " << fileName);
+    return false;
+    }
+
+  unsigned char header[vtkSlicerBetaProbeLogFormat::HeaderSize];
+  vtkTypeInt64 size = 0;
+  if (fread(header, 1, sizeof(header), this->File) != sizeof(header) ||
+      !vtkSlicerBetaProbeLogFormat::DecodeHeader(header, this->CreationTime,
+                                                 this->HostToWallOffset) ||
+      SeekFile(this->File, 0, SEEK_END) != 0 ||
+      (size = TellFile(this->File)) < 0)
+    {
+    vtkErrorMacro("Open: " << fileName << " is not a BetaProbe binary log");
+    this->Close();
+    return false;
+    }
+
+  this->NumberOfRecords = static_cast<vtkIdType>(
+    (size - vtkSlicerBetaProbeLogFormat::HeaderSize) / vtkSlicerBetaProbeLogFormat::RecordSize);
+
+  // End records are only missing if a session was interrupted
+  if (!this->IndexBlocksFromEnd() && !this->IndexBlocksByScanning())
+    {
+    vtkErrorMacro("Open: Unable to read " << fileName);
+    this->Close();
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogReader::Close()
+{
+  if (this->File)
+    {
+    fclose(this->File);
+    this->File = NULL;
+    }
+  this->CreationTime = 0;
+  this->HostToWallOffset = 0;
+  this->NumberOfRecords = 0;
+  this->Blocks.clear();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogReader::IsOpen() const
+{
+  return this->File != NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerBetaProbeLogReader::GetNumberOfRecords() const
+{
+  return this->NumberOfRecords;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogReader::ReadRecord(vtkIdType index, logRecord& record)
+{
+  if (!this->File || index < 0 || index >= this->NumberOfRecords)
+    {
+    return false;
+    }
+
+  unsigned char buffer[vtkSlicerBetaProbeLogFormat::RecordSize];
+  const vtkTypeInt64 offset = vtkSlicerBetaProbeLogFormat::HeaderSize +
+    static_cast<vtkTypeInt64>(index) * vtkSlicerBetaProbeLogFormat::RecordSize;
+  return SeekFile(this->File, offset, SEEK_SET) == 0 &&
+    fread(buffer, 1, sizeof(buffer), this->File) == sizeof(buffer) &&
+    vtkSlicerBetaProbeLogFormat::DecodeRecord(buffer, record);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogReader::ReadRecords(vtkIdType index, vtkIdType count,
+                                              std::vector<unsigned char>& buffer)
+{
+  const size_t size = static_cast<size_t>(count) * vtkSlicerBetaProbeLogFormat::RecordSize;
+  buffer.resize(size);
+  const vtkTypeInt64 offset = vtkSlicerBetaProbeLogFormat::HeaderSize +
+    static_cast<vtkTypeInt64>(index) * vtkSlicerBetaProbeLogFormat::RecordSize;
+  return SeekFile(this->File, offset, SEEK_SET) == 0 &&
+    fread(&buffer[0], 1, size, this->File) == size;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeLogReader::GetNumberOfBlocks() const
+{
+  return static_cast<int>(this->Blocks.size());
+}
+
+//----------------------------------------------------------------------------
+const vtkSlicerBetaProbeLogReader::blockInfo* vtkSlicerBetaProbeLogReader::GetBlock(int index) const
+{
+  if (index < 0 || index >= this->GetNumberOfBlocks())
+    {
+    return NULL;
+    }
+  return &this->Blocks[index];
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogReader::IndexBlocksFromEnd()
+{
+  this->Blocks.clear();
+
+  // Walk the blocks back from the last end record. Each block must start
+  // right after the end of the previous one.
+  logRecord end;
+  logRecord begin;
+  vtkIdType index = this->NumberOfRecords - 1;
+  while (index >= 0)
+    {
+    if (!this->ReadRecord(index, end) ||
+        end.Type != vtkSlicerBetaProbeLogFormat::BlockEndRecord ||
+        end.BeginIndex >= static_cast<vtkTypeUInt64>(index) ||
+        end.NumberOfSamples != index - end.BeginIndex - 1)
+      {
+      this->Blocks.clear();
+      return false;
+      }
+
+    const vtkIdType beginIndex = static_cast<vtkIdType>(end.BeginIndex);
+    if (!this->ReadRecord(beginIndex, begin) ||
+        begin.Type != vtkSlicerBetaProbeLogFormat::BlockBeginRecord)
+      {
+      this->Blocks.clear();
+      return false;
+      }
+
+    blockInfo block;
+    block.Kind = end.BlockKind;
+    block.BeginIndex = beginIndex;
+    block.EndIndex = index;
+    block.NumberOfSamples = end.NumberOfSamples;
+    block.FirstTime = end.FirstTime;
+    block.LastTime = end.LastTime;
+    block.HostToWallOffset = begin.WallTime - begin.HostTime;
+    this->Blocks.push_back(block);
+
+    index = beginIndex - 1;
+    }
+
+  std::reverse(this->Blocks.begin(), this->Blocks.end());
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogReader::IndexBlocksByScanning()
+{
+  this->Blocks.clear();
+
+  std::vector<unsigned char> buffer;
+  logRecord record;
+  blockInfo block;
+  bool inBlock = false;
+
+  for (vtkIdType first = 0; first < this->NumberOfRecords; first += RecordsPerRead)
+    {
+    const vtkIdType count = std::min(RecordsPerRead, this->NumberOfRecords - first);
+    if (!this->ReadRecords(first, count, buffer))
+      {
+      this->Blocks.clear();
+      return false;
+      }
+
+    for (vtkIdType i = 0; i < count; ++i)
+      {
+      if (!vtkSlicerBetaProbeLogFormat::DecodeRecord(
+            &buffer[i * vtkSlicerBetaProbeLogFormat::RecordSize], record))
+        {
+        continue;
+        }
+
+      const vtkIdType index = first + i;
+      switch (record.Type)
+        {
+        case vtkSlicerBetaProbeLogFormat::BlockBeginRecord:
+          if (inBlock)
+            {
+            // Previous block was not closed
+            block.EndIndex = index;
+            this->Blocks.push_back(block);
+            }
+          block.Kind = record.BlockKind;
+          block.BeginIndex = index;
+          block.EndIndex = index;
+          block.NumberOfSamples = 0;
+          block.FirstTime = 0;
+          block.LastTime = 0;
+          block.HostToWallOffset = record.WallTime - record.HostTime;
+          inBlock = true;
+          break;
+        case vtkSlicerBetaProbeLogFormat::SampleRecord:
+          if (inBlock)
+            {
+            block.LastTime = record.HostTime;
+            if (block.NumberOfSamples++ == 0)
+              {
+              block.FirstTime = record.HostTime;
+              }
+            }
+          break;
+        case vtkSlicerBetaProbeLogFormat::BlockEndRecord:
+          if (inBlock)
+            {
+            block.EndIndex = index;
+            this->Blocks.push_back(block);
+            inBlock = false;
+            }
+          break;
+        default:
+          break;
+        }
+      }
+    }
+
+  if (inBlock)
+    {
+    block.EndIndex = this->NumberOfRecords;
+    this->Blocks.push_back(block);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerBetaProbeLogReader::FindSample(vtkTypeInt64 wallTime)
+{
+  logRecord record;
+  for (std::vector<blockInfo>::const_iterator block = this->Blocks.begin();
+       block != this->Blocks.end(); ++block)
+    {
+    if (block->NumberOfSamples == 0 ||
+        block->LastTime + block->HostToWallOffset < wallTime)
+      {
+      continue;
+      }
+
+    // Samples of a block are in time order
+    const vtkTypeInt64 hostTime = wallTime - block->HostToWallOffset;
+    vtkIdType low = block->BeginIndex + 1;
+    vtkIdType high = block->EndIndex;
+    while (low < high)
+      {
+      const vtkIdType middle = low + (high - low) / 2;
+      if (this->ReadRecord(middle, record) &&
+          record.Type == vtkSlicerBetaProbeLogFormat::SampleRecord &&
+          record.HostTime >= hostTime)
+        {
+        high = middle;
+        }
+      else
+        {
+        low = middle + 1;
+        }
+      }
+    if (low < block->EndIndex)
+      {
+      return low;
+      }
+    }
+  return this->NumberOfRecords;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogReader::ExportCSV(const char* fileName)
+{
+  if (!this->IsOpen() || !fileName || !*fileName)
+    {
+    return false;
+    }
+
+  FILE* output = fopen(fileName, "wb");
+  if (!output)
+    {
+    vtkErrorMacro("ExportCSV: Unable to open " << fileName);
+    return false;
+    }
+
+  std::string text;
+  text.reserve(2 * TextBlockSize);
+  vtkSlicerBetaProbeLogFormat::FormatHeaderText(this->CreationTime, text);
+
+  std::vector<unsigned char> buffer;
+  logRecord record;
+  bool success = true;
+  for (vtkIdType first = 0; success && first < this->NumberOfRecords; first += RecordsPerRead)
+    {
+    const vtkIdType count = std::min(RecordsPerRead, this->NumberOfRecords - first);
+    if (!this->ReadRecords(first, count, buffer))
+      {
+      success = false;
+      break;
+      }
+
+    for (vtkIdType i = 0; i < count; ++i)
+      {
+      if (vtkSlicerBetaProbeLogFormat::DecodeRecord(
+            &buffer[i * vtkSlicerBetaProbeLogFormat::RecordSize], record))
+        {
+        if (record.Type == vtkSlicerBetaProbeLogFormat::SampleRecord &&
+            record.Counts.DeviceTime != 0)
+          {
+          vtkSlicerBetaProbeCountParser::FormatDeviceTime(record.Counts);
+          }
+        vtkSlicerBetaProbeLogFormat::FormatRecordText(record, text);
+        }
+      }
+
+    if (text.size() >= TextBlockSize)
+      {
+      success = fwrite(text.data(), 1, text.size(), output) == text.size();
+      text.clear();
+      }
+    }
+
+  if (success && !text.empty())
+    {
+    success = fwrite(text.data(), 1, text.size(), output) == text.size();
+    }
+  if (fclose(output) != 0)
+    {
+    success = false;
+    }
+
+  if (!success)
+    {
+    vtkErrorMacro("ExportCSV: Unable to write " << fileName);
+    }
+  return success;
+}
@@ -0,0 +1,110 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkSlicerBetaProbeLogReader - read binary recording logs
+// .SECTION Description
+// Reads the binary recording logs described in vtkSlicerBetaProbeLogFormat.
+// Opening a log indexes its blocks from their end records, falling back to
+// a scan of the whole file if the log was not closed properly, so samples
+// can be looked up by time with a binary search in their block.
+// ExportCSV() converts a log to the CSV layout written in text format.
+
+#ifndef __vtkSlicerBetaProbeLogReader_h
+#define __vtkSlicerBetaProbeLogReader_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeLogFormat.h"
+
+// STD includes
+#include <cstdio>
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeLogReader :
+  public vtkObject
+{
+public:
+  static vtkSlicerBetaProbeLogReader *New();
+  vtkTypeMacro(vtkSlicerBetaProbeLogReader, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  typedef vtkSlicerBetaProbeLogFormat::logRecord logRecord;
+
+  /// Recording block. EndIndex is the index of the end record, or the
+  /// number of records if the block was not closed. Times are on the host
+  /// clock; adding HostToWallOffset gives wall clock times.
+  typedef struct
+  {
+    int Kind;
+    vtkIdType BeginIndex;
+    vtkIdType EndIndex;
+    vtkIdType NumberOfSamples;
+    vtkTypeInt64 FirstTime;
+    vtkTypeInt64 LastTime;
+    vtkTypeInt64 HostToWallOffset;
+  }blockInfo;
+
+  /// Open a binary log and index its blocks. Return false if the file
+  /// cannot be read or is not a binary log.
+  bool Open(const char* fileName);
+  void Close();
+  bool IsOpen() const;
+
+  /// Creation time of the log, nanoseconds since 1970-01-01 UTC
+  vtkGetMacro(CreationTime, vtkTypeInt64);
+
+  /// Number of complete records. An incomplete last record is ignored.
+  vtkIdType GetNumberOfRecords() const;
+  bool ReadRecord(vtkIdType index, logRecord& record);
+
+  int GetNumberOfBlocks() const;
+  const blockInfo* GetBlock(int index) const;
+
+  /// Index of the first sample of a block recorded at or after wallTime
+  /// (nanoseconds since 1970-01-01 UTC), or GetNumberOfRecords() if none.
+  vtkIdType FindSample(vtkTypeInt64 wallTime);
+
+  /// Write the log as CSV text, as it would have been written in text
+  /// format. Return false on I/O error.
+  bool ExportCSV(const char* fileName);
+
+protected:
+  vtkSlicerBetaProbeLogReader();
+  virtual ~vtkSlicerBetaProbeLogReader();
+
+  bool IndexBlocksFromEnd();
+  bool IndexBlocksByScanning();
+  bool ReadRecords(vtkIdType index, vtkIdType count, std::vector<unsigned char>& buffer);
+
+  FILE* File;
+  vtkTypeInt64 CreationTime;
+  vtkTypeInt64 HostToWallOffset;
+  vtkIdType NumberOfRecords;
+  std::vector<blockInfo> Blocks;
+
+private:
+  vtkSlicerBetaProbeLogReader(const vtkSlicerBetaProbeLogReader&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeLogReader&);               // Not implemented
+};
+
+#endif
@@ -0,0 +1,454 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeLogWriter.h"
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <chrono>
+#include <thread>
+
+#if defined(_WIN32)
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
+namespace
+{
+// Records formatted before each write to the file
+const size_t BlockSize = 64 * 1024;
+
+// Wait between two looks at an empty queue, in milliseconds
+const int WaitInterval = 5;
+
+//----------------------------------------------------------------------------
+int SeekFile(FILE* file, vtkTypeInt64 offset, int origin)
+{
+#if defined(_WIN32)
+  return _fseeki64(file, offset, origin);
+#else
+  return fseeko(file, static_cast<off_t>(offset), origin);
+#endif
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 TellFile(FILE* file)
+{
+#if defined(_WIN32)
+  return _ftelli64(file);
+#else
+  return static_cast<vtkTypeInt64>(ftello(file));
+#endif
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerBetaProbeLogWriter);
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeLogWriter::vtkSlicerBetaProbeLogWriter()
+  : Records(8192)
+{
+  this->Thread = vtkMultiThreader::New();
+  this->ThreadID = -1;
+  this->StopRequested = false;
+  this->File = NULL;
+  this->Format = vtkSlicerBetaProbeLogFormat::TextFormat;
+  this->SyncInterval = 1.0;
+  this->NextRecordIndex = 0;
+  this->BlockBeginIndex = 0;
+  this->BlockSamples = 0;
+  this->BlockFirstTime = 0;
+  this->BlockLastTime = 0;
+  this->NumberOfRecordsWritten = 0;
+  this->NumberOfRecordsDropped = 0;
+  this->WriteFailed = false;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeLogWriter::~vtkSlicerBetaProbeLogWriter()
+{
+  this->Close();
+  this->Thread->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogWriter::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "Open: " << this->IsOpen() << "\n";
+  os << indent << "Format: " << this->Format << "\n";
+  os << indent << "SyncInterval: " << this->SyncInterval << "\n";
+  os << indent << "NumberOfPendingRecords: "
+     << this->GetNumberOfPendingRecords() << "\n";
+  os << indent << "NumberOfRecordsWritten: "
+     << this->GetNumberOfRecordsWritten() << "\n";
+  os << indent << "NumberOfRecordsDropped: "
+     << this->GetNumberOfRecordsDropped() << "\n";
+  os << indent << "WriteFailed: " << this->GetWriteFailed() << "\n";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::Open(const char* fileName, int format)
+{
+  this->Close();
+
+  if (!fileName || !*fileName)
+    {
+    return false;
+    }
+
+  this->Format = format;
+  const bool opened = (format == vtkSlicerBetaProbeLogFormat::BinaryFormat) ?
+    this->OpenBinary(fileName) : this->OpenText(fileName);
+  if (!opened)
+    {
+    return false;
+    }
+
+  this->NumberOfRecordsWritten = 0;
+  this->NumberOfRecordsDropped = 0;
+  this->WriteFailed = false;
+
+  this->StopRequested = false;
+  this->ThreadID = this->Thread->SpawnThread(
+    (vtkThreadFunctionType)&vtkSlicerBetaProbeLogWriter::ThreadFunction, this);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::OpenText(const char* fileName)
+{
+  this->File = fopen(fileName, "ab");
+  if (!this->File)
+    {
+    vtkErrorMacro("Open: Unable to open " << fileName);
+    return false;
+    }
+
+  // Start new files with the banner
+  if (SeekFile(this->File, 0, SEEK_END) == 0 && TellFile(this->File) == 0)
+    {
+    std::string banner;
+    vtkSlicerBetaProbeLogFormat::FormatHeaderText(
+      vtkSlicerBetaProbeLogFormat::GetWallTime(), banner);
+    this->WriteBlock(banner);
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::OpenBinary(const char* fileName)
+{
+  // Not in append mode: an interrupted session may have left a partial
+  // record, which is overwritten
+  this->File = fopen(fileName, "r+b");
+  if (!this->File)
+    {
+    this->File = fopen(fileName, "w+b");
+    }
+  if (!this->File)
+    {
+    vtkErrorMacro("Open: Unable to open " << fileName);
+    return false;
+    }
+
+  unsigned char header[vtkSlicerBetaProbeLogFormat::HeaderSize];
+  vtkTypeInt64 size = 0;
+  if (SeekFile(this->File, 0, SEEK_END) == 0)
+    {
+    size = TellFile(this->File);
+    }
+
+  if (size == 0)
+    {
+    const vtkTypeInt64 wallTime = vtkSlicerBetaProbeLogFormat::GetWallTime();
+    vtkSlicerBetaProbeLogFormat::EncodeHeader(
+      wallTime, wallTime - vtkMRMLBetaProbeNode::GetHostTime(), header);
+    this->WriteBlock(std::string(reinterpret_cast<char*>(header), sizeof(header)));
+    size = sizeof(header);
+    }
+  else
+    {
+    vtkTypeInt64 creationTime = 0;
+    vtkTypeInt64 hostToWallOffset = 0;
+    if (SeekFile(this->File, 0, SEEK_SET) != 0 ||
+        fread(header, 1, sizeof(header), this->File) != sizeof(header) ||
+        !vtkSlicerBetaProbeLogFormat::DecodeHeader(header, creationTime, hostToWallOffset))
+      {
+      vtkErrorMacro("Open: " << fileName << " is not a BetaProbe binary log");
+      fclose(this->File);
+      this->File = NULL;
+      return false;
+      }
+    }
+
+  this->NextRecordIndex = (size - vtkSlicerBetaProbeLogFormat::HeaderSize) /
+    vtkSlicerBetaProbeLogFormat::RecordSize;
+  this->BlockBeginIndex = this->NextRecordIndex;
+  this->BlockSamples = 0;
+  this->BlockFirstTime = 0;
+  this->BlockLastTime = 0;
+  SeekFile(this->File, vtkSlicerBetaProbeLogFormat::HeaderSize +
+           this->NextRecordIndex * vtkSlicerBetaProbeLogFormat::RecordSize, SEEK_SET);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogWriter::Close()
+{
+  if (this->ThreadID >= 0)
+    {
+    // The thread writes the pending records before exiting
+    this->StopRequested = true;
+    this->Thread->TerminateThread(this->ThreadID);
+    this->ThreadID = -1;
+    }
+  if (this->File)
+    {
+    fclose(this->File);
+    this->File = NULL;
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::IsOpen() const
+{
+  return this->File != NULL;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::BeginBlock(int kind)
+{
+  return this->EnqueueBlockRecord(vtkSlicerBetaProbeLogFormat::BlockBeginRecord, kind);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::EndBlock(int kind)
+{
+  return this->EnqueueBlockRecord(vtkSlicerBetaProbeLogFormat::BlockEndRecord, kind);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::EnqueueBlockRecord(int type, int kind)
+{
+  logRecord record;
+  record.Type = type;
+  record.BlockKind = kind;
+  record.Flagged = false;
+  record.HostTime = vtkMRMLBetaProbeNode::GetHostTime();
+  record.WallTime = vtkSlicerBetaProbeLogFormat::GetWallTime();
+  return this->Enqueue(record);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::WriteSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                                              const vtkMRMLBetaProbeNode::countingData& counts,
+                                              bool flagged)
+{
+  logRecord record;
+  record.Type = vtkSlicerBetaProbeLogFormat::SampleRecord;
+  record.BlockKind = 0;
+  record.Flagged = flagged;
+  record.Position = position;
+  record.Counts = counts;
+  return this->Enqueue(record);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::Enqueue(const logRecord& record)
+{
+  if (!this->IsOpen())
+    {
+    return false;
+    }
+  if (!this->Records.Push(record))
+    {
+    this->NumberOfRecordsDropped++;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+size_t vtkSlicerBetaProbeLogWriter::GetNumberOfPendingRecords() const
+{
+  return this->Records.GetSize();
+}
+
+//----------------------------------------------------------------------------
+size_t vtkSlicerBetaProbeLogWriter::GetQueueCapacity() const
+{
+  return this->Records.GetCapacity();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeLogWriter::GetNumberOfRecordsWritten() const
+{
+  return this->NumberOfRecordsWritten.load();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeLogWriter::GetNumberOfRecordsDropped() const
+{
+  return this->NumberOfRecordsDropped.load();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogWriter::GetWriteFailed() const
+{
+  return this->WriteFailed.load();
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeLogWriter::ThreadFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* vinfo =
+    static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeLogWriter* writer =
+    static_cast<vtkSlicerBetaProbeLogWriter*>(vinfo->UserData);
+
+  writer->WriteLoop();
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogWriter::WriteLoop()
+{
+  typedef std::chrono::steady_clock clock;
+
+  std::string block;
+  block.reserve(2 * BlockSize);
+  logRecord record;
+
+  const clock::duration syncInterval =
+    std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(this->SyncInterval));
+  clock::time_point lastSync = clock::now();
+  bool unsynced = false;
+
+  while (true)
+    {
+    // Read before draining, so the records queued before Close() are written
+    const bool stopping = this->StopRequested;
+
+    vtkTypeUInt64 numberOfRecords = 0;
+    while (block.size() < BlockSize && this->Records.Pop(record))
+      {
+      this->FormatRecord(record, block);
+      numberOfRecords++;
+      }
+
+    if (!block.empty())
+      {
+      this->WriteBlock(block);
+      this->NumberOfRecordsWritten += numberOfRecords;
+      block.clear();
+      unsynced = true;
+      }
+
+    if (unsynced && (stopping || clock::now() - lastSync >= syncInterval))
+      {
+      this->Sync();
+      lastSync = clock::now();
+      unsynced = false;
+      }
+
+    if (numberOfRecords == 0)
+      {
+      if (stopping)
+        {
+        break;
+        }
+      std::this_thread::sleep_for(std::chrono::milliseconds(WaitInterval));
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogWriter::FormatRecord(logRecord& record, std::string& block)
+{
+  if (this->Format != vtkSlicerBetaProbeLogFormat::BinaryFormat)
+    {
+    vtkSlicerBetaProbeLogFormat::FormatRecordText(record, block);
+    return;
+    }
+
+  // Keep track of the block being written, to index it in its end record
+  switch (record.Type)
+    {
+    case vtkSlicerBetaProbeLogFormat::BlockBeginRecord:
+      this->BlockBeginIndex = this->NextRecordIndex;
+      this->BlockSamples = 0;
+      this->BlockFirstTime = 0;
+      this->BlockLastTime = 0;
+      break;
+    case vtkSlicerBetaProbeLogFormat::SampleRecord:
+      this->BlockLastTime = vtkSlicerBetaProbeLogFormat::GetSampleTime(record.Counts);
+      if (this->BlockSamples++ == 0)
+        {
+        this->BlockFirstTime = this->BlockLastTime;
+        }
+      break;
+    case vtkSlicerBetaProbeLogFormat::BlockEndRecord:
+      record.NumberOfSamples = this->BlockSamples;
+      record.BeginIndex = this->BlockBeginIndex;
+      record.FirstTime = this->BlockFirstTime;
+      record.LastTime = this->BlockLastTime;
+      break;
+    default:
+      break;
+    }
+
+  unsigned char buffer[vtkSlicerBetaProbeLogFormat::RecordSize];
+  vtkSlicerBetaProbeLogFormat::EncodeRecord(record, buffer);
+  block.append(reinterpret_cast<char*>(buffer), sizeof(buffer));
+  this->NextRecordIndex++;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogWriter::WriteBlock(const std::string& block)
+{
+  if (fwrite(block.data(), 1, block.size(), this->File) != block.size())
+    {
+    this->WriteFailed = true;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogWriter::Sync()
+{
+  if (fflush(this->File) != 0)
+    {
+    this->WriteFailed = true;
+    return;
+    }
+#if defined(_WIN32)
+  _commit(_fileno(this->File));
+#elif defined(__APPLE__)
+  fsync(fileno(this->File));
+#else
+  fdatasync(fileno(this->File));
+#endif
+}
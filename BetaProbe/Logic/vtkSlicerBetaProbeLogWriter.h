@@ -0,0 +1,145 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+
+// .NAME vtkSlicerBetaProbeLogWriter - background writer of the recording log
+// .SECTION Description
+// Writes the recording log, as CSV text or binary (see
+// vtkSlicerBetaProbeLogFormat), from a dedicated thread. Records are queued
+// by the main thread in a lock-free ring buffer of fixed-size records, and
+// formatted by the writing thread into blocks written in one call. The file
+// is synced to disk every SyncInterval instead of being flushed per line,
+// so slow storage never stalls the main thread: when the writer falls a
+// full queue behind, records are dropped and counted instead.
+
+#ifndef __vtkSlicerBetaProbeLogWriter_h
+#define __vtkSlicerBetaProbeLogWriter_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeLogFormat.h"
+#include "vtkSlicerBetaProbeRingBuffer.h"
+
+// STD includes
+#include <atomic>
+#include <cstdio>
+#include <string>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+class vtkMultiThreader;
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeLogWriter :
+  public vtkObject
+{
+public:
+  static vtkSlicerBetaProbeLogWriter *New();
+  vtkTypeMacro(vtkSlicerBetaProbeLogWriter, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Longest time written records may stay out of the disk, in seconds.
+  /// 0 syncs after every block.
+  vtkSetClampMacro(SyncInterval, double, 0.0, 60.0);
+  vtkGetMacro(SyncInterval, double);
+
+  /// Open fileName for appending, in format (one of
+  /// vtkSlicerBetaProbeLogFormat::*Format), and start the writing thread.
+  /// New files start with the banner or header of the format. Return false
+  /// if the file could not be opened, or is not a binary log when format
+  /// is binary.
+  bool Open(const char* fileName, int format);
+
+  /// Write the pending records, sync and close the file.
+  void Close();
+
+  bool IsOpen() const;
+
+  vtkGetMacro(Format, int);
+
+  /// Queue the beginning or the end of a recording block, of kind
+  /// vtkSlicerBetaProbeLogFormat::SingleShotBlock or ContinuousBlock.
+  /// Records must only be queued from one thread. Return false if the
+  /// record was dropped.
+  bool BeginBlock(int kind);
+  bool EndBlock(int kind);
+
+  /// Queue a sample. Return false if the record was dropped.
+  bool WriteSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                   const vtkMRMLBetaProbeNode::countingData& counts,
+                   bool flagged);
+
+  /// Number of records waiting to be written, and queue capacity
+  size_t GetNumberOfPendingRecords() const;
+  size_t GetQueueCapacity() const;
+
+  /// Statistics since Open()
+  vtkTypeUInt64 GetNumberOfRecordsWritten() const;
+  vtkTypeUInt64 GetNumberOfRecordsDropped() const;
+
+  /// True if a write to the file failed since Open()
+  bool GetWriteFailed() const;
+
+protected:
+  vtkSlicerBetaProbeLogWriter();
+  virtual ~vtkSlicerBetaProbeLogWriter();
+
+  typedef vtkSlicerBetaProbeLogFormat::logRecord logRecord;
+
+  bool OpenText(const char* fileName);
+  bool OpenBinary(const char* fileName);
+
+  static void* ThreadFunction(void* ptr);
+  void WriteLoop();
+  void FormatRecord(logRecord& record, std::string& block);
+  void WriteBlock(const std::string& block);
+  void Sync();
+  bool EnqueueBlockRecord(int type, int kind);
+  bool Enqueue(const logRecord& record);
+
+  vtkMultiThreader* Thread;
+  int ThreadID;
+  std::atomic<bool> StopRequested;
+
+  FILE* File;
+  int Format;
+  double SyncInterval;
+
+  // Binary block index, only used by the writing thread
+  vtkTypeUInt64 NextRecordIndex;
+  vtkTypeUInt64 BlockBeginIndex;
+  vtkTypeUInt32 BlockSamples;
+  vtkTypeInt64 BlockFirstTime;
+  vtkTypeInt64 BlockLastTime;
+
+  vtkSlicerBetaProbeRingBuffer<logRecord> Records;
+
+  std::atomic<vtkTypeUInt64> NumberOfRecordsWritten;
+  std::atomic<vtkTypeUInt64> NumberOfRecordsDropped;
+  std::atomic<bool> WriteFailed;
+
+private:
+  vtkSlicerBetaProbeLogWriter(const vtkSlicerBetaProbeLogWriter&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeLogWriter&);               // Not implemented
+};
+
+#endif
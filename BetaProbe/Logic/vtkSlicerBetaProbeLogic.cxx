@@ -17,16 +17,71 @@
 
 // BetaProbe Logic includes
 #include "vtkSlicerBetaProbeLogic.h"
+#include "vtkSlicerBetaProbeActivityMap.h"
+#include "vtkSlicerBetaProbeCountParser.h"
+#include "vtkSlicerBetaProbeCountReceiver.h"
+#include "vtkSlicerBetaProbeTrackingReceiver.h"
 
 // MRML includes
 #include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSessionStorageNode.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkMRMLLabelMapVolumeDisplayNode.h"
+#include "vtkMRMLLinearTransformNode.h"
+#include "vtkMRMLScalarVolumeDisplayNode.h"
+#include "vtkMRMLScalarVolumeNode.h"
+#include "vtkMRMLScene.h"
 
 // VTK includes
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
 
 // STD includes
 #include <cassert>
+#include <cstring>
+
+namespace
+{
+//----------------------------------------------------------------------------
+void PoseToMatrix(const vtkMRMLBetaProbeNode::trackingData& pose, double matrix[4][4])
+{
+  double rotation[3][3];
+  vtkMath::QuaternionToMatrix3x3(pose.Orientation, rotation);
+  const double translation[3] = { pose.X, pose.Y, pose.Z };
+  for (int i = 0; i < 3; ++i)
+    {
+    for (int j = 0; j < 3; ++j)
+      {
+      matrix[i][j] = rotation[i][j];
+      }
+    matrix[i][3] = translation[i];
+    matrix[3][i] = 0.0;
+    }
+  matrix[3][3] = 1.0;
+}
+
+//----------------------------------------------------------------------------
+void MatrixToPose(const double matrix[4][4], vtkTypeInt64 receiveTime,
+                  vtkMRMLBetaProbeNode::trackingData& pose)
+{
+  double rotation[3][3];
+  for (int i = 0; i < 3; ++i)
+    {
+    for (int j = 0; j < 3; ++j)
+      {
+      rotation[i][j] = matrix[i][j];
+      }
+    }
+  vtkMath::Matrix3x3ToQuaternion(rotation, pose.Orientation);
+  pose.X = matrix[0][3];
+  pose.Y = matrix[1][3];
+  pose.Z = matrix[2][3];
+  pose.ReceiveTime = receiveTime;
+}
+}
 
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkSlicerBetaProbeLogic);
@@ -34,17 +89,577 @@ vtkStandardNewMacro(vtkSlicerBetaProbeLogic);
 //----------------------------------------------------------------------------
 vtkSlicerBetaProbeLogic::vtkSlicerBetaProbeLogic()
 {
+  this->CountReceiver = vtkSlicerBetaProbeCountReceiver::New();
+  this->TrackingReceiver = vtkSlicerBetaProbeTrackingReceiver::New();
+  this->ParentToWorld = vtkMatrix4x4::New();
+  this->AlignedNode = NULL;
+  this->ScheduledNode = NULL;
+  this->NextPoseIndex = 0;
+  this->PendingCoverageComponent = -1;
+  this->PreviousRestrictDeviceName = -1;
 }
 
 //----------------------------------------------------------------------------
 vtkSlicerBetaProbeLogic::~vtkSlicerBetaProbeLogic()
 {
+  if (this->CountReceiver)
+    {
+    this->CountReceiver->Stop();
+    this->CountReceiver->Delete();
+    }
+  if (this->TrackingReceiver)
+    {
+    this->TrackingReceiver->Stop();
+    this->TrackingReceiver->Delete();
+    }
+  this->ParentToWorld->Delete();
 }
 
 //----------------------------------------------------------------------------
 void vtkSlicerBetaProbeLogic::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "DeviceClockOffset: " << this->GetDeviceClockOffset() << "\n";
+  os << indent << "DeviceClockDrift: " << this->GetDeviceClockDrift() << "\n";
+  os << indent << "CountReceiver:\n";
+  this->CountReceiver->PrintSelf(os, indent.GetNextIndent());
+  os << indent << "TrackingReceiver:\n";
+  this->TrackingReceiver->PrintSelf(os, indent.GetNextIndent());
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeLogic::StartCountReceiver(vtkMRMLBetaProbeNode* betaProbeNode,
+                                                const char* address, int port)
+{
+  // Rebind if already running (e.g. Reconnect button)
+  this->CountReceiver->Stop();
+  this->ClockEstimator.Reset();
+
+  if (betaProbeNode)
+    {
+    this->CountReceiver->SetIngestMode(betaProbeNode->GetCountIngestMode());
+    this->CountReceiver->SetBatchSize(betaProbeNode->GetCountBatchSize());
+    this->CountReceiver->SetReceiveBufferSize(betaProbeNode->GetCountReceiveBufferSize());
+    }
+
+  return this->CountReceiver->Start(address, port);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogic::StopCountReceiver()
+{
+  this->CountReceiver->Stop();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeLogic::StartTrackingReceiver(vtkMRMLBetaProbeNode* betaProbeNode)
+{
+  this->StopTrackingReceiver();
+
+  if (!betaProbeNode || !betaProbeNode->GetTrackingDeviceNode())
+    {
+    return 0;
+    }
+
+  const char* deviceName = betaProbeNode->GetTrackingDeviceName();
+  if ((!deviceName || !*deviceName) && betaProbeNode->GetTransformNode())
+    {
+    deviceName = betaProbeNode->GetTransformNode()->GetName();
+    }
+
+  // The receiver must be the only consumer of the device: hand the tool
+  // transform over from the connector, the poses keep it up to date.
+  // StopTrackingReceiver() gives it back.
+  vtkMRMLIGTLConnectorNode* connector = betaProbeNode->GetTrackingDeviceNode();
+  this->TrackingConnectorID = connector->GetID() ? connector->GetID() : "";
+  this->TrackingNodeID = betaProbeNode->GetID() ? betaProbeNode->GetID() : "";
+  vtkMRMLLinearTransformNode* toolTransform = betaProbeNode->GetTransformNode();
+  if (toolTransform && toolTransform->GetID() && deviceName &&
+      toolTransform->GetName() && !strcmp(toolTransform->GetName(), deviceName))
+    {
+    for (unsigned int i = 0; i < connector->GetNumberOfIncomingMRMLNodes(); ++i)
+      {
+      if (connector->GetIncomingMRMLNode(i) == toolTransform)
+        {
+        connector->UnregisterIncomingMRMLNode(toolTransform);
+        this->UnregisteredTransformID = toolTransform->GetID();
+        break;
+        }
+      }
+    }
+  this->PreviousRestrictDeviceName = connector->GetRestrictDeviceName();
+  connector->SetRestrictDeviceName(1);
+
+  return this->TrackingReceiver->Start(connector, deviceName);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogic::StopTrackingReceiver()
+{
+  this->TrackingReceiver->Stop();
+  this->RestoreTrackingConnector();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogic::RestoreTrackingConnector()
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  vtkMRMLIGTLConnectorNode* connector = NULL;
+  if (scene && !this->TrackingConnectorID.empty())
+    {
+    connector = vtkMRMLIGTLConnectorNode::SafeDownCast(
+      scene->GetNodeByID(this->TrackingConnectorID.c_str()));
+    }
+
+  if (connector)
+    {
+    if (this->PreviousRestrictDeviceName >= 0)
+      {
+      connector->SetRestrictDeviceName(this->PreviousRestrictDeviceName);
+      }
+    vtkMRMLNode* toolTransform = this->UnregisteredTransformID.empty() ? NULL :
+      scene->GetNodeByID(this->UnregisteredTransformID.c_str());
+    if (toolTransform)
+      {
+      connector->RegisterIncomingMRMLNode(toolTransform);
+      }
+    }
+
+  this->TrackingConnectorID.clear();
+  this->TrackingNodeID.clear();
+  this->UnregisteredTransformID.clear();
+  this->PreviousRestrictDeviceName = -1;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeLogic::ProcessIncomingPoses(vtkMRMLBetaProbeNode* betaProbeNode)
+{
+  vtkMRMLLinearTransformNode* toolTransform = betaProbeNode->GetTransformNode();
+
+  // Poses are received in the tracker frame, i.e. relative to the parent
+  // of the tool transform
+  double parentToWorld[4][4];
+  bool hasParent = false;
+  if (toolTransform && toolTransform->GetParentTransformNode())
+    {
+    toolTransform->GetParentTransformNode()->GetMatrixTransformToWorld(this->ParentToWorld);
+    memcpy(parentToWorld, this->ParentToWorld->Element, sizeof(parentToWorld));
+    hasParent = true;
+    }
+
+  int numberOfPoses = 0;
+  double toolToParent[4][4];
+  vtkMRMLBetaProbeNode::trackingData pose;
+  while (this->TrackingReceiver->PopPose(pose))
+    {
+    PoseToMatrix(pose, toolToParent);
+    if (hasParent)
+      {
+      double toolToWorld[4][4];
+      for (int i = 0; i < 4; ++i)
+        {
+        for (int j = 0; j < 4; ++j)
+          {
+          toolToWorld[i][j] = parentToWorld[i][0] * toolToParent[0][j] +
+            parentToWorld[i][1] * toolToParent[1][j] +
+            parentToWorld[i][2] * toolToParent[2][j] +
+            parentToWorld[i][3] * toolToParent[3][j];
+          }
+        }
+      vtkMRMLBetaProbeNode::trackingData worldPose;
+      MatrixToPose(toolToWorld, pose.ReceiveTime, worldPose);
+      betaProbeNode->WritePoseData(worldPose);
+      }
+    else
+      {
+      betaProbeNode->WritePoseData(pose);
+      }
+    numberOfPoses++;
+    }
+
+  // Keep the scene in sync with the latest pose only. The node is not
+  // modified: observers read the published pose on their display timer.
+  if (numberOfPoses > 0 && toolTransform && toolTransform->GetMatrixTransformToParent())
+    {
+    toolTransform->GetMatrixTransformToParent()->DeepCopy(&toolToParent[0][0]);
+    }
+
+  return numberOfPoses;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerBetaProbeLogic::GetDeviceClockOffset() const
+{
+  if (!this->ClockEstimator.IsValid())
+    {
+    return 0.0;
+    }
+  return static_cast<double>(this->ClockEstimator.GetOffset()) * 1e-9;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerBetaProbeLogic::GetDeviceClockDrift() const
+{
+  return this->ClockEstimator.GetDrift();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeLogic::ProcessIncomingData(vtkMRMLBetaProbeNode* betaProbeNode)
+{
+  if (!betaProbeNode)
+    {
+    return 0;
+    }
+
+  if (betaProbeNode->GetTrackingIngestMode() == vtkMRMLBetaProbeNode::TrackingIngestDirect)
+    {
+    this->ProcessIncomingPoses(betaProbeNode);
+    }
+
+  const bool align = betaProbeNode->GetAlignStreams() != 0;
+  if (!align || betaProbeNode != this->AlignedNode)
+    {
+    // Start over from the latest pose
+    this->StreamAligner.Reset();
+    this->AlignedNode = align ? betaProbeNode : NULL;
+    this->NextPoseIndex = betaProbeNode->GetNumberOfPosesReceived();
+    }
+
+  int numberOfSamples = 0;
+  vtkMRMLBetaProbeNode::countingData sample;
+  while (this->CountReceiver->PopSample(sample))
+    {
+    // Binary packets only carry the device timestamp. Format it here,
+    // off the receiving thread, for display and logs.
+    if (sample.Date[0] == '\0' && sample.DeviceTime != 0)
+      {
+      vtkSlicerBetaProbeCountParser::FormatDeviceTime(sample);
+      }
+    else if (sample.DeviceTime == 0)
+      {
+      vtkSlicerBetaProbeCountParser::ParseDeviceTime(sample);
+      }
+
+    // Map the device timestamp on the host clock
+    if (sample.DeviceTime != 0)
+      {
+      this->ClockEstimator.AddSample(sample.DeviceTime, sample.ReceiveTime);
+      sample.HostTime = this->ClockEstimator.DeviceToHost(sample.DeviceTime);
+      }
+    const vtkTypeUInt64 countNumber = betaProbeNode->WriteCountData(sample);
+    if (countNumber != 0)
+      {
+      if (align)
+        {
+        this->StreamAligner.AddCount(sample, countNumber);
+        }
+      else
+        {
+        // Pair with the latest pose
+        vtkSlicerBetaProbeStreamAligner::alignedData candidate;
+        betaProbeNode->GetCurrentPosition(candidate.Position);
+        candidate.Counts = sample;
+        candidate.CountNumber = countNumber;
+        this->ScheduledSamples.push_back(candidate);
+        }
+      }
+    numberOfSamples++;
+    }
+
+  if (align)
+    {
+    // Poses received by the node since the last call
+    vtkMRMLBetaProbeNode::trackingData pose;
+    const vtkTypeUInt64 numberOfPoses = betaProbeNode->GetNumberOfPosesReceived();
+    for (; this->NextPoseIndex < numberOfPoses; ++this->NextPoseIndex)
+      {
+      if (betaProbeNode->GetReceivedPose(this->NextPoseIndex, pose))
+        {
+        this->StreamAligner.AddPose(pose);
+        }
+      }
+
+    const double nanosecondsPerSecond = 1e9;
+    this->StreamAligner.SetWindow(static_cast<vtkTypeInt64>(
+      betaProbeNode->GetAlignmentWindow() * nanosecondsPerSecond));
+    this->StreamAligner.SetMaximumExtrapolation(static_cast<vtkTypeInt64>(
+      betaProbeNode->GetMaximumExtrapolation() * nanosecondsPerSecond));
+    this->StreamAligner.Update(vtkMRMLBetaProbeNode::GetHostTime(),
+                               this->ScheduledSamples);
+    }
+
+  // Count numbers are per node
+  if (betaProbeNode != this->ScheduledNode)
+    {
+    this->RecordingScheduler.Reset();
+    this->ScheduledNode = betaProbeNode;
+    }
+  this->RecordingScheduler.SetPolicy(betaProbeNode->GetRecordingPolicy());
+  this->RecordingScheduler.SetInterval(static_cast<vtkTypeInt64>(
+    1e9 / betaProbeNode->GetRecordingRate()));
+  this->RecordingScheduler.SetMotionThreshold(betaProbeNode->GetRecordingMotionThreshold());
+  if (this->RecordingScheduler.Update(this->ScheduledSamples) > 0)
+    {
+    this->InvokeEvent(ScheduledSamplesEvent);
+    }
+  this->ScheduledSamples.clear();
+
+  return numberOfSamples;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeLogic::GetNumberOfScheduledSamples() const
+{
+  return static_cast<int>(this->ScheduledSamples.size());
+}
+
+//----------------------------------------------------------------------------
+const vtkSlicerBetaProbeStreamAligner::alignedData*
+vtkSlicerBetaProbeLogic::GetScheduledSample(int index) const
+{
+  if (index < 0 || index >= static_cast<int>(this->ScheduledSamples.size()))
+    {
+    return NULL;
+    }
+  return &this->ScheduledSamples[index];
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLScalarVolumeNode* vtkSlicerBetaProbeLogic
+::CreateActivityMap(vtkMRMLBetaProbeNode* betaProbeNode,
+                    vtkMRMLScalarVolumeNode* referenceVolume,
+                    int pointSize,
+                    int aggregation,
+                    int coverageComponent)
+{
+  if (!betaProbeNode || !referenceVolume || !referenceVolume->GetImageData())
+    {
+    return NULL;
+    }
+
+  vtkSmartPointer<vtkSlicerBetaProbeActivityMap> map =
+    vtkSmartPointer<vtkSlicerBetaProbeActivityMap>::New();
+  vtkNew<vtkMatrix4x4> rasToIJK;
+  referenceVolume->GetRASToIJKMatrix(rasToIJK.GetPointer());
+  map->SetGeometry(referenceVolume->GetImageData()->GetDimensions(), rasToIJK.GetPointer());
+  map->SetPointSize(pointSize);
+  map->SetAggregation(aggregation);
+  map->SetComputeCoverage(coverageComponent >= 0);
+  if (map->Update(betaProbeNode->GetSessionStore()) < 0)
+    {
+    return NULL;
+    }
+
+  vtkMRMLScalarVolumeNode* mapNode = this->AddMapNode(referenceVolume, "-BetaProbeMapping", map);
+  if (mapNode && map->GetCoverageOutput(coverageComponent))
+    {
+    this->AddCoverageNode(referenceVolume, "-BetaProbeCoverage",
+                          map->GetCoverageOutput(coverageComponent));
+    }
+  return mapNode;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeLogic
+::StartActivityMap(vtkMRMLBetaProbeNode* betaProbeNode,
+                   vtkMRMLScalarVolumeNode* referenceVolume,
+                   int pointSize,
+                   int aggregation,
+                   int coverageComponent)
+{
+  if (!betaProbeNode || !referenceVolume || !referenceVolume->GetImageData() ||
+      !referenceVolume->GetID())
+    {
+    return false;
+    }
+  if (this->PendingMap)
+    {
+    vtkErrorMacro("StartActivityMap: A map is already being built");
+    return false;
+    }
+
+  // Recording goes on meanwhile: build from a copy of the samples, which
+  // shares them
+  vtkSmartPointer<vtkMRMLBetaProbeSessionStore> samples =
+    vtkSmartPointer<vtkMRMLBetaProbeSessionStore>::New();
+  samples->ShallowCopy(betaProbeNode->GetSessionStore());
+
+  this->PendingMap = vtkSmartPointer<vtkSlicerBetaProbeActivityMap>::New();
+  vtkNew<vtkMatrix4x4> rasToIJK;
+  referenceVolume->GetRASToIJKMatrix(rasToIJK.GetPointer());
+  this->PendingMap->SetGeometry(referenceVolume->GetImageData()->GetDimensions(),
+                                rasToIJK.GetPointer());
+  this->PendingMap->SetPointSize(pointSize);
+  this->PendingMap->SetAggregation(aggregation);
+  this->PendingMap->SetComputeCoverage(coverageComponent >= 0);
+  this->PendingReferenceVolumeID = referenceVolume->GetID();
+  this->PendingCoverageComponent = coverageComponent;
+  return this->PendingMap->StartUpdate(samples);
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerBetaProbeLogic::GetActivityMapProgress()
+{
+  return this->PendingMap ? this->PendingMap->GetProgress() : -1.0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeLogic::CancelActivityMap()
+{
+  if (this->PendingMap)
+    {
+    this->PendingMap->AbortUpdate();
+    this->PendingMap->WaitForUpdate();
+    this->PendingMap = NULL;
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLScalarVolumeNode* vtkSlicerBetaProbeLogic::FinishActivityMap()
+{
+  if (!this->PendingMap || this->PendingMap->IsUpdating())
+    {
+    return NULL;
+    }
+
+  vtkSmartPointer<vtkSlicerBetaProbeActivityMap> map = this->PendingMap;
+  this->PendingMap = NULL;
+  if (map->WaitForUpdate() < 0 || !this->GetMRMLScene())
+    {
+    return NULL;
+    }
+
+  vtkMRMLScalarVolumeNode* referenceVolume = vtkMRMLScalarVolumeNode::SafeDownCast(
+    this->GetMRMLScene()->GetNodeByID(this->PendingReferenceVolumeID.c_str()));
+  if (!referenceVolume)
+    {
+    return NULL;
+    }
+  vtkMRMLScalarVolumeNode* mapNode = this->AddMapNode(referenceVolume, "-BetaProbeMapping", map);
+  if (mapNode && map->GetCoverageOutput(this->PendingCoverageComponent))
+    {
+    this->AddCoverageNode(referenceVolume, "-BetaProbeCoverage",
+                          map->GetCoverageOutput(this->PendingCoverageComponent));
+    }
+  return mapNode;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLScalarVolumeNode* vtkSlicerBetaProbeLogic
+::UpdateLiveMap(vtkMRMLBetaProbeNode* betaProbeNode,
+                vtkMRMLScalarVolumeNode* referenceVolume,
+                int pointSize,
+                int aggregation,
+                int coverageComponent)
+{
+  if (!this->GetMRMLScene() || !betaProbeNode || !betaProbeNode->GetID() ||
+      !referenceVolume || !referenceVolume->GetImageData() || !referenceVolume->GetID())
+    {
+    return NULL;
+    }
+
+  liveMap& live = this->LiveMaps[betaProbeNode->GetID()];
+  vtkMRMLScalarVolumeNode* mapNode = NULL;
+  bool keepMap = live.Map && live.ReferenceVolumeID == referenceVolume->GetID();
+  if (keepMap && !live.MapNodeID.empty())
+    {
+    mapNode = vtkMRMLScalarVolumeNode::SafeDownCast(
+      this->GetMRMLScene()->GetNodeByID(live.MapNodeID.c_str()));
+    keepMap = (mapNode != NULL);
+    }
+
+  // A map without node failed its first update: kept, so that the same
+  // failure is not reported at every call
+  if (!keepMap)
+    {
+    live.Map = vtkSmartPointer<vtkSlicerBetaProbeActivityMap>::New();
+    vtkNew<vtkMatrix4x4> rasToIJK;
+    referenceVolume->GetRASToIJKMatrix(rasToIJK.GetPointer());
+    live.Map->SetGeometry(referenceVolume->GetImageData()->GetDimensions(),
+                          rasToIJK.GetPointer());
+    live.ReferenceVolumeID = referenceVolume->GetID();
+    live.MapNodeID = "";
+    live.CoverageNodeID = "";
+    }
+
+  // Only the new samples, unless the session, the point size or the
+  // coverage changed
+  live.Map->SetPointSize(pointSize);
+  live.Map->SetAggregation(aggregation);
+  live.Map->SetComputeCoverage(coverageComponent >= 0);
+  if (live.Map->Update(betaProbeNode->GetSessionStore()) < 0)
+    {
+    return NULL;
+    }
+
+  if (!mapNode)
+    {
+    mapNode = this->AddMapNode(referenceVolume, "-BetaProbeLiveMapping", live.Map);
+    live.MapNodeID = (mapNode && mapNode->GetID()) ? mapNode->GetID() : "";
+    }
+
+  // Coverage node created by the first update computing coverage, then
+  // pointed to the component asked for
+  vtkImageData* coverage = live.Map->GetCoverageOutput(coverageComponent);
+  if (mapNode && coverage)
+    {
+    vtkMRMLScalarVolumeNode* coverageNode = vtkMRMLScalarVolumeNode::SafeDownCast(
+      this->GetMRMLScene()->GetNodeByID(live.CoverageNodeID.c_str()));
+    if (!coverageNode)
+      {
+      coverageNode = this->AddCoverageNode(referenceVolume, "-BetaProbeLiveCoverage", coverage);
+      live.CoverageNodeID = (coverageNode && coverageNode->GetID()) ? coverageNode->GetID() : "";
+      }
+    else if (coverageNode->GetImageData() != coverage)
+      {
+      coverageNode->SetAndObserveImageData(coverage);
+      }
+    }
+  return mapNode;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeActivityMap* vtkSlicerBetaProbeLogic
+::GetLiveMap(vtkMRMLBetaProbeNode* betaProbeNode)
+{
+  if (!betaProbeNode || !betaProbeNode->GetID())
+    {
+    return NULL;
+    }
+  std::map<std::string, liveMap>::iterator it = this->LiveMaps.find(betaProbeNode->GetID());
+  return it != this->LiveMaps.end() ? it->second.Map.GetPointer() : NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLScalarVolumeNode* vtkSlicerBetaProbeLogic
+::AddMapNode(vtkMRMLScalarVolumeNode* referenceVolume,
+             const char* nameSuffix,
+             vtkSlicerBetaProbeActivityMap* map)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene)
+    {
+    return NULL;
+    }
+
+  std::string mapName = referenceVolume->GetName() ? referenceVolume->GetName() : "";
+  mapName += nameSuffix;
+
+  vtkSmartPointer<vtkMRMLLabelMapVolumeDisplayNode> labelMapDisplayNode =
+    vtkSmartPointer<vtkMRMLLabelMapVolumeDisplayNode>::New();
+  scene->AddNode(labelMapDisplayNode);
+
+  vtkSmartPointer<vtkMRMLScalarVolumeNode> mapNode =
+    vtkSmartPointer<vtkMRMLScalarVolumeNode>::New();
+  mapNode->Copy(referenceVolume);
+  mapNode->LabelMapOn();
+  mapNode->SetAndObserveDisplayNodeID(labelMapDisplayNode->GetID());
+  mapNode->SetName(mapName.c_str());
+  mapNode->SetAndObserveImageData(map->GetOutput());
+  scene->AddNode(mapNode);
+
+  return mapNode;
 }
 
 //---------------------------------------------------------------------------
@@ -66,6 +681,11 @@ void vtkSlicerBetaProbeLogic::RegisterNodes()
     = vtkMRMLBetaProbeNode::New();
   this->GetMRMLScene()->RegisterNodeClass(betaProbeNode);
   betaProbeNode->Delete();
+
+  vtkMRMLBetaProbeSessionStorageNode* sessionStorageNode
+    = vtkMRMLBetaProbeSessionStorageNode::New();
+  this->GetMRMLScene()->RegisterNodeClass(sessionStorageNode);
+  sessionStorageNode->Delete();
 }
 
 //---------------------------------------------------------------------------
@@ -82,7 +702,67 @@ void vtkSlicerBetaProbeLogic
 
 //---------------------------------------------------------------------------
 void vtkSlicerBetaProbeLogic
-::OnMRMLSceneNodeRemoved(vtkMRMLNode* vtkNotUsed(node))
+::OnMRMLSceneNodeRemoved(vtkMRMLNode* node)
 {
+  if (!node->GetID())
+    {
+    return;
+    }
+
+  // Forget the live map of a removed BetaProbe node
+  if (vtkMRMLBetaProbeNode::SafeDownCast(node))
+    {
+    this->LiveMaps.erase(node->GetID());
+    }
+
+  // Direct tracking ingest: give the connector back its settings when the
+  // BetaProbe node goes, stop pulling from a removed connector, and do not
+  // register a removed tool transform again
+  if (this->TrackingNodeID == node->GetID())
+    {
+    this->StopTrackingReceiver();
+    }
+  else if (this->TrackingConnectorID == node->GetID())
+    {
+    this->TrackingConnectorID.clear();
+    this->StopTrackingReceiver();
+    }
+  else if (this->UnregisteredTransformID == node->GetID())
+    {
+    this->UnregisteredTransformID.clear();
+    }
 }
 
+
+//----------------------------------------------------------------------------
+vtkMRMLScalarVolumeNode* vtkSlicerBetaProbeLogic
+::AddCoverageNode(vtkMRMLScalarVolumeNode* referenceVolume,
+                  const char* nameSuffix,
+                  vtkImageData* image)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene)
+    {
+    return NULL;
+    }
+
+  std::string coverageName = referenceVolume->GetName() ? referenceVolume->GetName() : "";
+  coverageName += nameSuffix;
+
+  vtkSmartPointer<vtkMRMLScalarVolumeDisplayNode> displayNode =
+    vtkSmartPointer<vtkMRMLScalarVolumeDisplayNode>::New();
+  displayNode->SetAutoWindowLevel(1);
+  displayNode->SetAndObserveColorNodeID("vtkMRMLColorTableNodeGrey");
+  scene->AddNode(displayNode);
+
+  vtkSmartPointer<vtkMRMLScalarVolumeNode> coverageNode =
+    vtkSmartPointer<vtkMRMLScalarVolumeNode>::New();
+  coverageNode->Copy(referenceVolume);
+  coverageNode->SetLabelMap(0);
+  coverageNode->SetAndObserveDisplayNodeID(displayNode->GetID());
+  coverageNode->SetName(coverageName.c_str());
+  coverageNode->SetAndObserveImageData(image);
+  scene->AddNode(coverageNode);
+
+  return coverageNode;
+}
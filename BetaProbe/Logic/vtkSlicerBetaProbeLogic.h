@@ -29,11 +29,29 @@
 
 // MRML includes
 
+// VTK includes
+#include <vtkCommand.h>
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeActivityMap.h"
+#include "vtkSlicerBetaProbeClockEstimator.h"
+#include "vtkSlicerBetaProbeRecordingScheduler.h"
+#include "vtkSlicerBetaProbeStreamAligner.h"
+
 // STD includes
 #include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
 
 #include "vtkSlicerBetaProbeModuleLogicExport.h"
 
+class vtkImageData;
+class vtkMRMLBetaProbeNode;
+class vtkMRMLScalarVolumeNode;
+class vtkSlicerBetaProbeCountReceiver;
+class vtkSlicerBetaProbeTrackingReceiver;
+class vtkMatrix4x4;
 
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeLogic :
@@ -45,6 +63,110 @@ public:
   vtkTypeMacro(vtkSlicerBetaProbeLogic, vtkSlicerModuleLogic);
   void PrintSelf(ostream& os, vtkIndent indent);
 
+  enum Events
+  {
+    /// Invoked by ProcessIncomingData() when counts have been paired with
+    /// poses and kept by the recording policy of the node. Read them with
+    /// GetScheduledSample().
+    ScheduledSamplesEvent = vtkCommand::UserEvent + 1200
+  };
+
+  /// Start receiving counts from the BetaProbe device on a background thread,
+  /// using the ingest settings of betaProbeNode.
+  /// Return 1 on success, 0 if the socket could not be bound.
+  int StartCountReceiver(vtkMRMLBetaProbeNode* betaProbeNode,
+                         const char* address, int port);
+  void StopCountReceiver();
+  vtkGetObjectMacro(CountReceiver, vtkSlicerBetaProbeCountReceiver);
+
+  /// Pull the tool poses straight from the tracking connector of
+  /// betaProbeNode on a background thread (direct tracking ingest), using
+  /// its TrackingDeviceName or, if not set, the name of its transform node.
+  /// The connector stops importing that device: the transform node is
+  /// unregistered from its incoming nodes and new device names are
+  /// restricted. Return 1 on success.
+  int StartTrackingReceiver(vtkMRMLBetaProbeNode* betaProbeNode);
+
+  /// Stop pulling the tool poses and restore the connector: the transform
+  /// node unregistered by StartTrackingReceiver() is registered again and
+  /// the previous device name restriction is set back. Also done when the
+  /// BetaProbe node is removed from the scene.
+  void StopTrackingReceiver();
+  vtkGetObjectMacro(TrackingReceiver, vtkSlicerBetaProbeTrackingReceiver);
+
+  /// Offset (host - device, in seconds) and drift (ppm) of the device clock,
+  /// estimated from the counts received since StartCountReceiver(). Used to
+  /// stamp each count with its HostTime.
+  double GetDeviceClockOffset() const;
+  double GetDeviceClockDrift() const;
+
+  /// Move the poses and counts queued by the receiving threads into the
+  /// node, pair every new count with the pose at its time (aligned streams)
+  /// or with the latest pose, and keep the pairs allowed by the recording
+  /// policy of the node. Meant to be called periodically from the main thread.
+  /// Return the number of counts consumed.
+  int ProcessIncomingData(vtkMRMLBetaProbeNode* betaProbeNode);
+
+  /// Samples kept by the last ProcessIncomingData() call. Only valid
+  /// while ScheduledSamplesEvent is being processed.
+  int GetNumberOfScheduledSamples() const;
+  const vtkSlicerBetaProbeStreamAligner::alignedData* GetScheduledSample(int index) const;
+
+  /// Activity map of the samples recorded by betaProbeNode, in a new label
+  /// map volume node with the geometry of referenceVolume, added to the
+  /// scene. Every sample sets the voxels within pointSize of its position,
+  /// voxels set by several samples are combined by aggregation (see
+  /// vtkSlicerBetaProbeActivityMap::Aggregate*).
+  /// Unless coverageComponent is -1, the coverage of the map is computed
+  /// along with it, and that component (see
+  /// vtkSlicerBetaProbeActivityMap::Coverage*) added to the scene in a
+  /// second volume node.
+  /// Return the map node, NULL on error.
+  vtkMRMLScalarVolumeNode* CreateActivityMap(vtkMRMLBetaProbeNode* betaProbeNode,
+                                             vtkMRMLScalarVolumeNode* referenceVolume,
+                                             int pointSize,
+                                             int aggregation = vtkSlicerBetaProbeActivityMap::AggregateLatest,
+                                             int coverageComponent = -1);
+
+  /// Build the map of CreateActivityMap() on a background thread, from the
+  /// samples recorded so far. Return false if a build is already running.
+  bool StartActivityMap(vtkMRMLBetaProbeNode* betaProbeNode,
+                        vtkMRMLScalarVolumeNode* referenceVolume,
+                        int pointSize,
+                        int aggregation = vtkSlicerBetaProbeActivityMap::AggregateLatest,
+                        int coverageComponent = -1);
+
+  /// Fraction of the map built by StartActivityMap() done, -1 if none is
+  /// being built
+  double GetActivityMapProgress();
+
+  /// Stop building the map started by StartActivityMap()
+  void CancelActivityMap();
+
+  /// If the map started by StartActivityMap() is built, add it to the
+  /// scene, as CreateActivityMap() does, and return it. Return NULL
+  /// otherwise, or if its reference volume was removed meanwhile.
+  vtkMRMLScalarVolumeNode* FinishActivityMap();
+
+  /// Live activity map of betaProbeNode: created like CreateActivityMap()
+  /// by the first call, then kept, and only the samples recorded since the
+  /// previous call are splatted. A new map is created if referenceVolume
+  /// changed or if the map node was removed from the scene. Changing
+  /// aggregation between two statistics only redraws the map, changing
+  /// coverageComponent between two components only shows another one.
+  /// Meant to be called periodically from the main thread. Return NULL if
+  /// the map could not be updated, as when its statistics exceed
+  /// vtkSlicerBetaProbeActivityMap::GetStatisticsMemoryLimit().
+  vtkMRMLScalarVolumeNode* UpdateLiveMap(vtkMRMLBetaProbeNode* betaProbeNode,
+                                         vtkMRMLScalarVolumeNode* referenceVolume,
+                                         int pointSize,
+                                         int aggregation = vtkSlicerBetaProbeActivityMap::AggregateLatest,
+                                         int coverageComponent = -1);
+
+  /// Map behind the live map of betaProbeNode (scalar range, extent
+  /// updated by the last UpdateLiveMap()), NULL if none
+  vtkSlicerBetaProbeActivityMap* GetLiveMap(vtkMRMLBetaProbeNode* betaProbeNode);
+
 protected:
   vtkSlicerBetaProbeLogic();
   virtual ~vtkSlicerBetaProbeLogic();
@@ -55,6 +177,65 @@ protected:
   virtual void UpdateFromMRMLScene();
   virtual void OnMRMLSceneNodeAdded(vtkMRMLNode* node);
   virtual void OnMRMLSceneNodeRemoved(vtkMRMLNode* node);
+
+  /// Write the poses pulled by TrackingReceiver into the node, in world
+  /// coordinates, and mirror the latest one on its transform node.
+  /// Return the number of poses consumed.
+  int ProcessIncomingPoses(vtkMRMLBetaProbeNode* betaProbeNode);
+
+  /// Undo the changes StartTrackingReceiver() made to the connector, if it
+  /// is still in the scene, and forget them.
+  void RestoreTrackingConnector();
+
+  /// Add to the scene a label map volume node showing the output of map,
+  /// with the geometry of referenceVolume, named after it.
+  vtkMRMLScalarVolumeNode* AddMapNode(vtkMRMLScalarVolumeNode* referenceVolume,
+                                      const char* nameSuffix,
+                                      vtkSlicerBetaProbeActivityMap* map);
+
+  /// Add to the scene a grey scale volume node showing image, with the
+  /// geometry of referenceVolume, named after it.
+  vtkMRMLScalarVolumeNode* AddCoverageNode(vtkMRMLScalarVolumeNode* referenceVolume,
+                                           const char* nameSuffix,
+                                           vtkImageData* image);
+
+  typedef struct
+  {
+    std::string ReferenceVolumeID;
+    std::string MapNodeID;
+    std::string CoverageNodeID;
+    vtkSmartPointer<vtkSlicerBetaProbeActivityMap> Map;
+  }liveMap;
+
+  vtkSlicerBetaProbeCountReceiver* CountReceiver;
+  vtkSlicerBetaProbeTrackingReceiver* TrackingReceiver;
+  vtkMatrix4x4* ParentToWorld;
+  vtkSlicerBetaProbeClockEstimator ClockEstimator;
+
+  // Direct tracking ingest: nodes of StartTrackingReceiver(), the tool
+  // transform it unregistered from the connector and the device name
+  // restriction of the connector before (-1 if not changed)
+  std::string TrackingConnectorID;
+  std::string TrackingNodeID;
+  std::string UnregisteredTransformID;
+  int PreviousRestrictDeviceName;
+
+  vtkSlicerBetaProbeStreamAligner StreamAligner;
+  vtkSlicerBetaProbeRecordingScheduler RecordingScheduler;
+  std::vector<vtkSlicerBetaProbeStreamAligner::alignedData> ScheduledSamples;
+  vtkMRMLBetaProbeNode* ScheduledNode;
+  vtkMRMLBetaProbeNode* AlignedNode;
+  vtkTypeUInt64 NextPoseIndex;
+
+  // Map being built by StartActivityMap(), its reference volume and the
+  // coverage component to show
+  vtkSmartPointer<vtkSlicerBetaProbeActivityMap> PendingMap;
+  std::string PendingReferenceVolumeID;
+  int PendingCoverageComponent;
+
+  // Live maps, by ID of their BetaProbe node
+  std::map<std::string, liveMap> LiveMaps;
+
 private:
 
   vtkSlicerBetaProbeLogic(const vtkSlicerBetaProbeLogic&); // Not implemented
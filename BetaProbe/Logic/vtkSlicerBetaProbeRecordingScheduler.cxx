@@ -0,0 +1,157 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeRecordingScheduler.h"
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeRecordingScheduler::vtkSlicerBetaProbeRecordingScheduler()
+{
+  this->Policy = vtkMRMLBetaProbeNode::RecordOnNewCount;
+  this->Interval = 100000000;
+  this->MotionThreshold = 1.0;
+  this->NumberOfSkippedCounts = 0;
+  this->Reset();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeRecordingScheduler::SetPolicy(int policy)
+{
+  if (policy != this->Policy)
+    {
+    this->Policy = policy;
+    this->Reset();
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeRecordingScheduler::GetPolicy() const
+{
+  return this->Policy;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeRecordingScheduler::SetInterval(vtkTypeInt64 interval)
+{
+  this->Interval = interval;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeRecordingScheduler::GetInterval() const
+{
+  return this->Interval;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeRecordingScheduler::SetMotionThreshold(double threshold)
+{
+  this->MotionThreshold = threshold;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerBetaProbeRecordingScheduler::GetMotionThreshold() const
+{
+  return this->MotionThreshold;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeRecordingScheduler::Reset()
+{
+  this->HasLastSample = false;
+  this->LastCountNumber = 0;
+  this->NextTime = 0;
+  this->LastPosition[0] = 0.0;
+  this->LastPosition[1] = 0.0;
+  this->LastPosition[2] = 0.0;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeRecordingScheduler::GetNumberOfSkippedCounts() const
+{
+  return this->NumberOfSkippedCounts;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeRecordingScheduler::Update(
+  std::vector<vtkSlicerBetaProbeStreamAligner::alignedData>& samples)
+{
+  size_t numberOfKept = 0;
+  for (size_t i = 0; i < samples.size(); ++i)
+    {
+    if (!this->Accept(samples[i]))
+      {
+      this->NumberOfSkippedCounts++;
+      continue;
+      }
+    if (numberOfKept != i)
+      {
+      samples[numberOfKept] = samples[i];
+      }
+    numberOfKept++;
+    }
+  samples.resize(numberOfKept);
+  return static_cast<int>(numberOfKept);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeRecordingScheduler::Accept(
+  const vtkSlicerBetaProbeStreamAligner::alignedData& sample)
+{
+  if (this->HasLastSample && sample.CountNumber <= this->LastCountNumber)
+    {
+    return false;
+    }
+
+  const vtkMRMLBetaProbeNode::trackingData& position = sample.Position;
+  const vtkTypeInt64 time = vtkSlicerBetaProbeStreamAligner::GetCountTime(sample.Counts);
+  if (this->HasLastSample)
+    {
+    if (this->Policy == vtkMRMLBetaProbeNode::RecordAtFixedRate &&
+        time < this->NextTime)
+      {
+      return false;
+      }
+    if (this->Policy == vtkMRMLBetaProbeNode::RecordOnMotion)
+      {
+      const double dx = position.X - this->LastPosition[0];
+      const double dy = position.Y - this->LastPosition[1];
+      const double dz = position.Z - this->LastPosition[2];
+      if (dx * dx + dy * dy + dz * dz < this->MotionThreshold * this->MotionThreshold)
+        {
+        return false;
+        }
+      }
+    }
+
+  // Keep to the rate on average, unless counts are late by more than an
+  // interval
+  if (this->HasLastSample && time - this->NextTime < this->Interval)
+    {
+    this->NextTime += this->Interval;
+    }
+  else
+    {
+    this->NextTime = time + this->Interval;
+    }
+
+  this->HasLastSample = true;
+  this->LastCountNumber = sample.CountNumber;
+  this->LastPosition[0] = position.X;
+  this->LastPosition[1] = position.Y;
+  this->LastPosition[2] = position.Z;
+  return true;
+}
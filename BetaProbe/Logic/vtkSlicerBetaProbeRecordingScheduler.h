@@ -0,0 +1,84 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeRecordingScheduler - choose the counts to record
+// .SECTION Description
+// Continuous recording is driven by the counts, not by the tracker: every
+// count received is a candidate, paired with the pose at its time (aligned
+// streams) or with the latest pose. The scheduler keeps the candidates
+// allowed by the recording policy of the node (see
+// vtkMRMLBetaProbeNode::RecordOn*) and drops the others.
+//
+// Candidates are numbered by vtkMRMLBetaProbeNode::WriteCountData(): a
+// count whose number is not greater than the last one kept is stale and
+// never kept, so no count is recorded twice.
+
+#ifndef __vtkSlicerBetaProbeRecordingScheduler_h
+#define __vtkSlicerBetaProbeRecordingScheduler_h
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeStreamAligner.h"
+
+// STD includes
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeRecordingScheduler
+{
+public:
+  vtkSlicerBetaProbeRecordingScheduler();
+
+  /// One of vtkMRMLBetaProbeNode::RecordOn*. Changing it starts over.
+  void SetPolicy(int policy);
+  int GetPolicy() const;
+
+  /// Shortest time between two counts kept by RecordAtFixedRate, in ns
+  void SetInterval(vtkTypeInt64 interval);
+  vtkTypeInt64 GetInterval() const;
+
+  /// Shortest distance between two counts kept by RecordOnMotion, in mm
+  void SetMotionThreshold(double threshold);
+  double GetMotionThreshold() const;
+
+  /// Remove from samples the candidates that must not be recorded, keeping
+  /// the others in order. Return the number of samples kept.
+  int Update(std::vector<vtkSlicerBetaProbeStreamAligner::alignedData>& samples);
+
+  /// Forget the last count kept
+  void Reset();
+
+  /// Candidates dropped by the policy, or because they were stale
+  vtkTypeUInt64 GetNumberOfSkippedCounts() const;
+
+protected:
+  bool Accept(const vtkSlicerBetaProbeStreamAligner::alignedData& sample);
+
+  int Policy;
+  vtkTypeInt64 Interval;
+  double MotionThreshold;
+
+  bool HasLastSample;
+  vtkTypeUInt64 LastCountNumber;
+  vtkTypeInt64 NextTime;
+  double LastPosition[3];
+
+  vtkTypeUInt64 NumberOfSkippedCounts;
+};
+
+#endif
@@ -0,0 +1,105 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeRingBuffer - single producer / single consumer queue
+// .SECTION Description
+// Fixed capacity, lock-free ring buffer used to hand samples from a receiver
+// thread to the main thread. Exactly one thread may call Push() and exactly
+// one (other) thread may call Pop(). Slots are allocated once, so neither
+// side touches the heap once the buffer is constructed.
+
+#ifndef __vtkSlicerBetaProbeRingBuffer_h
+#define __vtkSlicerBetaProbeRingBuffer_h
+
+// STD includes
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+template <class T>
+class vtkSlicerBetaProbeRingBuffer
+{
+public:
+  /// Capacity is rounded up to the next power of two.
+  explicit vtkSlicerBetaProbeRingBuffer(size_t capacity = 4096)
+    : Head(0), Tail(0)
+  {
+    size_t size = 2;
+    while (size < capacity)
+      {
+      size <<= 1;
+      }
+    this->Slots.resize(size);
+    this->Mask = size - 1;
+  }
+
+  /// Producer side. Returns false (and leaves the buffer untouched)
+  /// if the consumer has fallen a full capacity behind.
+  bool Push(const T& item)
+  {
+    const size_t head = this->Head.load(std::memory_order_relaxed);
+    if (head - this->Tail.load(std::memory_order_acquire) > this->Mask)
+      {
+      return false;
+      }
+    this->Slots[head & this->Mask] = item;
+    this->Head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer side. Returns false if the buffer is empty.
+  bool Pop(T& item)
+  {
+    const size_t tail = this->Tail.load(std::memory_order_relaxed);
+    if (tail == this->Head.load(std::memory_order_acquire))
+      {
+      return false;
+      }
+    item = this->Slots[tail & this->Mask];
+    this->Tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Approximate number of queued items (exact when called from
+  /// either the producer or the consumer thread).
+  size_t GetSize() const
+  {
+    return this->Head.load(std::memory_order_acquire) -
+      this->Tail.load(std::memory_order_acquire);
+  }
+
+  size_t GetCapacity() const
+  {
+    return this->Mask + 1;
+  }
+
+private:
+  vtkSlicerBetaProbeRingBuffer(const vtkSlicerBetaProbeRingBuffer&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeRingBuffer&);               // Not implemented
+
+  std::vector<T> Slots;
+  size_t Mask;
+
+  // Keep producer and consumer indices on separate cache lines
+  char PadBefore[64];
+  std::atomic<size_t> Head;
+  char PadMiddle[64];
+  std::atomic<size_t> Tail;
+  char PadAfter[64];
+};
+
+#endif
@@ -0,0 +1,475 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeSessionLoader.h"
+#include "vtkSlicerBetaProbeCountParser.h"
+#include "vtkSlicerBetaProbeLogFormat.h"
+
+// MRML includes
+#include "vtkMRMLBetaProbeSessionChunk.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cstring>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace
+{
+// Files smaller than this are parsed by a single thread
+const size_t MinimumRangeSize = 1 << 16;
+
+//----------------------------------------------------------------------------
+// Read-only mapping of a whole file, unmapped when destroyed
+class mappedFile
+{
+public:
+  mappedFile() : Data(NULL), Size(0)
+#if defined(_WIN32)
+    , File(INVALID_HANDLE_VALUE), Mapping(NULL)
+#endif
+  {
+  }
+
+  ~mappedFile()
+  {
+#if defined(_WIN32)
+    if (this->Data)
+      {
+      UnmapViewOfFile(this->Data);
+      }
+    if (this->Mapping)
+      {
+      CloseHandle(this->Mapping);
+      }
+    if (this->File != INVALID_HANDLE_VALUE)
+      {
+      CloseHandle(this->File);
+      }
+#else
+    if (this->Data)
+      {
+      munmap(const_cast<char*>(this->Data), this->Size);
+      }
+#endif
+  }
+
+  bool Open(const char* fileName)
+  {
+#if defined(_WIN32)
+    this->File = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER size;
+    if (this->File == INVALID_HANDLE_VALUE || !GetFileSizeEx(this->File, &size))
+      {
+      return false;
+      }
+    this->Size = static_cast<size_t>(size.QuadPart);
+    if (this->Size == 0)
+      {
+      return true;
+      }
+    this->Mapping = CreateFileMappingA(this->File, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!this->Mapping)
+      {
+      return false;
+      }
+    this->Data = static_cast<const char*>(MapViewOfFile(this->Mapping, FILE_MAP_READ, 0, 0, 0));
+    return this->Data != NULL;
+#else
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+      {
+      return false;
+      }
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+      {
+      close(fd);
+      return false;
+      }
+    this->Size = static_cast<size_t>(status.st_size);
+    if (this->Size == 0)
+      {
+      close(fd);
+      return true;
+      }
+    void* data = mmap(NULL, this->Size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file open
+    close(fd);
+    if (data == MAP_FAILED)
+      {
+      return false;
+      }
+    madvise(data, this->Size, MADV_SEQUENTIAL);
+    this->Data = static_cast<const char*>(data);
+    return true;
+#endif
+  }
+
+  const char* Data;
+  size_t Size;
+
+private:
+#if defined(_WIN32)
+  HANDLE File;
+  HANDLE Mapping;
+#endif
+};
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerBetaProbeSessionLoader);
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeSessionLoader::vtkSlicerBetaProbeSessionLoader()
+{
+  this->Threader = vtkMultiThreader::New();
+  this->Binary = false;
+  this->NumberOfSkippedLines = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeSessionLoader::~vtkSlicerBetaProbeSessionLoader()
+{
+  this->Threader->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeSessionLoader::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "NumberOfThreads: " << this->Threader->GetNumberOfThreads() << "\n";
+  os << indent << "NumberOfSkippedLines: " << this->NumberOfSkippedLines << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeSessionLoader::SetNumberOfThreads(int numberOfThreads)
+{
+  if (numberOfThreads < 1 || numberOfThreads == this->Threader->GetNumberOfThreads())
+    {
+    return;
+    }
+  this->Threader->SetNumberOfThreads(numberOfThreads);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeSessionLoader::GetNumberOfThreads()
+{
+  return this->Threader->GetNumberOfThreads();
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerBetaProbeSessionLoader::Load(const char* fileName,
+                                                 vtkMRMLBetaProbeNode* node)
+{
+  this->NumberOfSkippedLines = 0;
+  if (!fileName || !*fileName || !node)
+    {
+    vtkErrorMacro("Load: No file name or no node");
+    return -1;
+    }
+
+  mappedFile file;
+  if (!file.Open(fileName))
+    {
+    vtkErrorMacro("Load: Unable to map " << fileName);
+    return -1;
+    }
+
+  const char* data = file.Data;
+  size_t size = file.Size;
+  const size_t magicSize = 4;
+  this->Binary = (size >= static_cast<size_t>(vtkSlicerBetaProbeLogFormat::HeaderSize) &&
+                  memcmp(data, "BPLG", magicSize) == 0);
+  if (this->Binary)
+    {
+    vtkTypeInt64 creationTime = 0;
+    vtkTypeInt64 hostToWallOffset = 0;
+    if (!vtkSlicerBetaProbeLogFormat::DecodeHeader(reinterpret_cast<const unsigned char*>(data),
+                                                   creationTime, hostToWallOffset))
+      {
+      vtkErrorMacro("Load: " << fileName << " is not a supported BetaProbe binary log");
+      return -1;
+      }
+    data += vtkSlicerBetaProbeLogFormat::HeaderSize;
+    size -= vtkSlicerBetaProbeLogFormat::HeaderSize;
+    // A partial last record was being written when the log was interrupted
+    size -= size % vtkSlicerBetaProbeLogFormat::RecordSize;
+    }
+  else
+    {
+    // So was a last line without end of line, which may be cut inside a
+    // number
+    const size_t tornSize = size;
+    while (size > 0 && data[size - 1] != '\n')
+      {
+      --size;
+      }
+    if (size < tornSize)
+      {
+      this->NumberOfSkippedLines++;
+      }
+    }
+
+  // Split in ranges of whole records or lines
+  const int numberOfThreads = this->Threader->GetNumberOfThreads();
+  const int numberOfRanges = (size < MinimumRangeSize || numberOfThreads < 1) ?
+    1 : numberOfThreads;
+  this->Ranges.assign(numberOfThreads, parseRange());
+  const char* end = data + size;
+  const char* begin = data;
+  for (int i = 0; i < numberOfThreads; ++i)
+    {
+    parseRange& range = this->Ranges[i];
+    range.Begin = begin;
+    range.NumberOfSkippedLines = 0;
+    if (i >= numberOfRanges - 1)
+      {
+      range.End = (i == numberOfRanges - 1) ? end : begin;
+      begin = range.End;
+      continue;
+      }
+
+    size_t cut = size / numberOfRanges * (i + 1);
+    if (this->Binary)
+      {
+      cut -= cut % vtkSlicerBetaProbeLogFormat::RecordSize;
+      range.End = std::max(begin, data + cut);
+      }
+    else
+      {
+      const char* p = std::max(begin, data + cut);
+      const char* newLine = static_cast<const char*>(memchr(p, '\n', end - p));
+      range.End = newLine ? newLine + 1 : end;
+      }
+    begin = range.End;
+    }
+
+  this->Threader->SetSingleMethod(&vtkSlicerBetaProbeSessionLoader::ParseFunction, this);
+  this->Threader->SingleMethodExecute();
+
+  // Append in file order
+  vtkMRMLBetaProbeSessionStore* store = node->GetSessionStore();
+  store->Initialize();
+
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  position.Orientation[0] = 1.0;
+  position.Orientation[1] = 0.0;
+  position.Orientation[2] = 0.0;
+  position.Orientation[3] = 0.0;
+  counts.Date[0] = '\0';
+  counts.Time[0] = '\0';
+
+  vtkIdType numberOfSamples = 0;
+  for (size_t i = 0; i < this->Ranges.size(); ++i)
+    {
+    const std::vector<loadedSample>& samples = this->Ranges[i].Samples;
+    for (size_t s = 0; s < samples.size(); ++s)
+      {
+      const loadedSample& sample = samples[s];
+      position.X = sample.X;
+      position.Y = sample.Y;
+      position.Z = sample.Z;
+      position.ReceiveTime = sample.Timestamp;
+      counts.Smoothed = sample.Smoothed;
+      counts.BetaGamma = sample.BetaGamma;
+      counts.Gamma = sample.Gamma;
+      counts.Sequence = sample.Sequence;
+      counts.DeviceTime = sample.DeviceTime;
+      counts.ReceiveTime = sample.Timestamp;
+      counts.HostTime = (sample.Flags & vtkMRMLBetaProbeSessionChunk::HasHostTime) ?
+        sample.Timestamp : 0;
+      store->AppendSample(position, counts);
+      }
+    numberOfSamples += static_cast<vtkIdType>(samples.size());
+    this->NumberOfSkippedLines += this->Ranges[i].NumberOfSkippedLines;
+    }
+  this->Ranges.clear();
+
+  node->Modified();
+  return numberOfSamples;
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeSessionLoader::ParseFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeSessionLoader* self =
+    static_cast<vtkSlicerBetaProbeSessionLoader*>(info->UserData);
+  if (info->ThreadID < 0 || info->ThreadID >= static_cast<int>(self->Ranges.size()))
+    {
+    return NULL;
+    }
+
+  parseRange& range = self->Ranges[info->ThreadID];
+  if (self->Binary)
+    {
+    ParseBinary(range);
+    }
+  else
+    {
+    ParseCSV(range);
+    }
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeSessionLoader::ParseCSV(parseRange& range)
+{
+  // Sample lines are about 60 characters long
+  const size_t averageLineLength = 60;
+  range.Samples.reserve((range.End - range.Begin) / averageLineLength + 1);
+
+  // Date, Time, Smoothed, Beta+Gamma, Gamma, X, Y, Z and an optional flag
+  const int maximumNumberOfFields = 9;
+  const char* fieldBegin[maximumNumberOfFields];
+  const char* fieldEnd[maximumNumberOfFields];
+
+  vtkSlicerBetaProbeCountParser::hourCache cache;
+  memset(&cache, 0, sizeof(cache));
+  cache.Year = -1;
+
+  const char* p = range.Begin;
+  while (p < range.End)
+    {
+    const char* lineEnd = static_cast<const char*>(memchr(p, '\n', range.End - p));
+    if (!lineEnd)
+      {
+      lineEnd = range.End;
+      }
+    const char* next = (lineEnd == range.End) ? range.End : lineEnd + 1;
+    if (lineEnd != p && lineEnd[-1] == '\r')
+      {
+      --lineEnd;
+      }
+    if (lineEnd == p)
+      {
+      p = next;
+      continue;
+      }
+
+    // Split the fields
+    int numberOfFields = 0;
+    const char* field = p;
+    for (const char* c = p; ; ++c)
+      {
+      if (c == lineEnd || *c == ',')
+        {
+        if (numberOfFields == maximumNumberOfFields)
+          {
+          numberOfFields++;
+          break;
+          }
+        fieldBegin[numberOfFields] = field;
+        fieldEnd[numberOfFields] = c;
+        numberOfFields++;
+        field = c + 1;
+        if (c == lineEnd)
+          {
+          break;
+          }
+        }
+      }
+
+    loadedSample sample;
+    double values[6];
+    bool valid = (numberOfFields == 8 || numberOfFields == 9);
+    for (int i = 0; valid && i < 6; ++i)
+      {
+      valid = vtkSlicerBetaProbeCountParser::ParseDouble(fieldBegin[i + 2], fieldEnd[i + 2],
+                                                         values[i]);
+      }
+    if (!valid)
+      {
+      // Banner, column headers or malformed line
+      range.NumberOfSkippedLines++;
+      p = next;
+      continue;
+      }
+
+    sample.DeviceTime = 0;
+    vtkSlicerBetaProbeCountParser::ParseDeviceTime(fieldBegin[0], fieldEnd[0],
+                                                   fieldBegin[1], fieldEnd[1],
+                                                   sample.DeviceTime, &cache);
+    sample.Smoothed = static_cast<float>(values[0]);
+    sample.BetaGamma = static_cast<float>(values[1]);
+    sample.Gamma = static_cast<float>(values[2]);
+    sample.X = values[3];
+    sample.Y = values[4];
+    sample.Z = values[5];
+    // The CSV holds no host time, and device times are on another clock
+    sample.Timestamp = 0;
+    sample.Sequence = 0;
+    sample.Flags = 0;
+    range.Samples.push_back(sample);
+
+    p = next;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeSessionLoader::ParseBinary(parseRange& range)
+{
+  const size_t recordSize = vtkSlicerBetaProbeLogFormat::RecordSize;
+  range.Samples.reserve((range.End - range.Begin) / recordSize);
+
+  vtkSlicerBetaProbeLogFormat::logRecord record;
+  for (const char* p = range.Begin; p + recordSize <= range.End; p += recordSize)
+    {
+    if (!vtkSlicerBetaProbeLogFormat::DecodeRecord(reinterpret_cast<const unsigned char*>(p),
+                                                   record))
+      {
+      range.NumberOfSkippedLines++;
+      continue;
+      }
+    if (record.Type != vtkSlicerBetaProbeLogFormat::SampleRecord)
+      {
+      continue;
+      }
+
+    loadedSample sample;
+    sample.X = record.Position.X;
+    sample.Y = record.Position.Y;
+    sample.Z = record.Position.Z;
+    sample.Timestamp = record.HostTime;
+    sample.DeviceTime = record.Counts.DeviceTime;
+    sample.Smoothed = static_cast<float>(record.Counts.Smoothed);
+    sample.BetaGamma = static_cast<float>(record.Counts.BetaGamma);
+    sample.Gamma = static_cast<float>(record.Counts.Gamma);
+    sample.Sequence = record.Counts.Sequence;
+    sample.Flags = record.Counts.HostTime != 0 ?
+      static_cast<vtkTypeUInt32>(vtkMRMLBetaProbeSessionChunk::HasHostTime) : 0;
+    range.Samples.push_back(sample);
+    }
+}
@@ -0,0 +1,110 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeSessionLoader - reload recorded sessions
+// .SECTION Description
+// Loads the samples of a recording log, CSV text or binary (see
+// vtkSlicerBetaProbeLogFormat), into the session store of a node. The file
+// is memory-mapped and split in as many ranges as there are threads, cut
+// at line boundaries for CSV; every range is parsed by its own thread and
+// the samples are appended to the store in file order.
+//
+// The CSV holds no host time: samples loaded from CSV have a Timestamp of
+// 0 (unknown) and their device time (Date and Time columns) in DeviceTime
+// only. Banners, headers and malformed lines are skipped, as is a last
+// line without end of line, torn when the recording was interrupted.
+
+#ifndef __vtkSlicerBetaProbeSessionLoader_h
+#define __vtkSlicerBetaProbeSessionLoader_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <cstddef>
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+class vtkMRMLBetaProbeNode;
+class vtkMultiThreader;
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeSessionLoader :
+  public vtkObject
+{
+public:
+  static vtkSlicerBetaProbeSessionLoader *New();
+  vtkTypeMacro(vtkSlicerBetaProbeSessionLoader, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Number of parsing threads, by default the number of cores
+  void SetNumberOfThreads(int numberOfThreads);
+  int GetNumberOfThreads();
+
+  /// Replace the recorded samples of node with the samples of fileName.
+  /// This cannot be undone: callers confirm it if the samples of node are
+  /// not saved. Return the number of samples loaded, or -1 if the file
+  /// cannot be read, in which case node is left unchanged.
+  vtkIdType Load(const char* fileName, vtkMRMLBetaProbeNode* node);
+
+  /// Lines (CSV) or records (binary) skipped by the last Load()
+  vtkGetMacro(NumberOfSkippedLines, vtkIdType);
+
+protected:
+  vtkSlicerBetaProbeSessionLoader();
+  virtual ~vtkSlicerBetaProbeSessionLoader();
+
+  // Parsed sample, compact until it is appended to the store
+  typedef struct
+  {
+    double X;
+    double Y;
+    double Z;
+    vtkTypeInt64 Timestamp;
+    vtkTypeInt64 DeviceTime;
+    float Smoothed;
+    float BetaGamma;
+    float Gamma;
+    vtkTypeUInt32 Sequence;
+    vtkTypeUInt32 Flags;
+  }loadedSample;
+
+  // Range of the file parsed by one thread
+  typedef struct
+  {
+    const char* Begin;
+    const char* End;
+    std::vector<loadedSample> Samples;
+    vtkIdType NumberOfSkippedLines;
+  }parseRange;
+
+  static void* ParseFunction(void* ptr);
+  static void ParseCSV(parseRange& range);
+  static void ParseBinary(parseRange& range);
+
+  vtkMultiThreader* Threader;
+  std::vector<parseRange> Ranges;
+  bool Binary;
+  vtkIdType NumberOfSkippedLines;
+
+private:
+  vtkSlicerBetaProbeSessionLoader(const vtkSlicerBetaProbeSessionLoader&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeSessionLoader&);                   // Not implemented
+};
+
+#endif
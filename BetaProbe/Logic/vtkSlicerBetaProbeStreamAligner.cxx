@@ -0,0 +1,318 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeStreamAligner.h"
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+// Upper bound on buffered poses when no count consumes them
+const size_t MaximumNumberOfPoses = 4096;
+
+//----------------------------------------------------------------------------
+bool PoseBefore(const vtkMRMLBetaProbeNode::trackingData& pose, vtkTypeInt64 time)
+{
+  return pose.ReceiveTime < time;
+}
+
+//----------------------------------------------------------------------------
+bool TimeBefore(vtkTypeInt64 time, const vtkMRMLBetaProbeNode::trackingData& pose)
+{
+  return time < pose.ReceiveTime;
+}
+
+//----------------------------------------------------------------------------
+void Slerp(const double q0[4], const double q1[4], double alpha, double q[4])
+{
+  double target[4] = { q1[0], q1[1], q1[2], q1[3] };
+  double cosTheta = q0[0]*q1[0] + q0[1]*q1[1] + q0[2]*q1[2] + q0[3]*q1[3];
+
+  // Take the short way around
+  if (cosTheta < 0.0)
+    {
+    cosTheta = -cosTheta;
+    for (int i = 0; i < 4; ++i)
+      {
+      target[i] = -target[i];
+      }
+    }
+
+  double w0 = 1.0 - alpha;
+  double w1 = alpha;
+  if (cosTheta < 0.9995)
+    {
+    double theta = acos(cosTheta);
+    double sinTheta = sin(theta);
+    w0 = sin((1.0 - alpha) * theta) / sinTheta;
+    w1 = sin(alpha * theta) / sinTheta;
+    }
+
+  double norm = 0.0;
+  for (int i = 0; i < 4; ++i)
+    {
+    q[i] = w0 * q0[i] + w1 * target[i];
+    norm += q[i] * q[i];
+    }
+  norm = sqrt(norm);
+  if (norm > 0.0)
+    {
+    for (int i = 0; i < 4; ++i)
+      {
+      q[i] /= norm;
+      }
+    }
+}
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeStreamAligner::vtkSlicerBetaProbeStreamAligner()
+{
+  this->Window = 200000000LL;              // 200 ms
+  this->MaximumExtrapolation = 50000000LL; // 50 ms
+  this->NumberOfDroppedCounts = 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeStreamAligner::SetWindow(vtkTypeInt64 window)
+{
+  this->Window = window > 0 ? window : 0;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeStreamAligner::GetWindow() const
+{
+  return this->Window;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeStreamAligner::SetMaximumExtrapolation(vtkTypeInt64 maximumExtrapolation)
+{
+  this->MaximumExtrapolation = maximumExtrapolation > 0 ? maximumExtrapolation : 0;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeStreamAligner::GetMaximumExtrapolation() const
+{
+  return this->MaximumExtrapolation;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeStreamAligner::GetNumberOfDroppedCounts() const
+{
+  return this->NumberOfDroppedCounts;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeInt64 vtkSlicerBetaProbeStreamAligner::GetCountTime(const vtkMRMLBetaProbeNode::countingData& counts)
+{
+  // Prefer the device timestamp, free of network jitter
+  return counts.HostTime != 0 ? counts.HostTime : counts.ReceiveTime;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeStreamAligner::AddPose(const vtkMRMLBetaProbeNode::trackingData& pose)
+{
+  if (this->Poses.empty() || this->Poses.back().ReceiveTime <= pose.ReceiveTime)
+    {
+    this->Poses.push_back(pose);
+    }
+  else
+    {
+    this->Poses.insert(std::upper_bound(this->Poses.begin(), this->Poses.end(),
+                                        pose.ReceiveTime, TimeBefore), pose);
+    }
+
+  if (this->Poses.size() > MaximumNumberOfPoses)
+    {
+    this->Poses.pop_front();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeStreamAligner::AddCount(const vtkMRMLBetaProbeNode::countingData& counts,
+                                               vtkTypeUInt64 countNumber)
+{
+  alignedData sample;
+  sample.Counts = counts;
+  sample.CountNumber = countNumber;
+  this->Counts.push_back(sample);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeStreamAligner::Reset()
+{
+  this->Poses.clear();
+  this->Counts.clear();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeStreamAligner::Update(vtkTypeInt64 now, std::vector<alignedData>& aligned)
+{
+  int numberOfAligned = 0;
+
+  while (!this->Counts.empty())
+    {
+    alignedData& sample = this->Counts.front();
+    bool drop = false;
+    if (this->AlignCount(sample.Counts, now, sample.Position, drop))
+      {
+      aligned.push_back(sample);
+      numberOfAligned++;
+      }
+    else if (drop)
+      {
+      this->NumberOfDroppedCounts++;
+      }
+    else
+      {
+      // Wait for more poses
+      break;
+      }
+    this->Counts.pop_front();
+    }
+
+  this->PrunePoses();
+  return numberOfAligned;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeStreamAligner::AlignCount(const vtkMRMLBetaProbeNode::countingData& counts,
+                                                 vtkTypeInt64 now,
+                                                 vtkMRMLBetaProbeNode::trackingData& pose,
+                                                 bool& drop)
+{
+  const vtkTypeInt64 t = GetCountTime(counts);
+  drop = false;
+
+  if (this->Poses.empty())
+    {
+    drop = (now - t >= this->Window);
+    return false;
+    }
+
+  const size_t numberOfPoses = this->Poses.size();
+  const vtkMRMLBetaProbeNode::trackingData& first = this->Poses.front();
+  const vtkMRMLBetaProbeNode::trackingData& last = this->Poses.back();
+
+  if (t > last.ReceiveTime)
+    {
+    // A later pose may still arrive
+    if (now - t < this->Window)
+      {
+      return false;
+      }
+    if (t - last.ReceiveTime > this->MaximumExtrapolation)
+      {
+      drop = true;
+      return false;
+      }
+    if (numberOfPoses < 2)
+      {
+      pose = last;
+      }
+    else
+      {
+      const vtkMRMLBetaProbeNode::trackingData& previous = this->Poses[numberOfPoses - 2];
+      vtkTypeInt64 dt = last.ReceiveTime - previous.ReceiveTime;
+      double alpha = dt > 0 ? static_cast<double>(t - previous.ReceiveTime) / dt : 1.0;
+      InterpolatePose(previous, last, alpha, pose);
+      }
+    pose.ReceiveTime = t;
+    return true;
+    }
+
+  if (t < first.ReceiveTime)
+    {
+    if (first.ReceiveTime - t > this->MaximumExtrapolation)
+      {
+      drop = true;
+      return false;
+      }
+    if (numberOfPoses < 2)
+      {
+      pose = first;
+      }
+    else
+      {
+      const vtkMRMLBetaProbeNode::trackingData& next = this->Poses[1];
+      vtkTypeInt64 dt = next.ReceiveTime - first.ReceiveTime;
+      double alpha = dt > 0 ? static_cast<double>(t - first.ReceiveTime) / dt : 0.0;
+      InterpolatePose(first, next, alpha, pose);
+      }
+    pose.ReceiveTime = t;
+    return true;
+    }
+
+  // Bracketing poses: pose0.ReceiveTime <= t <= pose1.ReceiveTime
+  std::deque<vtkMRMLBetaProbeNode::trackingData>::const_iterator next =
+    std::lower_bound(this->Poses.begin(), this->Poses.end(), t, PoseBefore);
+  if (next->ReceiveTime == t || next == this->Poses.begin())
+    {
+    pose = *next;
+    }
+  else
+    {
+    const vtkMRMLBetaProbeNode::trackingData& pose0 = *(next - 1);
+    const vtkMRMLBetaProbeNode::trackingData& pose1 = *next;
+    double alpha = static_cast<double>(t - pose0.ReceiveTime) /
+      (pose1.ReceiveTime - pose0.ReceiveTime);
+    InterpolatePose(pose0, pose1, alpha, pose);
+    }
+  pose.ReceiveTime = t;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeStreamAligner::PrunePoses()
+{
+  if (this->Poses.empty())
+    {
+    return;
+    }
+
+  // Nothing older than this can be needed by a pending or future count
+  vtkTypeInt64 horizon = this->Poses.back().ReceiveTime - this->Window;
+  if (!this->Counts.empty())
+    {
+    horizon = std::min(horizon, GetCountTime(this->Counts.front().Counts));
+    }
+  horizon -= this->MaximumExtrapolation;
+
+  // Keep the last pose before the horizon, to interpolate from
+  while (this->Poses.size() > 2 && this->Poses[1].ReceiveTime <= horizon)
+    {
+    this->Poses.pop_front();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeStreamAligner::InterpolatePose(const vtkMRMLBetaProbeNode::trackingData& pose0,
+                                                      const vtkMRMLBetaProbeNode::trackingData& pose1,
+                                                      double alpha,
+                                                      vtkMRMLBetaProbeNode::trackingData& pose)
+{
+  pose.X = pose0.X + alpha * (pose1.X - pose0.X);
+  pose.Y = pose0.Y + alpha * (pose1.Y - pose0.Y);
+  pose.Z = pose0.Z + alpha * (pose1.Z - pose0.Z);
+  Slerp(pose0.Orientation, pose1.Orientation, alpha, pose.Orientation);
+  pose.ReceiveTime = pose0.ReceiveTime + static_cast<vtkTypeInt64>(
+    alpha * (pose1.ReceiveTime - pose0.ReceiveTime));
+}
@@ -0,0 +1,103 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeStreamAligner - pair counts with interpolated poses
+// .SECTION Description
+// Buffers the tracking and counting streams by host time and, for each count,
+// interpolates the probe pose at the time the count was acquired: linearly
+// for the translation, with slerp for the orientation.
+//
+// A count is emitted as soon as a pose after its time is known, or once it is
+// older than Window. Counts that fall more than MaximumExtrapolation outside
+// the buffered poses are dropped instead of being paired with a stale pose.
+
+#ifndef __vtkSlicerBetaProbeStreamAligner_h
+#define __vtkSlicerBetaProbeStreamAligner_h
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// STD includes
+#include <deque>
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeStreamAligner
+{
+public:
+  /// CountNumber is the number given to the count by
+  /// vtkMRMLBetaProbeNode::WriteCountData()
+  typedef struct
+  {
+    vtkMRMLBetaProbeNode::trackingData Position;
+    vtkMRMLBetaProbeNode::countingData Counts;
+    vtkTypeUInt64 CountNumber;
+  }alignedData;
+
+  vtkSlicerBetaProbeStreamAligner();
+
+  /// Maximum time (ns) a count waits for a later pose
+  void SetWindow(vtkTypeInt64 window);
+  vtkTypeInt64 GetWindow() const;
+
+  /// Maximum distance in time (ns) between a count and the nearest pose
+  /// for the pose to be extrapolated
+  void SetMaximumExtrapolation(vtkTypeInt64 maximumExtrapolation);
+  vtkTypeInt64 GetMaximumExtrapolation() const;
+
+  void AddPose(const vtkMRMLBetaProbeNode::trackingData& pose);
+  void AddCount(const vtkMRMLBetaProbeNode::countingData& counts,
+                vtkTypeUInt64 countNumber = 0);
+
+  /// Emit every count that can be aligned at host time now into aligned.
+  /// Return the number of samples appended.
+  int Update(vtkTypeInt64 now, std::vector<alignedData>& aligned);
+
+  /// Drop all buffered poses and counts
+  void Reset();
+
+  vtkTypeUInt64 GetNumberOfDroppedCounts() const;
+
+  /// Host time at which a count was acquired: its HostTime when the device
+  /// clock is known, its ReceiveTime otherwise
+  static vtkTypeInt64 GetCountTime(const vtkMRMLBetaProbeNode::countingData& counts);
+
+  /// Interpolate (or extrapolate, for alpha outside [0,1]) between two poses
+  static void InterpolatePose(const vtkMRMLBetaProbeNode::trackingData& pose0,
+                              const vtkMRMLBetaProbeNode::trackingData& pose1,
+                              double alpha,
+                              vtkMRMLBetaProbeNode::trackingData& pose);
+
+protected:
+  bool AlignCount(const vtkMRMLBetaProbeNode::countingData& counts,
+                  vtkTypeInt64 now, vtkMRMLBetaProbeNode::trackingData& pose,
+                  bool& drop);
+  void PrunePoses();
+
+  vtkTypeInt64 Window;
+  vtkTypeInt64 MaximumExtrapolation;
+
+  std::deque<vtkMRMLBetaProbeNode::trackingData> Poses;
+  // Counts waiting for a pose, Position is not set
+  std::deque<alignedData> Counts;
+
+  vtkTypeUInt64 NumberOfDroppedCounts;
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeTrackingReceiver.h"
+
+// OpenIGTLinkIF includes
+#include "vtkIGTLCircularBuffer.h"
+#include "vtkMRMLIGTLConnectorNode.h"
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkMultiThreader.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerBetaProbeTrackingReceiver);
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeTrackingReceiver::ConnectorImportsDevice(vtkMRMLIGTLConnectorNode* connector,
+                                                                const char* deviceName)
+{
+  if (!connector || !deviceName)
+    {
+    return false;
+    }
+
+  // Without restriction, the connector creates a node for any new device
+  if (!connector->GetRestrictDeviceName())
+    {
+    return true;
+    }
+
+  for (unsigned int i = 0; i < connector->GetNumberOfIncomingMRMLNodes(); ++i)
+    {
+    vtkMRMLNode* node = connector->GetIncomingMRMLNode(i);
+    if (node && node->GetName() && !strcmp(node->GetName(), deviceName))
+      {
+      return true;
+      }
+    }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeTrackingReceiver::vtkSlicerBetaProbeTrackingReceiver()
+  : Poses(1024)
+{
+  this->Thread = vtkMultiThreader::New();
+  this->ThreadID = -1;
+  this->StopRequested = false;
+  this->PollInterval = 1000;
+  this->Connector = NULL;
+  this->TransformMessage = igtl::TransformMessage::New();
+  this->PositionMessage = igtl::PositionMessage::New();
+  this->NumberOfMessagesReceived = 0;
+  this->NumberOfPosesDropped = 0;
+  this->NumberOfInvalidMessages = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerBetaProbeTrackingReceiver::~vtkSlicerBetaProbeTrackingReceiver()
+{
+  this->Stop();
+  this->Thread->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeTrackingReceiver::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "Running: " << this->IsRunning() << "\n";
+  os << indent << "DeviceName: " << this->DeviceName << "\n";
+  os << indent << "PollInterval: " << this->PollInterval << "\n";
+  os << indent << "NumberOfMessagesReceived: "
+     << this->GetNumberOfMessagesReceived() << "\n";
+  os << indent << "NumberOfPosesDropped: "
+     << this->GetNumberOfPosesDropped() << "\n";
+  os << indent << "NumberOfInvalidMessages: "
+     << this->GetNumberOfInvalidMessages() << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeTrackingReceiver::Start(vtkMRMLIGTLConnectorNode* connector,
+                                              const char* deviceName)
+{
+  if (!connector || !deviceName || !*deviceName)
+    {
+    vtkErrorMacro("Start: A connector and a device name are required");
+    return 0;
+    }
+
+  this->Stop();
+
+  // The circular buffers of the connector have a single consumer
+  if (ConnectorImportsDevice(connector, deviceName))
+    {
+    vtkErrorMacro("Start: " << deviceName << " is imported by the connector,"
+                  " unregister its incoming node and restrict the device names");
+    return 0;
+    }
+
+  this->Connector = connector;
+  this->Connector->Register(this);
+  this->DeviceName = deviceName;
+
+  this->StopRequested = false;
+  this->ThreadID = this->Thread->SpawnThread(
+    (vtkThreadFunctionType)&vtkSlicerBetaProbeTrackingReceiver::ThreadFunction, this);
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeTrackingReceiver::Stop()
+{
+  if (this->ThreadID >= 0)
+    {
+    this->StopRequested = true;
+    this->Thread->TerminateThread(this->ThreadID);
+    this->ThreadID = -1;
+    }
+  if (this->Connector)
+    {
+    this->Connector->UnRegister(this);
+    this->Connector = NULL;
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeTrackingReceiver::IsRunning() const
+{
+  return this->ThreadID >= 0;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeTrackingReceiver::PopPose(vtkMRMLBetaProbeNode::trackingData& pose)
+{
+  return this->Poses.Pop(pose);
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeTrackingReceiver::GetNumberOfMessagesReceived() const
+{
+  return this->NumberOfMessagesReceived.load();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeTrackingReceiver::GetNumberOfPosesDropped() const
+{
+  return this->NumberOfPosesDropped.load();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkSlicerBetaProbeTrackingReceiver::GetNumberOfInvalidMessages() const
+{
+  return this->NumberOfInvalidMessages.load();
+}
+
+//----------------------------------------------------------------------------
+void* vtkSlicerBetaProbeTrackingReceiver::ThreadFunction(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* vinfo =
+    static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  vtkSlicerBetaProbeTrackingReceiver* receiver =
+    static_cast<vtkSlicerBetaProbeTrackingReceiver*>(vinfo->UserData);
+
+  receiver->PollLoop();
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeTrackingReceiver::PollLoop()
+{
+  const std::chrono::microseconds interval(this->PollInterval);
+
+  while (!this->StopRequested)
+    {
+    this->PullBuffer();
+    std::this_thread::sleep_for(interval);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerBetaProbeTrackingReceiver::PullBuffer()
+{
+  // Only the latest message of the device is kept by the connector
+  vtkIGTLCircularBuffer* buffer = this->Connector->GetCircularBuffer(this->DeviceName);
+  if (!buffer || !buffer->IsUpdated())
+    {
+    return;
+    }
+
+  // The slot may be reused by the connector thread as soon as it is
+  // released: copy the message out before EndPull() and decode the copy.
+  vtkMRMLBetaProbeNode::trackingData pose;
+  buffer->StartPull();
+  pose.ReceiveTime = vtkMRMLBetaProbeNode::GetHostTime();
+  igtl::MessageBase::Pointer message = buffer->GetPullBuffer();
+  igtl::MessageBase* copy = message.IsNotNull() ? this->CopyMessage(message) : NULL;
+  buffer->EndPull();
+
+  if (!copy || !this->DecodeMessage(copy, pose))
+    {
+    return;
+    }
+
+  this->NumberOfMessagesReceived++;
+  if (!this->Poses.Push(pose))
+    {
+    this->NumberOfPosesDropped++;
+    }
+}
+
+//----------------------------------------------------------------------------
+igtl::MessageBase* vtkSlicerBetaProbeTrackingReceiver::CopyMessage(igtl::MessageBase* message)
+{
+  const char* deviceType = message->GetDeviceType();
+
+  if (!strcmp(deviceType, "TRANSFORM"))
+    {
+    this->TransformMessage->Copy(message);
+    return this->TransformMessage;
+    }
+  if (!strcmp(deviceType, "POSITION"))
+    {
+    this->PositionMessage->Copy(message);
+    return this->PositionMessage;
+    }
+
+  // Other message types are left to the connector
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerBetaProbeTrackingReceiver::DecodeMessage(igtl::MessageBase* message,
+                                                       vtkMRMLBetaProbeNode::trackingData& pose)
+{
+  // The CRC check also rejects a copy torn by a write into the slot
+  if (message == this->TransformMessage.GetPointer())
+    {
+    if (!(this->TransformMessage->Unpack(1) & igtl::MessageHeader::UNPACK_BODY))
+      {
+      this->NumberOfInvalidMessages++;
+      return false;
+      }
+
+    igtl::Matrix4x4 matrix;
+    this->TransformMessage->GetMatrix(matrix);
+    pose.X = matrix[0][3];
+    pose.Y = matrix[1][3];
+    pose.Z = matrix[2][3];
+
+    double rotation[3][3];
+    for (int i = 0; i < 3; ++i)
+      {
+      for (int j = 0; j < 3; ++j)
+        {
+        rotation[i][j] = matrix[i][j];
+        }
+      }
+    vtkMath::Matrix3x3ToQuaternion(rotation, pose.Orientation);
+    return true;
+    }
+
+  if (message == this->PositionMessage.GetPointer())
+    {
+    if (!(this->PositionMessage->Unpack(1) & igtl::MessageHeader::UNPACK_BODY))
+      {
+      this->NumberOfInvalidMessages++;
+      return false;
+      }
+
+    float position[3];
+    float quaternion[4]; // x, y, z, w
+    this->PositionMessage->GetPosition(position);
+    this->PositionMessage->GetQuaternion(quaternion);
+    pose.X = position[0];
+    pose.Y = position[1];
+    pose.Z = position[2];
+    pose.Orientation[0] = quaternion[3];
+    pose.Orientation[1] = quaternion[0];
+    pose.Orientation[2] = quaternion[1];
+    pose.Orientation[3] = quaternion[2];
+    return true;
+    }
+
+  return false;
+}
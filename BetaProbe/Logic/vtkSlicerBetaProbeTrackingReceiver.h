@@ -0,0 +1,129 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkSlicerBetaProbeTrackingReceiver - direct OpenIGTLink pose ingest
+// .SECTION Description
+// Pulls TRANSFORM and POSITION messages of one device straight from the
+// circular buffers of an OpenIGTLink connector, on a dedicated thread, and
+// queues the decoded poses in a lock-free ring buffer. Poses are stamped
+// with the host time they were pulled at, without waiting for the connector
+// to update a transform node and for the scene to dispatch its events.
+// Consume them from the main thread with PopPose().
+//
+// A circular buffer of the connector supports a single consumer: the
+// receiver must be the only one pulling the device, so the connector must
+// not import it into the scene at the same time (see Start()).
+
+#ifndef __vtkSlicerBetaProbeTrackingReceiver_h
+#define __vtkSlicerBetaProbeTrackingReceiver_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeRingBuffer.h"
+
+// OpenIGTLink includes
+#include <igtlPositionMessage.h>
+#include <igtlTransformMessage.h>
+
+// STD includes
+#include <atomic>
+#include <string>
+
+#include "vtkSlicerBetaProbeModuleLogicExport.h"
+
+class vtkMRMLIGTLConnectorNode;
+class vtkMultiThreader;
+
+/// \ingroup Slicer_QtModules_BetaProbe
+class VTK_SLICER_BETAPROBE_MODULE_LOGIC_EXPORT vtkSlicerBetaProbeTrackingReceiver :
+  public vtkObject
+{
+public:
+  static vtkSlicerBetaProbeTrackingReceiver *New();
+  vtkTypeMacro(vtkSlicerBetaProbeTrackingReceiver, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Time between two polls of the connector buffers, in microseconds
+  vtkSetClampMacro(PollInterval, int, 100, 100000);
+  vtkGetMacro(PollInterval, int);
+
+  /// Start pulling the messages of deviceName from connector. Messages of
+  /// other devices are left to the connector.
+  /// Return 1 on success, 0 if connector or deviceName is missing or if
+  /// the connector imports deviceName itself.
+  int Start(vtkMRMLIGTLConnectorNode* connector, const char* deviceName);
+
+  /// Return true if connector imports the messages of deviceName into the
+  /// scene, i.e. if it does not restrict the device names or has an
+  /// incoming node of that name. Direct pulling must not run alongside.
+  static bool ConnectorImportsDevice(vtkMRMLIGTLConnectorNode* connector,
+                                     const char* deviceName);
+
+  /// Stop the pulling thread and release the connector.
+  void Stop();
+
+  bool IsRunning() const;
+
+  /// Pop the oldest pose, in the coordinate frame of the tracker. Must only
+  /// be called from one thread. Return false if no pose is pending.
+  bool PopPose(vtkMRMLBetaProbeNode::trackingData& pose);
+
+  /// Statistics, updated by the pulling thread
+  vtkTypeUInt64 GetNumberOfMessagesReceived() const;
+  vtkTypeUInt64 GetNumberOfPosesDropped() const;
+  vtkTypeUInt64 GetNumberOfInvalidMessages() const;
+
+protected:
+  vtkSlicerBetaProbeTrackingReceiver();
+  virtual ~vtkSlicerBetaProbeTrackingReceiver();
+
+  static void* ThreadFunction(void* ptr);
+  void PollLoop();
+  void PullBuffer();
+  igtl::MessageBase* CopyMessage(igtl::MessageBase* message);
+  bool DecodeMessage(igtl::MessageBase* message,
+                     vtkMRMLBetaProbeNode::trackingData& pose);
+
+  vtkMultiThreader* Thread;
+  int ThreadID;
+  std::atomic<bool> StopRequested;
+  int PollInterval;
+
+  vtkMRMLIGTLConnectorNode* Connector;
+  std::string DeviceName;
+
+  // Reused for every message
+  igtl::TransformMessage::Pointer TransformMessage;
+  igtl::PositionMessage::Pointer PositionMessage;
+
+  vtkSlicerBetaProbeRingBuffer<vtkMRMLBetaProbeNode::trackingData> Poses;
+
+  std::atomic<vtkTypeUInt64> NumberOfMessagesReceived;
+  std::atomic<vtkTypeUInt64> NumberOfPosesDropped;
+  std::atomic<vtkTypeUInt64> NumberOfInvalidMessages;
+
+private:
+  vtkSlicerBetaProbeTrackingReceiver(const vtkSlicerBetaProbeTrackingReceiver&); // Not implemented
+  void operator=(const vtkSlicerBetaProbeTrackingReceiver&);                      // Not implemented
+};
+
+#endif
@@ -20,18 +20,59 @@
 
   ==============================================================================*/
 
-#define MAX_DATA_SAVED 50
-
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <sstream>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
 
 #include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSeqLock.h"
+#include "vtkMRMLBetaProbeSessionStorageNode.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
 #include "vtkMRMLIGTLConnectorNode.h"
 #include "vtkMRMLLinearTransformNode.h"
 
+#include <vtkMath.h>
 #include <vtkMatrix4x4.h>
 #include <vtkNew.h>
 #include <vtkObjectFactory.h>
 
+namespace
+{
+//----------------------------------------------------------------------------
+void InitializePosition(vtkMRMLBetaProbeNode::trackingData& position)
+{
+  position.X = 0.0;
+  position.Y = 0.0;
+  position.Z = 0.0;
+  position.Orientation[0] = 1.0;
+  position.Orientation[1] = 0.0;
+  position.Orientation[2] = 0.0;
+  position.Orientation[3] = 0.0;
+  position.ReceiveTime = 0;
+}
+
+//----------------------------------------------------------------------------
+void InitializeCounts(vtkMRMLBetaProbeNode::countingData& counts)
+{
+  counts.Date[0] = '\0';
+  counts.Time[0] = '\0';
+  counts.Smoothed  = 0.0;
+  counts.BetaGamma = 0.0;
+  counts.Gamma     = 0.0;
+  counts.Sequence  = 0;
+  counts.DeviceTime = 0;
+  counts.ReceiveTime = 0;
+  counts.HostTime = 0;
+}
+}
+
 //----------------------------------------------------------------------------
 vtkMRMLNodeNewMacro(vtkMRMLBetaProbeNode);
 
@@ -42,17 +83,36 @@ vtkMRMLBetaProbeNode::vtkMRMLBetaProbeNode()
   this->HideFromEditors = false;
   this->TrackingDeviceNode = NULL;
   this->ToolTransform = NULL;
-  this->numberOfTrackingDataReceived = 0;
-
-  this->currentPosition.X = 0.0;
-  this->currentPosition.Y = 0.0;
-  this->currentPosition.Z = 0.0;
-
-  this->currentValues.Date.assign("");
-  this->currentValues.Time.assign("");
-  this->currentValues.Smoothed  = 0.0;
-  this->currentValues.BetaGamma = 0.0;
-  this->currentValues.Gamma     = 0.0;
+  this->ToolMatrix = vtkMatrix4x4::New();
+  this->SessionStore = vtkMRMLBetaProbeSessionStore::New();
+  this->SessionMemoryBudget = 256;
+  this->SessionStore->SetMemoryBudget(
+    static_cast<size_t>(this->SessionMemoryBudget) * 1024 * 1024);
+  this->JournalCommitInterval = 0.5;
+  this->JournalCommitRecords = 256;
+
+  InitializePosition(this->currentPosition);
+  this->PublishedPosition = new vtkMRMLBetaProbeSeqLock<trackingData>;
+  this->PublishedCounts = new vtkMRMLBetaProbeSeqLock<countingData>;
+
+  this->TrackingIngestMode = TrackingIngestTransformNode;
+  this->TrackingDeviceName = NULL;
+
+  this->CountIngestMode = CountIngestSingle;
+  this->CountBatchSize = 32;
+  this->CountReceiveBufferSize = 0;
+
+  this->AlignStreams = 0;
+  this->AlignmentWindow = 0.2;
+  this->MaximumExtrapolation = 0.05;
+
+  this->RecordingPolicy = RecordOnNewCount;
+  this->RecordingRate = 10.0;
+  this->RecordingMotionThreshold = 1.0;
+  this->DisplayRefreshRate = 20.0;
+
+  this->poseHistory.resize(PoseHistorySize);
+  this->numberOfPosesReceived = 0;
 }
 
 //----------------------------------------------------------------------------
@@ -62,25 +122,167 @@ vtkMRMLBetaProbeNode::~vtkMRMLBetaProbeNode()
     {
     this->TrackingDeviceNode->Delete();
     }
+  this->ToolMatrix->Delete();
+  this->SessionStore->Delete();
+  delete this->PublishedPosition;
+  delete this->PublishedCounts;
+  this->SetTrackingDeviceName(NULL);
 }
 
 //----------------------------------------------------------------------------
 void vtkMRMLBetaProbeNode::WriteXML(ostream& of, int nIndent)
 {
   Superclass::WriteXML(of, nIndent);
+
+  vtkIndent indent(nIndent);
+  of << indent << " sessionMemoryBudget=\"" << this->SessionMemoryBudget << "\"";
+  of << indent << " journalCommitInterval=\"" << this->JournalCommitInterval << "\"";
+  of << indent << " journalCommitRecords=\"" << this->JournalCommitRecords << "\"";
+  of << indent << " trackingIngestMode=\"" << this->TrackingIngestMode << "\"";
+  if (this->TrackingDeviceName)
+    {
+    of << indent << " trackingDeviceName=\"" << this->TrackingDeviceName << "\"";
+    }
+  of << indent << " countIngestMode=\"" << this->CountIngestMode << "\"";
+  of << indent << " countBatchSize=\"" << this->CountBatchSize << "\"";
+  of << indent << " countReceiveBufferSize=\"" << this->CountReceiveBufferSize << "\"";
+  of << indent << " alignStreams=\"" << this->AlignStreams << "\"";
+  of << indent << " alignmentWindow=\"" << this->AlignmentWindow << "\"";
+  of << indent << " maximumExtrapolation=\"" << this->MaximumExtrapolation << "\"";
+  of << indent << " recordingPolicy=\"" << this->RecordingPolicy << "\"";
+  of << indent << " recordingRate=\"" << this->RecordingRate << "\"";
+  of << indent << " recordingMotionThreshold=\"" << this->RecordingMotionThreshold << "\"";
+  of << indent << " displayRefreshRate=\"" << this->DisplayRefreshRate << "\"";
 }
 
 
 //----------------------------------------------------------------------------
 void vtkMRMLBetaProbeNode::ReadXMLAttributes(const char** atts)
 {
+  int disabledModify = this->StartModify();
+
   Superclass::ReadXMLAttributes(atts);
+
+  const char* attName;
+  const char* attValue;
+  while (*atts != NULL)
+    {
+    attName = *(atts++);
+    attValue = *(atts++);
+
+    int intValue = 0;
+    double doubleValue = 0.0;
+    std::stringstream ss;
+    ss << attValue;
+    if (!strcmp(attName, "sessionMemoryBudget"))
+      {
+      ss >> intValue;
+      this->SetSessionMemoryBudget(intValue);
+      }
+    else if (!strcmp(attName, "journalCommitInterval"))
+      {
+      ss >> doubleValue;
+      this->SetJournalCommitInterval(doubleValue);
+      }
+    else if (!strcmp(attName, "journalCommitRecords"))
+      {
+      ss >> intValue;
+      this->SetJournalCommitRecords(intValue);
+      }
+    else if (!strcmp(attName, "trackingIngestMode"))
+      {
+      ss >> intValue;
+      this->SetTrackingIngestMode(intValue);
+      }
+    else if (!strcmp(attName, "trackingDeviceName"))
+      {
+      this->SetTrackingDeviceName(attValue);
+      }
+    else if (!strcmp(attName, "countIngestMode"))
+      {
+      ss >> intValue;
+      this->SetCountIngestMode(intValue);
+      }
+    else if (!strcmp(attName, "countBatchSize"))
+      {
+      ss >> intValue;
+      this->SetCountBatchSize(intValue);
+      }
+    else if (!strcmp(attName, "countReceiveBufferSize"))
+      {
+      ss >> intValue;
+      this->SetCountReceiveBufferSize(intValue);
+      }
+    else if (!strcmp(attName, "alignStreams"))
+      {
+      ss >> intValue;
+      this->SetAlignStreams(intValue);
+      }
+    else if (!strcmp(attName, "alignmentWindow"))
+      {
+      ss >> doubleValue;
+      this->SetAlignmentWindow(doubleValue);
+      }
+    else if (!strcmp(attName, "maximumExtrapolation"))
+      {
+      ss >> doubleValue;
+      this->SetMaximumExtrapolation(doubleValue);
+      }
+    else if (!strcmp(attName, "recordingPolicy"))
+      {
+      ss >> intValue;
+      this->SetRecordingPolicy(intValue);
+      }
+    else if (!strcmp(attName, "recordingRate"))
+      {
+      ss >> doubleValue;
+      this->SetRecordingRate(doubleValue);
+      }
+    else if (!strcmp(attName, "recordingMotionThreshold"))
+      {
+      ss >> doubleValue;
+      this->SetRecordingMotionThreshold(doubleValue);
+      }
+    else if (!strcmp(attName, "displayRefreshRate"))
+      {
+      ss >> doubleValue;
+      this->SetDisplayRefreshRate(doubleValue);
+      }
+    }
+
+  this->EndModify(disabledModify);
 }
 
 //----------------------------------------------------------------------------
 void vtkMRMLBetaProbeNode::Copy(vtkMRMLNode *anode)
 {
+  int disabledModify = this->StartModify();
+
   Superclass::Copy(anode);
+
+  vtkMRMLBetaProbeNode* node = vtkMRMLBetaProbeNode::SafeDownCast(anode);
+  if (node)
+    {
+    // Recorded samples are shared until either node records more
+    this->SessionStore->ShallowCopy(node->GetSessionStore());
+    this->SetSessionMemoryBudget(node->GetSessionMemoryBudget());
+    this->SetJournalCommitInterval(node->GetJournalCommitInterval());
+    this->SetJournalCommitRecords(node->GetJournalCommitRecords());
+    this->SetTrackingIngestMode(node->GetTrackingIngestMode());
+    this->SetTrackingDeviceName(node->GetTrackingDeviceName());
+    this->SetCountIngestMode(node->GetCountIngestMode());
+    this->SetCountBatchSize(node->GetCountBatchSize());
+    this->SetCountReceiveBufferSize(node->GetCountReceiveBufferSize());
+    this->SetAlignStreams(node->GetAlignStreams());
+    this->SetAlignmentWindow(node->GetAlignmentWindow());
+    this->SetMaximumExtrapolation(node->GetMaximumExtrapolation());
+    this->SetRecordingPolicy(node->GetRecordingPolicy());
+    this->SetRecordingRate(node->GetRecordingRate());
+    this->SetRecordingMotionThreshold(node->GetRecordingMotionThreshold());
+    this->SetDisplayRefreshRate(node->GetDisplayRefreshRate());
+    }
+
+  this->EndModify(disabledModify);
 }
 
 //-----------------------------------------------------------
@@ -89,6 +291,20 @@ void vtkMRMLBetaProbeNode::UpdateScene(vtkMRMLScene *scene)
   Superclass::UpdateScene(scene);
 }
 
+//---------------------------------------------------------------------------
+vtkMRMLStorageNode* vtkMRMLBetaProbeNode::CreateDefaultStorageNode()
+{
+  return vtkMRMLBetaProbeSessionStorageNode::New();
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLBetaProbeNode::GetModifiedSinceRead()
+{
+  // Recording does not invoke Modified()
+  return this->Superclass::GetModifiedSinceRead() ||
+    this->SessionStore->GetGeneration() != this->SessionStore->GetStoredGeneration();
+}
+
 //---------------------------------------------------------------------------
 void vtkMRMLBetaProbeNode::ProcessMRMLEvents ( vtkObject *caller,
                                                unsigned long event,
@@ -124,17 +340,41 @@ void vtkMRMLBetaProbeNode::ProcessMRMLEvents ( vtkObject *caller,
     // Data received
     if (event == vtkMRMLLinearTransformNode::TransformModifiedEvent)
       {
-      if (this->ToolTransform)
+      // Poses are written by the logic in direct mode
+      if (this->ToolTransform &&
+          this->TrackingIngestMode != TrackingIngestDirect)
         {
-        vtkSmartPointer<vtkMatrix4x4> matrixReceived =
-          vtkSmartPointer<vtkMatrix4x4>::New();
-        this->ToolTransform->GetMatrixTransformToWorld(matrixReceived.GetPointer());
-
-        this->currentPosition.X = std::floor(matrixReceived->GetElement(0,3)*100)/100;
-        this->currentPosition.Y = std::floor(matrixReceived->GetElement(1,3)*100)/100;
-        this->currentPosition.Z = std::floor(matrixReceived->GetElement(2,3)*100)/100;
-        this->TrackingDeviceNode->InvokeEvent(vtkMRMLIGTLConnectorNode::ReceiveEvent);
-        this->Modified();
+        this->currentPosition.ReceiveTime = GetHostTime();
+
+        // Reuse the cached matrix, keeping the previous pose to detect
+        // notifications that did not move the tool
+        double previous[4][4];
+        memcpy(previous, this->ToolMatrix->Element, sizeof(previous));
+        this->ToolTransform->GetMatrixTransformToWorld(this->ToolMatrix);
+        const bool poseChanged =
+          memcmp(previous, this->ToolMatrix->Element, sizeof(previous)) != 0;
+
+        if (poseChanged)
+          {
+          this->currentPosition.X = this->ToolMatrix->Element[0][3];
+          this->currentPosition.Y = this->ToolMatrix->Element[1][3];
+          this->currentPosition.Z = this->ToolMatrix->Element[2][3];
+
+          double rotation[3][3];
+          for (int i = 0; i < 3; ++i)
+            {
+            for (int j = 0; j < 3; ++j)
+              {
+              rotation[i][j] = this->ToolMatrix->Element[i][j];
+              }
+            }
+          vtkMath::Matrix3x3ToQuaternion(rotation, this->currentPosition.Orientation);
+          }
+
+        // A still tool is still a pose sample for the stream aligner.
+        // Readers poll the published pose, at their own rate: the node is
+        // not modified by every pose.
+        this->WritePoseData(this->currentPosition);
         }
       }
     else if (event == vtkMRMLIGTLConnectorNode::ConnectedEvent)
@@ -144,6 +384,27 @@ void vtkMRMLBetaProbeNode::ProcessMRMLEvents ( vtkObject *caller,
     }
 }
 
+//---------------------------------------------------------------------------
+vtkTypeInt64 vtkMRMLBetaProbeNode::GetHostTime()
+{
+#if defined(_WIN32)
+  static LARGE_INTEGER frequency;
+  if (frequency.QuadPart == 0)
+    {
+    QueryPerformanceFrequency(&frequency);
+    }
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  vtkTypeInt64 seconds = counter.QuadPart / frequency.QuadPart;
+  vtkTypeInt64 remainder = counter.QuadPart % frequency.QuadPart;
+  return seconds * 1000000000LL + remainder * 1000000000LL / frequency.QuadPart;
+#else
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<vtkTypeInt64>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+#endif
+}
+
 //---------------------------------------------------------------------------
 void vtkMRMLBetaProbeNode::SetTrackingDeviceNode(vtkMRMLIGTLConnectorNode *trackingNode)
 {
@@ -162,60 +423,81 @@ void vtkMRMLBetaProbeNode::SetTrackingDeviceNode(vtkMRMLIGTLConnectorNode *track
 }
 
 //---------------------------------------------------------------------------
-vtkMRMLBetaProbeNode::trackingData* vtkMRMLBetaProbeNode::GetCurrentPosition()
+vtkTypeUInt64 vtkMRMLBetaProbeNode::GetCurrentPosition(trackingData& position)
 {
-  return &this->currentPosition;
+  const vtkTypeUInt64 number = this->PublishedPosition->Read(position);
+  if (number == 0)
+    {
+    InitializePosition(position);
+    }
+  return number;
 }
 
 //---------------------------------------------------------------------------
-vtkMRMLBetaProbeNode::countingData* vtkMRMLBetaProbeNode::GetCurrentCounts()
+vtkTypeUInt64 vtkMRMLBetaProbeNode::GetCurrentCounts(countingData& counts)
 {
-  return &this->currentValues;
+  const vtkTypeUInt64 number = this->PublishedCounts->Read(counts);
+  if (number == 0)
+    {
+    InitializeCounts(counts);
+    }
+  return number;
 }
 
 //---------------------------------------------------------------------------
-void vtkMRMLBetaProbeNode::WriteCountData(std::string date,
-                                          std::string time,
-                                          double smoothed,
-                                          double betaGamma,
-                                          double gamma)
+vtkTypeUInt64 vtkMRMLBetaProbeNode::WriteCountData(const countingData& counts)
 {
-  if (date.empty() || time.empty())
+  if ((counts.Date[0] == '\0' || counts.Time[0] == '\0') &&
+      counts.DeviceTime == 0)
     {
-    return;
+    return 0;
     }
 
-  if (!&this->currentValues)
-    {
-    return;
-    }
+  return this->PublishedCounts->Write(counts);
+}
 
-  this->currentValues.Date.assign(date);
-  this->currentValues.Time.assign(time);
-  this->currentValues.Smoothed  = smoothed;
-  this->currentValues.BetaGamma = betaGamma;
-  this->currentValues.Gamma     = gamma;
+//---------------------------------------------------------------------------
+void vtkMRMLBetaProbeNode::RecordMappingData()
+{
+  trackingData position;
+  countingData counts;
+  this->GetCurrentPosition(position);
+  this->GetCurrentCounts(counts);
+  this->RecordMappingData(position, counts);
 }
 
 //---------------------------------------------------------------------------
-std::vector<vtkMRMLBetaProbeNode::trackingData> vtkMRMLBetaProbeNode::GetTrackerPositions()
+void vtkMRMLBetaProbeNode::RecordMappingData(const trackingData& position,
+                                             const countingData& counts)
 {
-  return this->trackerPosition;
+  this->SessionStore->AppendSample(position, counts);
 }
 
 //---------------------------------------------------------------------------
-std::vector<vtkMRMLBetaProbeNode::countingData> vtkMRMLBetaProbeNode::GetBetaProbeValues()
+void vtkMRMLBetaProbeNode::WritePoseData(const trackingData& pose)
 {
-  return this->countingValues;
+  this->PublishedPosition->Write(pose);
+  this->poseHistory[this->numberOfPosesReceived % PoseHistorySize] = pose;
+  this->numberOfPosesReceived++;
 }
 
 //---------------------------------------------------------------------------
-void vtkMRMLBetaProbeNode::RecordMappingData()
+vtkTypeUInt64 vtkMRMLBetaProbeNode::GetNumberOfPosesReceived()
 {
-  this->trackerPosition.push_back(this->currentPosition);
-  this->countingValues.push_back(this->currentValues);
-  this->numberOfCountingDataReceived++;
-  this->numberOfTrackingDataReceived++;
+  return this->numberOfPosesReceived;
+}
+
+//---------------------------------------------------------------------------
+bool vtkMRMLBetaProbeNode::GetReceivedPose(vtkTypeUInt64 index, trackingData& pose)
+{
+  if (index >= this->numberOfPosesReceived ||
+      this->numberOfPosesReceived - index > PoseHistorySize)
+    {
+    return false;
+    }
+
+  pose = this->poseHistory[index % PoseHistorySize];
+  return true;
 }
 
 //---------------------------------------------------------------------------
@@ -233,3 +515,22 @@ void vtkMRMLBetaProbeNode::SetTransformNode(vtkMRMLLinearTransformNode* newTrans
                                   connectorNodeEvents.GetPointer());
 
 }
+
+//---------------------------------------------------------------------------
+void vtkMRMLBetaProbeNode::SetSessionMemoryBudget(int budget)
+{
+  budget = std::max(budget, 0);
+  if (budget == this->SessionMemoryBudget)
+    {
+    return;
+    }
+  this->SessionMemoryBudget = budget;
+  this->SessionStore->SetMemoryBudget(static_cast<size_t>(budget) * 1024 * 1024);
+  this->Modified();
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLLinearTransformNode* vtkMRMLBetaProbeNode::GetTransformNode()
+{
+  return this->ToolTransform;
+}
@@ -25,35 +25,103 @@
 
 
 #include "vtkSetGet.h"
-#include "vtkMRMLNode.h"
+#include "vtkMRMLStorableNode.h"
 #include "vtkMRMLIGTLConnectorNode.h"
 #include "vtkSlicerBetaProbeModuleMRMLExport.h"
 
 class vtkMRMLScene;
 class vtkMRMLLinearTransformNode;
+class vtkMatrix4x4;
+class vtkMRMLBetaProbeSessionStore;
+template <class T> class vtkMRMLBetaProbeSeqLock;
 
-class  VTK_SLICER_BETAPROBE_MODULE_MRML_EXPORT vtkMRMLBetaProbeNode : public vtkMRMLNode
+class  VTK_SLICER_BETAPROBE_MODULE_MRML_EXPORT vtkMRMLBetaProbeNode : public vtkMRMLStorableNode
 {
 public:
   static vtkMRMLBetaProbeNode *New();
-  vtkTypeMacro(vtkMRMLBetaProbeNode, vtkMRMLNode);
+  vtkTypeMacro(vtkMRMLBetaProbeNode, vtkMRMLStorableNode);
 
+  // Description:
+  // Size of the Date and Time buffers, including the terminating null
+  enum { DateTimeStringSize = 32 };
+
+  // Description:
+  // How the count receiver reads the UDP socket
+  // Single: one receive call per datagram (all platforms)
+  // Batched: many datagrams per call with recvmmsg (Linux only)
+  enum
+  {
+    CountIngestSingle = 0,
+    CountIngestBatched
+  };
+
+  // Description:
+  // How tool poses reach the node
+  // TransformNode: through the tool transform node updated by the connector
+  // Direct: pulled from the connector by the logic, bypassing the scene
+  enum
+  {
+    TrackingIngestTransformNode = 0,
+    TrackingIngestDirect
+  };
+
+  // Description:
+  // Which counts are recorded in continuous mode. A count is never
+  // recorded twice.
+  // OnNewCount: every count
+  // AtFixedRate: at most RecordingRate counts per second
+  // OnMotion: counts acquired after the probe moved RecordingMotionThreshold
+  // mm since the last record
+  enum
+  {
+    RecordOnNewCount = 0,
+    RecordAtFixedRate,
+    RecordOnMotion
+  };
+
+  // Description:
+  // Number of recent poses kept for GetReceivedPose()
+  enum { PoseHistorySize = 512 };
+
+  // Description:
+  // Orientation is a unit quaternion (w, x, y, z).
+  // ReceiveTime is the host time (see GetHostTime()) at which the pose
+  // was received.
   typedef struct
   {
     double X;
     double Y;
     double Z;
+    double Orientation[4];
+    vtkTypeInt64 ReceiveTime;
   }trackingData;
 
+  // Description:
+  // Sequence is only known for binary count packets.
+  // DeviceTime is in nanoseconds since 1970-01-01 UTC, on the device clock,
+  // and 0 if unknown.
+  // ReceiveTime is the host time (see GetHostTime()) at which the datagram
+  // was received, taken from the kernel when available.
+  // HostTime is DeviceTime mapped on the host clock by the logic, free of
+  // network jitter, or 0 until the device clock is known.
   typedef struct
   {
-    std::string Date;
-    std::string Time;
+    char Date[DateTimeStringSize];
+    char Time[DateTimeStringSize];
     double Smoothed;
     double BetaGamma;
     double Gamma;
+    vtkTypeUInt32 Sequence;
+    vtkTypeInt64 DeviceTime;
+    vtkTypeInt64 ReceiveTime;
+    vtkTypeInt64 HostTime;
   }countingData;
 
+  // Description:
+  // Host clock used to stamp received samples: nanoseconds on a monotonic
+  // clock with an arbitrary origin. Safe to call from any thread.
+  static vtkTypeInt64 GetHostTime();
+
   //--------------------------------------------------------------------------
   // MRMLNode methods
   //--------------------------------------------------------------------------
@@ -85,24 +153,123 @@ public:
                                    unsigned long /*event*/, 
                                    void * /*callData*/ );
 
+  // Description:
+  // Recorded samples are saved by a vtkMRMLBetaProbeSessionStorageNode
+  virtual vtkMRMLStorageNode* CreateDefaultStorageNode();
+
+  // Description:
+  // Also true if samples changed since the session was saved or loaded
+  virtual bool GetModifiedSinceRead();
+
   void SetTrackingDeviceNode(vtkMRMLIGTLConnectorNode* trackingNode);
   vtkGetObjectMacro(TrackingDeviceNode, vtkMRMLIGTLConnectorNode);
 
-  trackingData* GetCurrentPosition();
-  countingData* GetCurrentCounts();
-
-  void WriteCountData(std::string date,
-		      std::string time,
-		      double smoothed,
-		      double betaGamma,
-		      double gamma);
+  // Description:
+  // Consistent copy of the latest pose and counts, safe to call from any
+  // thread while they are written, without blocking the writer. Return
+  // the number of the copy (poses or counts written so far), or 0 if none
+  // was written yet: position is then the identity at the origin and
+  // counts are 0.
+  // New poses and counts do not invoke Modified(): poll these instead.
+  vtkTypeUInt64 GetCurrentPosition(trackingData& position);
+  vtkTypeUInt64 GetCurrentCounts(countingData& counts);
 
-  std::vector<trackingData> GetTrackerPositions();
-  std::vector<countingData> GetBetaProbeValues();
+  // Description:
+  // Set current counts. Samples without date, time or device time
+  // are ignored. Counts are written by one thread at a time.
+  // Return the number of the counts (see GetCurrentCounts()), 0 if ignored.
+  vtkTypeUInt64 WriteCountData(const countingData& counts);
 
+  // Description:
+  // Append a sample to the session store
   void RecordMappingData();
+  void RecordMappingData(const trackingData& position,
+                         const countingData& counts);
+
+  // Description:
+  // Samples recorded so far, stored column by column and read in place.
+  // See vtkMRMLBetaProbeSessionStore::GetGeneration() to find what changed.
+  vtkGetObjectMacro(SessionStore, vtkMRMLBetaProbeSessionStore);
+
+  // Description:
+  // Memory kept for the recorded samples, in MB. Older samples past it are
+  // spilled to a temporary file. 0 keeps every sample in memory.
+  void SetSessionMemoryBudget(int budget);
+  vtkGetMacro(SessionMemoryBudget, int);
+
+  // Description:
+  // Group commit policy of the recording journal: recorded samples are
+  // synced to disk in batches of JournalCommitRecords samples, or
+  // JournalCommitInterval seconds after the first sample of a batch.
+  vtkSetClampMacro(JournalCommitInterval, double, 0.0, 60.0);
+  vtkGetMacro(JournalCommitInterval, double);
+  vtkSetClampMacro(JournalCommitRecords, int, 1, 65536);
+  vtkGetMacro(JournalCommitRecords, int);
+
+  // Description:
+  // Poses received so far are numbered from 0. The last PoseHistorySize
+  // of them can be read back, e.g. to align them with the counts.
+  // GetReceivedPose returns false if the pose is not (or no longer) available.
+  vtkTypeUInt64 GetNumberOfPosesReceived();
+  bool GetReceivedPose(vtkTypeUInt64 index, trackingData& pose);
+
+  // Description:
+  // Set the current pose and append it to the received poses, without
+  // invoking Modified(). Used by the direct tracking ingest. Poses are
+  // written by one thread at a time.
+  void WritePoseData(const trackingData& pose);
 
   void SetTransformNode(vtkMRMLLinearTransformNode* newTransform);
+  vtkMRMLLinearTransformNode* GetTransformNode();
+
+  // Description:
+  // Tracking ingest, one of TrackingIngest*. In direct mode, the messages
+  // of TrackingDeviceName (by default the name of the tool transform node)
+  // are decoded by the logic and tool transform events are ignored.
+  vtkSetClampMacro(TrackingIngestMode, int, TrackingIngestTransformNode, TrackingIngestDirect);
+  vtkGetMacro(TrackingIngestMode, int);
+  vtkSetStringMacro(TrackingDeviceName);
+  vtkGetStringMacro(TrackingDeviceName);
+
+  // Description:
+  // Count receiver settings, applied when the receiver is (re)started.
+  // CountBatchSize is the maximum number of datagrams read per call in
+  // batched mode. CountReceiveBufferSize is the socket receive buffer in
+  // bytes (0 keeps the system default).
+  vtkSetClampMacro(CountIngestMode, int, CountIngestSingle, CountIngestBatched);
+  vtkGetMacro(CountIngestMode, int);
+  vtkSetClampMacro(CountBatchSize, int, 1, 1024);
+  vtkGetMacro(CountBatchSize, int);
+  vtkSetClampMacro(CountReceiveBufferSize, int, 0, 64*1024*1024);
+  vtkGetMacro(CountReceiveBufferSize, int);
+
+  // Description:
+  // Pair each count with the pose interpolated at the count time, instead
+  // of the latest pose. AlignmentWindow is the longest a count waits for a
+  // later pose and MaximumExtrapolation the furthest a pose is extrapolated,
+  // both in seconds.
+  vtkSetMacro(AlignStreams, int);
+  vtkGetMacro(AlignStreams, int);
+  vtkBooleanMacro(AlignStreams, int);
+  vtkSetClampMacro(AlignmentWindow, double, 0.0, 10.0);
+  vtkGetMacro(AlignmentWindow, double);
+  vtkSetClampMacro(MaximumExtrapolation, double, 0.0, 10.0);
+  vtkGetMacro(MaximumExtrapolation, double);
+
+  // Description:
+  // Continuous recording policy, one of RecordOn*. RecordingRate is in
+  // counts per second, RecordingMotionThreshold in mm.
+  vtkSetClampMacro(RecordingPolicy, int, RecordOnNewCount, RecordOnMotion);
+  vtkGetMacro(RecordingPolicy, int);
+  vtkSetClampMacro(RecordingRate, double, 0.1, 1000.0);
+  vtkGetMacro(RecordingRate, double);
+  vtkSetClampMacro(RecordingMotionThreshold, double, 0.0, 1000.0);
+  vtkGetMacro(RecordingMotionThreshold, double);
+
+  // Description:
+  // Rate at which the module panel refreshes its readouts, in Hz
+  vtkSetClampMacro(DisplayRefreshRate, double, 1.0, 60.0);
+  vtkGetMacro(DisplayRefreshRate, double);
 
 protected:
   vtkMRMLBetaProbeNode();
@@ -115,13 +282,36 @@ protected:
   vtkMRMLIGTLConnectorNode* CountingDeviceNode;
 
   vtkMRMLLinearTransformNode* ToolTransform;
+  // Last matrix read from ToolTransform, reused for every update
+  vtkMatrix4x4* ToolMatrix;
 
-  std::vector<trackingData> trackerPosition;
+  // Pose being updated from ToolTransform
   trackingData currentPosition;
-  double numberOfTrackingDataReceived;
-  std::vector<countingData> countingValues;
-  countingData currentValues;
-  double numberOfCountingDataReceived;
+  vtkMRMLBetaProbeSeqLock<trackingData>* PublishedPosition;
+  vtkMRMLBetaProbeSeqLock<countingData>* PublishedCounts;
+  vtkMRMLBetaProbeSessionStore* SessionStore;
+  int SessionMemoryBudget;
+  double JournalCommitInterval;
+  int JournalCommitRecords;
+
+  int TrackingIngestMode;
+  char* TrackingDeviceName;
+
+  int CountIngestMode;
+  int CountBatchSize;
+  int CountReceiveBufferSize;
+
+  int AlignStreams;
+  double AlignmentWindow;
+  double MaximumExtrapolation;
+
+  int RecordingPolicy;
+  double RecordingRate;
+  double RecordingMotionThreshold;
+  double DisplayRefreshRate;
+
+  std::vector<trackingData> poseHistory;
+  vtkTypeUInt64 numberOfPosesReceived;
 };
 
 #endif
@@ -0,0 +1,115 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkMRMLBetaProbeSeqLock - latest value published by one writer
+// .SECTION Description
+// Sequence lock holding a copy of the last value written. Exactly one
+// thread may call Write(); any number of threads may call Read() at the
+// same time. The writer never waits; a reader that overlaps a write
+// retries until it gets a consistent copy, so it never sees half of one
+// value and half of the next. Neither side takes a lock or touches the
+// heap.
+//
+// T must be trivially copyable. The value is kept in atomic words, so
+// concurrent reads and writes are not data races.
+
+#ifndef __vtkMRMLBetaProbeSeqLock_h
+#define __vtkMRMLBetaProbeSeqLock_h
+
+// VTK includes
+#include <vtkType.h>
+
+// STD includes
+#include <atomic>
+#include <cstring>
+
+template <class T>
+class vtkMRMLBetaProbeSeqLock
+{
+public:
+  vtkMRMLBetaProbeSeqLock()
+    : Sequence(0)
+  {
+    for (size_t i = 0; i < NumberOfWords; ++i)
+      {
+      this->Words[i].store(0, std::memory_order_relaxed);
+      }
+  }
+
+  /// Writer side. Publish value and return its number, counting from 1.
+  vtkTypeUInt64 Write(const T& value)
+  {
+    vtkTypeUInt64 words[NumberOfWords];
+    words[NumberOfWords - 1] = 0;
+    memcpy(words, &value, sizeof(T));
+
+    // Odd while the words are being written
+    const vtkTypeUInt64 sequence = this->Sequence.load(std::memory_order_relaxed);
+    this->Sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < NumberOfWords; ++i)
+      {
+      this->Words[i].store(words[i], std::memory_order_relaxed);
+      }
+    this->Sequence.store(sequence + 2, std::memory_order_release);
+    return sequence / 2 + 1;
+  }
+
+  /// Reader side. Copy the last value published and return its number,
+  /// 0 if nothing was published yet (value is then left untouched).
+  vtkTypeUInt64 Read(T& value) const
+  {
+    vtkTypeUInt64 words[NumberOfWords];
+    vtkTypeUInt64 before = 0;
+    vtkTypeUInt64 after = 0;
+    do
+      {
+      before = this->Sequence.load(std::memory_order_acquire);
+      for (size_t i = 0; i < NumberOfWords; ++i)
+        {
+        words[i] = this->Words[i].load(std::memory_order_relaxed);
+        }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = this->Sequence.load(std::memory_order_relaxed);
+      }
+    while ((before & 1) || before != after);
+
+    if (before == 0)
+      {
+      return 0;
+      }
+    memcpy(&value, words, sizeof(T));
+    return before / 2;
+  }
+
+  /// Number of values published so far
+  vtkTypeUInt64 GetNumberOfWrites() const
+  {
+    return this->Sequence.load(std::memory_order_acquire) / 2;
+  }
+
+private:
+  vtkMRMLBetaProbeSeqLock(const vtkMRMLBetaProbeSeqLock&); // Not implemented
+  void operator=(const vtkMRMLBetaProbeSeqLock&);          // Not implemented
+
+  enum { NumberOfWords = (sizeof(T) + sizeof(vtkTypeUInt64) - 1) / sizeof(vtkTypeUInt64) };
+
+  std::atomic<vtkTypeUInt64> Sequence;
+  std::atomic<vtkTypeUInt64> Words[NumberOfWords];
+};
+
+#endif
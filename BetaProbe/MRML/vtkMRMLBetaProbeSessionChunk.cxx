@@ -0,0 +1,232 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MRML includes
+#include "vtkMRMLBetaProbeSessionChunk.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <cstring>
+
+namespace
+{
+//----------------------------------------------------------------------------
+template <typename T>
+std::pair<char*, size_t> GetColumn(const std::vector<T>& values)
+{
+  return std::pair<char*, size_t>(
+    reinterpret_cast<char*>(const_cast<T*>(&values[0])), sizeof(T));
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkMRMLBetaProbeSessionChunk);
+
+//----------------------------------------------------------------------------
+vtkMRMLBetaProbeSessionChunk::vtkMRMLBetaProbeSessionChunk()
+{
+  this->NumberOfSamples = 0;
+
+  this->Timestamps.resize(Capacity);
+  this->DeviceTimes.resize(Capacity);
+  this->X.resize(Capacity);
+  this->Y.resize(Capacity);
+  this->Z.resize(Capacity);
+  for (int i = 0; i < 4; ++i)
+    {
+    this->Orientation[i].resize(Capacity);
+    }
+  this->Smoothed.resize(Capacity);
+  this->BetaGamma.resize(Capacity);
+  this->Gamma.resize(Capacity);
+  this->Sequences.resize(Capacity);
+  this->Flags.resize(Capacity);
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLBetaProbeSessionChunk::~vtkMRMLBetaProbeSessionChunk()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionChunk::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "NumberOfSamples: " << this->NumberOfSamples << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionChunk::GetNumberOfSamples() const
+{
+  return this->NumberOfSamples;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionChunk::IsFull() const
+{
+  return this->NumberOfSamples >= Capacity;
+}
+
+//----------------------------------------------------------------------------
+size_t vtkMRMLBetaProbeSessionChunk::GetMemorySize()
+{
+  const size_t bytesPerSample =
+    2 * sizeof(vtkTypeInt64) + 3 * sizeof(double) + 7 * sizeof(float) +
+    2 * sizeof(vtkTypeUInt32);
+  return bytesPerSample * Capacity;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionChunk::AppendSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                                                const vtkMRMLBetaProbeNode::countingData& counts)
+{
+  if (this->IsFull())
+    {
+    return false;
+    }
+
+  const int i = this->NumberOfSamples;
+
+  vtkTypeUInt32 flags = 0;
+  if (counts.DeviceTime != 0)
+    {
+    flags |= HasDeviceTime;
+    }
+  if (counts.HostTime != 0)
+    {
+    flags |= HasHostTime;
+    this->Timestamps[i] = counts.HostTime;
+    }
+  else
+    {
+    this->Timestamps[i] = counts.ReceiveTime;
+    }
+
+  this->DeviceTimes[i] = counts.DeviceTime;
+  this->X[i] = position.X;
+  this->Y[i] = position.Y;
+  this->Z[i] = position.Z;
+  for (int c = 0; c < 4; ++c)
+    {
+    this->Orientation[c][i] = static_cast<float>(position.Orientation[c]);
+    }
+  this->Smoothed[i] = static_cast<float>(counts.Smoothed);
+  this->BetaGamma[i] = static_cast<float>(counts.BetaGamma);
+  this->Gamma[i] = static_cast<float>(counts.Gamma);
+  this->Sequences[i] = counts.Sequence;
+  this->Flags[i] = flags;
+
+  this->NumberOfSamples++;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionChunk::DeepCopy(vtkMRMLBetaProbeSessionChunk* source)
+{
+  std::vector<column> columns;
+  std::vector<column> sourceColumns;
+  this->GetColumns(columns);
+  source->GetColumns(sourceColumns);
+  for (size_t c = 0; c < columns.size(); ++c)
+    {
+    memcpy(columns[c].first, sourceColumns[c].first,
+           columns[c].second * source->NumberOfSamples);
+    }
+  this->NumberOfSamples = source->NumberOfSamples;
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionChunk::GetSample(int i,
+                                             vtkMRMLBetaProbeNode::trackingData& position,
+                                             vtkMRMLBetaProbeNode::countingData& counts) const
+{
+  position.X = this->X[i];
+  position.Y = this->Y[i];
+  position.Z = this->Z[i];
+  for (int c = 0; c < 4; ++c)
+    {
+    position.Orientation[c] = this->Orientation[c][i];
+    }
+  position.ReceiveTime = this->Timestamps[i];
+
+  counts.Date[0] = '\0';
+  counts.Time[0] = '\0';
+  counts.Smoothed = this->Smoothed[i];
+  counts.BetaGamma = this->BetaGamma[i];
+  counts.Gamma = this->Gamma[i];
+  counts.Sequence = this->Sequences[i];
+  counts.DeviceTime = this->DeviceTimes[i];
+  counts.ReceiveTime = this->Timestamps[i];
+  counts.HostTime = (this->Flags[i] & HasHostTime) ? this->Timestamps[i] : 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionChunk::GetColumns(std::vector<column>& columns) const
+{
+  columns.clear();
+  columns.push_back(GetColumn(this->Timestamps));
+  columns.push_back(GetColumn(this->DeviceTimes));
+  columns.push_back(GetColumn(this->X));
+  columns.push_back(GetColumn(this->Y));
+  columns.push_back(GetColumn(this->Z));
+  for (int c = 0; c < 4; ++c)
+    {
+    columns.push_back(GetColumn(this->Orientation[c]));
+    }
+  columns.push_back(GetColumn(this->Smoothed));
+  columns.push_back(GetColumn(this->BetaGamma));
+  columns.push_back(GetColumn(this->Gamma));
+  columns.push_back(GetColumn(this->Sequences));
+  columns.push_back(GetColumn(this->Flags));
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionChunk::WriteColumns(FILE* file) const
+{
+  std::vector<column> columns;
+  this->GetColumns(columns);
+  for (size_t c = 0; c < columns.size(); ++c)
+    {
+    if (fwrite(columns[c].first, columns[c].second, Capacity, file) !=
+        static_cast<size_t>(Capacity))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionChunk::ReadColumns(FILE* file)
+{
+  std::vector<column> columns;
+  this->GetColumns(columns);
+  for (size_t c = 0; c < columns.size(); ++c)
+    {
+    if (fread(columns[c].first, columns[c].second, Capacity, file) !=
+        static_cast<size_t>(Capacity))
+      {
+      this->NumberOfSamples = 0;
+      return false;
+      }
+    }
+  this->NumberOfSamples = Capacity;
+  return true;
+}
@@ -0,0 +1,141 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkMRMLBetaProbeSessionChunk - fixed-size block of recorded samples
+// .SECTION Description
+// Stores up to Capacity recorded samples column by column: one contiguous
+// array per channel, allocated once when the chunk is created. Columns can
+// be scanned directly through the Get*() pointers, which stay valid for the
+// lifetime of the chunk. Chunks are only filled by
+// vtkMRMLBetaProbeSessionStore and are read-only for everyone else.
+//
+// Counts and orientations are stored in single precision, the precision of
+// the binary count packets; timestamps and positions in full precision.
+
+#ifndef __vtkMRMLBetaProbeSessionChunk_h
+#define __vtkMRMLBetaProbeSessionChunk_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// STD includes
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleMRMLExport.h"
+
+class VTK_SLICER_BETAPROBE_MODULE_MRML_EXPORT vtkMRMLBetaProbeSessionChunk : public vtkObject
+{
+public:
+  static vtkMRMLBetaProbeSessionChunk *New();
+  vtkTypeMacro(vtkMRMLBetaProbeSessionChunk, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Number of samples per chunk
+  enum { Capacity = 4096 };
+
+  // Description:
+  // Per-sample flags
+  // HasDeviceTime: DeviceTime is known
+  // HasHostTime: Timestamp was mapped from the device clock, instead of
+  // being the receive time
+  enum
+  {
+    HasDeviceTime = 0x1,
+    HasHostTime = 0x2
+  };
+
+  int GetNumberOfSamples() const;
+  bool IsFull() const;
+
+  // Description:
+  // Rebuild sample index. Date and Time are left empty.
+  void GetSample(int index,
+                 vtkMRMLBetaProbeNode::trackingData& position,
+                 vtkMRMLBetaProbeNode::countingData& counts) const;
+
+  // Description:
+  // Columns, GetNumberOfSamples() values each.
+  // Timestamp is the count time on the host clock (see
+  // vtkMRMLBetaProbeNode::GetHostTime()), 0 if unknown (sessions loaded
+  // from CSV logs).
+  // Orientation is (w, x, y, z), as in vtkMRMLBetaProbeNode::trackingData.
+  const vtkTypeInt64* GetTimestamps() const { return &this->Timestamps[0]; }
+  const vtkTypeInt64* GetDeviceTimes() const { return &this->DeviceTimes[0]; }
+  const double* GetX() const { return &this->X[0]; }
+  const double* GetY() const { return &this->Y[0]; }
+  const double* GetZ() const { return &this->Z[0]; }
+  const float* GetOrientation(int component) const { return &this->Orientation[component][0]; }
+  const float* GetSmoothed() const { return &this->Smoothed[0]; }
+  const float* GetBetaGamma() const { return &this->BetaGamma[0]; }
+  const float* GetGamma() const { return &this->Gamma[0]; }
+  const vtkTypeUInt32* GetSequences() const { return &this->Sequences[0]; }
+  const vtkTypeUInt32* GetFlags() const { return &this->Flags[0]; }
+
+  // Description:
+  // Memory used by the columns, in bytes
+  static size_t GetMemorySize();
+
+protected:
+  vtkMRMLBetaProbeSessionChunk();
+  ~vtkMRMLBetaProbeSessionChunk();
+  vtkMRMLBetaProbeSessionChunk(const vtkMRMLBetaProbeSessionChunk&);
+  void operator=(const vtkMRMLBetaProbeSessionChunk&);
+
+  friend class vtkMRMLBetaProbeSessionStore;
+
+  // Description:
+  // Append a sample. Return false if the chunk is full.
+  bool AppendSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                    const vtkMRMLBetaProbeNode::countingData& counts);
+
+  // Description:
+  // Copy the samples of source
+  void DeepCopy(vtkMRMLBetaProbeSessionChunk* source);
+
+  // Description:
+  // Write or read the columns of a full chunk, GetMemorySize() bytes, at
+  // the current position of file. Return false on I/O error.
+  bool WriteColumns(FILE* file) const;
+  bool ReadColumns(FILE* file);
+
+  // Description:
+  // Start and value size of every column, in the order of the members
+  typedef std::pair<char*, size_t> column;
+  void GetColumns(std::vector<column>& columns) const;
+
+  int NumberOfSamples;
+
+  std::vector<vtkTypeInt64> Timestamps;
+  std::vector<vtkTypeInt64> DeviceTimes;
+  std::vector<double> X;
+  std::vector<double> Y;
+  std::vector<double> Z;
+  std::vector<float> Orientation[4];
+  std::vector<float> Smoothed;
+  std::vector<float> BetaGamma;
+  std::vector<float> Gamma;
+  std::vector<vtkTypeUInt32> Sequences;
+  std::vector<vtkTypeUInt32> Flags;
+};
+
+#endif
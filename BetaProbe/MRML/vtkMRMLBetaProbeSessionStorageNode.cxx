@@ -0,0 +1,95 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MRML includes
+#include "vtkMRMLBetaProbeSessionStorageNode.h"
+#include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+#include <vtkStringArray.h>
+
+//----------------------------------------------------------------------------
+vtkMRMLNodeNewMacro(vtkMRMLBetaProbeSessionStorageNode);
+
+//----------------------------------------------------------------------------
+vtkMRMLBetaProbeSessionStorageNode::vtkMRMLBetaProbeSessionStorageNode()
+{
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLBetaProbeSessionStorageNode::~vtkMRMLBetaProbeSessionStorageNode()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStorageNode::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionStorageNode::CanReadInReferenceNode(vtkMRMLNode* refNode)
+{
+  return refNode && refNode->IsA("vtkMRMLBetaProbeNode");
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStorageNode::InitializeSupportedReadFileTypes()
+{
+  this->SupportedReadFileTypes->InsertNextValue("BetaProbe Session (.bpsession)");
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStorageNode::InitializeSupportedWriteFileTypes()
+{
+  this->SupportedWriteFileTypes->InsertNextValue("BetaProbe Session (.bpsession)");
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionStorageNode::ReadDataInternal(vtkMRMLNode* refNode)
+{
+  vtkMRMLBetaProbeNode* betaProbeNode = vtkMRMLBetaProbeNode::SafeDownCast(refNode);
+  if (!betaProbeNode)
+    {
+    vtkErrorMacro("ReadDataInternal: Reference node is not a vtkMRMLBetaProbeNode");
+    return 0;
+    }
+
+  std::string fullName = this->GetFullNameFromFileName();
+  if (!betaProbeNode->GetSessionStore()->ReadSessionFile(fullName.c_str()))
+    {
+    return 0;
+    }
+  betaProbeNode->Modified();
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionStorageNode::WriteDataInternal(vtkMRMLNode* refNode)
+{
+  vtkMRMLBetaProbeNode* betaProbeNode = vtkMRMLBetaProbeNode::SafeDownCast(refNode);
+  if (!betaProbeNode)
+    {
+    vtkErrorMacro("WriteDataInternal: Reference node is not a vtkMRMLBetaProbeNode");
+    return 0;
+    }
+
+  std::string fullName = this->GetFullNameFromFileName();
+  return betaProbeNode->GetSessionStore()->WriteSessionFile(fullName.c_str()) ? 1 : 0;
+}
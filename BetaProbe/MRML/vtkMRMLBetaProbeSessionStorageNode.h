@@ -0,0 +1,69 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkMRMLBetaProbeSessionStorageNode - storage of recorded sessions
+// .SECTION Description
+// Saves the samples recorded by a vtkMRMLBetaProbeNode to a compressed
+// session file next to the scene, and restores them when the scene is
+// loaded. See vtkMRMLBetaProbeSessionStore for the file layout.
+//
+// Reading reads every sample, spilling past the session memory budget, so
+// the file may go once the scene is loaded (.mrb bundles are unpacked to
+// a temporary directory). A truncated file fails the read and leaves the
+// recorded session as it was.
+
+#ifndef __vtkMRMLBetaProbeSessionStorageNode_h
+#define __vtkMRMLBetaProbeSessionStorageNode_h
+
+// MRML includes
+#include "vtkMRMLStorageNode.h"
+
+#include "vtkSlicerBetaProbeModuleMRMLExport.h"
+
+class VTK_SLICER_BETAPROBE_MODULE_MRML_EXPORT vtkMRMLBetaProbeSessionStorageNode : public vtkMRMLStorageNode
+{
+public:
+  static vtkMRMLBetaProbeSessionStorageNode *New();
+  vtkTypeMacro(vtkMRMLBetaProbeSessionStorageNode, vtkMRMLStorageNode);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  virtual vtkMRMLNode* CreateNodeInstance();
+
+  // Description:
+  // Get node XML tag name (like Storage, Model)
+  virtual const char* GetNodeTagName() {return "BetaProbeSessionStorage";};
+
+  // Description:
+  // Only vtkMRMLBetaProbeNode can be stored
+  virtual bool CanReadInReferenceNode(vtkMRMLNode* refNode);
+
+  virtual const char* GetDefaultWriteFileExtension() {return "bpsession";};
+
+protected:
+  vtkMRMLBetaProbeSessionStorageNode();
+  ~vtkMRMLBetaProbeSessionStorageNode();
+  vtkMRMLBetaProbeSessionStorageNode(const vtkMRMLBetaProbeSessionStorageNode&);
+  void operator=(const vtkMRMLBetaProbeSessionStorageNode&);
+
+  virtual void InitializeSupportedReadFileTypes();
+  virtual void InitializeSupportedWriteFileTypes();
+
+  virtual int ReadDataInternal(vtkMRMLNode* refNode);
+  virtual int WriteDataInternal(vtkMRMLNode* refNode);
+};
+
+#endif
@@ -0,0 +1,520 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// MRML includes
+#include "vtkMRMLBetaProbeSessionStore.h"
+
+// VTK includes
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtk_zlib.h>
+
+// STD includes
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+namespace
+{
+// Spilled chunks kept in memory once paged back
+const size_t NumberOfPagedChunks = 4;
+
+// Session file header, see class description
+const unsigned int SessionHeaderSize = 32;
+const vtkTypeUInt32 SessionByteOrderMark = 0x01020304;
+const vtkTypeUInt32 SessionVersion = 1;
+
+//----------------------------------------------------------------------------
+bool ReadSessionHeader(gzFile file, vtkTypeUInt64& numberOfSamples)
+{
+  char header[SessionHeaderSize];
+  if (gzread(file, header, SessionHeaderSize) != static_cast<int>(SessionHeaderSize) ||
+      memcmp(header, "BPSS", 4) != 0)
+    {
+    return false;
+    }
+
+  vtkTypeUInt32 byteOrderMark, version, capacity;
+  memcpy(&byteOrderMark, header + 4, 4);
+  memcpy(&version, header + 8, 4);
+  memcpy(&capacity, header + 12, 4);
+  memcpy(&numberOfSamples, header + 16, 8);
+  return byteOrderMark == SessionByteOrderMark &&
+    version == SessionVersion &&
+    capacity == static_cast<vtkTypeUInt32>(vtkMRMLBetaProbeSessionChunk::Capacity);
+}
+
+//----------------------------------------------------------------------------
+int SeekSpill(FILE* file, vtkTypeInt64 offset)
+{
+#if defined(_WIN32)
+  return _fseeki64(file, offset, SEEK_SET);
+#else
+  return fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+}
+}
+
+//----------------------------------------------------------------------------
+struct vtkMRMLBetaProbeSessionStore::spillFile
+{
+  spillFile(FILE* file) : File(file), Size(0) {}
+  ~spillFile() { fclose(this->File); }
+
+  FILE* File;
+  // Chunks are appended, never overwritten
+  vtkTypeInt64 Size;
+  // Held across every seek and the read or write that follows it: a copy
+  // of the store may page chunks back on another thread while this store
+  // spills new ones
+  std::mutex Mutex;
+};
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkMRMLBetaProbeSessionStore);
+
+//----------------------------------------------------------------------------
+vtkMRMLBetaProbeSessionStore::vtkMRMLBetaProbeSessionStore()
+{
+  this->NumberOfSamples = 0;
+  this->Generation = 0;
+  this->ResetGeneration = 0;
+  this->StoredGeneration = 0;
+  this->MemoryBudget = 0;
+  this->SpillFailed = false;
+  this->NumberOfSpilledChunks = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLBetaProbeSessionStore::~vtkMRMLBetaProbeSessionStore()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStore::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+
+  os << indent << "NumberOfSamples: " << this->NumberOfSamples << "\n";
+  os << indent << "Generation: " << this->Generation << "\n";
+  os << indent << "ResetGeneration: " << this->ResetGeneration << "\n";
+  os << indent << "NumberOfChunks: " << this->GetNumberOfChunks() << "\n";
+  os << indent << "MemorySize: " << this->GetMemorySize() << "\n";
+  os << indent << "MemoryBudget: " << this->MemoryBudget << "\n";
+  os << indent << "NumberOfSpilledChunks: " << this->NumberOfSpilledChunks << "\n";
+  os << indent << "StoredGeneration: " << this->StoredGeneration << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStore::AppendSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                                                const vtkMRMLBetaProbeNode::countingData& counts)
+{
+  if (this->Chunks.empty() || this->Chunks.back()->IsFull())
+    {
+    this->Chunks.push_back(vtkSmartPointer<vtkMRMLBetaProbeSessionChunk>::New());
+    this->SpillOffsets.push_back(-1);
+    this->EnforceMemoryBudget();
+    }
+  else if (this->Chunks.back()->GetReferenceCount() > 1)
+    {
+    // Shared with another store (or held by a reader): copy on write
+    vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> chunk =
+      vtkSmartPointer<vtkMRMLBetaProbeSessionChunk>::New();
+    chunk->DeepCopy(this->Chunks.back());
+    this->Chunks.back() = chunk;
+    }
+
+  this->Chunks.back()->AppendSample(position, counts);
+  this->NumberOfSamples++;
+  this->Generation++;
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStore::Initialize()
+{
+  this->Chunks.clear();
+  this->SpillOffsets.clear();
+  this->PagedChunks.clear();
+  this->NumberOfSamples = 0;
+  this->NumberOfSpilledChunks = 0;
+  this->SpillFailed = false;
+  // Temporary file, removed when no store shares it anymore
+  this->SpillFile.reset();
+  this->ResetGeneration = ++this->Generation;
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStore::ShallowCopy(vtkMRMLBetaProbeSessionStore* source)
+{
+  if (!source || source == this)
+    {
+    return;
+    }
+
+  const bool sourceStored = (source->Generation == source->StoredGeneration);
+  this->Initialize();
+  this->Chunks = source->Chunks;
+  this->SpillOffsets = source->SpillOffsets;
+  this->PagedChunks = source->PagedChunks;
+  this->NumberOfSamples = source->NumberOfSamples;
+  this->NumberOfSpilledChunks = source->NumberOfSpilledChunks;
+  this->SpillFile = source->SpillFile;
+  this->SpillFailed = source->SpillFailed;
+  this->StoredGeneration = sourceStored ? this->Generation : 0;
+  this->EnforceMemoryBudget();
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkMRMLBetaProbeSessionStore::GetGeneration() const
+{
+  return this->Generation;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkMRMLBetaProbeSessionStore::GetResetGeneration() const
+{
+  return this->ResetGeneration;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkMRMLBetaProbeSessionStore::GetNumberOfSamples() const
+{
+  return this->NumberOfSamples;
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionStore::GetNumberOfChunks() const
+{
+  return static_cast<int>(this->Chunks.size());
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> vtkMRMLBetaProbeSessionStore::AcquireChunk(int index) const
+{
+  if (index < 0 || index >= this->GetNumberOfChunks())
+    {
+    return NULL;
+    }
+  if (this->Chunks[index])
+    {
+    return this->Chunks[index];
+    }
+  return this->PageChunk(index);
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionStore::GetSample(vtkIdType index,
+                                             vtkMRMLBetaProbeNode::trackingData& position,
+                                             vtkMRMLBetaProbeNode::countingData& counts) const
+{
+  if (index < 0 || index >= this->NumberOfSamples)
+    {
+    return false;
+    }
+
+  int indexInChunk = 0;
+  vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> chunk =
+    this->AcquireChunkOfSample(index, indexInChunk);
+  if (!chunk)
+    {
+    return false;
+    }
+  chunk->GetSample(indexInChunk, position, counts);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkMRMLBetaProbeSessionChunk>
+vtkMRMLBetaProbeSessionStore::AcquireChunkOfSample(vtkIdType index, int& indexInChunk) const
+{
+  if (index < 0 || index >= this->NumberOfSamples)
+    {
+    return NULL;
+    }
+
+  const vtkIdType capacity = vtkMRMLBetaProbeSessionChunk::Capacity;
+  indexInChunk = static_cast<int>(index % capacity);
+  return this->AcquireChunk(static_cast<int>(index / capacity));
+}
+
+//----------------------------------------------------------------------------
+size_t vtkMRMLBetaProbeSessionStore::GetMemorySize() const
+{
+  const size_t numberOfChunks = this->Chunks.size() - this->NumberOfSpilledChunks +
+    this->PagedChunks.size();
+  return numberOfChunks * vtkMRMLBetaProbeSessionChunk::GetMemorySize();
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionStore::GetNumberOfSpilledChunks() const
+{
+  return this->NumberOfSpilledChunks;
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStore::SetMemoryBudget(size_t budget)
+{
+  this->MemoryBudget = budget;
+  this->EnforceMemoryBudget();
+}
+
+//----------------------------------------------------------------------------
+size_t vtkMRMLBetaProbeSessionStore::GetMemoryBudget() const
+{
+  return this->MemoryBudget;
+}
+
+//----------------------------------------------------------------------------
+void vtkMRMLBetaProbeSessionStore::EnforceMemoryBudget()
+{
+  if (this->MemoryBudget == 0 || this->SpillFailed)
+    {
+    return;
+    }
+
+  const size_t chunkSize = vtkMRMLBetaProbeSessionChunk::GetMemorySize();
+  const int lastChunk = this->GetNumberOfChunks() - 1;
+
+  // Chunks are spilled oldest first, so the first resident chunk follows
+  // the spilled ones
+  for (int index = this->NumberOfSpilledChunks; index < lastChunk; ++index)
+    {
+    const size_t residentSize =
+      (this->Chunks.size() - this->NumberOfSpilledChunks) * chunkSize;
+    if (residentSize <= this->MemoryBudget || !this->SpillChunk(index))
+      {
+      break;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionStore::SpillChunk(int index)
+{
+  if (!this->SpillFile)
+    {
+    FILE* file = tmpfile();
+    if (!file)
+      {
+      vtkErrorMacro("SpillChunk: Unable to create a temporary file, "
+                    "keeping every chunk in memory");
+      this->SpillFailed = true;
+      return false;
+      }
+    this->SpillFile = std::make_shared<spillFile>(file);
+    }
+
+  std::lock_guard<std::mutex> lock(this->SpillFile->Mutex);
+  const vtkTypeInt64 offset = this->SpillFile->Size;
+  if (SeekSpill(this->SpillFile->File, offset) != 0 ||
+      !this->Chunks[index]->WriteColumns(this->SpillFile->File))
+    {
+    vtkErrorMacro("SpillChunk: Unable to write to the temporary file, "
+                  "keeping every chunk in memory");
+    this->SpillFailed = true;
+    return false;
+    }
+
+  this->SpillFile->Size += static_cast<vtkTypeInt64>(vtkMRMLBetaProbeSessionChunk::GetMemorySize());
+  this->SpillOffsets[index] = offset;
+  this->Chunks[index] = NULL;
+  this->NumberOfSpilledChunks++;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> vtkMRMLBetaProbeSessionStore::PageChunk(int index) const
+{
+  for (std::deque<pagedChunk>::iterator it = this->PagedChunks.begin();
+       it != this->PagedChunks.end(); ++it)
+    {
+    if (it->first == index)
+      {
+      pagedChunk paged = *it;
+      this->PagedChunks.erase(it);
+      this->PagedChunks.push_front(paged);
+      return paged.second;
+      }
+    }
+
+  vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> chunk =
+    vtkSmartPointer<vtkMRMLBetaProbeSessionChunk>::New();
+  bool paged = false;
+  if (this->SpillFile)
+    {
+    std::lock_guard<std::mutex> lock(this->SpillFile->Mutex);
+    paged = SeekSpill(this->SpillFile->File, this->SpillOffsets[index]) == 0 &&
+      chunk->ReadColumns(this->SpillFile->File);
+    }
+  if (!paged)
+    {
+    vtkErrorMacro("AcquireChunk: Unable to read chunk " << index
+                  << " back from the temporary file");
+    return NULL;
+    }
+
+  this->PagedChunks.push_front(pagedChunk(index, chunk));
+  if (this->PagedChunks.size() > NumberOfPagedChunks)
+    {
+    this->PagedChunks.pop_back();
+    }
+  return chunk;
+}
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 vtkMRMLBetaProbeSessionStore::GetStoredGeneration() const
+{
+  return this->StoredGeneration;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionStore::WriteSessionFile(const char* fileName) const
+{
+  if (!fileName || !*fileName)
+    {
+    vtkErrorMacro("WriteSessionFile: No file name");
+    return false;
+    }
+
+  // Fastest compression: columns of a session compress well already
+  gzFile file = gzopen(fileName, "wb1");
+  if (!file)
+    {
+    vtkErrorMacro("WriteSessionFile: Unable to open " << fileName);
+    return false;
+    }
+
+  char header[SessionHeaderSize];
+  memset(header, 0, SessionHeaderSize);
+  const vtkTypeUInt32 capacity = vtkMRMLBetaProbeSessionChunk::Capacity;
+  const vtkTypeUInt64 numberOfSamples = this->NumberOfSamples;
+  memcpy(header, "BPSS", 4);
+  memcpy(header + 4, &SessionByteOrderMark, 4);
+  memcpy(header + 8, &SessionVersion, 4);
+  memcpy(header + 12, &capacity, 4);
+  memcpy(header + 16, &numberOfSamples, 8);
+  bool success = (gzwrite(file, header, SessionHeaderSize) == static_cast<int>(SessionHeaderSize));
+
+  std::vector<vtkMRMLBetaProbeSessionChunk::column> columns;
+  for (int index = 0; success && index < this->GetNumberOfChunks(); ++index)
+    {
+    vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> chunk = this->AcquireChunk(index);
+    if (!chunk)
+      {
+      success = false;
+      break;
+      }
+    chunk->GetColumns(columns);
+    for (size_t c = 0; success && c < columns.size(); ++c)
+      {
+      const unsigned int size =
+        static_cast<unsigned int>(columns[c].second * chunk->GetNumberOfSamples());
+      success = (gzwrite(file, columns[c].first, size) == static_cast<int>(size));
+      }
+    }
+
+  if (gzclose(file) != Z_OK || !success)
+    {
+    vtkErrorMacro("WriteSessionFile: Unable to write " << fileName);
+    return false;
+    }
+
+  const_cast<vtkMRMLBetaProbeSessionStore*>(this)->StoredGeneration = this->Generation;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionStore::ReadSessionFile(const char* fileName)
+{
+  if (!fileName || !*fileName)
+    {
+    vtkErrorMacro("ReadSessionFile: No file name");
+    return false;
+    }
+
+  vtkTypeUInt64 numberOfSamples = 0;
+  gzFile file = gzopen(fileName, "rb");
+  bool valid = (file && ReadSessionHeader(file, numberOfSamples));
+  if (file)
+    {
+    gzclose(file);
+    }
+  if (!valid)
+    {
+    vtkErrorMacro("ReadSessionFile: " << fileName << " is not a BetaProbe session file");
+    return false;
+    }
+
+  // Samples are read into a new store first: if the file is truncated,
+  // the samples of this one are kept
+  vtkNew<vtkMRMLBetaProbeSessionStore> session;
+  session->SetMemoryBudget(this->MemoryBudget);
+  if (!session->ReadSessionSamples(fileName))
+    {
+    vtkErrorMacro("ReadSessionFile: Unable to read the samples of " << fileName);
+    return false;
+    }
+
+  this->ShallowCopy(session.GetPointer());
+  this->StoredGeneration = this->Generation;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkMRMLBetaProbeSessionStore::ReadSessionSamples(const char* fileName)
+{
+  gzFile file = gzopen(fileName, "rb");
+  vtkTypeUInt64 numberOfSamples = 0;
+  if (!file || !ReadSessionHeader(file, numberOfSamples))
+    {
+    if (file)
+      {
+      gzclose(file);
+      }
+    return false;
+    }
+
+  std::vector<vtkMRMLBetaProbeSessionChunk::column> columns;
+  vtkTypeUInt64 remaining = numberOfSamples;
+  bool success = true;
+  while (success && remaining > 0)
+    {
+    vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> chunk =
+      vtkSmartPointer<vtkMRMLBetaProbeSessionChunk>::New();
+    const int numberOfChunkSamples = static_cast<int>(
+      std::min<vtkTypeUInt64>(remaining, vtkMRMLBetaProbeSessionChunk::Capacity));
+    chunk->GetColumns(columns);
+    for (size_t c = 0; success && c < columns.size(); ++c)
+      {
+      const unsigned int size =
+        static_cast<unsigned int>(columns[c].second * numberOfChunkSamples);
+      success = (gzread(file, columns[c].first, size) == static_cast<int>(size));
+      }
+    if (success)
+      {
+      chunk->NumberOfSamples = numberOfChunkSamples;
+      this->Chunks.push_back(chunk);
+      this->SpillOffsets.push_back(-1);
+      this->NumberOfSamples += numberOfChunkSamples;
+      this->EnforceMemoryBudget();
+      remaining -= numberOfChunkSamples;
+      }
+    }
+
+  gzclose(file);
+  return success;
+}
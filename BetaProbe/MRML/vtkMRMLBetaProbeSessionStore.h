@@ -0,0 +1,183 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// .NAME vtkMRMLBetaProbeSessionStore - columnar store of recorded samples
+// .SECTION Description
+// Samples recorded during a session, kept in a list of
+// vtkMRMLBetaProbeSessionChunk. The store grows one chunk at a time, so
+// recorded samples are never moved or copied when it grows.
+//
+// Samples are read in place through the column pointers of the chunks.
+// Past MemoryBudget, the oldest full chunks are spilled to an anonymous
+// temporary file and paged back on demand by AcquireChunk(); the chunk
+// returned stays valid as long as the caller holds it.
+//
+// Full chunks never change, so ShallowCopy() shares them, spilled or not,
+// between stores. The last chunk is shared as well, and duplicated by the
+// first store that appends to it. Stores sharing chunks may be used from
+// different threads, e.g. one recording while a copy is read.
+//
+// Consumers remember the generation and number of samples they last
+// processed: if GetResetGeneration() is still older than that generation,
+// only the samples after that number are new, otherwise everything changed.
+//
+// Session files are gzip-compressed, written in native byte order:
+//   offset size
+//        0    4  magic "BPSS"
+//        4    4  byte order mark 0x01020304
+//        8    4  version (1)
+//       12    4  samples per chunk (vtkMRMLBetaProbeSessionChunk::Capacity)
+//       16    8  number of samples
+//       24    8  reserved (0)
+// followed, for every chunk, by its columns in the order of
+// vtkMRMLBetaProbeSessionChunk, each holding the samples of the chunk.
+
+#ifndef __vtkMRMLBetaProbeSessionStore_h
+#define __vtkMRMLBetaProbeSessionStore_h
+
+// VTK includes
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+
+// MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSessionChunk.h"
+
+// STD includes
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "vtkSlicerBetaProbeModuleMRMLExport.h"
+
+class VTK_SLICER_BETAPROBE_MODULE_MRML_EXPORT vtkMRMLBetaProbeSessionStore : public vtkObject
+{
+public:
+  static vtkMRMLBetaProbeSessionStore *New();
+  vtkTypeMacro(vtkMRMLBetaProbeSessionStore, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Append a sample, allocating a new chunk if the last one is full.
+  // Does not invoke Modified().
+  void AppendSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                    const vtkMRMLBetaProbeNode::countingData& counts);
+
+  // Description:
+  // Remove all samples
+  void Initialize();
+
+  // Description:
+  // Share the samples of source, without copying them. Costs one pointer
+  // per chunk.
+  void ShallowCopy(vtkMRMLBetaProbeSessionStore* source);
+
+  vtkIdType GetNumberOfSamples() const;
+
+  // Description:
+  // Generation is incremented by every change of the store. ResetGeneration
+  // is the generation of the last Initialize(), i.e. of the last change that
+  // was not an append.
+  vtkTypeUInt64 GetGeneration() const;
+  vtkTypeUInt64 GetResetGeneration() const;
+
+  // Description:
+  // Chunks hold vtkMRMLBetaProbeSessionChunk::Capacity samples each, but
+  // the last one.
+  // A NULL chunk is returned if index is out of range or if a spilled
+  // chunk could not be read back.
+  int GetNumberOfChunks() const;
+  vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> AcquireChunk(int index) const;
+
+  // Description:
+  // Chunk holding sample index, and position of the sample in that chunk.
+  vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> AcquireChunkOfSample(vtkIdType index,
+                                                                     int& indexInChunk) const;
+
+  // Description:
+  // Rebuild sample index. Return false if index is out of range.
+  bool GetSample(vtkIdType index,
+                 vtkMRMLBetaProbeNode::trackingData& position,
+                 vtkMRMLBetaProbeNode::countingData& counts) const;
+
+  // Description:
+  // Memory allowed for the recorded chunks, in bytes. 0 keeps every chunk
+  // in memory. The chunk being filled is never spilled.
+  void SetMemoryBudget(size_t budget);
+  size_t GetMemoryBudget() const;
+
+  // Description:
+  // Memory allocated for the samples (recorded and paged back chunks), in bytes
+  size_t GetMemorySize() const;
+
+  int GetNumberOfSpilledChunks() const;
+
+  // Description:
+  // Write the samples to a session file. Return false on error.
+  bool WriteSessionFile(const char* fileName) const;
+
+  // Description:
+  // Replace the samples with those of a session file. Chunks past the
+  // memory budget are spilled while reading. Return false, and keep the
+  // samples, if the file is not a session file or is truncated.
+  bool ReadSessionFile(const char* fileName);
+
+  // Description:
+  // Generation of the samples last written to or read from a session file
+  vtkTypeUInt64 GetStoredGeneration() const;
+
+protected:
+  vtkMRMLBetaProbeSessionStore();
+  ~vtkMRMLBetaProbeSessionStore();
+  vtkMRMLBetaProbeSessionStore(const vtkMRMLBetaProbeSessionStore&);
+  void operator=(const vtkMRMLBetaProbeSessionStore&);
+
+  typedef std::pair<int, vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> > pagedChunk;
+
+  // Temporary file, shared by the stores sharing its chunks
+  struct spillFile;
+
+  void EnforceMemoryBudget();
+  bool SpillChunk(int index);
+  vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> PageChunk(int index) const;
+
+  // Append the samples of a session file to an empty store
+  bool ReadSessionSamples(const char* fileName);
+
+  // Spilled chunks are NULL, and their offset in SpillFile is kept in
+  // SpillOffsets
+  std::vector< vtkSmartPointer<vtkMRMLBetaProbeSessionChunk> > Chunks;
+  std::vector<vtkTypeInt64> SpillOffsets;
+  vtkIdType NumberOfSamples;
+
+  size_t MemoryBudget;
+  std::shared_ptr<spillFile> SpillFile;
+  bool SpillFailed;
+  int NumberOfSpilledChunks;
+
+  // Most recently paged back chunks, most recent first
+  mutable std::deque<pagedChunk> PagedChunks;
+
+  vtkTypeUInt64 Generation;
+  vtkTypeUInt64 ResetGeneration;
+  vtkTypeUInt64 StoredGeneration;
+};
+
+#endif
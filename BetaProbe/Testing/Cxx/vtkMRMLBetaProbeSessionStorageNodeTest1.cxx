@@ -0,0 +1,209 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSessionChunk.h"
+#include "vtkMRMLBetaProbeSessionStorageNode.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkNew.h>
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// A session of a few chunks, spilled past the memory budget, is saved to a
+// .bpsession file and read into a node holding other samples. Copies of
+// the file torn at several points, as an interrupted save or copy leaves
+// them, fail the read and leave the samples of the node as they were.
+
+namespace
+{
+const vtkIdType NumberOfSamples = 3 * vtkMRMLBetaProbeSessionChunk::Capacity + 100;
+
+//----------------------------------------------------------------------------
+// Sample index as recorded, and as read back: the store keeps a single
+// timestamp, the host time if known
+void MakeSessionSample(vtkIdType index,
+                       vtkMRMLBetaProbeNode::trackingData& position,
+                       vtkMRMLBetaProbeNode::countingData& counts)
+{
+  vtkSlicerBetaProbeTestingUtilities::MakeSample(index, 0.25 * index, position, counts);
+  position.X += 1e-9;
+  position.Orientation[0] = 0.5;
+  position.Orientation[1] = -0.5;
+  position.Orientation[2] = 0.25;
+  position.Orientation[3] = 0.75;
+  counts.ReceiveTime = 5000000000LL + index * 1000000;
+  counts.HostTime = (index % 5 != 0) ? counts.ReceiveTime : 0;
+  counts.DeviceTime = (index % 11 != 0) ? counts.DeviceTime : 0;
+  position.ReceiveTime = counts.ReceiveTime;
+}
+
+//----------------------------------------------------------------------------
+bool CheckSamples(int line, vtkMRMLBetaProbeSessionStore* store, vtkIdType count)
+{
+  if (store->GetNumberOfSamples() != count)
+    {
+    std::cerr << "Line " << line << ": " << store->GetNumberOfSamples()
+              << " samples instead of " << count << std::endl;
+    return false;
+    }
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  for (vtkIdType i = 0; i < count; ++i)
+    {
+    MakeSessionSample(i, position, counts);
+    if (!vtkSlicerBetaProbeTestingUtilities::CheckSample(line, store, i, position, counts))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool ReadFile(const std::string& fileName, std::string& contents)
+{
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (!file)
+    {
+    return false;
+    }
+  contents.clear();
+  char buffer[65536];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+    contents.append(buffer, size);
+    }
+  fclose(file);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool WriteFile(const std::string& fileName, const std::string& contents)
+{
+  FILE* file = fopen(fileName.c_str(), "wb");
+  if (!file)
+    {
+    return false;
+    }
+  const bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+  return fclose(file) == 0 && written;
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionStorageNodeTest1(int argc, char* argv[])
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: " << argv[0] << " temporary_directory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string fileName = std::string(argv[1]) + "/vtkMRMLBetaProbeSessionStorageNodeTest1.bpsession";
+  const std::string tornFileName = std::string(argv[1]) + "/vtkMRMLBetaProbeSessionStorageNodeTest1-torn.bpsession";
+  const size_t budget = 2 * vtkMRMLBetaProbeSessionChunk::GetMemorySize();
+
+  vtkNew<vtkMRMLBetaProbeNode> node;
+  vtkMRMLBetaProbeSessionStore* store = node->GetSessionStore();
+  store->SetMemoryBudget(budget);
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  for (vtkIdType i = 0; i < NumberOfSamples; ++i)
+    {
+    MakeSessionSample(i, position, counts);
+    store->AppendSample(position, counts);
+    }
+  if (store->GetNumberOfSpilledChunks() == 0 ||
+      store->GetStoredGeneration() == store->GetGeneration())
+    {
+    std::cerr << "Line " << __LINE__ << ": the session was not spilled, or is saved"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkMRMLBetaProbeSessionStorageNode> storageNode;
+  storageNode->SetFileName(fileName.c_str());
+  if (!storageNode->WriteData(node.GetPointer()) ||
+      store->GetStoredGeneration() != store->GetGeneration())
+    {
+    std::cerr << "Line " << __LINE__ << ": unable to save " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Every sample replaces those of the node, spilled while they are read
+  vtkNew<vtkMRMLBetaProbeNode> readNode;
+  vtkMRMLBetaProbeSessionStore* readStore = readNode->GetSessionStore();
+  readStore->SetMemoryBudget(budget);
+  for (int i = 0; i < 5; ++i)
+    {
+    vtkSlicerBetaProbeTestingUtilities::AppendSample(readStore, i, i, i, i, i, i);
+    }
+  if (!storageNode->ReadData(readNode.GetPointer()) ||
+      !CheckSamples(__LINE__, readStore, NumberOfSamples) ||
+      readStore->GetNumberOfSpilledChunks() == 0 ||
+      readStore->GetStoredGeneration() != readStore->GetGeneration())
+    {
+    std::cerr << "Line " << __LINE__ << ": " << fileName << " was read wrong" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Torn in the header, in the middle, and before the last chunk is
+  // complete; then not a session file, and missing
+  std::string contents;
+  if (!ReadFile(fileName, contents))
+    {
+    std::cerr << "Line " << __LINE__ << ": unable to read " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string tornFiles[] =
+  {
+    contents.substr(0, 20),
+    contents.substr(0, contents.size() / 2),
+    contents.substr(0, contents.size() - 100),
+    std::string("BPSX") + std::string(28, '\0')
+  };
+  const vtkTypeUInt64 generation = readStore->GetGeneration();
+  storageNode->SetFileName(tornFileName.c_str());
+  for (size_t t = 0; t <= sizeof(tornFiles) / sizeof(tornFiles[0]); ++t)
+    {
+    remove(tornFileName.c_str());
+    if (t < sizeof(tornFiles) / sizeof(tornFiles[0]) && !WriteFile(tornFileName, tornFiles[t]))
+      {
+      std::cerr << "Line " << __LINE__ << ": unable to write " << tornFileName << std::endl;
+      return EXIT_FAILURE;
+      }
+    if (storageNode->ReadData(readNode.GetPointer()) ||
+        readStore->GetGeneration() != generation ||
+        !CheckSamples(__LINE__, readStore, NumberOfSamples))
+      {
+      std::cerr << "Line " << __LINE__ << ": torn file " << t << " was read" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  remove(tornFileName.c_str());
+  remove(fileName.c_str());
+
+  return EXIT_SUCCESS;
+}
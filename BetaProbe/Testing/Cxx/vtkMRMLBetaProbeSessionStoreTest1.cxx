@@ -0,0 +1,178 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe MRML includes
+#include "vtkMRMLBetaProbeSessionChunk.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkNew.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+using vtkSlicerBetaProbeTestingUtilities::MakeSample;
+
+namespace
+{
+//----------------------------------------------------------------------------
+void AppendSamples(vtkMRMLBetaProbeSessionStore* store, vtkIdType count, double offset)
+{
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  const vtkIdType first = store->GetNumberOfSamples();
+  for (vtkIdType i = first; i < first + count; ++i)
+    {
+    MakeSample(i, i + offset, position, counts);
+    store->AppendSample(position, counts);
+    }
+}
+
+//----------------------------------------------------------------------------
+bool CheckSample(int line, vtkMRMLBetaProbeSessionStore* store,
+                 vtkIdType index, double value)
+{
+  vtkMRMLBetaProbeNode::trackingData expectedPosition;
+  vtkMRMLBetaProbeNode::countingData expectedCounts;
+  MakeSample(index, value, expectedPosition, expectedCounts);
+  return vtkSlicerBetaProbeTestingUtilities::CheckSample(
+    line, store, index, expectedPosition, expectedCounts);
+}
+
+//----------------------------------------------------------------------------
+bool CheckSamples(int line, vtkMRMLBetaProbeSessionStore* store,
+                  vtkIdType begin, vtkIdType end, double offset)
+{
+  for (vtkIdType i = begin; i < end; ++i)
+    {
+    if (!CheckSample(line, store, i, i + offset))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionStoreTest1(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  const vtkIdType capacity = vtkMRMLBetaProbeSessionChunk::Capacity;
+  const size_t chunkSize = vtkMRMLBetaProbeSessionChunk::GetMemorySize();
+
+  // Within the budget, every chunk stays in memory
+  vtkNew<vtkMRMLBetaProbeSessionStore> store;
+  store->SetMemoryBudget(3 * chunkSize);
+  AppendSamples(store.GetPointer(), capacity + 1, 0.0);
+  if (store->GetNumberOfSamples() != capacity + 1 ||
+      store->GetNumberOfChunks() != 2 ||
+      store->GetNumberOfSpilledChunks() != 0)
+    {
+    std::cerr << "Line " << __LINE__ << ": " << store->GetNumberOfSamples()
+              << " samples in " << store->GetNumberOfChunks() << " chunks, "
+              << store->GetNumberOfSpilledChunks() << " spilled" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Past the budget, the oldest full chunks are spilled
+  const vtkIdType numberOfSamples = 8 * capacity + 100;
+  AppendSamples(store.GetPointer(), numberOfSamples - store->GetNumberOfSamples(), 0.0);
+  if (store->GetNumberOfSamples() != numberOfSamples ||
+      store->GetNumberOfChunks() != 9 ||
+      store->GetNumberOfSpilledChunks() < 5)
+    {
+    std::cerr << "Line " << __LINE__ << ": " << store->GetNumberOfSamples()
+              << " samples in " << store->GetNumberOfChunks() << " chunks, "
+              << store->GetNumberOfSpilledChunks() << " spilled" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!CheckSamples(__LINE__, store.GetPointer(), 0, numberOfSamples, 0.0))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Paging back all chunks keeps the memory bounded: on top of the budget,
+  // only the chunk being filled and the last few paged back chunks are kept
+  if (store->GetMemorySize() > store->GetMemoryBudget() + 5 * chunkSize)
+    {
+    std::cerr << "Line " << __LINE__ << ": " << store->GetMemorySize()
+              << " bytes allocated for a budget of " << store->GetMemoryBudget()
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  if (store->GetSample(-1, position, counts) ||
+      store->GetSample(numberOfSamples, position, counts))
+    {
+    std::cerr << "Line " << __LINE__ << ": out of range samples were returned" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Appending to the source does not change a shallow copy, nor the other
+  // way around, although they share the last chunk until then
+  vtkNew<vtkMRMLBetaProbeSessionStore> copy;
+  copy->ShallowCopy(store.GetPointer());
+  if (copy->GetNumberOfSamples() != numberOfSamples ||
+      !CheckSamples(__LINE__, copy.GetPointer(), 0, numberOfSamples, 0.0))
+    {
+    return EXIT_FAILURE;
+    }
+
+  AppendSamples(store.GetPointer(), 10, 0.0);
+  if (copy->GetNumberOfSamples() != numberOfSamples ||
+      copy->GetSample(numberOfSamples, position, counts))
+    {
+    std::cerr << "Line " << __LINE__ << ": the copy has "
+              << copy->GetNumberOfSamples() << " samples" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  AppendSamples(copy.GetPointer(), 20, 1000.0);
+  if (store->GetNumberOfSamples() != numberOfSamples + 10 ||
+      copy->GetNumberOfSamples() != numberOfSamples + 20 ||
+      !CheckSamples(__LINE__, store.GetPointer(), numberOfSamples - 10, numberOfSamples + 10, 0.0) ||
+      !CheckSamples(__LINE__, copy.GetPointer(), numberOfSamples - 10, numberOfSamples, 0.0) ||
+      !CheckSamples(__LINE__, copy.GetPointer(), numberOfSamples, numberOfSamples + 20, 1000.0))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Filling the shared chunk and spilling more does not affect the copy
+  AppendSamples(store.GetPointer(), 3 * capacity, 0.0);
+  if (!CheckSamples(__LINE__, copy.GetPointer(), 0, numberOfSamples, 0.0) ||
+      !CheckSamples(__LINE__, copy.GetPointer(), numberOfSamples, numberOfSamples + 20, 1000.0) ||
+      !CheckSamples(__LINE__, store.GetPointer(), 0, store->GetNumberOfSamples(), 0.0))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Initialize() releases the samples of the source only
+  store->Initialize();
+  if (store->GetNumberOfSamples() != 0 || store->GetNumberOfChunks() != 0 ||
+      copy->GetNumberOfSamples() != numberOfSamples + 20 ||
+      !CheckSample(__LINE__, copy.GetPointer(), 0, 0.0))
+    {
+    std::cerr << "Line " << __LINE__ << ": Initialize() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe MRML includes
+#include "vtkMRMLBetaProbeSessionChunk.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+
+// STD includes
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+// A store keeps spilling chunks while a shallow copy sharing its temporary
+// file pages chunks back on another thread, as a background map update
+// does while recording goes on.
+
+namespace
+{
+//----------------------------------------------------------------------------
+void AppendSamples(vtkMRMLBetaProbeSessionStore* store, vtkIdType count)
+{
+  const vtkIdType first = store->GetNumberOfSamples();
+  for (vtkIdType i = first; i < first + count; ++i)
+    {
+    vtkSlicerBetaProbeTestingUtilities::AppendSample(
+      store, static_cast<double>(i), 0.0, 0.0, static_cast<double>(i % 1000), 0.0, i);
+    }
+}
+
+//----------------------------------------------------------------------------
+struct readerData
+{
+  vtkMRMLBetaProbeSessionStore* Store;
+  std::atomic<bool> Done;
+  int NumberOfPasses;
+  vtkIdType FirstError;
+};
+
+//----------------------------------------------------------------------------
+// Read every sample of the copy, again and again, until the source is done
+void* ReadSamples(void* ptr)
+{
+  vtkMultiThreader::ThreadInfo* info = static_cast<vtkMultiThreader::ThreadInfo*>(ptr);
+  readerData* data = static_cast<readerData*>(info->UserData);
+
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  const vtkIdType numberOfSamples = data->Store->GetNumberOfSamples();
+  while (data->FirstError < 0 && (!data->Done || data->NumberOfPasses < 2))
+    {
+    for (vtkIdType i = 0; i < numberOfSamples; ++i)
+      {
+      if (!data->Store->GetSample(i, position, counts) ||
+          position.X != static_cast<double>(i) ||
+          counts.Gamma != static_cast<double>(i % 1000) ||
+          counts.ReceiveTime != i)
+        {
+        data->FirstError = i;
+        return NULL;
+        }
+      }
+    data->NumberOfPasses++;
+    }
+  return NULL;
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkMRMLBetaProbeSessionStoreTest2(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  const vtkIdType capacity = vtkMRMLBetaProbeSessionChunk::Capacity;
+
+  vtkNew<vtkMRMLBetaProbeSessionStore> store;
+  store->SetMemoryBudget(2 * vtkMRMLBetaProbeSessionChunk::GetMemorySize());
+  AppendSamples(store.GetPointer(), 16 * capacity);
+
+  vtkNew<vtkMRMLBetaProbeSessionStore> copy;
+  copy->ShallowCopy(store.GetPointer());
+  if (copy->GetNumberOfSpilledChunks() < 10)
+    {
+    std::cerr << "Line " << __LINE__ << ": only " << copy->GetNumberOfSpilledChunks()
+              << " chunks were spilled" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  readerData data;
+  data.Store = copy.GetPointer();
+  data.Done = false;
+  data.NumberOfPasses = 0;
+  data.FirstError = -1;
+
+  vtkNew<vtkMultiThreader> threader;
+  const int threadID = threader->SpawnThread(&ReadSamples, &data);
+
+  // Every new chunk spills an older one to the shared file
+  for (int chunk = 0; chunk < 64; ++chunk)
+    {
+    AppendSamples(store.GetPointer(), capacity);
+    }
+  data.Done = true;
+  threader->TerminateThread(threadID);
+
+  if (data.FirstError >= 0)
+    {
+    std::cerr << "Line " << __LINE__ << ": sample " << data.FirstError
+              << " of the copy was read back wrong" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (store->GetNumberOfSpilledChunks() < 70 ||
+      store->GetNumberOfSamples() != 80 * capacity ||
+      copy->GetNumberOfSamples() != 16 * capacity)
+    {
+    std::cerr << "Line " << __LINE__ << ": " << store->GetNumberOfSpilledChunks()
+              << " chunks spilled" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // The chunks spilled meanwhile are read back as well
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  for (vtkIdType i = 0; i < store->GetNumberOfSamples(); ++i)
+    {
+    if (!store->GetSample(i, position, counts) || position.X != static_cast<double>(i))
+      {
+      std::cerr << "Line " << __LINE__ << ": sample " << i
+                << " was read back wrong" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe includes
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkSlicerBetaProbeActivityMap.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// Three overlapping samples, with a point size of 1 (boxes of 3 voxels
+// along every axis), in a 10^3 map with RAS = IJK:
+//   gamma 2, beta+gamma 5 at (4.5, 4.5, 4.5): voxels 3 to 5
+//   gamma 8, beta+gamma 10 at (5.5, 4.5, 4.5): voxels 4 to 6 along I
+//   gamma 5, beta+gamma 9 at (4.2, 4.2, 4.2): voxels 3 to 5
+// Voxel (4, 4, 4) is set by all of them, (3, 4, 4) by the first and the
+// last, (6, 4, 4) by the second only.
+
+using vtkSlicerBetaProbeTestingUtilities::AppendSample;
+
+namespace
+{
+typedef vtkSlicerBetaProbeActivityMap activityMap;
+
+const int Dimension = 10;
+
+//----------------------------------------------------------------------------
+double GetVoxel(vtkImageData* image, int i, int j, int k)
+{
+  const vtkIdType index = (static_cast<vtkIdType>(k) * Dimension + j) * Dimension + i;
+  if (image->GetScalarType() == VTK_FLOAT)
+    {
+    return static_cast<float*>(image->GetScalarPointer())[index];
+    }
+  return static_cast<double*>(image->GetScalarPointer())[index];
+}
+
+//----------------------------------------------------------------------------
+bool CheckVoxel(int line, const char* name, vtkImageData* image, int i,
+                double expected, double tolerance)
+{
+  const double value = GetVoxel(image, i, 4, 4);
+  if (!(std::fabs(value - expected) <= tolerance))
+    {
+    std::cerr << "Line " << line << ": " << name << " of voxel (" << i
+              << ", 4, 4) is " << value << " instead of " << expected << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Values of voxels (3, 4, 4), (4, 4, 4) and (6, 4, 4); (0, 4, 4) is not set
+bool CheckVoxels(int line, const char* name, vtkImageData* image,
+                 const double expected[3], double tolerance)
+{
+  return CheckVoxel(line, name, image, 3, expected[0], tolerance) &&
+    CheckVoxel(line, name, image, 4, expected[1], tolerance) &&
+    CheckVoxel(line, name, image, 6, expected[2], tolerance) &&
+    CheckVoxel(line, name, image, 0, 0.0, 0.0);
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeActivityMapTest1(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  vtkNew<vtkMRMLBetaProbeSessionStore> store;
+  AppendSample(store.GetPointer(), 4.5, 4.5, 4.5, 2.0, 5.0, 1);
+  AppendSample(store.GetPointer(), 5.5, 4.5, 4.5, 8.0, 10.0, 2);
+  AppendSample(store.GetPointer(), 4.2, 4.2, 4.2, 5.0, 9.0, 3);
+
+  const int dimensions[3] = { Dimension, Dimension, Dimension };
+  vtkNew<vtkMatrix4x4> rasToIJK;
+  vtkNew<activityMap> map;
+  map->SetGeometry(dimensions, rasToIJK.GetPointer());
+  map->SetPointSize(1);
+
+  // Every aggregation, switching from one to the next
+  const struct
+  {
+    int Aggregation;
+    const char* Name;
+    double Expected[3];
+  } aggregations[] =
+  {
+    { activityMap::AggregateLatest, "Latest", { 5.0, 5.0, 8.0 } },
+    { activityMap::AggregateMean, "Mean", { 3.5, 5.0, 8.0 } },
+    { activityMap::AggregateMaximum, "Maximum", { 5.0, 8.0, 8.0 } },
+    { activityMap::AggregateSum, "Sum", { 7.0, 15.0, 8.0 } },
+    { activityMap::AggregateCount, "Count", { 2.0, 3.0, 1.0 } },
+    { activityMap::AggregateLatest, "Latest", { 5.0, 5.0, 8.0 } }
+  };
+  const int numberOfAggregations = sizeof(aggregations) / sizeof(aggregations[0]);
+  for (int a = 0; a < numberOfAggregations; ++a)
+    {
+    map->SetAggregation(aggregations[a].Aggregation);
+    map->Update(store.GetPointer());
+    if (!CheckVoxels(__LINE__, aggregations[a].Name, map->GetOutput(),
+                     aggregations[a].Expected, 1e-12))
+      {
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Samples splatted one update at a time, into a float map
+  vtkNew<vtkMRMLBetaProbeSessionStore> growingStore;
+  map->SetScalarType(VTK_FLOAT);
+  map->SetAggregation(activityMap::AggregateMean);
+  map->ComputeCoverageOn();
+  for (vtkIdType s = 0; s < store->GetNumberOfSamples(); ++s)
+    {
+    vtkMRMLBetaProbeNode::trackingData position;
+    vtkMRMLBetaProbeNode::countingData counts;
+    store->GetSample(s, position, counts);
+    AppendSample(growingStore.GetPointer(), position.X, position.Y, position.Z,
+                 counts.Gamma, counts.BetaGamma, counts.ReceiveTime);
+    if (map->Update(growingStore.GetPointer()) != 1)
+      {
+      std::cerr << "Line " << __LINE__ << ": sample " << s << " was not splatted alone"
+                << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  const double expectedMean[3] = { 3.5, 5.0, 8.0 };
+  if (!CheckVoxels(__LINE__, "Mean", map->GetOutput(), expectedMean, 1e-6))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Coverage: sample standard deviation of {2, 5}, {2, 8, 5} and {8}
+  const double expectedCount[3] = { 2.0, 3.0, 1.0 };
+  const double expectedStandardDeviation[3] = { sqrt(4.5), 3.0, 0.0 };
+  if (!CheckVoxels(__LINE__, "Count",
+                   map->GetCoverageOutput(activityMap::CoverageCount),
+                   expectedCount, 0.0) ||
+      !CheckVoxels(__LINE__, "Standard deviation",
+                   map->GetCoverageOutput(activityMap::CoverageStandardDeviation),
+                   expectedStandardDeviation, 1e-5))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // 95% exact Poisson intervals of the summed counts (7, 15 and 8 gamma,
+  // 14, 24 and 10 beta+gamma), divided by the number of samples. The
+  // Wilson-Hilferty approximation is within 1% of them.
+  const double gammaLower[3] = { 2.8144 / 2, 8.3954 / 3, 3.4538 };
+  const double gammaUpper[3] = { 14.4227 / 2, 24.7402 / 3, 15.7632 };
+  const double betaGammaLower[3] = { 7.6539 / 2, 15.3773 / 3, 4.7954 };
+  const double betaGammaUpper[3] = { 23.4896 / 2, 35.7101 / 3, 18.3904 };
+  const struct
+  {
+    int Component;
+    const char* Name;
+    const double* Expected;
+  } bounds[] =
+  {
+    { activityMap::CoverageGammaLower, "Gamma lower bound", gammaLower },
+    { activityMap::CoverageGammaUpper, "Gamma upper bound", gammaUpper },
+    { activityMap::CoverageBetaGammaLower, "Beta+gamma lower bound", betaGammaLower },
+    { activityMap::CoverageBetaGammaUpper, "Beta+gamma upper bound", betaGammaUpper }
+  };
+  for (int b = 0; b < 4; ++b)
+    {
+    vtkImageData* image = map->GetCoverageOutput(bounds[b].Component);
+    for (int v = 0; v < 3; ++v)
+      {
+      const int i = (v == 0) ? 3 : (v == 1) ? 4 : 6;
+      if (!CheckVoxel(__LINE__, bounds[b].Name, image, i, bounds[b].Expected[v],
+                      0.01 * bounds[b].Expected[v]))
+        {
+        return EXIT_FAILURE;
+        }
+      }
+    if (!CheckVoxel(__LINE__, bounds[b].Name, image, 0, 0.0, 0.0))
+      {
+      return EXIT_FAILURE;
+      }
+    }
+
+  // A higher confidence level widens the intervals
+  const double upper95 = GetVoxel(map->GetCoverageOutput(activityMap::CoverageGammaUpper), 4, 4, 4);
+  const double lower95 = GetVoxel(map->GetCoverageOutput(activityMap::CoverageGammaLower), 4, 4, 4);
+  map->SetConfidenceLevel(0.99);
+  if (!(GetVoxel(map->GetCoverageOutput(activityMap::CoverageGammaUpper), 4, 4, 4) > upper95) ||
+      !(GetVoxel(map->GetCoverageOutput(activityMap::CoverageGammaLower), 4, 4, 4) < lower95))
+    {
+    std::cerr << "Line " << __LINE__ << ": the 99% interval is not wider" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  if (map->GetCoverageOutput(-1) ||
+      map->GetCoverageOutput(activityMap::NumberOfCoverageComponents))
+    {
+    std::cerr << "Line " << __LINE__ << ": out of range coverage images were returned"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Statistics over the memory limit are not allocated, and the map is not
+  // updated until they are not needed anymore
+  vtkNew<activityMap> limitedMap;
+  limitedMap->SetStatisticsMemoryLimit(Dimension * Dimension * Dimension);
+  limitedMap->SetGeometry(dimensions, rasToIJK.GetPointer());
+  limitedMap->SetAggregation(activityMap::AggregateMean);
+  if (limitedMap->Update(store.GetPointer()) != -1)
+    {
+    std::cerr << "Line " << __LINE__ << ": accumulators over the limit were allocated"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  limitedMap->SetAggregation(activityMap::AggregateLatest);
+  limitedMap->ComputeCoverageOn();
+  if (limitedMap->Update(store.GetPointer()) != -1)
+    {
+    std::cerr << "Line " << __LINE__ << ": coverage over the limit was allocated"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  limitedMap->ComputeCoverageOff();
+  if (limitedMap->Update(store.GetPointer()) != 3)
+    {
+    std::cerr << "Line " << __LINE__ << ": the map without statistics was not updated"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
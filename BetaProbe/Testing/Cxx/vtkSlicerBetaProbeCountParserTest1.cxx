@@ -0,0 +1,215 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeCountParser.h"
+
+// STD includes
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+//----------------------------------------------------------------------------
+bool CheckParse(int line, const char* datagram,
+                vtkSlicerBetaProbeCountParser::ParseStatus expectedStatus,
+                vtkMRMLBetaProbeNode::countingData& sample)
+{
+  const vtkSlicerBetaProbeCountParser::ParseStatus status =
+    vtkSlicerBetaProbeCountParser::ParseCSV(datagram, strlen(datagram), sample);
+  if (status != expectedStatus)
+    {
+    std::cerr << "Line " << line << ": parsing \"" << datagram << "\" returned "
+              << status << " instead of " << expectedStatus << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool CheckCounts(int line, const vtkMRMLBetaProbeNode::countingData& sample,
+                 double smoothed, double betaGamma, double gamma)
+{
+  if (sample.Smoothed != smoothed || sample.BetaGamma != betaGamma || sample.Gamma != gamma)
+    {
+    std::cerr << "Line " << line << ": counts are " << sample.Smoothed << ", "
+              << sample.BetaGamma << ", " << sample.Gamma << " instead of "
+              << smoothed << ", " << betaGamma << ", " << gamma << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool CheckDeviceTime(int line, const char* date, const char* time, bool expectedResult,
+                     vtkTypeInt64& deviceTime)
+{
+  vtkMRMLBetaProbeNode::countingData sample;
+  memset(&sample, 0, sizeof(sample));
+  strncpy(sample.Date, date, sizeof(sample.Date) - 1);
+  strncpy(sample.Time, time, sizeof(sample.Time) - 1);
+  if (vtkSlicerBetaProbeCountParser::ParseDeviceTime(sample) != expectedResult)
+    {
+    std::cerr << "Line " << line << ": \"" << date << " " << time << "\" was "
+              << (expectedResult ? "rejected" : "accepted") << std::endl;
+    return false;
+    }
+  deviceTime = sample.DeviceTime;
+  return true;
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeCountParserTest1(int vtkNotUsed(argc), char* vtkNotUsed(argv)[])
+{
+  vtkMRMLBetaProbeNode::countingData sample;
+
+  // Plain datagram, line terminator included
+  if (!CheckParse(__LINE__, "2013-05-10,12:34:56.789,12.5,1.25e2,-0.003\r\n",
+                  vtkSlicerBetaProbeCountParser::Success, sample) ||
+      !CheckCounts(__LINE__, sample, 12.5, 125.0, -0.003))
+    {
+    return EXIT_FAILURE;
+    }
+  if (strcmp(sample.Date, "2013-05-10") != 0 || strcmp(sample.Time, "12:34:56.789") != 0)
+    {
+    std::cerr << "Line " << __LINE__ << ": date and time are \"" << sample.Date
+              << "\" and \"" << sample.Time << "\"" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Counts padded with spaces and tabs, as QString::toDouble() accepted
+  if (!CheckParse(__LINE__, "2013-05-10,12:34:56, 12, 3.5, 4",
+                  vtkSlicerBetaProbeCountParser::Success, sample) ||
+      !CheckCounts(__LINE__, sample, 12.0, 3.5, 4.0))
+    {
+    return EXIT_FAILURE;
+    }
+  if (!CheckParse(__LINE__, "2013-05-10,12:34:56,\t7 ,  8\t, 9  \n",
+                  vtkSlicerBetaProbeCountParser::Success, sample) ||
+      !CheckCounts(__LINE__, sample, 7.0, 8.0, 9.0))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Malformed datagrams
+  if (!CheckParse(__LINE__, "a,b,1,2", vtkSlicerBetaProbeCountParser::MissingField, sample) ||
+      !CheckParse(__LINE__, "a,b,1,2,3,4", vtkSlicerBetaProbeCountParser::ExtraField, sample) ||
+      !CheckParse(__LINE__, "a,,1,2,3", vtkSlicerBetaProbeCountParser::MissingField, sample) ||
+      !CheckParse(__LINE__, "a,b,1x,2,3", vtkSlicerBetaProbeCountParser::InvalidNumber, sample) ||
+      !CheckParse(__LINE__, "a,b,1 2,2,3", vtkSlicerBetaProbeCountParser::InvalidNumber, sample) ||
+      !CheckParse(__LINE__, "a,b,  ,2,3", vtkSlicerBetaProbeCountParser::InvalidNumber, sample) ||
+      !CheckParse(__LINE__, "a,b,1e,2,3", vtkSlicerBetaProbeCountParser::InvalidNumber, sample))
+    {
+    return EXIT_FAILURE;
+    }
+
+  // Device times, against FormatDeviceTime()
+  vtkTypeInt64 deviceTime = 0;
+  if (!CheckDeviceTime(__LINE__, "2013-05-10", "12:34:56.789", true, deviceTime))
+    {
+    return EXIT_FAILURE;
+    }
+  sample.DeviceTime = deviceTime;
+  vtkSlicerBetaProbeCountParser::FormatDeviceTime(sample);
+  if (strcmp(sample.Date, "2013-05-10") != 0 || strcmp(sample.Time, "12:34:56.789") != 0)
+    {
+    std::cerr << "Line " << __LINE__ << ": device time formatted as \"" << sample.Date
+              << " " << sample.Time << "\"" << std::endl;
+    return EXIT_FAILURE;
+    }
+  vtkTypeInt64 wholeSecond = 0;
+  vtkTypeInt64 nanosecond = 0;
+  if (!CheckDeviceTime(__LINE__, "2013-05-10", "12:34:56", true, wholeSecond) ||
+      !CheckDeviceTime(__LINE__, "2013-05-10", "12:34:56.000000001", true, nanosecond) ||
+      !CheckDeviceTime(__LINE__, "2012-02-29", "00:00:00", true, deviceTime) ||
+      !CheckDeviceTime(__LINE__, "2000-02-29", "23:59:59", true, deviceTime))
+    {
+    return EXIT_FAILURE;
+    }
+  if (nanosecond - wholeSecond != 1)
+    {
+    std::cerr << "Line " << __LINE__ << ": fraction of second read as "
+              << nanosecond - wholeSecond << " ns" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Wrong numbers of digits, trailing characters and out of range fields,
+  // which mktime() would have normalized
+  const char* invalidTimes[][2] =
+    {
+    { "213-05-10", "12:34:56" }, { "20130-05-10", "12:34:56" },
+    { "2013-5-10", "12:34:56" }, { "2013-05-1", "12:34:56" },
+    { "2013-05-10", "2:34:56" }, { "2013-05-10", "12:345:56" },
+    { "2013-05-10", "12:34:5" }, { "2013-05-10", "12:34:56.1234567890" },
+    { "2013-05-10x1", "12:34:56" }, { "2013-05-10", "12:34:56.7x" },
+    { "2013-00-10", "12:34:56" }, { "2013-13-10", "12:34:56" },
+    { "2013-05-00", "12:34:56" }, { "2013-04-31", "12:34:56" },
+    { "2013-02-29", "12:34:56" }, { "1900-02-29", "12:34:56" },
+    { "2013-05-10", "24:00:00" }, { "2013-05-10", "12:60:56" },
+    { "2013-05-10", "12:34:60" }, { "", "12:34:56" }, { "2013-05-10", "" }
+    };
+  for (size_t i = 0; i < sizeof(invalidTimes) / sizeof(invalidTimes[0]); ++i)
+    {
+    if (!CheckDeviceTime(__LINE__, invalidTimes[i][0], invalidTimes[i][1], false, deviceTime))
+      {
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Numbers, against strtod()
+  const char* numbers[] =
+    {
+    "0.1", "-42", "+7", "1e-5", "0.000000123", "3.14159265358979",
+    "123456789012345678901234", "  2.5\t"
+    };
+  for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i)
+    {
+    double value = 0.0;
+    const double expected = strtod(numbers[i], NULL);
+    if (!vtkSlicerBetaProbeCountParser::ParseDouble(
+          numbers[i], numbers[i] + strlen(numbers[i]), value) ||
+        std::fabs(value - expected) > 1e-15 * std::fabs(expected))
+      {
+      std::cerr << "Line " << __LINE__ << ": \"" << numbers[i] << "\" parsed as "
+                << value << " instead of " << expected << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Malformed numbers, and numbers out of the range of double
+  const char* invalidNumbers[] =
+    {
+    "", " ", "-", ".", "1e", "1e+", "1.2.3", "0x10", "1,5", "inf", "nan",
+    "1e309", "-1e309", "1e99999", "123456789012345678901234e300"
+    };
+  for (size_t i = 0; i < sizeof(invalidNumbers) / sizeof(invalidNumbers[0]); ++i)
+    {
+    double value = 0.0;
+    if (vtkSlicerBetaProbeCountParser::ParseDouble(
+          invalidNumbers[i], invalidNumbers[i] + strlen(invalidNumbers[i]), value))
+      {
+      std::cerr << "Line " << __LINE__ << ": \"" << invalidNumbers[i] << "\" parsed as "
+                << value << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  return EXIT_SUCCESS;
+}
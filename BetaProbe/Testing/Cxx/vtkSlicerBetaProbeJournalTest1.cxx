@@ -0,0 +1,308 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe includes
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkSlicerBetaProbeJournal.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// A journal written in batches of 100 samples is left on disk as a crash
+// leaves it, then recovered: every sample of its batches, or those of the
+// batches before the first torn or corrupted one. A journal is only
+// recovered once, and is locked until it is removed.
+
+namespace
+{
+const int BatchSize = 100;
+const int NumberOfSamples = 1050;
+
+//----------------------------------------------------------------------------
+// Journal that can stop as if its process died
+class crashingJournal : public vtkSlicerBetaProbeJournal
+{
+public:
+  static crashingJournal* New();
+  vtkTypeMacro(crashingJournal, vtkSlicerBetaProbeJournal);
+
+  // Stop the writing thread, then release the file and its lock without
+  // removing it. The thread commits the pending samples before stopping.
+  void Crash()
+  {
+    this->StopRequested = true;
+    this->Thread->TerminateThread(this->ThreadID);
+    this->ThreadID = -1;
+    fclose(this->File);
+    this->File = NULL;
+  }
+
+protected:
+  crashingJournal() {}
+  ~crashingJournal() {}
+};
+
+vtkStandardNewMacro(crashingJournal);
+
+//----------------------------------------------------------------------------
+// Sample index as recorded, and as recovered: the journal keeps a single
+// timestamp, the host time if known
+void MakeJournalSample(vtkIdType index,
+                       vtkMRMLBetaProbeNode::trackingData& position,
+                       vtkMRMLBetaProbeNode::countingData& counts)
+{
+  vtkSlicerBetaProbeTestingUtilities::MakeSample(index, 0.25 * index, position, counts);
+  position.X += 1e-9;
+  position.Orientation[0] = 0.5;
+  position.Orientation[1] = -0.5;
+  position.Orientation[2] = 0.25;
+  position.Orientation[3] = 0.75;
+  counts.ReceiveTime = 5000000000LL + index * 1000000;
+  counts.HostTime = (index % 5 != 0) ? counts.ReceiveTime : 0;
+  counts.DeviceTime = (index % 11 != 0) ? counts.DeviceTime : 0;
+  position.ReceiveTime = counts.ReceiveTime;
+}
+
+//----------------------------------------------------------------------------
+bool CheckSamples(int line, vtkMRMLBetaProbeSessionStore* store, vtkIdType count)
+{
+  if (store->GetNumberOfSamples() != count)
+    {
+    std::cerr << "Line " << line << ": " << store->GetNumberOfSamples()
+              << " samples recovered instead of " << count << std::endl;
+    return false;
+    }
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  for (vtkIdType i = 0; i < count; ++i)
+    {
+    MakeJournalSample(i, position, counts);
+    if (!vtkSlicerBetaProbeTestingUtilities::CheckSample(line, store, i, position, counts))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool FileExists(const std::string& fileName)
+{
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (file)
+    {
+    fclose(file);
+    }
+  return file != NULL;
+}
+
+//----------------------------------------------------------------------------
+bool ReadFile(const std::string& fileName, std::string& contents)
+{
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (!file)
+    {
+    return false;
+    }
+  contents.clear();
+  char buffer[65536];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+    contents.append(buffer, size);
+    }
+  fclose(file);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool WriteFile(const std::string& fileName, const std::string& contents)
+{
+  FILE* file = fopen(fileName.c_str(), "wb");
+  if (!file)
+    {
+    return false;
+    }
+  const bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+  return fclose(file) == 0 && written;
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeJournalTest1(int argc, char* argv[])
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: " << argv[0] << " temporary_directory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string fileName = std::string(argv[1]) + "/vtkSlicerBetaProbeJournalTest1.bpjournal";
+  const std::string tornFileName = std::string(argv[1]) + "/vtkSlicerBetaProbeJournalTest1-torn.bpjournal";
+
+  // Batches of exactly BatchSize samples, the last one committed on Crash()
+  vtkNew<crashingJournal> journal;
+  journal->SetCommitRecords(BatchSize);
+  journal->SetCommitInterval(60.0);
+  if (!journal->Open(fileName.c_str()))
+    {
+    std::cerr << "Line " << __LINE__ << ": unable to open " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // The journal of a running session is not recovered
+  vtkNew<vtkMRMLBetaProbeNode> node;
+  vtkMRMLBetaProbeSessionStore* store = node->GetSessionStore();
+  vtkNew<vtkSlicerBetaProbeJournal> recovery;
+  if (recovery->Recover(fileName.c_str(), node.GetPointer()) != -1 ||
+      store->GetNumberOfSamples() != 0)
+    {
+    std::cerr << "Line " << __LINE__ << ": an open journal was recovered" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  for (vtkIdType i = 0; i < NumberOfSamples; ++i)
+    {
+    MakeJournalSample(i, position, counts);
+    if (!journal->WriteSample(position, counts))
+      {
+      std::cerr << "Line " << __LINE__ << ": sample " << i << " was dropped" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  const vtkTypeUInt64 fullBatches = (NumberOfSamples / BatchSize) * BatchSize;
+  for (int wait = 0; wait < 1000 && journal->GetNumberOfSamplesCommitted() < fullBatches; ++wait)
+    {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  journal->Crash();
+  if (journal->GetNumberOfSamplesCommitted() != NumberOfSamples ||
+      journal->GetWriteFailed() || !FileExists(fileName))
+    {
+    std::cerr << "Line " << __LINE__ << ": " << journal->GetNumberOfSamplesCommitted()
+              << " samples committed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Torn in the middle of the last batch, then with a corrupted record in
+  // the sixth batch: the batches before are recovered
+  std::string contents;
+  const size_t batchSize = vtkSlicerBetaProbeJournal::BatchHeaderSize +
+    BatchSize * vtkSlicerBetaProbeJournal::RecordSize;
+  const size_t sixthRecords = vtkSlicerBetaProbeJournal::HeaderSize + 5 * batchSize +
+    vtkSlicerBetaProbeJournal::BatchHeaderSize;
+  if (!ReadFile(fileName, contents) ||
+      contents.size() != vtkSlicerBetaProbeJournal::HeaderSize + 10 * batchSize +
+        vtkSlicerBetaProbeJournal::BatchHeaderSize + 50 * vtkSlicerBetaProbeJournal::RecordSize)
+    {
+    std::cerr << "Line " << __LINE__ << ": the journal holds " << contents.size()
+              << " bytes" << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string corrupted = contents;
+  corrupted[sixthRecords + 10 * vtkSlicerBetaProbeJournal::RecordSize + 3] ^= 0x10;
+  std::string notJournal = contents;
+  notJournal[2] = 'X';
+  const struct
+  {
+    std::string Contents;
+    vtkIdType NumberOfSamples;
+  } tornJournals[] =
+  {
+    { contents.substr(0, contents.size() - 40), fullBatches },
+    { contents.substr(0, sixthRecords - 4), 5 * BatchSize },
+    { corrupted, 5 * BatchSize },
+    { contents.substr(0, vtkSlicerBetaProbeJournal::HeaderSize), 0 },
+    { notJournal, -1 }
+  };
+  for (size_t t = 0; t < sizeof(tornJournals) / sizeof(tornJournals[0]); ++t)
+    {
+    store->Initialize();
+    vtkNew<vtkSlicerBetaProbeJournal> tornRecovery;
+    if (!WriteFile(tornFileName, tornJournals[t].Contents) ||
+        tornRecovery->Recover(tornFileName.c_str(), node.GetPointer()) !=
+          tornJournals[t].NumberOfSamples ||
+        !CheckSamples(__LINE__, store, std::max<vtkIdType>(tornJournals[t].NumberOfSamples, 0)))
+      {
+      std::cerr << "Line " << __LINE__ << ": torn journal " << t
+                << " was recovered wrong" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Released as is when the recovery is destroyed, without being removed
+  if (!FileExists(tornFileName))
+    {
+    std::cerr << "Line " << __LINE__ << ": a recovered journal was removed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  remove(tornFileName.c_str());
+
+  // Every sample, once
+  store->Initialize();
+  if (recovery->Recover(fileName.c_str(), node.GetPointer()) != NumberOfSamples ||
+      recovery->GetNumberOfRecoveredJournals() != 1 ||
+      !CheckSamples(__LINE__, store, NumberOfSamples))
+    {
+    std::cerr << "Line " << __LINE__ << ": the journal was recovered wrong" << std::endl;
+    return EXIT_FAILURE;
+    }
+  vtkNew<vtkSlicerBetaProbeJournal> secondRecovery;
+  if (secondRecovery->Recover(fileName.c_str(), node.GetPointer()) != -1 ||
+      recovery->Recover(fileName.c_str(), node.GetPointer()) != -1 ||
+      store->GetNumberOfSamples() != NumberOfSamples)
+    {
+    std::cerr << "Line " << __LINE__ << ": a recovered journal was recovered again" << std::endl;
+    return EXIT_FAILURE;
+    }
+  recovery->RemoveRecoveredJournals();
+  if (FileExists(fileName) || recovery->GetNumberOfRecoveredJournals() != 0)
+    {
+    std::cerr << "Line " << __LINE__ << ": the recovered journal was not removed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Journals closed normally are removed
+  vtkNew<vtkSlicerBetaProbeJournal> closedJournal;
+  if (!closedJournal->Open(fileName.c_str()) ||
+      !closedJournal->WriteSample(position, counts))
+    {
+    std::cerr << "Line " << __LINE__ << ": unable to write " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+  closedJournal->Close();
+  if (closedJournal->GetNumberOfSamplesCommitted() != 1 || FileExists(fileName))
+    {
+    std::cerr << "Line " << __LINE__ << ": the closed journal was kept" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
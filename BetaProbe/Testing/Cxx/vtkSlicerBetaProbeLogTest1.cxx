@@ -0,0 +1,359 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe Logic includes
+#include "vtkSlicerBetaProbeCountParser.h"
+#include "vtkSlicerBetaProbeLogFormat.h"
+#include "vtkSlicerBetaProbeLogReader.h"
+#include "vtkSlicerBetaProbeLogWriter.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkNew.h>
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A binary log of a continuous block and a single shot block is written,
+// read back record by record, searched by time and exported to CSV. A
+// copy torn in the middle of its last record, as a crash leaves it, is
+// read back up to that record, then appended to.
+
+namespace
+{
+typedef vtkSlicerBetaProbeLogFormat logFormat;
+
+const int NumberOfContinuousSamples = 1000;
+const int NumberOfSingleShots = 10;
+const vtkTypeInt64 SamplePeriod = 1000000;
+
+//----------------------------------------------------------------------------
+struct loggedSample
+{
+  vtkMRMLBetaProbeNode::trackingData Position;
+  vtkMRMLBetaProbeNode::countingData Counts;
+  bool Flagged;
+};
+
+//----------------------------------------------------------------------------
+// One sample per millisecond from startTime. Some have no host time, and
+// are timed by their receive time, some have no device time.
+loggedSample MakeLoggedSample(vtkIdType index, vtkTypeInt64 startTime, bool flagged)
+{
+  loggedSample sample;
+  vtkSlicerBetaProbeTestingUtilities::MakeSample(index, 0.25 * index,
+                                                 sample.Position, sample.Counts);
+  sample.Counts.ReceiveTime = startTime + index * SamplePeriod;
+  sample.Counts.HostTime = (index % 5 != 0) ? sample.Counts.ReceiveTime : 0;
+  sample.Counts.DeviceTime = (index % 11 != 0) ?
+    1700000000000000000LL + index * SamplePeriod : 0;
+  if (sample.Counts.DeviceTime != 0)
+    {
+    vtkSlicerBetaProbeCountParser::FormatDeviceTime(sample.Counts);
+    }
+  sample.Flagged = flagged;
+  return sample;
+}
+
+//----------------------------------------------------------------------------
+bool CheckSample(int line, const vtkSlicerBetaProbeLogReader::logRecord& record,
+                 const loggedSample& expected)
+{
+  const vtkMRMLBetaProbeNode::countingData& counts = expected.Counts;
+  const vtkMRMLBetaProbeNode::trackingData& position = expected.Position;
+  if (record.Type != logFormat::SampleRecord ||
+      record.Flagged != expected.Flagged ||
+      record.HostTime != counts.ReceiveTime ||
+      record.Counts.ReceiveTime != counts.ReceiveTime ||
+      record.Counts.HostTime != counts.HostTime ||
+      record.Counts.DeviceTime != counts.DeviceTime ||
+      record.Counts.Sequence != counts.Sequence ||
+      record.Counts.Smoothed != counts.Smoothed ||
+      record.Counts.BetaGamma != counts.BetaGamma ||
+      record.Counts.Gamma != counts.Gamma ||
+      record.Position.X != position.X ||
+      record.Position.Y != position.Y ||
+      record.Position.Z != position.Z)
+    {
+    std::cerr << "Line " << line << ": sample " << counts.Sequence << " read back as ("
+              << record.Type << ", " << record.Counts.Sequence << ", "
+              << record.Counts.Gamma << ", " << record.Position.X << ")" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool CheckBlock(int line, vtkSlicerBetaProbeLogReader* reader, int blockIndex,
+                int kind, vtkIdType beginIndex, vtkIdType endIndex,
+                const std::vector<loggedSample>& samples, size_t firstSample)
+{
+  const vtkSlicerBetaProbeLogReader::blockInfo* block = reader->GetBlock(blockIndex);
+  const vtkIdType numberOfSamples = endIndex - beginIndex - 1;
+  if (!block || block->Kind != kind || block->BeginIndex != beginIndex ||
+      block->EndIndex != endIndex || block->NumberOfSamples != numberOfSamples ||
+      block->FirstTime != samples[firstSample].Counts.ReceiveTime ||
+      block->LastTime != samples[firstSample + numberOfSamples - 1].Counts.ReceiveTime)
+    {
+    std::cerr << "Line " << line << ": block " << blockIndex << " is wrong" << std::endl;
+    return false;
+    }
+
+  vtkSlicerBetaProbeLogReader::logRecord record;
+  if (!reader->ReadRecord(beginIndex, record) ||
+      record.Type != logFormat::BlockBeginRecord || record.BlockKind != kind)
+    {
+    std::cerr << "Line " << line << ": record " << beginIndex
+              << " does not begin block " << blockIndex << std::endl;
+    return false;
+    }
+  for (vtkIdType i = 0; i < numberOfSamples; ++i)
+    {
+    if (!reader->ReadRecord(beginIndex + 1 + i, record) ||
+        !CheckSample(line, record, samples[firstSample + i]))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool ReadFile(const std::string& fileName, std::string& contents)
+{
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (!file)
+    {
+    return false;
+    }
+  contents.clear();
+  char buffer[65536];
+  size_t size = 0;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+    contents.append(buffer, size);
+    }
+  fclose(file);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool WriteFile(const std::string& fileName, const std::string& contents)
+{
+  FILE* file = fopen(fileName.c_str(), "wb");
+  if (!file)
+    {
+    return false;
+    }
+  const bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+  return fclose(file) == 0 && written;
+}
+
+//----------------------------------------------------------------------------
+// Write a block of samples [first, last) to an open writer
+bool WriteBlock(vtkSlicerBetaProbeLogWriter* writer, int kind,
+                const std::vector<loggedSample>& samples, size_t first, size_t last)
+{
+  bool queued = writer->BeginBlock(kind);
+  for (size_t i = first; i < last; ++i)
+    {
+    queued = writer->WriteSample(samples[i].Position, samples[i].Counts,
+                                 samples[i].Flagged) && queued;
+    }
+  return writer->EndBlock(kind) && queued;
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeLogTest1(int argc, char* argv[])
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: " << argv[0] << " temporary_directory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string fileName = std::string(argv[1]) + "/vtkSlicerBetaProbeLogTest1.bplog";
+  const std::string tornFileName = std::string(argv[1]) + "/vtkSlicerBetaProbeLogTest1-torn.bplog";
+  const std::string csvFileName = std::string(argv[1]) + "/vtkSlicerBetaProbeLogTest1.csv";
+  remove(fileName.c_str());
+  remove(tornFileName.c_str());
+
+  // Continuous samples, then single shots, then the samples appended to
+  // the torn log
+  const vtkTypeInt64 startTime = vtkMRMLBetaProbeNode::GetHostTime();
+  std::vector<loggedSample> samples;
+  for (vtkIdType i = 0; i < NumberOfContinuousSamples + 2 * NumberOfSingleShots; ++i)
+    {
+    samples.push_back(MakeLoggedSample(
+      i, startTime, i < NumberOfContinuousSamples && i % 7 == 3));
+    }
+  const size_t singleShots = NumberOfContinuousSamples;
+  const size_t appended = NumberOfContinuousSamples + NumberOfSingleShots;
+
+  vtkNew<vtkSlicerBetaProbeLogWriter> writer;
+  if (!writer->Open(fileName.c_str(), logFormat::BinaryFormat) ||
+      !WriteBlock(writer.GetPointer(), logFormat::ContinuousBlock, samples, 0, singleShots) ||
+      !WriteBlock(writer.GetPointer(), logFormat::SingleShotBlock, samples, singleShots, appended))
+    {
+    std::cerr << "Line " << __LINE__ << ": unable to write " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+  writer->Close();
+  const vtkIdType numberOfRecords = NumberOfContinuousSamples + NumberOfSingleShots + 4;
+  if (writer->GetNumberOfRecordsWritten() != static_cast<vtkTypeUInt64>(numberOfRecords) ||
+      writer->GetNumberOfRecordsDropped() != 0 || writer->GetWriteFailed())
+    {
+    std::cerr << "Line " << __LINE__ << ": " << writer->GetNumberOfRecordsWritten()
+              << " records written, " << writer->GetNumberOfRecordsDropped()
+              << " dropped" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Every record and block
+  vtkNew<vtkSlicerBetaProbeLogReader> reader;
+  if (!reader->Open(fileName.c_str()) ||
+      reader->GetNumberOfRecords() != numberOfRecords ||
+      reader->GetNumberOfBlocks() != 2 ||
+      !CheckBlock(__LINE__, reader.GetPointer(), 0, logFormat::ContinuousBlock,
+                  0, NumberOfContinuousSamples + 1, samples, 0) ||
+      !CheckBlock(__LINE__, reader.GetPointer(), 1, logFormat::SingleShotBlock,
+                  NumberOfContinuousSamples + 2, numberOfRecords - 1, samples, singleShots))
+    {
+    std::cerr << "Line " << __LINE__ << ": " << fileName << " was read back wrong" << std::endl;
+    return EXIT_FAILURE;
+    }
+  vtkSlicerBetaProbeLogReader::logRecord record;
+  if (reader->ReadRecord(-1, record) || reader->ReadRecord(numberOfRecords, record))
+    {
+    std::cerr << "Line " << __LINE__ << ": out of range records were read" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // Samples by wall time: the first at or after it, in the first block
+  // reaching it. Each block has its own host to wall clock offset.
+  const vtkSlicerBetaProbeLogReader::blockInfo* block = reader->GetBlock(0);
+  const vtkTypeInt64 firstWallTime = block->FirstTime + block->HostToWallOffset;
+  block = reader->GetBlock(1);
+  const vtkTypeInt64 singleShotWallTime = block->FirstTime + block->HostToWallOffset;
+  const struct
+  {
+    vtkTypeInt64 WallTime;
+    vtkIdType Index;
+  } searches[] =
+  {
+    { firstWallTime - 1000 * SamplePeriod, 1 },
+    { firstWallTime, 1 },
+    { firstWallTime + 1, 2 },
+    { firstWallTime + 500 * SamplePeriod, 501 },
+    { firstWallTime + (NumberOfContinuousSamples - 1) * SamplePeriod, NumberOfContinuousSamples },
+    { singleShotWallTime, NumberOfContinuousSamples + 3 },
+    { firstWallTime + 10000 * SamplePeriod, numberOfRecords }
+  };
+  for (size_t s = 0; s < sizeof(searches) / sizeof(searches[0]); ++s)
+    {
+    const vtkIdType index = reader->FindSample(searches[s].WallTime);
+    if (index != searches[s].Index)
+      {
+      std::cerr << "Line " << __LINE__ << ": search " << s << " found record " << index
+                << " instead of " << searches[s].Index << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // CSV export: the text the text format writes for the same records
+  std::string expectedText;
+  logFormat::FormatHeaderText(reader->GetCreationTime(), expectedText);
+  for (vtkIdType r = 0; r < numberOfRecords; ++r)
+    {
+    reader->ReadRecord(r, record);
+    if (record.Type == logFormat::SampleRecord)
+      {
+      const loggedSample& sample =
+        samples[r <= NumberOfContinuousSamples ? r - 1 : r - 3];
+      record.Counts = sample.Counts;
+      record.Position = sample.Position;
+      }
+    logFormat::FormatRecordText(record, expectedText);
+    }
+  std::string text;
+  if (!reader->ExportCSV(csvFileName.c_str()) ||
+      !ReadFile(csvFileName, text) || text != expectedText)
+    {
+    std::cerr << "Line " << __LINE__ << ": " << csvFileName << " differs from\n"
+              << expectedText << std::endl;
+    return EXIT_FAILURE;
+    }
+  reader->Close();
+
+  // Torn in the middle of the last sample: the single shot block was not
+  // closed, its last sample is incomplete
+  std::string contents;
+  if (!ReadFile(fileName, contents) ||
+      !WriteFile(tornFileName, contents.substr(
+        0, contents.size() - logFormat::RecordSize - logFormat::RecordSize / 2)))
+    {
+    std::cerr << "Line " << __LINE__ << ": unable to tear " << fileName << std::endl;
+    return EXIT_FAILURE;
+    }
+  const vtkIdType tornRecords = numberOfRecords - 2;
+  if (!reader->Open(tornFileName.c_str()) ||
+      reader->GetNumberOfRecords() != tornRecords ||
+      reader->GetNumberOfBlocks() != 2 ||
+      !CheckBlock(__LINE__, reader.GetPointer(), 0, logFormat::ContinuousBlock,
+                  0, NumberOfContinuousSamples + 1, samples, 0) ||
+      !CheckBlock(__LINE__, reader.GetPointer(), 1, logFormat::SingleShotBlock,
+                  NumberOfContinuousSamples + 2, tornRecords, samples, singleShots) ||
+      reader->FindSample(firstWallTime + 10000 * SamplePeriod) != tornRecords)
+    {
+    std::cerr << "Line " << __LINE__ << ": " << tornFileName << " was read back wrong"
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  reader->Close();
+
+  // Appending overwrites the incomplete record
+  if (!writer->Open(tornFileName.c_str(), logFormat::BinaryFormat) ||
+      !WriteBlock(writer.GetPointer(), logFormat::SingleShotBlock, samples, appended,
+                  samples.size()))
+    {
+    std::cerr << "Line " << __LINE__ << ": unable to append to " << tornFileName << std::endl;
+    return EXIT_FAILURE;
+    }
+  writer->Close();
+  if (!reader->Open(tornFileName.c_str()) ||
+      reader->GetNumberOfRecords() != tornRecords + NumberOfSingleShots + 2 ||
+      reader->GetNumberOfBlocks() != 3 ||
+      !CheckBlock(__LINE__, reader.GetPointer(), 1, logFormat::SingleShotBlock,
+                  NumberOfContinuousSamples + 2, tornRecords, samples, singleShots) ||
+      !CheckBlock(__LINE__, reader.GetPointer(), 2, logFormat::SingleShotBlock,
+                  tornRecords, tornRecords + NumberOfSingleShots + 1, samples, appended))
+    {
+    std::cerr << "Line " << __LINE__ << ": " << tornFileName
+              << " was read back wrong after appending" << std::endl;
+    return EXIT_FAILURE;
+    }
+  reader->Close();
+
+  remove(fileName.c_str());
+  remove(tornFileName.c_str());
+  remove(csvFileName.c_str());
+  return EXIT_SUCCESS;
+}
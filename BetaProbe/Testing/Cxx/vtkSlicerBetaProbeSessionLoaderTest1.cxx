@@ -0,0 +1,303 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// BetaProbe includes
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkSlicerBetaProbeCountParser.h"
+#include "vtkSlicerBetaProbeLogFormat.h"
+#include "vtkSlicerBetaProbeSessionLoader.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkNew.h>
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// A CSV log and a binary log of the same samples, large enough to be
+// split between threads, are loaded on one thread and on several, and
+// every column kept by each format is compared. Copies torn in the middle
+// of their last sample, as a crash leaves them, are loaded up to that
+// sample.
+
+namespace
+{
+typedef vtkSlicerBetaProbeLogFormat logFormat;
+
+const int NumberOfSamples = 4000;
+const int NumberOfThreads = 4;
+
+//----------------------------------------------------------------------------
+// Sample index as logged. Some have no host time, and are timed by their
+// receive time, some have no device time. Device times are whole
+// milliseconds, the precision of the CSV Time column.
+void MakeLoggedSample(vtkIdType index,
+                      vtkMRMLBetaProbeNode::trackingData& position,
+                      vtkMRMLBetaProbeNode::countingData& counts)
+{
+  vtkSlicerBetaProbeTestingUtilities::MakeSample(index, 0.25 * index, position, counts);
+  counts.ReceiveTime = 5000000000LL + index * 1000000;
+  counts.HostTime = (index % 5 != 0) ? counts.ReceiveTime : 0;
+  counts.DeviceTime = (index % 11 != 0) ? 1700000000000000000LL + index * 1000000 : 0;
+  position.ReceiveTime = counts.ReceiveTime;
+  if (counts.DeviceTime != 0)
+    {
+    vtkSlicerBetaProbeCountParser::FormatDeviceTime(counts);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Sample index as loaded: the binary log keeps a single timestamp, the
+// host time if known. The CSV log keeps no timestamp and no sequence
+// number.
+void MakeLoadedSample(vtkIdType index, bool binary,
+                      vtkMRMLBetaProbeNode::trackingData& position,
+                      vtkMRMLBetaProbeNode::countingData& counts)
+{
+  MakeLoggedSample(index, position, counts);
+  if (!binary)
+    {
+    position.ReceiveTime = 0;
+    counts.ReceiveTime = 0;
+    counts.HostTime = 0;
+    counts.Sequence = 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+void MakeSampleRecord(vtkIdType index, logFormat::logRecord& record)
+{
+  memset(&record, 0, sizeof(record));
+  record.Type = logFormat::SampleRecord;
+  MakeLoggedSample(index, record.Position, record.Counts);
+  record.HostTime = logFormat::GetSampleTime(record.Counts);
+}
+
+//----------------------------------------------------------------------------
+void MakeBlockRecord(int type, logFormat::logRecord& record)
+{
+  memset(&record, 0, sizeof(record));
+  record.Type = type;
+  record.BlockKind = logFormat::ContinuousBlock;
+  record.WallTime = 1700000000000000000LL;
+}
+
+//----------------------------------------------------------------------------
+// Log of numberOfSamples samples in a continuous block, ended if complete
+void MakeLog(bool binary, vtkIdType numberOfSamples, bool complete, std::string& contents)
+{
+  contents.clear();
+  logFormat::logRecord record;
+  unsigned char buffer[logFormat::HeaderSize];
+  if (binary)
+    {
+    logFormat::EncodeHeader(1700000000000000000LL, 0, buffer);
+    contents.append(reinterpret_cast<char*>(buffer), logFormat::HeaderSize);
+    }
+  else
+    {
+    logFormat::FormatHeaderText(1700000000000000000LL, contents);
+    }
+
+  for (vtkIdType i = -1; i <= numberOfSamples; ++i)
+    {
+    if (i == -1)
+      {
+      MakeBlockRecord(logFormat::BlockBeginRecord, record);
+      }
+    else if (i == numberOfSamples)
+      {
+      if (!complete)
+        {
+        break;
+        }
+      MakeBlockRecord(logFormat::BlockEndRecord, record);
+      }
+    else
+      {
+      MakeSampleRecord(i, record);
+      }
+    if (binary)
+      {
+      logFormat::EncodeRecord(record, buffer);
+      contents.append(reinterpret_cast<char*>(buffer), logFormat::RecordSize);
+      }
+    else
+      {
+      logFormat::FormatRecordText(record, contents);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+bool WriteFile(const std::string& fileName, const std::string& contents)
+{
+  FILE* file = fopen(fileName.c_str(), "wb");
+  if (!file)
+    {
+    return false;
+    }
+  const bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+  return fclose(file) == 0 && written;
+}
+
+//----------------------------------------------------------------------------
+// Load contents on numberOfThreads threads, and compare the first
+// numberOfSamples samples with the logged ones
+bool CheckLoad(int line, const std::string& fileName, const std::string& contents,
+               bool binary, int numberOfThreads, vtkIdType numberOfSamples,
+               vtkIdType numberOfSkippedLines)
+{
+  vtkNew<vtkMRMLBetaProbeNode> node;
+  vtkNew<vtkSlicerBetaProbeSessionLoader> loader;
+  loader->SetNumberOfThreads(numberOfThreads);
+  if (!WriteFile(fileName, contents))
+    {
+    std::cerr << "Line " << line << ": unable to write " << fileName << std::endl;
+    return false;
+    }
+  const vtkIdType loaded = loader->Load(fileName.c_str(), node.GetPointer());
+  remove(fileName.c_str());
+  if (loaded != numberOfSamples ||
+      loader->GetNumberOfSkippedLines() != numberOfSkippedLines)
+    {
+    std::cerr << "Line " << line << ": " << loaded << " samples loaded and "
+              << loader->GetNumberOfSkippedLines() << " lines skipped on "
+              << numberOfThreads << " threads instead of " << numberOfSamples
+              << " and " << numberOfSkippedLines << std::endl;
+    return false;
+    }
+
+  vtkMRMLBetaProbeSessionStore* store = node->GetSessionStore();
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  for (vtkIdType i = 0; i < numberOfSamples; ++i)
+    {
+    MakeLoadedSample(i, binary, position, counts);
+    if (!vtkSlicerBetaProbeTestingUtilities::CheckSample(line, store, i, position, counts))
+      {
+      return false;
+      }
+    }
+  return store->GetNumberOfSamples() == numberOfSamples;
+}
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerBetaProbeSessionLoaderTest1(int argc, char* argv[])
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: " << argv[0] << " temporary_directory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  const std::string directory = argv[1];
+
+  for (int binary = 0; binary < 2; ++binary)
+    {
+    const std::string fileName = directory + (binary ?
+      "/vtkSlicerBetaProbeSessionLoaderTest1.bplog" :
+      "/vtkSlicerBetaProbeSessionLoaderTest1.csv");
+
+    // Lines of the banner and block beginning, and of the block end,
+    // skipped from the CSV
+    std::string head;
+    std::string contents;
+    MakeLog(binary != 0, 0, false, head);
+    MakeLog(binary != 0, 0, true, contents);
+    vtkIdType headLines = 0;
+    vtkIdType endLines = 0;
+    for (size_t c = 0; !binary && c < contents.size(); ++c)
+      {
+      if (contents[c] == '\n' && (c == 0 || contents[c - 1] != '\n'))
+        {
+        (c < head.size() ? headLines : endLines)++;
+        }
+      }
+
+    MakeLog(binary != 0, NumberOfSamples, true, contents);
+    if (!CheckLoad(__LINE__, fileName, contents, binary != 0, 1,
+                   NumberOfSamples, headLines + endLines) ||
+        !CheckLoad(__LINE__, fileName, contents, binary != 0, NumberOfThreads,
+                   NumberOfSamples, headLines + endLines))
+      {
+      return EXIT_FAILURE;
+      }
+
+    // Torn in the middle of the last sample: in its Z column for the CSV,
+    // which would be read as another number
+    MakeLog(binary != 0, NumberOfSamples, false, contents);
+    size_t tornSize = contents.size() - logFormat::RecordSize / 2;
+    if (!binary)
+      {
+      const size_t lastLine = contents.rfind('\n', contents.size() - 2) + 1;
+      size_t comma = lastLine;
+      for (int field = 0; field < 7; ++field)
+        {
+        comma = contents.find(',', comma) + 1;
+        }
+      tornSize = comma + 2;
+      }
+    contents.resize(tornSize);
+    if (!CheckLoad(__LINE__, fileName, contents, binary != 0, 1,
+                   NumberOfSamples - 1, binary ? 0 : headLines + 1) ||
+        !CheckLoad(__LINE__, fileName, contents, binary != 0, NumberOfThreads,
+                   NumberOfSamples - 1, binary ? 0 : headLines + 1))
+      {
+      return EXIT_FAILURE;
+      }
+
+    // Corrupted sample records and lines are skipped
+    MakeLog(binary != 0, NumberOfSamples, false, contents);
+    if (binary)
+      {
+      contents[logFormat::HeaderSize + NumberOfSamples * logFormat::RecordSize] = 7;
+      }
+    else
+      {
+      contents[contents.rfind(',', contents.size() - 2)] = ';';
+      }
+    if (!CheckLoad(__LINE__, fileName, contents, binary != 0, NumberOfThreads,
+                   NumberOfSamples - 1, binary ? 1 : headLines + 1))
+      {
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Files that are not logs are not loaded
+  vtkNew<vtkMRMLBetaProbeNode> node;
+  vtkNew<vtkSlicerBetaProbeSessionLoader> loader;
+  const std::string missingFileName = directory + "/vtkSlicerBetaProbeSessionLoaderTest1.missing";
+  std::string notBinary;
+  MakeLog(true, 10, true, notBinary);
+  notBinary[4] = 99;
+  const std::string notBinaryFileName = directory + "/vtkSlicerBetaProbeSessionLoaderTest1.bplog";
+  if (loader->Load(missingFileName.c_str(), node.GetPointer()) != -1 ||
+      !WriteFile(notBinaryFileName, notBinary) ||
+      loader->Load(notBinaryFileName.c_str(), node.GetPointer()) != -1)
+    {
+    std::cerr << "Line " << __LINE__ << ": a file that is not a log was loaded" << std::endl;
+    return EXIT_FAILURE;
+    }
+  remove(notBinaryFileName.c_str());
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,118 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Samples shared by the tests and the benchmarks
+
+#ifndef __vtkSlicerBetaProbeTestingUtilities_h
+#define __vtkSlicerBetaProbeTestingUtilities_h
+
+// BetaProbe MRML includes
+#include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+
+// STD includes
+#include <cstring>
+#include <iostream>
+
+namespace vtkSlicerBetaProbeTestingUtilities
+{
+//----------------------------------------------------------------------------
+/// Sample at (x, y, z) with an identity orientation, every other field 0
+inline void MakeSample(double x, double y, double z, double gamma, double betaGamma,
+                       vtkTypeInt64 receiveTime,
+                       vtkMRMLBetaProbeNode::trackingData& position,
+                       vtkMRMLBetaProbeNode::countingData& counts)
+{
+  memset(&position, 0, sizeof(position));
+  memset(&counts, 0, sizeof(counts));
+  position.X = x;
+  position.Y = y;
+  position.Z = z;
+  position.Orientation[0] = 1.0;
+  counts.Gamma = gamma;
+  counts.BetaGamma = betaGamma;
+  counts.ReceiveTime = receiveTime;
+}
+
+//----------------------------------------------------------------------------
+/// Sample index with every column set from value. Multiples of 0.25 below
+/// 10^6 are exact in float and in decimal text, so those samples survive
+/// every file format.
+inline void MakeSample(vtkIdType index, double value,
+                       vtkMRMLBetaProbeNode::trackingData& position,
+                       vtkMRMLBetaProbeNode::countingData& counts)
+{
+  MakeSample(value, 2.0 * value, -value, value + 0.5, value + 0.25, index,
+             position, counts);
+  position.ReceiveTime = index;
+  counts.Smoothed = value;
+  counts.Sequence = static_cast<vtkTypeUInt32>(index);
+  counts.DeviceTime = 1000 + index;
+}
+
+//----------------------------------------------------------------------------
+inline void AppendSample(vtkMRMLBetaProbeSessionStore* store, double x, double y, double z,
+                         double gamma, double betaGamma, vtkTypeInt64 receiveTime)
+{
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  MakeSample(x, y, z, gamma, betaGamma, receiveTime, position, counts);
+  store->AppendSample(position, counts);
+}
+
+//----------------------------------------------------------------------------
+/// Compare every column kept by store for sample index. Date and Time are
+/// not kept.
+inline bool CheckSample(int line, vtkMRMLBetaProbeSessionStore* store, vtkIdType index,
+                        const vtkMRMLBetaProbeNode::trackingData& expectedPosition,
+                        const vtkMRMLBetaProbeNode::countingData& expectedCounts)
+{
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  if (!store->GetSample(index, position, counts))
+    {
+    std::cerr << "Line " << line << ": sample " << index << " is missing" << std::endl;
+    return false;
+    }
+
+  bool orientation = true;
+  for (int c = 0; c < 4; ++c)
+    {
+    orientation = orientation && position.Orientation[c] == expectedPosition.Orientation[c];
+    }
+  if (position.X != expectedPosition.X || position.Y != expectedPosition.Y ||
+      position.Z != expectedPosition.Z || !orientation ||
+      position.ReceiveTime != expectedPosition.ReceiveTime ||
+      counts.ReceiveTime != expectedCounts.ReceiveTime ||
+      counts.HostTime != expectedCounts.HostTime ||
+      counts.DeviceTime != expectedCounts.DeviceTime ||
+      counts.Smoothed != expectedCounts.Smoothed ||
+      counts.BetaGamma != expectedCounts.BetaGamma ||
+      counts.Gamma != expectedCounts.Gamma ||
+      counts.Sequence != expectedCounts.Sequence)
+    {
+    std::cerr << "Line " << line << ": sample " << index << " is (" << position.X
+              << ", " << counts.Gamma << ", " << counts.ReceiveTime << ") instead of ("
+              << expectedPosition.X << ", " << expectedCounts.Gamma << ", "
+              << expectedCounts.ReceiveTime << ")" << std::endl;
+    return false;
+    }
+  return true;
+}
+}
+
+#endif
@@ -0,0 +1,235 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Samples splatted per second into a 200^3 map at several point sizes:
+// the per-voxel SetScalarComponentFromDouble() loop the module used to
+// run, against vtkSlicerBetaProbeActivityMap on a single thread. Both
+// maps must match.
+//
+// Then the speedup of vtkSlicerBetaProbeActivityMap on several threads,
+// for samples spread over the map and for a sweep over a few of its
+// planes. The maps must not depend on the number of threads.
+//
+// Usage: BetaProbeActivityMapBenchmark [--count N] [--threads N]
+
+// BetaProbe includes
+#include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
+#include "vtkSlicerBetaProbeActivityMap.h"
+#include "vtkSlicerBetaProbeTestingUtilities.h"
+
+// VTK includes
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkMultiThreader.h>
+#include <vtkNew.h>
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+const int Dimension = 200;
+
+//----------------------------------------------------------------------------
+// Samples spread over the map, far enough from its faces for the previous
+// loop, which did not clip the boxes. Along K, they are spread over depth
+// planes only.
+void AppendSamples(vtkMRMLBetaProbeSessionStore* store, long count, int margin,
+                   int depth)
+{
+  const double span[3] = { Dimension - 2.0 * margin - 1.0,
+                           Dimension - 2.0 * margin - 1.0,
+                           static_cast<double>(depth) };
+  vtkTypeUInt32 seed = 12345;
+  for (long n = 0; n < count; ++n)
+    {
+    double coordinates[3];
+    for (int i = 0; i < 3; ++i)
+      {
+      seed = seed * 1664525u + 1013904223u;
+      coordinates[i] = margin + span[i] * (seed >> 8) / 16777216.0;
+      }
+    vtkSlicerBetaProbeTestingUtilities::AppendSample(
+      store, coordinates[0], coordinates[1], coordinates[2],
+      static_cast<double>(n % 1000), 0.0, n);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Splat loop of the module before vtkSlicerBetaProbeActivityMap
+void PreviousSplat(vtkMRMLBetaProbeSessionStore* store, vtkMatrix4x4* rasToIJK,
+                   int pointSize, vtkImageData* map)
+{
+  vtkMRMLBetaProbeNode::trackingData position;
+  vtkMRMLBetaProbeNode::countingData counts;
+  for (vtkIdType pt = 0; pt < store->GetNumberOfSamples(); ++pt)
+    {
+    store->GetSample(pt, position, counts);
+    double curPoint[4] = { position.X, position.Y, position.Z, 1.0 };
+    double* registeredPoint = rasToIJK->MultiplyDoublePoint(curPoint);
+
+    double activityValue = counts.Gamma;
+    for (int k = registeredPoint[2] - pointSize; k < registeredPoint[2] + pointSize; ++k)
+      {
+      for (int j = registeredPoint[1] - pointSize; j < registeredPoint[1] + pointSize; ++j)
+        {
+        for (int i = registeredPoint[0] - pointSize; i < registeredPoint[0] + pointSize; ++i)
+          {
+          map->SetScalarComponentFromDouble(i, j, k, 0, activityValue);
+          }
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+double PrintRate(const char* name, int pointSize, long count, vtkTypeInt64 start)
+{
+  const double seconds = (vtkMRMLBetaProbeNode::GetHostTime() - start) * 1e-9;
+  printf("%-16s point size %d %10.2f k samples/s\n",
+         name, pointSize, count / seconds * 1e-3);
+  return seconds;
+}
+
+//----------------------------------------------------------------------------
+// Time the map of store on one thread and on numberOfThreads threads
+bool PrintSpeedup(const char* name, vtkSlicerBetaProbeActivityMap* map,
+                  vtkMRMLBetaProbeSessionStore* store, int numberOfThreads)
+{
+  const size_t numberOfVoxels = static_cast<size_t>(Dimension) * Dimension * Dimension;
+  std::vector<double> expected(numberOfVoxels);
+  double seconds[2];
+  for (int run = 0; run < 2; ++run)
+    {
+    map->SetNumberOfThreads(run == 0 ? 1 : numberOfThreads);
+    map->Reset();
+    const vtkTypeInt64 start = vtkMRMLBetaProbeNode::GetHostTime();
+    map->Update(store);
+    seconds[run] = (vtkMRMLBetaProbeNode::GetHostTime() - start) * 1e-9;
+
+    const double* values = static_cast<double*>(map->GetOutput()->GetScalarPointer());
+    if (run == 0)
+      {
+      memcpy(&expected[0], values, numberOfVoxels * sizeof(double));
+      }
+    else if (memcmp(&expected[0], values, numberOfVoxels * sizeof(double)) != 0)
+      {
+      fprintf(stderr, "%s: the map depends on the number of threads\n", name);
+      return false;
+      }
+    }
+  printf("%-16s %2d threads %10.2fx   (%.3f s on one thread)\n",
+         name, numberOfThreads, seconds[0] / seconds[1], seconds[0]);
+  return true;
+}
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  long count = 1000000;
+  int numberOfThreads = vtkMultiThreader::GetGlobalDefaultNumberOfThreads();
+  for (int i = 1; i < argc; ++i)
+    {
+    if (!strcmp(argv[i], "--count") && i + 1 < argc)
+      {
+      count = atol(argv[++i]);
+      }
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+      {
+      numberOfThreads = atoi(argv[++i]);
+      }
+    else
+      {
+      fprintf(stderr, "Usage: %s [--count N] [--threads N]\n", argv[0]);
+      return EXIT_FAILURE;
+      }
+    }
+  if (count <= 0 || numberOfThreads <= 0)
+    {
+    fprintf(stderr, "Count and threads must be positive\n");
+    return EXIT_FAILURE;
+    }
+
+  const int pointSizes[] = { 1, 2, 4, 6 };
+  const int numberOfPointSizes = sizeof(pointSizes) / sizeof(pointSizes[0]);
+  const int dimensions[3] = { Dimension, Dimension, Dimension };
+
+  vtkNew<vtkMRMLBetaProbeSessionStore> store;
+  store->SetMemoryBudget(0);
+  const int margin = pointSizes[numberOfPointSizes - 1] + 1;
+  AppendSamples(store.GetPointer(), count, margin, Dimension - 2 * margin - 1);
+
+  vtkNew<vtkMatrix4x4> rasToIJK;
+  vtkNew<vtkSlicerBetaProbeActivityMap> map;
+  map->SetNumberOfThreads(1);
+  map->SetGeometry(dimensions, rasToIJK.GetPointer());
+
+  vtkNew<vtkImageData> previousMap;
+  previousMap->SetDimensions(Dimension, Dimension, Dimension);
+  previousMap->AllocateScalars(VTK_DOUBLE, 1);
+
+  const size_t numberOfVoxels = static_cast<size_t>(Dimension) * Dimension * Dimension;
+  for (int p = 0; p < numberOfPointSizes; ++p)
+    {
+    const int pointSize = pointSizes[p];
+
+    memset(previousMap->GetScalarPointer(), 0, numberOfVoxels * sizeof(double));
+    vtkTypeInt64 start = vtkMRMLBetaProbeNode::GetHostTime();
+    PreviousSplat(store.GetPointer(), rasToIJK.GetPointer(), pointSize, previousMap.GetPointer());
+    const double previousSeconds = PrintRate("Previous", pointSize, count, start);
+
+    map->SetPointSize(pointSize);
+    start = vtkMRMLBetaProbeNode::GetHostTime();
+    map->Update(store.GetPointer());
+    const double seconds = PrintRate("Activity map", pointSize, count, start);
+    printf("%-16s point size %d %10.1fx\n", "Speedup", pointSize, previousSeconds / seconds);
+
+    const double* expected = static_cast<double*>(previousMap->GetScalarPointer());
+    const double* values = static_cast<double*>(map->GetOutput()->GetScalarPointer());
+    size_t mismatches = 0;
+    for (size_t v = 0; v < numberOfVoxels; ++v)
+      {
+      mismatches += (values[v] != expected[v]);
+      }
+    if (mismatches > 0)
+      {
+      fprintf(stderr, "%lu voxels differ at point size %d\n",
+              static_cast<unsigned long>(mismatches), pointSize);
+      return EXIT_FAILURE;
+      }
+    }
+
+  // A sweep over 20 planes: slabs of equal depth would leave most threads
+  // without a sample
+  vtkNew<vtkMRMLBetaProbeSessionStore> sweep;
+  sweep->SetMemoryBudget(0);
+  AppendSamples(sweep.GetPointer(), count, margin, 20);
+
+  map->SetPointSize(2);
+  if (!PrintSpeedup("Spread", map.GetPointer(), store.GetPointer(), numberOfThreads) ||
+      !PrintSpeedup("Sweep", map.GetPointer(), sweep.GetPointer(), numberOfThreads))
+    {
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Emit synthetic BetaProbe count datagrams, in the device CSV format or in
+// the binary format of vtkSlicerBetaProbeCountPacket.
+//
+// Usage: BetaProbeCountEmitter [--binary] [--rate Hz] [--count N] host port
+
+// BetaProbe includes
+#include "vtkSlicerBetaProbeCountPacket.h"
+
+// STD includes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+// Socket includes
+#if defined(_WIN32)
+# include <winsock2.h>
+# include <windows.h>
+#else
+# include <arpa/inet.h>
+# include <netinet/in.h>
+# include <sys/socket.h>
+# include <sys/time.h>
+# include <unistd.h>
+#endif
+
+namespace
+{
+//----------------------------------------------------------------------------
+vtkTypeInt64 WallClockNanoseconds()
+{
+#if defined(_WIN32)
+  FILETIME fileTime;
+  GetSystemTimeAsFileTime(&fileTime);
+  vtkTypeInt64 ticks = (static_cast<vtkTypeInt64>(fileTime.dwHighDateTime) << 32) |
+    fileTime.dwLowDateTime;
+  // 100ns ticks since 1601-01-01
+  return (ticks - 116444736000000000LL) * 100;
+#else
+  timeval now;
+  gettimeofday(&now, NULL);
+  return static_cast<vtkTypeInt64>(now.tv_sec) * 1000000000LL +
+    static_cast<vtkTypeInt64>(now.tv_usec) * 1000LL;
+#endif
+}
+
+//----------------------------------------------------------------------------
+void SleepMicroseconds(long microseconds)
+{
+#if defined(_WIN32)
+  Sleep(static_cast<DWORD>(microseconds / 1000));
+#else
+  usleep(static_cast<useconds_t>(microseconds));
+#endif
+}
+
+//----------------------------------------------------------------------------
+int FormatCSV(char* buffer, size_t size, vtkTypeInt64 deviceTime,
+              float smoothed, float betaGamma, float gamma)
+{
+  time_t seconds = static_cast<time_t>(deviceTime / 1000000000LL);
+  int milliseconds = static_cast<int>((deviceTime % 1000000000LL) / 1000000);
+  tm* local = localtime(&seconds);
+
+  char date[32];
+  char time[32];
+  strftime(date, sizeof(date), "%Y-%m-%d", local);
+  strftime(time, sizeof(time), "%H:%M:%S", local);
+  return snprintf(buffer, size, "%s,%s.%03d,%.2f,%.2f,%.2f",
+                  date, time, milliseconds, smoothed, betaGamma, gamma);
+}
+
+//----------------------------------------------------------------------------
+void PrintUsage(const char* program)
+{
+  fprintf(stderr,
+          "Usage: %s [--binary] [--rate Hz] [--count N] host port\n"
+          "  --binary   send binary packets instead of CSV text\n"
+          "  --rate     packets per second (default 10)\n"
+          "  --count    number of packets to send, 0 for no limit (default 0)\n",
+          program);
+}
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  bool binary = false;
+  double rate = 10.0;
+  long count = 0;
+  const char* host = NULL;
+  int port = 0;
+
+  for (int i = 1; i < argc; ++i)
+    {
+    if (!strcmp(argv[i], "--binary"))
+      {
+      binary = true;
+      }
+    else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+      {
+      rate = atof(argv[++i]);
+      }
+    else if (!strcmp(argv[i], "--count") && i + 1 < argc)
+      {
+      count = atol(argv[++i]);
+      }
+    else if (!host)
+      {
+      host = argv[i];
+      }
+    else
+      {
+      port = atoi(argv[i]);
+      }
+    }
+
+  if (!host || port <= 0 || rate <= 0.0)
+    {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+    }
+
+#if defined(_WIN32)
+  WSADATA wsaData;
+  WSAStartup(MAKEWORD(2,2), &wsaData);
+#endif
+
+  int sock = static_cast<int>(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+  if (sock < 0)
+    {
+    fprintf(stderr, "Unable to create socket\n");
+    return EXIT_FAILURE;
+    }
+
+  sockaddr_in destination;
+  memset(&destination, 0, sizeof(destination));
+  destination.sin_family = AF_INET;
+  destination.sin_port = htons(static_cast<unsigned short>(port));
+  destination.sin_addr.s_addr = inet_addr(host);
+
+  const long periodUs = static_cast<long>(1e6 / rate);
+  vtkSlicerBetaProbeCountPacket packet;
+  packet.Version = vtkSlicerBetaProbeCountPacket::CurrentVersion;
+  packet.Flags = 0;
+
+  for (long n = 0; count == 0 || n < count; ++n)
+    {
+    // Slowly varying synthetic activity
+    double phase = 0.05 * static_cast<double>(n);
+    packet.Sequence = static_cast<vtkTypeUInt32>(n);
+    packet.DeviceTime = WallClockNanoseconds();
+    packet.Gamma = static_cast<float>(50.0 + 40.0 * sin(phase));
+    packet.BetaGamma = static_cast<float>(packet.Gamma + 100.0 + 80.0 * sin(0.3 * phase));
+    packet.Smoothed = 0.5f * (packet.Gamma + packet.BetaGamma);
+
+    char buffer[128];
+    int length = 0;
+    if (binary)
+      {
+      packet.Encode(reinterpret_cast<unsigned char*>(buffer));
+      length = vtkSlicerBetaProbeCountPacket::Size;
+      }
+    else
+      {
+      length = FormatCSV(buffer, sizeof(buffer), packet.DeviceTime,
+                         packet.Smoothed, packet.BetaGamma, packet.Gamma);
+      }
+
+    sendto(sock, buffer, length, 0,
+           reinterpret_cast<sockaddr*>(&destination), sizeof(destination));
+    SleepMicroseconds(periodUs);
+    }
+
+#if defined(_WIN32)
+  closesocket(sock);
+  WSACleanup();
+#else
+  close(sock);
+#endif
+  return EXIT_SUCCESS;
+}
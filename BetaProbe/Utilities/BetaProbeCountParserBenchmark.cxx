@@ -0,0 +1,156 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Count datagrams parsed per second: the QString::section() chain the
+// module used to run on every datagram, against
+// vtkSlicerBetaProbeCountParser on CSV datagrams and binary packets.
+//
+// Usage: BetaProbeCountParserBenchmark [--count N]
+
+// BetaProbe includes
+#include "vtkMRMLBetaProbeNode.h"
+#include "vtkSlicerBetaProbeCountPacket.h"
+#include "vtkSlicerBetaProbeCountParser.h"
+
+// Qt includes
+#include <QByteArray>
+#include <QString>
+
+// STD includes
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+// Distinct datagrams, parsed in turn
+const int NumberOfDatagrams = 1024;
+
+typedef struct
+{
+  std::string Date;
+  std::string Time;
+  double Smoothed;
+  double BetaGamma;
+  double Gamma;
+}stringSample;
+
+//----------------------------------------------------------------------------
+void PrintRate(const char* name, long count, vtkTypeInt64 start, double checksum)
+{
+  const double seconds = (vtkMRMLBetaProbeNode::GetHostTime() - start) * 1e-9;
+  printf("%-28s %10.2f k datagrams/s   (checksum %g)\n",
+         name, count / seconds * 1e-3, checksum);
+}
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  long count = 2000000;
+  for (int i = 1; i < argc; ++i)
+    {
+    if (!strcmp(argv[i], "--count") && i + 1 < argc)
+      {
+      count = atol(argv[++i]);
+      }
+    else
+      {
+      fprintf(stderr, "Usage: %s [--count N]\n", argv[0]);
+      return EXIT_FAILURE;
+      }
+    }
+  if (count <= 0)
+    {
+    fprintf(stderr, "Count must be positive\n");
+    return EXIT_FAILURE;
+    }
+
+  // Datagrams as sent by the device, and as binary packets
+  std::vector<std::string> datagrams(NumberOfDatagrams);
+  std::vector<unsigned char> packets(NumberOfDatagrams * vtkSlicerBetaProbeCountPacket::Size);
+  vtkSlicerBetaProbeCountPacket packet;
+  packet.Version = vtkSlicerBetaProbeCountPacket::CurrentVersion;
+  packet.Flags = 0;
+  for (int n = 0; n < NumberOfDatagrams; ++n)
+    {
+    packet.Sequence = static_cast<vtkTypeUInt32>(n);
+    packet.DeviceTime = 1368189296000000000LL + n * 100000000LL;
+    packet.Gamma = static_cast<float>(n % 97) + 0.25f;
+    packet.BetaGamma = packet.Gamma + static_cast<float>(n % 131) + 0.5f;
+    packet.Smoothed = 0.5f * (packet.Gamma + packet.BetaGamma);
+    packet.Encode(&packets[n * vtkSlicerBetaProbeCountPacket::Size]);
+
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "2013-05-10,12:34:%02d.%03d,%.2f,%.2f,%.2f",
+             (n / 10) % 60, (n % 10) * 100, packet.Smoothed, packet.BetaGamma, packet.Gamma);
+    datagrams[n] = buffer;
+    }
+
+  // Before: one QByteArray, one QString and five sections per datagram
+  double checksum = 0.0;
+  stringSample stringValues;
+  vtkTypeInt64 start = vtkMRMLBetaProbeNode::GetHostTime();
+  for (long i = 0; i < count; ++i)
+    {
+    const std::string& data = datagrams[i % NumberOfDatagrams];
+    QByteArray datagram;
+    datagram.resize(static_cast<int>(data.size()));
+    memcpy(datagram.data(), data.data(), data.size());
+    QString dataReceived = QString(datagram);
+    stringValues.Date = dataReceived.section(',', 0, 0).toStdString();
+    stringValues.Time = dataReceived.section(',', 1, 1).toStdString();
+    stringValues.Smoothed = dataReceived.section(',', 2, 2).toDouble();
+    stringValues.BetaGamma = dataReceived.section(',', 3, 3).toDouble();
+    stringValues.Gamma = dataReceived.section(',', 4, 4).toDouble();
+    checksum += stringValues.Gamma;
+    }
+  PrintRate("QString::section", count, start, checksum);
+
+  // After: in place, into a preallocated sample
+  vtkMRMLBetaProbeNode::countingData sample;
+  checksum = 0.0;
+  start = vtkMRMLBetaProbeNode::GetHostTime();
+  for (long i = 0; i < count; ++i)
+    {
+    const std::string& data = datagrams[i % NumberOfDatagrams];
+    if (vtkSlicerBetaProbeCountParser::Parse(data.data(), data.size(), sample) ==
+        vtkSlicerBetaProbeCountParser::Success)
+      {
+      checksum += sample.Gamma;
+      }
+    }
+  PrintRate("CountParser, CSV", count, start, checksum);
+
+  checksum = 0.0;
+  start = vtkMRMLBetaProbeNode::GetHostTime();
+  for (long i = 0; i < count; ++i)
+    {
+    const char* data = reinterpret_cast<const char*>(
+      &packets[(i % NumberOfDatagrams) * vtkSlicerBetaProbeCountPacket::Size]);
+    if (vtkSlicerBetaProbeCountParser::Parse(data, vtkSlicerBetaProbeCountPacket::Size, sample) ==
+        vtkSlicerBetaProbeCountParser::Success)
+      {
+      checksum += sample.Gamma;
+      }
+    }
+  PrintRate("CountParser, binary", count, start, checksum);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+==============================================================================*/
+
+// Tool transform events absorbed per second by vtkMRMLBetaProbeNode, for a
+// moving and for a still tool, against the handler the node used to run
+// on every event (new matrix, flooring, Modified()).
+//
+// Usage: BetaProbeNodeBenchmark [--count N]
+
+// BetaProbe includes
+#include "vtkMRMLBetaProbeNode.h"
+
+// MRML includes
+#include <vtkMRMLLinearTransformNode.h>
+
+// VTK includes
+#include <vtkCallbackCommand.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkSmartPointer.h>
+
+// STD includes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+//----------------------------------------------------------------------------
+// Pose of event n, along a slow sweep
+void SetPose(vtkMatrix4x4* matrix, long n)
+{
+  const double angle = 1e-3 * n;
+  matrix->Identity();
+  matrix->SetElement(0, 0, cos(angle));
+  matrix->SetElement(0, 1, -sin(angle));
+  matrix->SetElement(1, 0, sin(angle));
+  matrix->SetElement(1, 1, cos(angle));
+  matrix->SetElement(0, 3, 50.0 * cos(angle));
+  matrix->SetElement(1, 3, 50.0 * sin(angle));
+  matrix->SetElement(2, 3, 1e-2 * (n % 1000));
+}
+
+//----------------------------------------------------------------------------
+// Handler of TransformModifiedEvent before the cached matrix path
+void PreviousHandler(vtkObject* caller, unsigned long, void* clientData, void*)
+{
+  vtkMRMLLinearTransformNode* transform = vtkMRMLLinearTransformNode::SafeDownCast(caller);
+  vtkMRMLBetaProbeNode* node = static_cast<vtkMRMLBetaProbeNode*>(clientData);
+  vtkSmartPointer<vtkMatrix4x4> matrixReceived = vtkSmartPointer<vtkMatrix4x4>::New();
+  transform->GetMatrixTransformToWorld(matrixReceived.GetPointer());
+  vtkMRMLBetaProbeNode::trackingData position;
+  memset(&position, 0, sizeof(position));
+  position.X = std::floor(matrixReceived->GetElement(0, 3) * 100) / 100;
+  position.Y = std::floor(matrixReceived->GetElement(1, 3) * 100) / 100;
+  position.Z = std::floor(matrixReceived->GetElement(2, 3) * 100) / 100;
+  node->Modified();
+}
+
+//----------------------------------------------------------------------------
+void PrintRate(const char* name, long count, vtkTypeInt64 start)
+{
+  const double seconds = (vtkMRMLBetaProbeNode::GetHostTime() - start) * 1e-9;
+  printf("%-24s %10.2f k events/s\n", name, count / seconds * 1e-3);
+}
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  long count = 1000000;
+  for (int i = 1; i < argc; ++i)
+    {
+    if (!strcmp(argv[i], "--count") && i + 1 < argc)
+      {
+      count = atol(argv[++i]);
+      }
+    else
+      {
+      fprintf(stderr, "Usage: %s [--count N]\n", argv[0]);
+      return EXIT_FAILURE;
+      }
+    }
+  if (count <= 0)
+    {
+    fprintf(stderr, "Count must be positive\n");
+    return EXIT_FAILURE;
+    }
+
+  vtkNew<vtkMatrix4x4> pose;
+
+  // Previous handler, on its own transform node
+    {
+    vtkNew<vtkMRMLLinearTransformNode> transform;
+    vtkNew<vtkMRMLBetaProbeNode> node;
+    vtkNew<vtkCallbackCommand> handler;
+    handler->SetCallback(PreviousHandler);
+    handler->SetClientData(node.GetPointer());
+    transform->AddObserver(vtkMRMLLinearTransformNode::TransformModifiedEvent,
+                           handler.GetPointer());
+    const vtkTypeInt64 start = vtkMRMLBetaProbeNode::GetHostTime();
+    for (long n = 0; n < count; ++n)
+      {
+      SetPose(pose.GetPointer(), n);
+      transform->GetMatrixTransformToParent()->DeepCopy(pose.GetPointer());
+      }
+    PrintRate("Previous, moving", count, start);
+    }
+
+  // Cached matrix path, moving then still tool
+  vtkNew<vtkMRMLLinearTransformNode> transform;
+  vtkNew<vtkMRMLBetaProbeNode> node;
+  node->SetTransformNode(transform.GetPointer());
+
+  vtkTypeUInt64 posesBefore = node->GetNumberOfPosesReceived();
+  vtkTypeInt64 start = vtkMRMLBetaProbeNode::GetHostTime();
+  for (long n = 0; n < count; ++n)
+    {
+    SetPose(pose.GetPointer(), n);
+    transform->GetMatrixTransformToParent()->DeepCopy(pose.GetPointer());
+    }
+  PrintRate("Cached matrix, moving", count, start);
+
+  start = vtkMRMLBetaProbeNode::GetHostTime();
+  for (long n = 0; n < count; ++n)
+    {
+    transform->InvokeEvent(vtkMRMLLinearTransformNode::TransformModifiedEvent);
+    }
+  PrintRate("Cached matrix, still", count, start);
+
+  // Every event must have been taken as a pose
+  const vtkTypeUInt64 poses = node->GetNumberOfPosesReceived() - posesBefore;
+  if (poses < static_cast<vtkTypeUInt64>(2 * count))
+    {
+    fprintf(stderr, "Only %llu poses of %ld events were recorded\n",
+            static_cast<unsigned long long>(poses), 2 * count);
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
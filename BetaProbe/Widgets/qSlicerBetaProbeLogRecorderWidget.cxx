@@ -25,11 +25,32 @@
 #include "ui_qSlicerBetaProbeLogRecorderWidget.h"
 
 #include "vtkMRMLBetaProbeNode.h"
+#include "vtkMRMLBetaProbeSessionStore.h"
 #include "vtkMRMLScene.h"
+#include "vtkSlicerBetaProbeJournal.h"
+#include "vtkSlicerBetaProbeLogic.h"
+#include "vtkSlicerBetaProbeLogReader.h"
+#include "vtkSlicerBetaProbeLogWriter.h"
+#include "vtkSlicerBetaProbeSessionLoader.h"
+
+#include "qSlicerCoreApplication.h"
+
+#include <vtkSmartPointer.h>
 
 #include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QMessageBox>
+#include <QTimer>
+
+namespace
+{
+// Refresh period of the queue status, in milliseconds
+const int StatusInterval = 500;
+}
 
 //-----------------------------------------------------------------------------
 /// \ingroup Slicer_QtModules_BetaProbe
@@ -41,14 +62,24 @@ protected:
   qSlicerBetaProbeLogRecorderWidget* const q_ptr;
 
   vtkMRMLBetaProbeNode* betaProbeMRMLNode;
+  vtkSlicerBetaProbeLogic* betaProbeLogic;
   QString currentLogFile;
-  std::ofstream recordingFile;
+  vtkSmartPointer<vtkSlicerBetaProbeLogWriter> logWriter;
+  vtkSmartPointer<vtkSlicerBetaProbeJournal> journal;
+  vtkIdType numberOfRecoveredSamples;
+  QString loadedSessionStatus;
+  QTimer* statusTimer;
   bool logFileOpen;
   bool recording;
   bool singleModeRecording;
   int singleShotStreak;
   bool flagData;
 
+  void recordSample(const vtkMRMLBetaProbeNode::trackingData& position,
+                    const vtkMRMLBetaProbeNode::countingData& counts);
+  void startJournal();
+  void finishJournal();
+
 public:
   qSlicerBetaProbeLogRecorderWidgetPrivate(
     qSlicerBetaProbeLogRecorderWidget& object);
@@ -63,6 +94,12 @@ qSlicerBetaProbeLogRecorderWidgetPrivate
   qSlicerBetaProbeLogRecorderWidget& object)
   : q_ptr(&object)
 {
+  this->betaProbeMRMLNode = NULL;
+  this->betaProbeLogic = NULL;
+  this->logWriter = vtkSmartPointer<vtkSlicerBetaProbeLogWriter>::New();
+  this->journal = vtkSmartPointer<vtkSlicerBetaProbeJournal>::New();
+  this->numberOfRecoveredSamples = 0;
+  this->statusTimer = new QTimer();
   this->logFileOpen = false;
   this->recording = false;
   this->singleModeRecording = true;
@@ -74,10 +111,9 @@ qSlicerBetaProbeLogRecorderWidgetPrivate
 qSlicerBetaProbeLogRecorderWidgetPrivate
 ::~qSlicerBetaProbeLogRecorderWidgetPrivate()
 {
-  if (this->recordingFile.is_open())
-    {
-    this->recordingFile.close();
-    }
+  this->logWriter->Close();
+  this->finishJournal();
+  delete this->statusTimer;
 }
 
 // --------------------------------------------------------------------------
@@ -87,6 +123,66 @@ void qSlicerBetaProbeLogRecorderWidgetPrivate
   this->Ui_qSlicerBetaProbeLogRecorderWidget::setupUi(widget);
 }
 
+// --------------------------------------------------------------------------
+void qSlicerBetaProbeLogRecorderWidgetPrivate
+::recordSample(const vtkMRMLBetaProbeNode::trackingData& position,
+               const vtkMRMLBetaProbeNode::countingData& counts)
+{
+  // Formatted and written by the writer thread
+  this->logWriter->WriteSample(position, counts, this->flagData);
+  this->flagData = false;
+
+  this->journal->WriteSample(position, counts);
+  this->betaProbeMRMLNode->RecordMappingData(position, counts);
+}
+
+// --------------------------------------------------------------------------
+void qSlicerBetaProbeLogRecorderWidgetPrivate
+::startJournal()
+{
+  QDir journalDirectory(qSlicerCoreApplication::application()->temporaryPath());
+  journalDirectory.mkpath("BetaProbe");
+  if (!journalDirectory.cd("BetaProbe"))
+    {
+    return;
+    }
+
+  // Journals still on disk belong to sessions that did not end cleanly.
+  // Those of other running instances are locked and skipped by Recover(),
+  // and the journals recovered here stay locked until finishJournal()
+  // removes them.
+  QStringList journals = journalDirectory.entryList(QStringList() << "*.bpjournal",
+                                                    QDir::Files, QDir::Name);
+  foreach (const QString& journalName, journals)
+    {
+    QString journalPath = journalDirectory.absoluteFilePath(journalName);
+    vtkIdType numberOfSamples = this->journal->Recover(
+      journalPath.toStdString().c_str(), this->betaProbeMRMLNode);
+    if (numberOfSamples >= 0)
+      {
+      // Kept until this session ends cleanly, in case it does not
+      this->numberOfRecoveredSamples += numberOfSamples;
+      }
+    }
+
+  QString journalName = QString("BetaProbe-%1-%2.bpjournal")
+    .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"))
+    .arg(QCoreApplication::applicationPid());
+  this->journal->SetCommitInterval(this->betaProbeMRMLNode->GetJournalCommitInterval());
+  this->journal->SetCommitRecords(this->betaProbeMRMLNode->GetJournalCommitRecords());
+  this->journal->Open(journalDirectory.absoluteFilePath(journalName).toStdString().c_str());
+}
+
+// --------------------------------------------------------------------------
+void qSlicerBetaProbeLogRecorderWidgetPrivate
+::finishJournal()
+{
+  // Removes the journal of this session
+  this->journal->Close();
+  this->journal->RemoveRecoveredJournals();
+}
+
+
 //-----------------------------------------------------------------------------
 // qSlicerBetaProbeLogRecorderWidget methods
 
@@ -110,6 +206,15 @@ qSlicerBetaProbeLogRecorderWidget
 
   connect(d->FlagDataButton, SIGNAL(clicked()),
 	  this, SLOT(onFlagDataClicked()));
+
+  connect(d->ExportCSVButton, SIGNAL(clicked()),
+	  this, SLOT(onExportCSVClicked()));
+
+  connect(d->LoadSessionButton, SIGNAL(clicked()),
+	  this, SLOT(onLoadSessionClicked()));
+
+  connect(d->statusTimer, SIGNAL(timeout()),
+	  this, SLOT(updateWriterStatus()));
 }
 
 //-----------------------------------------------------------------------------
@@ -118,7 +223,7 @@ qSlicerBetaProbeLogRecorderWidget
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
 
-  if (d->recordingFile.is_open())
+  if (d->logWriter->IsOpen())
     {
     this->endSingleShotRecording();
     this->closeLogFile();
@@ -139,7 +244,7 @@ void qSlicerBetaProbeLogRecorderWidget
     }    
   QString fileName = QFileDialog::getSaveFileName(this, tr("Select Output File"),
 						  previousPath.c_str(),
-						  tr("CSV (*.csv)"));
+						  tr("CSV (*.csv);;BetaProbe binary log (*.bplog)"));
   
   bool continousRecordingStatus = !d->singleModeRecording & d->recording;
   
@@ -181,21 +286,21 @@ void qSlicerBetaProbeLogRecorderWidget
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
 
-  // Open recording file
+  // Open recording file, in binary if it is a binary log
   QFileInfo file(filenamePath);
-  bool fileExists = file.exists();
+  int format = vtkSlicerBetaProbeLogFormat::TextFormat;
+  if (file.suffix().compare("bplog", Qt::CaseInsensitive) == 0)
+    {
+    format = vtkSlicerBetaProbeLogFormat::BinaryFormat;
+    }
   
   d->SelectFileButton->setText(file.fileName());
-  d->recordingFile.open(filenamePath.toStdString().c_str(), ios::out | ios::ate | ios::app);
   
-  if (d->recordingFile.is_open())
+  if (d->logWriter->Open(filenamePath.toStdString().c_str(), format))
     {
-    if (!fileExists)
-      {
-      d->recordingFile << "File recorded from BetaProbe Module " << std::endl;
-      d->recordingFile << "Creation date: " << QDateTime::currentDateTime().toString().toStdString() << std::endl;
-      }
     d->logFileOpen = true;
+    d->statusTimer->start(StatusInterval);
+    this->updateWriterStatus();
     }
 }
 
@@ -206,11 +311,46 @@ void qSlicerBetaProbeLogRecorderWidget
   Q_D(qSlicerBetaProbeLogRecorderWidget);
 
   d->SelectFileButton->setText("Select Output File");
-  if (d->recordingFile.is_open())
+  if (d->logWriter->IsOpen())
     {
-    d->recordingFile.close();
+    // Waits for the pending records to be written
+    d->logWriter->Close();
     d->logFileOpen = false;
+    d->statusTimer->stop();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeLogRecorderWidget
+::updateWriterStatus()
+{
+  Q_D(qSlicerBetaProbeLogRecorderWidget);
+
+  QString status = QString("Queue: %1 / %2  Dropped: %3")
+    .arg(d->logWriter->GetNumberOfPendingRecords())
+    .arg(d->logWriter->GetQueueCapacity())
+    .arg(d->logWriter->GetNumberOfRecordsDropped());
+  if (d->logWriter->GetWriteFailed())
+    {
+    status += "  Write error";
+    }
+  if (d->journal->GetNumberOfSamplesDropped() > 0)
+    {
+    status += QString("  Journal dropped: %1").arg(d->journal->GetNumberOfSamplesDropped());
     }
+  if (d->journal->GetWriteFailed())
+    {
+    status += "  Journal error";
+    }
+  if (d->numberOfRecoveredSamples > 0)
+    {
+    status += QString("  Recovered: %1").arg(d->numberOfRecoveredSamples);
+    }
+  if (!d->loadedSessionStatus.isEmpty())
+    {
+    status += "  " + d->loadedSessionStatus;
+    }
+  d->WriterStatusLabel->setText(status);
 }
 
 //-----------------------------------------------------------------------------
@@ -219,29 +359,13 @@ void qSlicerBetaProbeLogRecorderWidget
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
 
-  if (d->recordingFile && d->logFileOpen)
+  if (d->logFileOpen)
     {
-    vtkMRMLBetaProbeNode::trackingData* curPos =
-      d->betaProbeMRMLNode->GetCurrentPosition();
-    vtkMRMLBetaProbeNode::countingData* curVal =
-      d->betaProbeMRMLNode->GetCurrentCounts();
-    
-    if (curPos && curVal)
-      {
-      std::stringstream dataReceived;
-      dataReceived  << curVal->Date.c_str() << "," << curVal->Time.c_str() << ","
-		    << curVal->Smoothed << "," << curVal->BetaGamma << "," << curVal->Gamma << ","
-		    << curPos->X << "," << curPos->Y << "," << curPos->Z;
-
-      if (d->flagData)
-	{
-	dataReceived << ",Flagged";
-	d->flagData = false;
-	}
-
-      d->recordingFile << dataReceived.str() << std::endl;
-      d->betaProbeMRMLNode->RecordMappingData();
-      }
+    vtkMRMLBetaProbeNode::trackingData curPos;
+    vtkMRMLBetaProbeNode::countingData curVal;
+    d->betaProbeMRMLNode->GetCurrentPosition(curPos);
+    d->betaProbeMRMLNode->GetCurrentCounts(curVal);
+    d->recordSample(curPos, curVal);
     }
 }
 
@@ -257,25 +381,48 @@ void qSlicerBetaProbeLogRecorderWidget
     }
 
   d->betaProbeMRMLNode = newBetaProbeNode;
+
+  // Recover unfinished sessions and journal this one
+  if (!d->journal->IsOpen())
+    {
+    d->startJournal();
+    this->updateWriterStatus();
+    }
 }
 
 //-----------------------------------------------------------------------------
 void qSlicerBetaProbeLogRecorderWidget
-::onDataNodeModified()
+::setBetaProbeLogic(vtkSlicerBetaProbeLogic* newBetaProbeLogic)
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
-  
-  if (!d->betaProbeMRMLNode)
+
+  d->betaProbeLogic = newBetaProbeLogic;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeLogRecorderWidget
+::onScheduledSamples()
+{
+  Q_D(qSlicerBetaProbeLogRecorderWidget);
+
+  if (!d->betaProbeMRMLNode || !d->betaProbeLogic || !d->recording)
     {
     return;
     }
 
-  if (!d->recording)
+  if (!d->logFileOpen)
     {
     return;
     }
 
-  this->recordData();
+  // One record per count kept by the recording policy, never twice the
+  // same count
+  for (int i = 0; i < d->betaProbeLogic->GetNumberOfScheduledSamples(); ++i)
+    {
+    const vtkSlicerBetaProbeStreamAligner::alignedData* sample =
+      d->betaProbeLogic->GetScheduledSample(i);
+    d->recordSample(sample->Position, sample->Counts);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -344,18 +491,14 @@ void qSlicerBetaProbeLogRecorderWidget
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
   
-  if (!d->recordingFile)
+  if (!d->logFileOpen)
     {
     return;
     }
 
   if (d->singleShotStreak == 0)
     {
-    d->recordingFile << std::endl
-		     << "Single shots data" << std::endl
-		     << "-------------------------------------------------------------------------------------------------------------------------------------------------------------" << std::endl
-		     << "Date,Time,Smoothed,Beta+Gamma,Gamma,X,Y,Z" << std::endl
-		     << "-------------------------------------------------------------------------------------------------------------------------------------------------------------" << std::endl;
+    d->logWriter->BeginBlock(vtkSlicerBetaProbeLogFormat::SingleShotBlock);
     }
   
   this->recordData();
@@ -368,16 +511,14 @@ void qSlicerBetaProbeLogRecorderWidget
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
 
-  if (!d->recordingFile)
+  if (!d->logFileOpen)
     {
     return;
     }
   
   if (d->singleShotStreak != 0)
     {
-    d->recordingFile << "-------------------------------------------------------------------------------------------------------------------------------------------------------------" << std::endl
-		     << "End of single shots" << std::endl
-		     << std::endl;
+    d->logWriter->EndBlock(vtkSlicerBetaProbeLogFormat::SingleShotBlock);
     d->singleShotStreak = 0;
     }
 }
@@ -388,24 +529,23 @@ void qSlicerBetaProbeLogRecorderWidget
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
 
-  if (!d->recordingFile)
+  if (!d->logFileOpen)
     {
     return;
     }
 
   this->endSingleShotRecording();
 
-  d->recordingFile << std::endl
-		   << "Start recording at: " << QTime::currentTime().toString().toStdString() << std::endl
-		   << "-------------------------------------------------------------------------------------------------------------------------------------------------------------" << std::endl
-		   << "Date,Time,Smoothed,Beta+Gamma,Gamma,X,Y,Z,Flag" << std::endl
-		   << "-------------------------------------------------------------------------------------------------------------------------------------------------------------" << std::endl;
+  d->logWriter->BeginBlock(vtkSlicerBetaProbeLogFormat::ContinuousBlock);
   
   d->FlagDataButton->setEnabled(true);
 
-  // Observe modified event
-  qvtkConnect(d->betaProbeMRMLNode, vtkCommand::ModifiedEvent,
-	      this, SLOT(onDataNodeModified()));
+  // Record the counts chosen by the recording policy of the node
+  if (d->betaProbeLogic)
+    {
+    qvtkConnect(d->betaProbeLogic, vtkSlicerBetaProbeLogic::ScheduledSamplesEvent,
+                this, SLOT(onScheduledSamples()));
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -414,7 +554,7 @@ void qSlicerBetaProbeLogRecorderWidget
 {
   Q_D(qSlicerBetaProbeLogRecorderWidget);
 
-  if (!d->recordingFile)
+  if (!d->logFileOpen)
     {
     return;
     }
@@ -423,14 +563,11 @@ void qSlicerBetaProbeLogRecorderWidget
 
   if (!d->singleModeRecording)
     {
-    d->recordingFile << "-------------------------------------------------------------------------------------------------------------------------------------------------------------" << std::endl
-		     << "End recording at: " << QTime::currentTime().toString().toStdString() << std::endl
-		     << std::endl;
+    d->logWriter->EndBlock(vtkSlicerBetaProbeLogFormat::ContinuousBlock);
     }
 
-  // Stop observing modified event
-  qvtkDisconnect(d->betaProbeMRMLNode, vtkCommand::ModifiedEvent,
-		 this, SLOT(onDataNodeModified()));
+  qvtkDisconnect(d->betaProbeLogic, vtkSlicerBetaProbeLogic::ScheduledSamplesEvent,
+                 this, SLOT(onScheduledSamples()));
 }
 
 //-----------------------------------------------------------------------------
@@ -441,3 +578,89 @@ void qSlicerBetaProbeLogRecorderWidget
 
   d->flagData = true;
 }
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeLogRecorderWidget
+::onExportCSVClicked()
+{
+  Q_D(qSlicerBetaProbeLogRecorderWidget);
+
+  QString logFileName = QFileDialog::getOpenFileName(this, tr("Select Binary Log"),
+						     d->currentLogFile,
+						     tr("BetaProbe binary log (*.bplog)"));
+  if (logFileName.isEmpty())
+    {
+    return;
+    }
+
+  QFileInfo logFile(logFileName);
+  QString csvFileName = QFileDialog::getSaveFileName(this, tr("Export CSV"),
+						     logFile.absolutePath() + "/" +
+						     logFile.completeBaseName() + ".csv",
+						     tr("CSV (*.csv)"));
+  if (csvFileName.isEmpty())
+    {
+    return;
+    }
+
+  // Errors are reported by the reader
+  vtkSmartPointer<vtkSlicerBetaProbeLogReader> reader =
+    vtkSmartPointer<vtkSlicerBetaProbeLogReader>::New();
+  if (reader->Open(logFileName.toStdString().c_str()))
+    {
+    reader->ExportCSV(csvFileName.toStdString().c_str());
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeLogRecorderWidget
+::onLoadSessionClicked()
+{
+  Q_D(qSlicerBetaProbeLogRecorderWidget);
+
+  if (!d->betaProbeMRMLNode || d->recording)
+    {
+    return;
+    }
+
+  QString logFileName = QFileDialog::getOpenFileName(this, tr("Load Session"),
+						     d->currentLogFile,
+						     tr("BetaProbe log (*.csv *.bplog);;All files (*)"));
+  if (logFileName.isEmpty())
+    {
+    return;
+    }
+
+  // Loading replaces the recorded samples, and cannot be undone
+  vtkMRMLBetaProbeSessionStore* store = d->betaProbeMRMLNode->GetSessionStore();
+  if (store->GetNumberOfSamples() > 0 &&
+      store->GetGeneration() != store->GetStoredGeneration() &&
+      QMessageBox::question(this, tr("Load Session"),
+                            tr("The %1 samples of the current session are not saved with the "
+                               "scene. Replace them with the samples of %2?")
+                            .arg(store->GetNumberOfSamples())
+                            .arg(QFileInfo(logFileName).fileName()),
+                            QMessageBox::Yes | QMessageBox::No,
+                            QMessageBox::No) != QMessageBox::Yes)
+    {
+    return;
+    }
+
+  // Errors are reported by the loader
+  vtkSmartPointer<vtkSlicerBetaProbeSessionLoader> loader =
+    vtkSmartPointer<vtkSlicerBetaProbeSessionLoader>::New();
+  QElapsedTimer loadTimer;
+  loadTimer.start();
+  vtkIdType numberOfSamples = loader->Load(logFileName.toStdString().c_str(),
+					   d->betaProbeMRMLNode);
+  if (numberOfSamples < 0)
+    {
+    d->loadedSessionStatus = tr("Unable to load %1").arg(QFileInfo(logFileName).fileName());
+    }
+  else
+    {
+    d->loadedSessionStatus = tr("Loaded: %1 samples in %2 ms")
+      .arg(numberOfSamples).arg(loadTimer.elapsed());
+    }
+  this->updateWriterStatus();
+}
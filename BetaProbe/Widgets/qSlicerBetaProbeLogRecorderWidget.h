@@ -40,6 +40,7 @@
 
 class qSlicerBetaProbeLogRecorderWidgetPrivate;
 class vtkMRMLBetaProbeNode;
+class vtkSlicerBetaProbeLogic;
 
 /// \ingroup Slicer_QtModules_BetaProbe
 class Q_SLICER_MODULE_BETAPROBE_WIDGETS_EXPORT qSlicerBetaProbeLogRecorderWidget
@@ -55,14 +56,18 @@ public:
   void closeLogFile();
   void recordData();
   void setBetaProbeNode(vtkMRMLBetaProbeNode* newBetaProbeNode);
+  void setBetaProbeLogic(vtkSlicerBetaProbeLogic* newBetaProbeLogic);
   void connectionBroken();
 
 protected slots:
   void onSelectFileClicked();
-  void onDataNodeModified();
+  void onScheduledSamples();
   void onRecordModeChanged(bool singleMode);
   void onRecordButtonClicked();
   void onFlagDataClicked();
+  void updateWriterStatus();
+  void onExportCSVClicked();
+  void onLoadSessionClicked();
 
   void beginSingleShotRecording();
   void endSingleShotRecording();
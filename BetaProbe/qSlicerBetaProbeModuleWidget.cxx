@@ -15,30 +15,28 @@
 
   ==============================================================================*/
 
-// STL
-#include <sstream>
-
 // Qt includes
 #include <QDateTime>
 #include <QDebug>
 #include <QFileDialog>
 #include <QTimer>
-#include <QUdpSocket>
 
 // SlicerQt includes
 #include "qSlicerBetaProbeModuleWidget.h"
 #include "ui_qSlicerBetaProbeModuleWidget.h"
 
+// Logic includes
+#include "vtkSlicerBetaProbeActivityMap.h"
+#include "vtkSlicerBetaProbeLogic.h"
+
 // VTK includes
 #include "vtkImageData.h"
 #include "vtkLookupTable.h"
-#include "vtkMatrix4x4.h"
 
 // MRML includes
 #include "vtkMRMLBetaProbeNode.h"
 #include "vtkMRMLColorTableNode.h"
 #include "vtkMRMLIGTLConnectorNode.h"
-#include "vtkMRMLLabelMapVolumeDisplayNode.h"
 #include "vtkMRMLScalarVolumeNode.h"
 #include "vtkMRMLLinearTransformNode.h"
 
@@ -52,7 +50,8 @@ public:
 
   vtkMRMLBetaProbeNode* betaProbeNode;
   vtkMRMLIGTLConnectorNode* trackingNode;
-  QUdpSocket* countingNode;
+  QTimer* countsPollTimer;
+  QTimer* displayTimer;
   QTimer* udpTimeout;
   qSlicerBetaProbeModuleWidget::HostInformation BrainLab;
   qSlicerBetaProbeModuleWidget::HostInformation BetaProbe;
@@ -61,6 +60,25 @@ public:
   vtkMRMLScalarVolumeNode* VolumeToMap;
   vtkMRMLColorTableNode* BetaProbeColorNode;
   int PointSize;
+
+  // How samples on the same voxel are combined
+  // (vtkSlicerBetaProbeActivityMap::Aggregate*)
+  int Aggregation;
+
+  // Coverage component shown along with the map
+  // (vtkSlicerBetaProbeActivityMap::Coverage*), -1 for none
+  int CoverageComponent;
+
+  // Activity map being built by the logic
+  bool buildingMap;
+
+  // Live map last colored, and its range then
+  vtkMRMLScalarVolumeNode* liveMapNode;
+  double liveMapRange[2];
+
+  // Numbers of the pose and counts last displayed
+  vtkTypeUInt64 displayedPositionNumber;
+  vtkTypeUInt64 displayedCountsNumber;
 };
 
 //-----------------------------------------------------------------------------
@@ -71,7 +89,8 @@ qSlicerBetaProbeModuleWidgetPrivate::qSlicerBetaProbeModuleWidgetPrivate()
 {
   this->betaProbeNode = NULL;
   this->trackingNode = NULL;
-  this->countingNode = NULL;
+  this->countsPollTimer = new QTimer();
+  this->displayTimer = new QTimer();
   this->udpTimeout = new QTimer();
 
   this->betaProbeStatus = false;
@@ -89,11 +108,32 @@ qSlicerBetaProbeModuleWidgetPrivate::qSlicerBetaProbeModuleWidgetPrivate()
 
   // Number of voxels to display around real voxel position
   this->PointSize = 1;
+  this->Aggregation = vtkSlicerBetaProbeActivityMap::AggregateLatest;
+  this->CoverageComponent = -1;
+
+  this->buildingMap = false;
+
+  this->liveMapNode = NULL;
+  this->liveMapRange[0] = 0.0;
+  this->liveMapRange[1] = 0.0;
+
+  this->displayedPositionNumber = 0;
+  this->displayedCountsNumber = 0;
 }
 
 //-----------------------------------------------------------------------------
 qSlicerBetaProbeModuleWidgetPrivate::~qSlicerBetaProbeModuleWidgetPrivate()
 {
+  if (this->countsPollTimer)
+    {
+    this->countsPollTimer->deleteLater();
+    }
+
+  if (this->displayTimer)
+    {
+    this->displayTimer->deleteLater();
+    }
+
   if (this->udpTimeout)
     {
     this->udpTimeout->deleteLater();
@@ -127,6 +167,9 @@ void qSlicerBetaProbeModuleWidget::setup()
   d->setupUi(this);
   this->Superclass::setup();
 
+  d->LogRecorderWidget->setBetaProbeLogic(
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic()));
+
   connect(d->NodeSelector, SIGNAL(nodeAddedByUser(vtkMRMLNode*)),
           this, SLOT(onNodeAdded(vtkMRMLNode*)));
 
@@ -139,15 +182,39 @@ void qSlicerBetaProbeModuleWidget::setup()
   connect(d->udpTimeout, SIGNAL(timeout()),
           this, SLOT(onCountingNodeDisconnected()));
 
+  connect(d->countsPollTimer, SIGNAL(timeout()),
+          this, SLOT(onCountsReceived()));
+
+  // Readouts are refreshed at the display rate of the node, not on every
+  // pose or count received
+  connect(d->displayTimer, SIGNAL(timeout()),
+          this, SLOT(updateReadouts()));
+  d->displayTimer->start(50);
+
   connect(d->MapButton, SIGNAL(clicked()),
           this, SLOT(onMapButtonClicked()));
 
+  connect(d->CancelMapButton, SIGNAL(clicked()),
+          this, SLOT(onCancelMapClicked()));
+
+  connect(d->LiveMapCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onLiveMapToggled(bool)));
+
+  connect(d->AggregationComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onAggregationChanged(int)));
+
+  connect(d->CoverageComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(onCoverageChanged(int)));
+
   connect(d->VolumeToMapSelector, SIGNAL(currentNodeChanged(vtkMRMLNode*)),
           this, SLOT(onVolumeToMapSelected(vtkMRMLNode*)));
 
   connect(d->ColorWindowWidget, SIGNAL(valuesChanged(double, double)),
 	  this, SLOT(onColorWindowRangeChanged(double, double)));
 
+  d->MapProgressBar->setVisible(false);
+  d->CancelMapButton->setVisible(false);
+
   // Put label status to OFF
   this->setBetaProbeStatus(false);
   this->setTrackingStatus(false);
@@ -168,6 +235,8 @@ void qSlicerBetaProbeModuleWidget::onNodeAdded(vtkMRMLNode* node)
   if (nodeAdded)
     {
     d->betaProbeNode = nodeAdded;
+    d->displayedPositionNumber = 0;
+    d->displayedCountsNumber = 0;
     d->LogRecorderWidget->setBetaProbeNode(nodeAdded);
 
     this->StartConnections();
@@ -184,19 +253,20 @@ void qSlicerBetaProbeModuleWidget::StartConnections()
     return;
     }
 
-  // Create new counting node if not existing
-  if (!d->countingNode)
+  vtkSlicerBetaProbeLogic* betaProbeLogic =
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic());
+  if (!betaProbeLogic)
     {
-    d->countingNode = new QUdpSocket(this);
+    return;
     }
 
-  // Connect it
-  QHostAddress betaProbeAddress = QHostAddress(QString::fromStdString(d->BetaProbe.IPAddress));
-  if (d->countingNode->bind(betaProbeAddress, d->BetaProbe.Port))
+  // Counts are received on a logic thread, and polled from here
+  if (betaProbeLogic->StartCountReceiver(d->betaProbeNode,
+                                         d->BetaProbe.IPAddress.c_str(),
+                                         d->BetaProbe.Port))
     {
     this->onCountingNodeConnected();
-    connect(d->countingNode, SIGNAL(readyRead()),
-            this, SLOT(onCountsReceived()));
+    d->countsPollTimer->start(10);
     }
 
   // Create new tracking node if not existing
@@ -216,9 +286,15 @@ void qSlicerBetaProbeModuleWidget::StartConnections()
   // Connect it
   if (d->trackingNode->Start())
     {
+    // Poses pulled by the logic are drained by the same timer as the counts
+    if (d->betaProbeNode->GetTrackingIngestMode() == vtkMRMLBetaProbeNode::TrackingIngestDirect &&
+        betaProbeLogic->StartTrackingReceiver(d->betaProbeNode) &&
+        !d->countsPollTimer->isActive())
+      {
+      d->countsPollTimer->start(10);
+      }
+
     // Connect events
-    qvtkConnect(d->trackingNode, vtkMRMLIGTLConnectorNode::ReceiveEvent,
-                this, SLOT(onTrackingNodeReceivedData()));
     qvtkConnect(d->trackingNode, vtkMRMLIGTLConnectorNode::ConnectedEvent,
                 this, SLOT(onTrackingNodeConnected()));
     qvtkConnect(d->trackingNode, vtkMRMLIGTLConnectorNode::DisconnectedEvent,
@@ -308,6 +384,12 @@ void qSlicerBetaProbeModuleWidget::onTrackingNodeDisconnected()
   d->LogRecorderWidget->connectionBroken();
 
   // Close connection
+  vtkSlicerBetaProbeLogic* betaProbeLogic =
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic());
+  if (betaProbeLogic)
+    {
+    betaProbeLogic->StopTrackingReceiver();
+    }
   if (!d->trackingNode)
     {
     return;
@@ -316,7 +398,7 @@ void qSlicerBetaProbeModuleWidget::onTrackingNodeDisconnected()
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerBetaProbeModuleWidget::onTrackingNodeReceivedData()
+void qSlicerBetaProbeModuleWidget::updateReadouts()
 {
   Q_D(qSlicerBetaProbeModuleWidget);
 
@@ -325,24 +407,43 @@ void qSlicerBetaProbeModuleWidget::onTrackingNodeReceivedData()
     return;
     }
 
-  // Get counts informations and update widget
-  vtkMRMLBetaProbeNode::countingData* newCountingData
-    = d->betaProbeNode->GetCurrentCounts();
-  if (newCountingData)
+  const int interval = static_cast<int>(1000.0 / d->betaProbeNode->GetDisplayRefreshRate());
+  if (d->displayTimer->interval() != interval)
     {
-    d->SmoothedLine->setText(QString::number(newCountingData->Smoothed));
-    d->BetaLine->setText(QString::number(newCountingData->BetaGamma));
-    d->GammaLine->setText(QString::number(newCountingData->Gamma));
+    d->displayTimer->setInterval(interval);
     }
 
-  // Get position informations and update widget
-  vtkMRMLBetaProbeNode::trackingData* newTrackingData
-    = d->betaProbeNode->GetCurrentPosition();
-  if (newTrackingData)
+  // Get counts informations and update widget, if they changed
+  vtkMRMLBetaProbeNode::countingData newCountingData;
+  const vtkTypeUInt64 countsNumber = d->betaProbeNode->GetCurrentCounts(newCountingData);
+  if (countsNumber != d->displayedCountsNumber)
     {
-    d->XLine->setText(QString::number(newTrackingData->X));
-    d->YLine->setText(QString::number(newTrackingData->Y));
-    d->ZLine->setText(QString::number(newTrackingData->Z));
+    d->SmoothedLine->setText(QString::number(newCountingData.Smoothed));
+    d->BetaLine->setText(QString::number(newCountingData.BetaGamma));
+    d->GammaLine->setText(QString::number(newCountingData.Gamma));
+    d->displayedCountsNumber = countsNumber;
+    }
+
+  // Get position informations and update widget, if it changed
+  vtkMRMLBetaProbeNode::trackingData newTrackingData;
+  const vtkTypeUInt64 positionNumber = d->betaProbeNode->GetCurrentPosition(newTrackingData);
+  if (positionNumber != d->displayedPositionNumber)
+    {
+    d->XLine->setText(QString::number(newTrackingData.X));
+    d->YLine->setText(QString::number(newTrackingData.Y));
+    d->ZLine->setText(QString::number(newTrackingData.Z));
+    d->displayedPositionNumber = positionNumber;
+    }
+
+  // The live map grows at the display rate too
+  if (d->LiveMapCheckBox->isChecked())
+    {
+    this->updateLiveMap();
+    }
+
+  if (d->buildingMap)
+    {
+    this->updateMapProgress();
     }
 }
 
@@ -368,7 +469,16 @@ void qSlicerBetaProbeModuleWidget::onCountsReceived()
 {
   Q_D(qSlicerBetaProbeModuleWidget);
 
-  if (!d->countingNode || !d->betaProbeNode || !d->udpTimeout)
+  vtkSlicerBetaProbeLogic* betaProbeLogic =
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic());
+  if (!betaProbeLogic || !d->betaProbeNode || !d->udpTimeout)
+    {
+    return;
+    }
+
+  const int numberOfCounts = betaProbeLogic->ProcessIncomingData(d->betaProbeNode);
+
+  if (numberOfCounts == 0)
     {
     return;
     }
@@ -379,29 +489,9 @@ void qSlicerBetaProbeModuleWidget::onCountsReceived()
     this->setBetaProbeStatus(true);
     }
 
-  while(d->countingNode->hasPendingDatagrams())
-    {
-    // BetaProbe system sends data every 100ms
-    // Timeout if no data during 1000ms
-    d->udpTimeout->start(1000);
-
-    // Read data
-    QByteArray datagram;
-    datagram.resize(d->countingNode->pendingDatagramSize());
-    d->countingNode->readDatagram(datagram.data(), datagram.size());
-
-    // Write datagrams
-    QString dataReceived = QString(datagram);
-    QString date = dataReceived.section(',',0,0);
-    QString time = dataReceived.section(',',1,1);
-    double s = dataReceived.section(',',2,2).toDouble();
-    double c = dataReceived.section(',',3,3).toDouble();
-    double g = dataReceived.section(',',4,4).toDouble();
-
-    d->betaProbeNode->WriteCountData(date.toStdString(),
-                                     time.toStdString(),
-                                     s, c, g);
-    }
+  // BetaProbe system sends data every 100ms
+  // Timeout if no data during 1000ms
+  d->udpTimeout->start(1000);
 }
 
 //-----------------------------------------------------------------------------
@@ -422,99 +512,178 @@ void qSlicerBetaProbeModuleWidget::onMapButtonClicked()
 {
   Q_D(qSlicerBetaProbeModuleWidget);
 
-  if (!d->betaProbeNode || !d->VolumeToMap || !this->mrmlScene())
+  vtkSlicerBetaProbeLogic* betaProbeLogic =
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic());
+  if (!betaProbeLogic || !d->betaProbeNode || !d->VolumeToMap || !this->mrmlScene())
     {
     return;
     }
 
-  // Get position and counting values
-  std::vector<vtkMRMLBetaProbeNode::trackingData> positionData;
-  std::vector<vtkMRMLBetaProbeNode::countingData> activityData;
-  positionData = d->betaProbeNode->GetTrackerPositions();
-  activityData = d->betaProbeNode->GetBetaProbeValues();
-
-  if (positionData.size() == activityData.size())
+  // Built on a background thread, collected by updateMapProgress()
+  if (betaProbeLogic->StartActivityMap(d->betaProbeNode, d->VolumeToMap, d->PointSize,
+                                       d->Aggregation, d->CoverageComponent))
     {
-    std::stringstream mapName;
-    mapName << d->VolumeToMap->GetName() << "-BetaProbeMapping";
-
-    // Create new volume with same information as volume to map
-    vtkSmartPointer<vtkMRMLLabelMapVolumeDisplayNode> labelMapDisplayNode
-      = vtkSmartPointer<vtkMRMLLabelMapVolumeDisplayNode>::New();
-    this->mrmlScene()->AddNode(labelMapDisplayNode);
-
-    vtkSmartPointer<vtkMRMLScalarVolumeNode> mapNode
-      = vtkSmartPointer<vtkMRMLScalarVolumeNode>::New();
-    mapNode->Copy(d->VolumeToMap);
-    mapNode->LabelMapOn();
-    mapNode->SetAndObserveDisplayNodeID(labelMapDisplayNode->GetID());
-    mapNode->SetName(mapName.str().c_str());
+    d->buildingMap = true;
+    d->MapButton->setEnabled(false);
+    d->MapProgressBar->setValue(0);
+    d->MapProgressBar->setVisible(true);
+    d->CancelMapButton->setVisible(true);
+    }
+}
 
-    vtkSmartPointer<vtkImageData> mapData
-      = vtkSmartPointer<vtkImageData>::New();
-    mapData->SetDimensions(d->VolumeToMap->GetImageData()->GetDimensions());
-    mapData->AllocateScalars(VTK_DOUBLE,1);
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeModuleWidget::onCancelMapClicked()
+{
+  vtkSlicerBetaProbeLogic* betaProbeLogic =
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic());
+  if (betaProbeLogic)
+    {
+    betaProbeLogic->CancelActivityMap();
+    }
+  this->updateMapProgress();
+}
 
-    // Get RASToIJK matrix to convert tracking coordinates from RAS to IJK
-    vtkSmartPointer<vtkMatrix4x4> RASToIJKMatrix
-      = vtkSmartPointer<vtkMatrix4x4>::New();
-    mapNode->GetRASToIJKMatrix(RASToIJKMatrix);
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeModuleWidget::updateMapProgress()
+{
+  Q_D(qSlicerBetaProbeModuleWidget);
 
-    // Map values
-    std::cerr << "Number of points: " << positionData.size() << std::endl;
+  vtkSlicerBetaProbeLogic* betaProbeLogic =
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic());
+  if (!betaProbeLogic)
+    {
+    return;
+    }
 
-    for (unsigned int pt = 0; pt < positionData.size(); ++pt)
+  const double progress = betaProbeLogic->GetActivityMapProgress();
+  if (progress >= 0.0)
+    {
+    d->MapProgressBar->setValue(static_cast<int>(progress * 100.0));
+    vtkMRMLScalarVolumeNode* mapNode = betaProbeLogic->FinishActivityMap();
+    if (mapNode && mapNode->GetImageData())
       {
-      double curPoint[4] = { positionData[pt].X, positionData[pt].Y, positionData[pt].Z, 1.0 };
-      double* registeredPoint;
-      registeredPoint = RASToIJKMatrix->MultiplyDoublePoint(curPoint);
-
-      // Also set same activity value to voxels around to make it more visible
-      double activityValue = activityData[pt].Gamma;
-      for (int k = registeredPoint[2]-d->PointSize; k < registeredPoint[2]+d->PointSize; ++k)
-	{
-	for (int j = registeredPoint[1]-d->PointSize; j < registeredPoint[1]+d->PointSize; ++j)
-	  {
-	  for (int i = registeredPoint[0]-d->PointSize; i < registeredPoint[0]+d->PointSize; ++i)
-	    {
-	    mapData->SetScalarComponentFromDouble(i,j,k,0,activityValue);
-	    }
-	  }
-	}
+      this->setMapColors(mapNode, mapNode->GetImageData()->GetScalarRange());
       }
-    mapData->Modified();
-    mapNode->SetAndObserveImageData(mapData);
-
-    // Create new lookup table if not already existing
-    // value 0: opacity 0
-    // From blue to red (Hue: 0.67 -> 0.0)
-    if (!d->BetaProbeColorNode)
+    if (betaProbeLogic->GetActivityMapProgress() >= 0.0)
       {
-      d->BetaProbeColorNode = vtkMRMLColorTableNode::New();
-      d->BetaProbeColorNode->SetName("BetaProbeColorNode");
-      d->BetaProbeColorNode->SetTypeToUser();
-      d->BetaProbeColorNode->SetNumberOfColors(256);
-
-      vtkLookupTable* betaProbeLUT = d->BetaProbeColorNode->GetLookupTable();
-      betaProbeLUT->SetRampToLinear();
-      betaProbeLUT->SetHueRange(0.67, 0.0);
-      betaProbeLUT->SetSaturationRange(1.0, 1.0);
-      betaProbeLUT->SetValueRange(1.0, 1.0);
-      betaProbeLUT->SetAlphaRange(1.0, 1.0);
-      betaProbeLUT->Build();
-      betaProbeLUT->SetTableValue(0, 0.0, 0.0, 0.0, 0.0);
-      d->BetaProbeColorNode->HideFromEditorsOff();
-      this->mrmlScene()->AddNode(d->BetaProbeColorNode);
+      // Still building
+      return;
       }
+    }
 
-    // Set range of data (range of scalar values)
-    // Update range even if not recreating color table
-    d->BetaProbeColorNode->GetLookupTable()->SetTableRange(mapData->GetScalarRange());
-    d->BetaProbeColorNode->Modified();
+  d->buildingMap = false;
+  d->MapButton->setEnabled(true);
+  d->MapProgressBar->setVisible(false);
+  d->CancelMapButton->setVisible(false);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeModuleWidget::onLiveMapToggled(bool live)
+{
+  Q_D(qSlicerBetaProbeModuleWidget);
 
-    // Add node to scene
-    labelMapDisplayNode->SetAndObserveColorNodeID(d->BetaProbeColorNode->GetID());
-    this->mrmlScene()->AddNode(mapNode);
+  d->liveMapNode = NULL;
+  if (live)
+    {
+    this->updateLiveMap();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeModuleWidget::onAggregationChanged(int index)
+{
+  Q_D(qSlicerBetaProbeModuleWidget);
+
+  // Items are in the order of vtkSlicerBetaProbeActivityMap::Aggregate*
+  d->Aggregation = index;
+  if (d->LiveMapCheckBox->isChecked())
+    {
+    this->updateLiveMap();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeModuleWidget::onCoverageChanged(int index)
+{
+  Q_D(qSlicerBetaProbeModuleWidget);
+
+  // First item is no coverage, then vtkSlicerBetaProbeActivityMap::Coverage*
+  d->CoverageComponent = index - 1;
+  if (d->LiveMapCheckBox->isChecked())
+    {
+    this->updateLiveMap();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeModuleWidget::updateLiveMap()
+{
+  Q_D(qSlicerBetaProbeModuleWidget);
+
+  vtkSlicerBetaProbeLogic* betaProbeLogic =
+    vtkSlicerBetaProbeLogic::SafeDownCast(this->logic());
+  if (!betaProbeLogic || !d->betaProbeNode || !d->VolumeToMap || !this->mrmlScene())
+    {
+    return;
+    }
+
+  // Only the samples recorded since the last update are splatted
+  vtkMRMLScalarVolumeNode* mapNode =
+    betaProbeLogic->UpdateLiveMap(d->betaProbeNode, d->VolumeToMap, d->PointSize,
+                                  d->Aggregation, d->CoverageComponent);
+  vtkSlicerBetaProbeActivityMap* liveMap = betaProbeLogic->GetLiveMap(d->betaProbeNode);
+  if (!mapNode || !liveMap)
+    {
+    return;
+    }
+
+  double range[2];
+  liveMap->GetScalarRange(range);
+  if (mapNode != d->liveMapNode ||
+      range[0] != d->liveMapRange[0] || range[1] != d->liveMapRange[1])
+    {
+    this->setMapColors(mapNode, range);
+    d->liveMapNode = mapNode;
+    d->liveMapRange[0] = range[0];
+    d->liveMapRange[1] = range[1];
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerBetaProbeModuleWidget::setMapColors(vtkMRMLScalarVolumeNode* mapNode, double range[2])
+{
+  Q_D(qSlicerBetaProbeModuleWidget);
+
+  // Create new lookup table if not already existing
+  // value 0: opacity 0
+  // From blue to red (Hue: 0.67 -> 0.0)
+  if (!d->BetaProbeColorNode)
+    {
+    d->BetaProbeColorNode = vtkMRMLColorTableNode::New();
+    d->BetaProbeColorNode->SetName("BetaProbeColorNode");
+    d->BetaProbeColorNode->SetTypeToUser();
+    d->BetaProbeColorNode->SetNumberOfColors(256);
+
+    vtkLookupTable* betaProbeLUT = d->BetaProbeColorNode->GetLookupTable();
+    betaProbeLUT->SetRampToLinear();
+    betaProbeLUT->SetHueRange(0.67, 0.0);
+    betaProbeLUT->SetSaturationRange(1.0, 1.0);
+    betaProbeLUT->SetValueRange(1.0, 1.0);
+    betaProbeLUT->SetAlphaRange(1.0, 1.0);
+    betaProbeLUT->Build();
+    betaProbeLUT->SetTableValue(0, 0.0, 0.0, 0.0, 0.0);
+    d->BetaProbeColorNode->HideFromEditorsOff();
+    this->mrmlScene()->AddNode(d->BetaProbeColorNode);
+    }
+
+  // Set range of data (range of scalar values)
+  // Update range even if not recreating color table
+  d->BetaProbeColorNode->GetLookupTable()->SetTableRange(range);
+  d->BetaProbeColorNode->Modified();
+
+  if (mapNode->GetDisplayNode())
+    {
+    mapNode->GetDisplayNode()->SetAndObserveColorNodeID(d->BetaProbeColorNode->GetID());
     }
 }
 
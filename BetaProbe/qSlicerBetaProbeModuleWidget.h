@@ -27,6 +27,7 @@
 
 class qSlicerBetaProbeModuleWidgetPrivate;
 class vtkMRMLNode;
+class vtkMRMLScalarVolumeNode;
 
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class Q_SLICER_QTMODULES_BETAPROBE_EXPORT qSlicerBetaProbeModuleWidget :
@@ -51,13 +52,19 @@ public slots:
   void onNodeAdded(vtkMRMLNode* node);
   void onTrackingNodeConnected();
   void onTrackingNodeDisconnected();
-  void onTrackingNodeReceivedData();
+  void updateReadouts();
   void onCountingNodeConnected();
   void onCountingNodeDisconnected();
   void onCountsReceived();
   void StartConnections();
   void onTransformNodeChanged(vtkMRMLNode* newTransform);
   void onMapButtonClicked();
+  void onCancelMapClicked();
+  void updateMapProgress();
+  void onLiveMapToggled(bool live);
+  void onAggregationChanged(int index);
+  void onCoverageChanged(int index);
+  void updateLiveMap();
   void onVolumeToMapSelected(vtkMRMLNode* selectedNode);
   void onColorWindowRangeChanged(double min, double max);
 
@@ -73,6 +80,7 @@ protected:
   virtual void setup();
   void setBetaProbeStatus(bool status);
   void setTrackingStatus(bool status);
+  void setMapColors(vtkMRMLScalarVolumeNode* mapNode, double range[2]);
 
 private:
   Q_DECLARE_PRIVATE(qSlicerBetaProbeModuleWidget);